@@ -1,45 +1,118 @@
+#ifndef _WIN32
+#define _DEFAULT_SOURCE // MAP_ANONYMOUS
+#endif
+
 #include "lblcont.h"
 
 #include <string.h>
 #include <stdlib.h>
 #include <assert.h>
 
+#ifdef _WIN32
+#include <windows.h>
+
+static uchar *vmreserve(cell sz) {
+    return VirtualAlloc(NULL, (SIZE_T)sz, MEM_RESERVE, PAGE_NOACCESS);
+}
+
+static bool vmcommit(uchar *at, cell sz) {
+    return VirtualAlloc(at, (SIZE_T)sz, MEM_COMMIT, PAGE_READWRITE) != NULL;
+}
+
+static void vmrelease(uchar *at, cell sz) {
+    (void)sz;
+    VirtualFree(at, 0, MEM_RELEASE);
+}
+#else
+#include <sys/mman.h>
+
+#ifndef MAP_NORESERVE
+#define MAP_NORESERVE 0
+#endif
+
+static uchar *vmreserve(cell sz) {
+    void *p = mmap(NULL, (size_t)sz, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    return p == MAP_FAILED ? NULL : p;
+}
+
+static bool vmcommit(uchar *at, cell sz) {
+    return 0 == mprotect(at, (size_t)sz, PROT_READ | PROT_WRITE);
+}
+
+static void vmrelease(uchar *at, cell sz) {
+    munmap(at, (size_t)sz);
+}
+#endif
+
+// Round up to a whole number of commits, which are whole pages
+static cell pmround(cell c) {
+    return (c + PM_COMMIT_MIN - 1) / PM_COMMIT_MIN * PM_COMMIT_MIN;
+}
+
 struct ProgMem pmnew(cell newcap) {
     struct ProgMem pm;
     memset(&pm, 0, sizeof pm);
 
-    pm.cap = newcap;
-    pm.sz = 0;
-    pm.memory = calloc(pm.cap, sizeof(uchar));
-
-    memset(pm.memory, 0, pm.cap);
+    // Fresh pages are zeroed
+    cell want = pmround(newcap ? newcap : 1);
+    pm.reserved = want > PM_RESERVE ? want : PM_RESERVE;
+    if (pm.reserved > SIZE_MAX / 2) pm.reserved = pmround(SIZE_MAX / 2);
+    while (!(pm.memory = vmreserve(pm.reserved)) && pm.reserved / 2 >= want) {
+        pm.reserved = pmround(pm.reserved / 2);
+    }
+    if (!pm.memory) {
+        assert(!"Reserve failed");
+        pm.reserved = 0;
+        return pm;
+    }
 
+    pmresize(&pm, newcap);
     return pm;
 }
 
-void pmresize(
+bool pmresize(
     struct ProgMem *pm,
     cell newcap
 ) {
-    uchar *m = realloc(pm->memory, newcap);
-    if (m) {
-        pm->memory = m;
-        pm->cap = newcap;
-    } else {
-        assert(!"Resize failed");
-    }
+    if (newcap <= pm->cap) return true;
+    if (newcap > pm->reserved) return false;
+
+    newcap = pmround(newcap);
+    if (newcap > pm->reserved) newcap = pm->reserved;
+    if (!vmcommit(pm->memory, newcap)) return false;
+    pm->cap = newcap;
+    return true;
 }
 
 void pmfree(struct ProgMem *pm) {
-    free(pm->memory);
+    if (pm->memory) vmrelease(pm->memory, pm->reserved);
+    pm->memory = NULL;
+    pm->sz = pm->cap = pm->reserved = 0;
+}
+
+// Makes room for srcsz more bytes, doubling what is committed so that
+// appending is amortised O(1)
+static void pmgrow(
+    struct ProgMem *pm,
+    cell srcsz
+) {
+    cell need = pm->sz + srcsz;
+    if (need <= pm->cap) return;
+
+    cell newcap = pm->cap * 2 > need ? pm->cap * 2 : need;
+    if (newcap > pm->reserved) newcap = need;
+    if (!pmresize(pm, newcap)) {
+        assert(!"Program memory exhausted");
+        abort();
+    }
 }
 
 void write(
     struct ProgMem *pm,
-    void *src,
+    const void *src,
     cell srcsz
 ) {
-    assert(pm->sz + srcsz <= pm->cap);
+    pmgrow(pm, srcsz);
     memcpy(pm->memory + pm->sz, src, srcsz);
     pm->sz += srcsz;
 }
@@ -48,7 +121,6 @@ void writecell(
     struct ProgMem *pm,
     cell c
 ) {
-    assert(pm->sz + sizeof c <= pm->cap);
     write(pm, &c, sizeof c);
 }
 
@@ -57,18 +129,16 @@ cell readcell(
     cell adr
 ) {
     cell c;
-    assert(adr <= pm->cap);
+    assert(adr + sizeof c <= pm->sz);
     memcpy(&c, pm->memory + adr, sizeof c);
     return c;
 }
 
 void writezstr(
     struct ProgMem *pm,
-    char *zstr
+    const char *zstr
 ) {
-    size_t len = strlen(zstr) + 1;
-    assert(pm->sz + len <= pm->cap);
-    write(pm, zstr, len);
+    write(pm, zstr, strlen(zstr) + 1);
 }
 
 // -- forward search
@@ -88,9 +158,7 @@ void writedata(
     struct ProgMem *pm,
     struct Data what
 ) {
-    assert(pm->sz + sizeof what.sz <= pm->cap);
     write(pm, &what.sz, sizeof what.sz);
-    assert(pm->sz + what.sz <= pm->cap);
     write(pm, what.data, what.sz);
 }
 
@@ -102,33 +170,28 @@ cell pad(cell c) {
 }
 
 void lbl_insert(struct ProgMem *pm,
-    char *name,
+    const char *name,
     cell ptr_to_data
 ) {
      // Link
     cell head = pm->sz;
-    assert(pm->sz + sizeof(cell) <= pm->cap);
     writecell(pm, pm->llhead);
     pm->llhead = head;
 
     // Len
     cell len = strlen(name) + 1;
     cell padsz = pad(len) - len;
-    assert(pm->sz + sizeof(cell) <= pm->cap);
     writecell(pm, len + padsz);
 
     // Str + padding
     // Str
-    assert(pm->sz + strlen(name) + 1 <= pm->cap);
     writezstr(pm, name);
 
     // Padding
     cell zero = 0;
-    assert(pm->sz + padsz <= pm->cap);
     write(pm, &zero, padsz);
 
     // &data
-    assert(pm->sz + sizeof(cell) <= pm->cap);
     writecell(pm, ptr_to_data);
 }
 
@@ -140,10 +203,10 @@ cell adrlink(
     struct ProgMem *pm,
     cell adr
 ) {
-    assert(pm->sz + adr <= pm->cap);
+    assert(adr <= pm->sz);
 
     cell rv = adr + (0 * sizeof adr);
-    assert(pm->sz + rv <= pm->cap);
+    assert(rv <= pm->sz);
 
     return rv;
 }
@@ -152,10 +215,10 @@ cell adrstrpadsz(
     struct ProgMem *pm,
     cell adr
 ) {
-    assert(pm->sz + adr <= pm->cap);
+    assert(adr <= pm->sz);
 
     cell rv = adr + (1 * sizeof adr);
-    assert(pm->sz + rv <= pm->cap);
+    assert(rv <= pm->sz);
 
     return rv;
 }
@@ -164,10 +227,10 @@ cell adrzstr(
     struct ProgMem *pm,
     cell adr
 ) {
-    assert(pm->sz + adr <= pm->cap);
+    assert(adr <= pm->sz);
 
     cell rv = adr + (2 * sizeof adr);
-    assert(pm->sz + rv <= pm->cap);
+    assert(rv <= pm->sz);
 
     return rv;
 }
@@ -176,15 +239,15 @@ cell adrpointer(
     struct ProgMem *pm,
     cell adr
 ) {
-    assert(adr <= pm->cap);
+    assert(adr <= pm->sz);
 
     cell adr_strpadsz = adrstrpadsz(pm, adr);
-    assert(adr_strpadsz <= pm->cap);
+    assert(adr_strpadsz <= pm->sz);
 
     cell zstrpadsz = readcell(pm, adr_strpadsz);
     cell adr_pointer = adr + (2 * sizeof adr) + zstrpadsz;
 
-    assert(adr_pointer <= pm->cap);
+    assert(adr_pointer <= pm->sz);
     return adr_pointer;
 }
 
@@ -192,10 +255,10 @@ cell readlink(
     struct ProgMem *pm,
     cell adr
 ) {
-    assert(adr <= pm->cap);
+    assert(adr <= pm->sz);
 
     cell o = adrlink(pm, adr);
-    assert(o <= pm->cap);
+    assert(o <= pm->sz);
 
     return readcell(pm, o);
 }
@@ -204,10 +267,10 @@ cell readstrpadsz(
     struct ProgMem *pm,
     cell adr
 ) {
-    assert(adr <= pm->cap);
+    assert(adr <= pm->sz);
 
     cell o = adrstrpadsz(pm, adr);
-    assert(o <= pm->cap);
+    assert(o <= pm->sz);
 
     return readcell(pm, o);
 }
@@ -216,18 +279,18 @@ char *readzstr(
     struct ProgMem *pm,
     cell adr
 ) {
-    assert(adr <= pm->cap);
-    return pm->memory + adrzstr(pm, adr);
+    assert(adr <= pm->sz);
+    return (char *)pm->memory + adrzstr(pm, adr);
 }
 
 cell readpointer(
     struct ProgMem *pm,
     cell adr
 ) {
-    assert(adr <= pm->cap);
+    assert(adr <= pm->sz);
 
     cell o = adrpointer(pm, adr);
-    assert(o <= pm->cap);
+    assert(o <= pm->sz);
 
     return readcell(pm, o);
 }
@@ -240,7 +303,7 @@ cell readpointer(
 // - if null link return null
 // - ptr = *link
 cell lbl_find(struct ProgMem *pm,
-    char *name
+    const char *name
 ) {
     cell ptr = pm->llhead;
     while (ptr) {
@@ -2,26 +2,38 @@
 #define LABEL_CONTAINER_H
 
 #include <stdint.h>
+#include <stdbool.h>
 
 typedef unsigned char uchar;
-typedef uint32_t cell;
+typedef uint64_t cell;
 
+// Program memory never moves once it is made, so pointers into it, such as
+// those from readzstr(), stay valid for its lifetime. pmnew() reserves a
+// range of address space far larger than it needs, without backing it, and
+// memory is committed at the end of that range as writes reach it, doubling
+// each time.
 struct ProgMem {
     uchar *memory;
     cell sz;
-    cell cap;
+    cell cap; // Committed
+    cell reserved; // Address space held, which cap can grow to
     cell llhead; // Head of linked list
 };
 
+// Reserve a little less on a 32 bit address space, if this much is refused
+#define PM_RESERVE ((cell)64 << 30)
+#define PM_COMMIT_MIN ((cell)64 << 10)
+
 struct ProgMem pmnew(cell newcap);
-void pmresize(struct ProgMem *pm, cell newcap);
+// Commits memory up to newcap. Returns false if that is past the reservation.
+bool pmresize(struct ProgMem *pm, cell newcap);
 void pmfree(struct ProgMem *pm);
 
-void write(struct ProgMem *pm, void *src, cell srcsz);
+void write(struct ProgMem *pm, const void *src, cell srcsz);
 void writecell(struct ProgMem *pm, cell c);
 cell readcell(struct ProgMem *pm, cell adr);
 
-void writezstr(struct ProgMem *pm, char *zstr);
+void writezstr(struct ProgMem *pm, const char *zstr);
 
 
 // -- data container
@@ -35,7 +47,7 @@ void writedata(struct ProgMem *pm, struct Data what);
 // Round up size to nearest sizeof(cell)
 cell pad(cell c);
 
-void lbl_insert(struct ProgMem *pm, char *name, cell ptr_to_data);
+void lbl_insert(struct ProgMem *pm, const char *name, cell ptr_to_data);
 
 
 // -- reverse pointer
@@ -51,6 +63,6 @@ cell readstrpadsz(struct ProgMem *pm, cell adr);
 char *readzstr(struct ProgMem *pm, cell adr);
 cell readpointer(struct ProgMem *pm, cell adr);
 
-cell lbl_find(struct ProgMem *pm, char *name);
+cell lbl_find(struct ProgMem *pm, const char *name);
 
 #endif
@@ -3,9 +3,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <string.h>
 
-//#include "lblcont.h"
-//#include "vm.h"
+#include "lblcont.h"
+#include "vm.h"
 
 // ---------------------------------------------------------
 
@@ -37,6 +38,158 @@ int main(void) {
 		TESTEND;
 	} 
 
+	{
+		TEST("Program memory grows without moving");
+
+		struct ProgMem pm = pmnew(16);
+		writecell(&pm, 0); // A link to address 0 ends the list
+		lbl_insert(&pm, "First", 1);
+		char *first = readzstr(&pm, pm.llhead);
+		uchar *base = pm.memory;
+		char name[16];
+		for (int i = 0; i < 100000; ++i) {
+			snprintf(name, sizeof name, "L%d", i);
+			lbl_insert(&pm, name, (cell)i + 2);
+		}
+		EXPECT(pm.memory == base);
+		EXPECT(pm.sz > ((cell)1 << 20));
+		EXPECT(0 == strcmp(first, "First"));
+		EXPECT(lbl_find(&pm, "First") == 1);
+		EXPECT(lbl_find(&pm, "L99999") == 100001);
+
+		// Past 4 GB. Only the page that is written is touched.
+		cell big = (cell)5 << 30;
+		EXPECT(pmresize(&pm, big));
+		memcpy(pm.memory + big - sizeof big, &big, sizeof big);
+		pm.sz = big;
+		EXPECT(readcell(&pm, big - sizeof big) == big);
+		EXPECT(pm.memory == base);
+
+		pmfree(&pm);
+		TESTEND;
+	}
+
+	{
+		TEST("Huge array declarations are lazy");
+
+		struct VmState vm = {0};
+		char decl[] = "DECLARE Big : ARRAY[1:100000000] OF INTEGER";
+		vm_exec_stmt(&vm, decl);
+		struct Var *big = &vm.vars[0];
+		EXPECT(big->valcnt == 100000000);
+		EXPECT(big->valmapped);
+		EXPECT(*(int *)vm_var_at(big, 1) == 0);
+		*(int *)vm_var_at(big, 50000000) = 7;
+		EXPECT(*(int *)vm_var_at(big, 50000000) == 7);
+		EXPECT(*(int *)vm_var_at(big, 100000000) == 0);
+
+		// Small arrays and non-zero defaults are still filled
+		char small[] = "DECLARE Days : ARRAY[0:9] OF DATE";
+		vm_exec_stmt(&vm, small);
+		EXPECT(!vm.vars[1].valmapped);
+		EXPECT(0 == strcmp(vm_var_at(&vm.vars[1], 9), "00/00/0000"));
+
+		// Earlier variables survive the variable table growing
+		char name[32];
+		for (int i = 0; i < 20; ++i) {
+			snprintf(name, sizeof name, "DECLARE V%d : INTEGER", i);
+			vm_exec_stmt(&vm, name);
+		}
+		EXPECT(*(int *)vm_var_at(&vm.vars[0], 50000000) == 7);
+
+		vm_free(&vm);
+		TESTEND;
+	}
+
+	{
+		TEST("Data segment shares equal data and loads from an image");
+
+		struct ProgramData pd = {0};
+		int pi = 314;
+		size_t greeting = program_data_append(&pd, "Greeting", "Hello", 5);
+		size_t num = program_data_append(&pd, "Pi", &pi, sizeof pi);
+		size_t alias = program_data_append(&pd, "Hi", "Hello", 5);
+		EXPECT(program_data_append(&pd, "Greeting", "Hello", 5) == greeting);
+		EXPECT(program_data_append(&pd, "Greeting", "Bye", 3) == PD_NONE);
+		EXPECT(program_data_header(&pd, alias)->data == program_data_header(&pd, greeting)->data);
+		EXPECT(program_data_header(&pd, num)->data % PD_ALIGN == 0);
+		EXPECT(pd.mem_sz % PD_ALIGN == 0);
+
+		// Enough names to rehash
+		char name[16];
+		for (int i = 0; i < 100; ++i) {
+			snprintf(name, sizeof name, "C%d", i);
+			program_data_append(&pd, name, &i, sizeof i);
+		}
+		EXPECT(program_data_find(&pd, "Pi") == num);
+		EXPECT(program_data_find(&pd, "Missing") == PD_NONE);
+
+		uint64_t image[1024];
+		size_t sz = program_data_serialize(&pd, image, sizeof image);
+		EXPECT(sz <= sizeof image);
+		struct ProgramData ro;
+		bool loaded = program_data_load(&ro, image, sz);
+		EXPECT(loaded);
+		EXPECT(ro.count == pd.count);
+		size_t c42 = program_data_find(&ro, "C42");
+		EXPECT(c42 != PD_NONE && *(int *)(ro.mem + program_data_header(&ro, c42)->data) == 42);
+		EXPECT(0 == memcmp(ro.mem + program_data_header(&ro, program_data_find(&ro, "Hi"))->data, "Hello", 5));
+		// The image is read-only, so nothing is appended to it
+		uint64_t before[1024];
+		memcpy(before, image, sz);
+		EXPECT(program_data_append(&ro, "New", "x", 1) == PD_NONE);
+		EXPECT(program_data_find(&ro, "New") == PD_NONE && 0 == memcmp(before, image, sz));
+		program_data_free(&ro);
+		program_data_free(&pd);
+
+		struct VmState vm = {0};
+		char limit[] = "CONSTANT Limit = -100";
+		char hello[] = "CONSTANT Hello = \"Hello\"";
+		char again[] = "CONSTANT Again = \"Hello\"";
+		vm_exec_stmt(&vm, limit);
+		vm_exec_stmt(&vm, hello);
+		vm_exec_stmt(&vm, again);
+		size_t lim = program_data_find(&vm.consts, "Limit");
+		EXPECT(lim != PD_NONE && *(int *)(vm.consts.mem + program_data_header(&vm.consts, lim)->data) == -100);
+		EXPECT(program_data_header(&vm.consts, program_data_find(&vm.consts, "Hello"))->data
+			== program_data_header(&vm.consts, program_data_find(&vm.consts, "Again"))->data);
+		vm_free(&vm);
+
+		TESTEND;
+	}
+
+	{
+		TEST("Case-insensitive compare at every length and offset");
+
+		// Letters, the bytes either side of them, and non-ASCII bytes
+		char text[160], upper_text[160];
+		const char cycle[] = "@AZ[`az{ Mixed Case\x80\xc1\xe1\xff";
+		for (size_t i = 0; i < sizeof text; ++i) {
+			text[i] = cycle[i % (sizeof cycle - 1)];
+			upper_text[i] = upper(text[i]);
+		}
+		for (size_t off = 0; off < 3; ++off) {
+			for (size_t n = 0; n + off <= 100; ++n) {
+				EXPECT(memeqci(text + off, upper_text + off, n));
+				if (n) {
+					upper_text[off + n - 1] ^= 1;
+					EXPECT(!memeqci(text + off, upper_text + off, n));
+					upper_text[off + n - 1] ^= 1;
+				}
+			}
+		}
+		EXPECT(!memeqci("[", "{", 1));
+		EXPECT(!memeqci("@@@@@@@@@@@@@@@@@", "`@@@@@@@@@@@@@@@@", 17));
+
+		struct VmState vm = {0};
+		char decl[] = "declare Count : integer";
+		vm_exec_stmt(&vm, decl);
+		EXPECT(vm.one_above_top == 1 && vm.vars[0].valesz == sizeof(int));
+		vm_free(&vm);
+
+		TESTEND;
+	}
+
 	 //TEST("test__example__variable_declarations");
 	 //{
 	 //} TESTEND;
@@ -1,7 +1,46 @@
+#ifndef _WIN32
+#define _DEFAULT_SOURCE // MAP_ANONYMOUS
+#endif
+
 #include "vm.h"
 #include <assert.h>
 #include <stdlib.h>
 
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+#ifdef _WIN32
+#include <windows.h>
+
+// Committed pages are zeroed when first touched
+static void *vm_map_zeroed(size_t sz) {
+    return VirtualAlloc(NULL, sz, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+}
+
+static void vm_unmap(void *at, size_t sz) {
+    (void)sz;
+    VirtualFree(at, 0, MEM_RELEASE);
+}
+#else
+#include <sys/mman.h>
+
+#ifndef MAP_NORESERVE
+#define MAP_NORESERVE 0
+#endif
+
+// Reads of untouched pages see the shared zero page; a page gets its own
+// frame on its first write
+static void *vm_map_zeroed(size_t sz) {
+    void *p = mmap(NULL, sz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    return p == MAP_FAILED ? NULL : p;
+}
+
+static void vm_unmap(void *at, size_t sz) {
+    munmap(at, sz);
+}
+#endif
+
 #define TODO assert(!"Todo");
 
 
@@ -19,30 +58,65 @@ char upper(char c) {
     return c;
 }
 
-static bool streqci(char *a, char *b) {
-    while (*a && *b) {
-        char ua = upper(*a);
-        char ub = upper(*b);
-        if (ua == ub) {
-            a++;
-            b++;
-        } else return false;
+#if defined(__SSE2__) || defined(_M_X64)
+// Letters have 0x20 cleared. Adding 128 - 'a' moves 'a'..'z' to the bottom
+// 26 values of a signed byte, so one compare finds them.
+static __m128i upper16(__m128i v) {
+    __m128i moved = _mm_add_epi8(v, _mm_set1_epi8((char)(128 - 'a')));
+    __m128i lowers = _mm_cmplt_epi8(moved, _mm_set1_epi8((char)(-128 + 26)));
+    return _mm_xor_si128(v, _mm_and_si128(lowers, _mm_set1_epi8(0x20)));
+}
+
+static bool sameci16(const char *a, const char *b) {
+    __m128i va = upper16(_mm_loadu_si128((const __m128i *)a));
+    __m128i vb = upper16(_mm_loadu_si128((const __m128i *)b));
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(va, vb)) == 0xffff;
+}
+#endif
+
+bool memeqci(const char *a, const char *b, size_t n) {
+#if defined(__SSE2__) || defined(_M_X64)
+    // 16 at a time, the last 16 overlapping the ones before
+    if (n >= 16) {
+        for (size_t i = 0; i + 16 < n; i += 16) {
+            if (!sameci16(a + i, b + i)) return false;
+        }
+        return sameci16(a + n - 16, b + n - 16);
+    }
+#endif
+    for (size_t i = 0; i < n; ++i) {
+        if (upper(a[i]) != upper(b[i])) return false;
     }
     return true;
 }
 
+// Whether the shorter of a and b starts the other, ignoring case
+static bool streqci(const char *a, const char *b) {
+    size_t a_len = strlen(a);
+    size_t b_len = strlen(b);
+    return memeqci(a, b, a_len < b_len ? a_len : b_len);
+}
+
 void vm_guess_stmt_kind_from_first_word(char *stmt_ptr, enum StatementGuess *out_sg, size_t *out_stmt_len) {
     if (streqci(stmt_ptr, "DECLARE")) {
         *out_sg = STMT_DECLARE;
         *out_stmt_len = sizeof "DECLARE" - 1;
         return;
     }
+    if (streqci(stmt_ptr, "CONSTANT")) {
+        *out_sg = STMT_CONSTANT;
+        *out_stmt_len = sizeof "CONSTANT" - 1;
+        return;
+    }
+    *out_sg = STMT_POSSIBLY_ASSIGNMENT;
+    *out_stmt_len = 0;
 }
 
-void grow(unsigned char **mem, size_t new_sz) {
+void grow(unsigned char **mem, size_t old_sz, size_t new_sz) {
     void *ptr = realloc(*mem, new_sz);
     assert(ptr); // For now.
-    memset(ptr, 0, new_sz);
+    // Only the new tail. What was there is kept.
+    if (new_sz > old_sz) memset((unsigned char *)ptr + old_sz, 0, new_sz - old_sz);
     *mem = ptr;
 }
 
@@ -85,6 +159,27 @@ static bool extract_skip_var_type(char **pstr, char **out_var_name, size_t *out_
     return extract_skip_var_name(pstr, out_var_name, out_var_len);
 }
 
+static bool extract_skip_size(char **pstr, size_t *out) {
+    char *s = *pstr;
+    *out = 0;
+    while (*s >= '0' && *s <= '9') {
+        *out = *out * 10 + (size_t)(*s - '0');
+        s += 1;
+    }
+    if (s == *pstr) return false;
+    *pstr = s;
+    return true;
+}
+
+static bool skip_char(char **pstr, char c) {
+    if (**pstr == c) {
+        *pstr += 1;
+        return true;
+    } else {
+        return false;
+    }
+}
+
 static bool skip_colon(char **pstr) {
     if (**pstr == ':') {
         *pstr += 1;
@@ -114,13 +209,14 @@ static bool skip_nul(char **pstr) {
 
 static void vm_alloc_var(struct VmState *state) {
     if (state->one_above_top >= state->cap) {
+        size_t old_cap = state->cap;
         if (state->cap) state->cap *= 2;
         else state->cap = 8;
 
         size_t alloc_sz = state->cap * sizeof(state->vars[0]);
         struct Var *ptr = realloc(state->vars, alloc_sz);
         assert(ptr);
-        memset(ptr, 0, alloc_sz);
+        memset(ptr + old_cap, 0, (state->cap - old_cap) * sizeof(state->vars[0]));
         state->vars = ptr;
     }
     state->one_above_top += 1;
@@ -129,7 +225,8 @@ static void vm_alloc_var(struct VmState *state) {
 static void vm_add_var(
     struct VmState *state,
     char *name, size_t name_len,
-    char *type, size_t type_len
+    char *type, size_t type_len,
+    size_t first_idx, size_t count
 ) {
     struct Var *top = &state->vars[state->one_above_top - 1];
 
@@ -142,97 +239,238 @@ static void vm_add_var(
     memcpy(top->name, name, (name_len >= max) ? max : name_len);
     memcpy(top->type, type, (type_len >= max) ? max : type_len);
 
-    // Assign default value. TODO take custom values into account.
+    // Default value of one element. TODO take custom values into account.
+    size_t esz = 0;
+    const void *dflt = NULL;
+    int dflt_int = 0;
+    double dflt_real = 0.0;
+    bool dflt_bool = false;
     if (streqci(type, "INTEGER")) {
-        top->valcnt = 1;
-        top->val_arr_starting_idx = 0;
-        top->valesz = sizeof(int);
-
-        size_t alloc_sz = top->valcnt * top->valesz;
-        top->valdat = malloc(alloc_sz);
-        assert(top->valdat);
-
-        *(int *)top->valdat = 0;
+        esz = sizeof(int);
+        dflt = &dflt_int;
     } else if (streqci(type, "REAL")) {
-        top->valcnt = 1;
-        top->val_arr_starting_idx = 0;
-        top->valesz = sizeof(double);
-
-        size_t alloc_sz = top->valcnt * top->valesz;
-        top->valdat = malloc(alloc_sz);
-        assert(top->valdat);
-
-        *(double *)top->valdat = 0.0;
+        esz = sizeof(double);
+        dflt = &dflt_real;
     } else if (streqci(type, "CHAR")) {
-        top->valcnt = 1;
-        top->val_arr_starting_idx = 0;
-        top->valesz = sizeof(char);
-
-        size_t alloc_sz = top->valcnt * top->valesz;
-        top->valdat = malloc(alloc_sz);
-        assert(top->valdat);
-
-        *(char *)top->valdat = '\0';
+        esz = sizeof(char);
+        dflt = "";
     } else if (streqci(type, "STRING")) {
-        top->valcnt = 1;
-        top->val_arr_starting_idx = 0;
-        top->valesz = sizeof("");
-
-        size_t alloc_sz = top->valcnt * top->valesz;
-        top->valdat = malloc(alloc_sz);
-        assert(top->valdat);
-
-        *(char *)top->valdat = '\0';
+        esz = sizeof("");
+        dflt = "";
     } else if (streqci(type, "BOOLEAN")) {
-        top->valcnt = 1;
-        top->val_arr_starting_idx = 0;
-        top->valesz = sizeof(bool);
-
-        size_t alloc_sz = top->valcnt * top->valesz;
-        top->valdat = malloc(alloc_sz);
-        assert(top->valdat);
-
-        *(bool *)top->valdat = false;
+        esz = sizeof(bool);
+        dflt = &dflt_bool;
     } else if (streqci(type, "DATE")) {
-        top->valcnt = 1;
-        top->val_arr_starting_idx = 0;
-        top->valesz = sizeof("00/00/0000");
-
-        size_t alloc_sz = top->valcnt * top->valesz;
-        top->valdat = malloc(alloc_sz);
+        esz = sizeof("00/00/0000");
+        dflt = "00/00/0000";
+    }
+    if (!dflt) return;
+
+    top->valcnt = count;
+    top->val_arr_starting_idx = first_idx;
+    top->valesz = esz;
+    top->valmapped = false;
+
+    // Every default but DATE's is all zero bytes. A large array of those is
+    // mapped instead, so no page is touched until an element on it is
+    // written.
+    assert(count <= SIZE_MAX / esz && "Array too large");
+    size_t alloc_sz = count * esz;
+    bool zero = !streqci(type, "DATE");
+    if (zero && alloc_sz >= VM_LAZY_ARRAY_MIN) {
+        top->valdat = vm_map_zeroed(alloc_sz);
+        top->valmapped = (top->valdat != NULL);
+    }
+    if (!top->valdat) {
+        top->valdat = zero ? calloc(count, esz) : malloc(alloc_sz);
         assert(top->valdat);
-
-        memcpy(top->valdat, "00/00/0000", sizeof "00/00/0000");
+        if (!zero) {
+            for (size_t i = 0; i < count; ++i) memcpy((char *)top->valdat + i * esz, dflt, esz);
+        }
     }
 }
 
 static void vm_decl_var_in_current_scope(
     struct VmState *state,
     char *name, size_t name_len,
-    char *type, size_t type_len
+    char *type, size_t type_len,
+    size_t first_idx, size_t count
 ) {
     vm_alloc_var(state);
-    vm_add_var(state, name, name_len, type, type_len);
+    vm_add_var(state, name, name_len, type, type_len, first_idx, count);
+}
+
+void *vm_var_at(struct Var *var, size_t idx) {
+    assert(idx >= var->val_arr_starting_idx && idx - var->val_arr_starting_idx < var->valcnt && "Index out of bounds");
+    return (char *)var->valdat + (idx - var->val_arr_starting_idx) * var->valesz;
 }
 
-void program_data_append(struct ProgramData *pd, char *zstr, void *data, size_t dat_len) {
-    size_t alignment = 8; //_Alignof(size_t);
-    size_t slen = strlen(zstr) + 1;
-    slen += alignment - (slen % alignment);
+void vm_free(struct VmState *state) {
+    for (size_t i = 0; i < state->one_above_top; ++i) {
+        struct Var *var = &state->vars[i];
+        if (var->valmapped) vm_unmap(var->valdat, var->valcnt * var->valesz);
+        else free(var->valdat);
+    }
+    free(state->vars);
+    program_data_free(&state->consts);
+    memset(state, 0, sizeof *state);
+}
 
-    size_t append_len = sizeof (struct Header) + slen + dat_len;
-    pd->mem_sz += append_len;
+static size_t pd_round(size_t n) {
+    return (n + PD_ALIGN - 1) / PD_ALIGN * PD_ALIGN;
+}
 
-    grow(&pd->mem, pd->mem_sz);
+// FNV-1a
+static size_t pd_hash(const void *key, size_t len) {
+    const unsigned char *b = key;
+    uint64_t h = 14695981039346656037u;
+    for (size_t i = 0; i < len; ++i) {
+        h ^= b[i];
+        h *= 1099511628211u;
+    }
+    return (size_t)h;
+}
+
+const struct Header *program_data_header(const struct ProgramData *pd, size_t at) {
+    assert(at % PD_ALIGN == 0 && at + sizeof(struct Header) <= pd->mem_sz && "Not a header");
+    return (const struct Header *)(pd->mem + at);
+}
+
+// The slot of the entry whose name, or data, is key, or else the empty slot
+// it would go in
+static size_t *pd_slot(const struct ProgramData *pd, bool by_data, const void *key, size_t len) {
+    size_t *table = by_data ? pd->by_data : pd->by_name;
+    size_t mask = pd->slots - 1;
+    for (size_t i = pd_hash(key, len) & mask;; i = (i + 1) & mask) {
+        if (!table[i]) return &table[i];
+        const struct Header *h = program_data_header(pd, table[i] - 1);
+        size_t at = by_data ? h->data : h->str;
+        size_t at_len = by_data ? h->datalen : h->strlen;
+        if (at_len == len && (!len || 0 == memcmp(pd->mem + at, key, len))) return &table[i];
+    }
+}
+
+// Rebuilds both tables with this many slots
+static void pd_index(struct ProgramData *pd, size_t slots) {
+    free(pd->by_name);
+    free(pd->by_data);
+    pd->slots = slots;
+    pd->by_name = calloc(slots, sizeof(size_t));
+    pd->by_data = calloc(slots, sizeof(size_t));
+    assert(pd->by_name && pd->by_data);
+
+    for (size_t at = pd->count ? pd->latest_header : PD_NONE; at != PD_NONE; ) {
+        const struct Header *h = program_data_header(pd, at);
+        size_t *slot = pd_slot(pd, false, pd->mem + h->str, h->strlen);
+        if (!*slot) *slot = at + 1;
+        slot = pd_slot(pd, true, pd->mem + h->data, h->datalen);
+        if (!*slot) *slot = at + 1;
+        at = h->next;
+    }
+}
+
+size_t program_data_append(struct ProgramData *pd, const char *zstr, const void *data, size_t dat_len) {
+    // An image from program_data_load() is not ours to write or grow
+    if (!pd->mem_cap && pd->mem) return PD_NONE;
+
+    // At most half full
+    if (2 * (pd->count + 1) > pd->slots) pd_index(pd, pd->slots ? pd->slots * 2 : 16);
+
+    size_t slen = strlen(zstr);
+    size_t *name_slot = pd_slot(pd, false, zstr, slen);
+    if (*name_slot) {
+        const struct Header *h = program_data_header(pd, *name_slot - 1);
+        bool same = h->datalen == dat_len && (!dat_len || 0 == memcmp(pd->mem + h->data, data, dat_len));
+        return same ? *name_slot - 1 : PD_NONE;
+    }
+    size_t *data_slot = pd_slot(pd, true, data, dat_len);
+
+    // Header, name, and data unless it is shared. mem_sz is always aligned.
+    size_t at = pd->mem_sz;
+    size_t str_at = at + sizeof(struct Header);
+    size_t end = str_at + pd_round(slen + 1);
+    size_t data_at = end;
+    if (*data_slot) data_at = program_data_header(pd, *data_slot - 1)->data;
+    else end += pd_round(dat_len);
+
+    if (end > pd->mem_cap) {
+        size_t cap = pd->mem_cap ? pd->mem_cap : 256;
+        while (cap < end) cap *= 2;
+        // New bytes are zeroed, so padding is too
+        grow((unsigned char **)&pd->mem, pd->mem_cap, cap);
+        pd->mem_cap = cap;
+    }
 
-    // Fill out header
     struct Header header;
-    header.next = pd->latest_header;
-    header.str;
+    header.next = pd->count ? pd->latest_header : PD_NONE;
+    header.str = str_at;
+    header.strlen = slen;
+    header.data = data_at;
+    header.datalen = dat_len;
+    memcpy(pd->mem + at, &header, sizeof header);
+    memcpy(pd->mem + str_at, zstr, slen + 1);
+    if (!*data_slot && dat_len) memcpy(pd->mem + data_at, data, dat_len);
+
+    pd->mem_sz = end;
+    pd->latest_header = at;
+    pd->count += 1;
+    *name_slot = at + 1;
+    if (!*data_slot) *data_slot = at + 1;
+    return at;
+}
+
+size_t program_data_find(const struct ProgramData *pd, const char *zstr) {
+    if (!pd->slots) return PD_NONE;
+    size_t *slot = pd_slot(pd, false, zstr, strlen(zstr));
+    return *slot ? *slot - 1 : PD_NONE;
+}
 
-    // Memcpy string
+// Precedes mem in an image. Its size keeps mem aligned.
+#define PD_MAGIC "CPIDATA"
+struct ProgramDataImage {
+    char magic[8];
+    size_t mem_sz;
+    size_t latest_header;
+    size_t count;
+};
+
+size_t program_data_serialize(const struct ProgramData *pd, void *out, size_t cap) {
+    struct ProgramDataImage img;
+    size_t sz = sizeof img + pd->mem_sz;
+    if (!out || cap < sz) return sz;
+
+    memcpy(img.magic, PD_MAGIC, sizeof img.magic);
+    img.mem_sz = pd->mem_sz;
+    img.latest_header = pd->latest_header;
+    img.count = pd->count;
+    memcpy(out, &img, sizeof img);
+    if (pd->mem_sz) memcpy((char *)out + sizeof img, pd->mem, pd->mem_sz);
+    return sz;
+}
 
-    // Memcpy data
+bool program_data_load(struct ProgramData *pd, const void *image, size_t sz) {
+    struct ProgramDataImage img;
+    if (sz < sizeof img || (uintptr_t)image % PD_ALIGN) return false;
+    memcpy(&img, image, sizeof img);
+    if (memcmp(img.magic, PD_MAGIC, sizeof img.magic) || img.mem_sz != sz - sizeof img) return false;
+
+    memset(pd, 0, sizeof *pd);
+    pd->mem = (char *)image + sizeof img; // Not written to, as mem_cap is 0
+    pd->mem_sz = img.mem_sz;
+    pd->latest_header = img.latest_header;
+    pd->count = img.count;
+
+    size_t slots = 16;
+    while (slots < 2 * pd->count) slots *= 2;
+    pd_index(pd, slots);
+    return true;
+}
+
+void program_data_free(struct ProgramData *pd) {
+    if (pd->mem_cap) free(pd->mem);
+    free(pd->by_name);
+    free(pd->by_data);
+    memset(pd, 0, sizeof *pd);
 }
 
 void vm_exec_stmt(struct VmState *state, char *stmt_ptr) {
@@ -247,6 +485,8 @@ void vm_exec_stmt(struct VmState *state, char *stmt_ptr) {
         {
             // <optional space> DECLARE <space> VarName <optional space> : <optional space> TypeName <optional space> <EOL>
             //                          ^ You are here.
+            // or, for an array, in place of TypeName,
+            // ARRAY [ <l> : <u> ] <space> OF <space> TypeName
 
             // Note: Replace asserts with macro exiting with a good error message.
 
@@ -264,11 +504,80 @@ void vm_exec_stmt(struct VmState *state, char *stmt_ptr) {
             char *var_type; size_t var_type_len;
             assert(extract_skip_var_type(&stmt_ptr, &var_type, &var_type_len) && "Expected variable type");
 
+            size_t first_idx = 0, count = 1;
+            if (var_type_len == sizeof "ARRAY" - 1 && streqci(var_type, "ARRAY")) {
+                size_t last_idx;
+                skip_whitespace(&stmt_ptr);
+                assert(skip_char(&stmt_ptr, '[') && "Expected [");
+                skip_whitespace(&stmt_ptr);
+                assert(extract_skip_size(&stmt_ptr, &first_idx) && "Expected lower bound");
+                skip_whitespace(&stmt_ptr);
+                assert(skip_colon(&stmt_ptr) && "Expected colon");
+                skip_whitespace(&stmt_ptr);
+                assert(extract_skip_size(&stmt_ptr, &last_idx) && "Expected upper bound");
+                skip_whitespace(&stmt_ptr);
+                assert(skip_char(&stmt_ptr, ']') && "Expected ]");
+                assert(last_idx >= first_idx && "Upper bound below lower bound");
+                count = last_idx - first_idx + 1;
+
+                assert(skip_whitespace(&stmt_ptr) && "Expected whitespace");
+                char *of; size_t of_len;
+                extract_skip_var_name(&stmt_ptr, &of, &of_len);
+                assert(of_len == sizeof "OF" - 1 && streqci(of, "OF") && "Expected OF");
+                assert(skip_whitespace(&stmt_ptr) && "Expected whitespace");
+                assert(extract_skip_var_type(&stmt_ptr, &var_type, &var_type_len) && "Expected element type");
+            }
+
             skip_whitespace(&stmt_ptr);
 
             assert(skip_newline(&stmt_ptr) || skip_nul(&stmt_ptr) && "Expected newline or nul terminator");
 
-            vm_decl_var_in_current_scope(state, var_name, var_name_len, var_type, var_type_len);
+            vm_decl_var_in_current_scope(state, var_name, var_name_len, var_type, var_type_len, first_idx, count);
+            break;
+        }
+        case STMT_CONSTANT:
+        {
+            // <optional space> CONSTANT <space> Name <optional space> = <optional space> Literal <optional space> <EOL>
+            //                           ^ You are here.
+            // Literal is an INTEGER, or a STRING in double quotes. Its value
+            // goes into the data segment, shared with any equal one.
+
+            assert(skip_whitespace(&stmt_ptr) && "Expected whitespace");
+
+            char *const_name; size_t const_name_len;
+            assert(extract_skip_var_name(&stmt_ptr, &const_name, &const_name_len) && const_name_len && "Expected constant name");
+            char name[64];
+            assert(const_name_len < sizeof name && "Constant name too long");
+            memcpy(name, const_name, const_name_len);
+            name[const_name_len] = '\0';
+
+            skip_whitespace(&stmt_ptr);
+            assert(skip_char(&stmt_ptr, '=') && "Expected =");
+            skip_whitespace(&stmt_ptr);
+
+            void *data;
+            size_t data_len;
+            int integer;
+            if (skip_char(&stmt_ptr, '"')) {
+                data = stmt_ptr;
+                while (*stmt_ptr && *stmt_ptr != '"') stmt_ptr += 1;
+                data_len = (size_t)(stmt_ptr - (char *)data);
+                assert(skip_char(&stmt_ptr, '"') && "Expected closing quote");
+            } else {
+                bool negative = skip_char(&stmt_ptr, '-');
+                size_t magnitude;
+                assert(extract_skip_size(&stmt_ptr, &magnitude) && "Expected literal");
+                integer = negative ? -(int)magnitude : (int)magnitude;
+                data = &integer;
+                data_len = sizeof integer;
+            }
+
+            skip_whitespace(&stmt_ptr);
+            assert((skip_newline(&stmt_ptr) || skip_nul(&stmt_ptr)) && "Expected newline or nul terminator");
+
+            size_t at = program_data_append(&state->consts, name, data, data_len);
+            assert(at != PD_NONE && "Constant redefined");
+            (void)at;
             break;
         }
         case STMT_POSSIBLY_ASSIGNMENT: // Fallthrough
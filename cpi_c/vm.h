@@ -84,13 +84,17 @@
 
 enum StatementGuess {
     STMT_DECLARE,
+    STMT_CONSTANT,
     STMT_POSSIBLY_ASSIGNMENT,
 };
 
 char upper(char c);
+// Whether n bytes of a and b are the same apart from the case of letters
+bool memeqci(const char *a, const char *b, size_t n);
 void vm_guess_stmt_kind_from_first_word(char *stmt_ptr, enum StatementGuess *out_sg, size_t *out_stmt_len);
 
-void grow(unsigned char **mem, size_t new_sz);
+// Reallocates to new_sz, zeroing only the bytes past old_sz
+void grow(unsigned char **mem, size_t old_sz, size_t new_sz);
 
 // Struct members are indices to a char* array instead of pointers
 // Avoids pointer invalidation
@@ -102,13 +106,41 @@ struct Header {
     size_t datalen;
 };
 
+// The data segment: named constants and literals, each a Header, then its
+// name, then its data, every part starting on an 8 byte boundary. Data that
+// is already in the segment under another name is shared rather than copied.
+// Entries are found by name through a hash table, and chained from the
+// latest to the first through Header.next, which is PD_NONE for the first.
+//
+// Since everything is an index into mem, mem is the whole segment. It can be
+// written into a compiled image and used from there read-only.
+#define PD_NONE ((size_t)-1)
+#define PD_ALIGN ((size_t)8)
+
 struct ProgramData {
     char *mem;
     size_t mem_sz;
     size_t latest_header;
+    size_t mem_cap; // 0 if mem is an image from program_data_load()
+    size_t count; // Entries
+    size_t *by_name; // Header index + 1, or 0 for an empty slot
+    size_t *by_data; // Likewise, for the first entry with each data
+    size_t slots; // In each table. A power of two.
 };
 
-void program_data_append(struct ProgramData *pd, char *zstr, void *data, size_t dat_len);
+// Returns the index of the Header for zstr. If zstr is already there with
+// the same data, that is returned. With different data, or if pd is a
+// read-only image, PD_NONE is.
+size_t program_data_append(struct ProgramData *pd, const char *zstr, const void *data, size_t dat_len);
+// The index of zstr's Header, or PD_NONE
+size_t program_data_find(const struct ProgramData *pd, const char *zstr);
+const struct Header *program_data_header(const struct ProgramData *pd, size_t at);
+// Writes the segment to out if it has room for it. Returns its size.
+size_t program_data_serialize(const struct ProgramData *pd, void *out, size_t cap);
+// Uses an image written by program_data_serialize() in place. It must be
+// 8 byte aligned and outlive pd.
+bool program_data_load(struct ProgramData *pd, const void *image, size_t sz);
+void program_data_free(struct ProgramData *pd);
 
 #define VAR_NAME_LEN ((size_t)8)
 struct VmState {
@@ -121,10 +153,20 @@ struct VmState {
         size_t val_arr_starting_idx;
         size_t valesz; // Value element size.
         void *valdat; // Value data
+        bool valmapped; // valdat is an anonymous mapping, not from malloc
     } *vars;
+    struct ProgramData consts; // CONSTANTs, by name
 };
 
+// Arrays of at least this many bytes whose default value is all zero bytes
+// are mapped rather than allocated and filled. Pages are only backed once
+// written, so a huge, sparsely used array costs little time or memory.
+#define VM_LAZY_ARRAY_MIN ((size_t)64 << 10)
+
 void vm_exec_stmt(struct VmState *state, char *stmt_ptr);
+// Element idx of an array, by its declared index. A scalar is element 0.
+void *vm_var_at(struct Var *var, size_t idx);
+void vm_free(struct VmState *state);
 
 #endif
 
@@ -0,0 +1,58 @@
+#include "alloc.hpp"
+
+#include <cstdlib>
+#include <new>
+
+// Trivial, so that it needs no construction on a new thread before the first
+// allocation there
+static thread_local AllocCounts counts;
+
+const AllocCounts &alloc_counts() {
+    return counts;
+}
+
+static void *counted(void *p, size_t size) {
+    if (!p) throw std::bad_alloc();
+    ++counts.allocations_;
+    counts.bytes_ += size;
+    return p;
+}
+
+// The array and nothrow forms come here by default. The sized deletes
+// are defined as well, as the compiler calls them once operator delete is
+// replaced.
+
+void *operator new(size_t size) {
+    return counted(std::malloc(size ? size : 1), size);
+}
+
+void operator delete(void *p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+    std::free(p);
+}
+
+void *operator new(size_t size, std::align_val_t align) {
+    size_t a = static_cast<size_t>(align);
+#if defined(_MSC_VER)
+    return counted(_aligned_malloc(size ? size : 1, a), size);
+#else
+    // aligned_alloc wants a nonzero multiple of the alignment
+    size_t rounded = size ? (size + a - 1) / a * a : a;
+    return counted(std::aligned_alloc(a, rounded), size);
+#endif
+}
+
+void operator delete(void *p, std::align_val_t) noexcept {
+#if defined(_MSC_VER)
+    _aligned_free(p);
+#else
+    std::free(p);
+#endif
+}
+
+void operator delete(void *p, size_t, std::align_val_t align) noexcept {
+    operator delete(p, align);
+}
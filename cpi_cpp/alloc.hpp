@@ -0,0 +1,13 @@
+#pragma once
+
+#include "util.hpp"
+
+// Heap allocations made by the calling thread: every global operator new
+// counts here. Tests and benchmarks read them before and after some work to
+// check that a steady loop allocates nothing.
+struct AllocCounts {
+    uint64_t allocations_ = 0;
+    uint64_t bytes_ = 0;
+};
+
+const AllocCounts &alloc_counts();
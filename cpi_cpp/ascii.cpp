@@ -0,0 +1,207 @@
+#include "ascii.hpp"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define CPI_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+#endif
+
+// MSVC compiles AVX2 intrinsics anywhere; GCC and Clang only in functions
+// marked for it
+#if defined(__GNUC__)
+#define CPI_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define CPI_TARGET_AVX2
+#endif
+
+// -- Scalar
+
+static char lower_char(char c) { return c >= 'A' && c <= 'Z' ? static_cast<char>(c + ('a' - 'A')) : c; }
+static char upper_char(char c) { return c >= 'a' && c <= 'z' ? static_cast<char>(c - ('a' - 'A')) : c; }
+
+static void scalar_lower(char *s, size_t n) {
+    for (size_t i = 0; i < n; ++i) s[i] = lower_char(s[i]);
+}
+
+static void scalar_upper(char *s, size_t n) {
+    for (size_t i = 0; i < n; ++i) s[i] = upper_char(s[i]);
+}
+
+static bool scalar_iequal(const char *a, const char *b, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        if (lower_char(a[i]) != lower_char(b[i])) return false;
+    }
+    return true;
+}
+
+static constexpr AsciiKernels scalar_kernels{ "scalar", scalar_lower, scalar_upper, scalar_iequal };
+
+#ifdef CPI_X86
+
+// Each kernel works a block at a time. Strings shorter than a block go to the
+// next narrower kernel. The last, partial, block is done by redoing the whole
+// block that ends with the string, which is harmless: case mapping twice is
+// the same as once, and comparing bytes again gives the same answer.
+//
+// Letters are found with a single signed compare: adding 128 - 'A' moves
+// 'A'..'Z' to the bottom 26 values of a signed byte.
+
+// -- SSE2, which every x86-64 CPU has
+
+static __m128i sse2_letters(__m128i v, char first) {
+    __m128i moved = _mm_add_epi8(v, _mm_set1_epi8(static_cast<char>(128 - first)));
+    return _mm_cmplt_epi8(moved, _mm_set1_epi8(static_cast<char>(-128 + 26)));
+}
+
+static __m128i sse2_lower_block(__m128i v) {
+    return _mm_or_si128(v, _mm_and_si128(sse2_letters(v, 'A'), _mm_set1_epi8(0x20)));
+}
+
+static __m128i sse2_upper_block(__m128i v) {
+    return _mm_xor_si128(v, _mm_and_si128(sse2_letters(v, 'a'), _mm_set1_epi8(0x20)));
+}
+
+template<__m128i (*Map)(__m128i), void (*Short)(char *, size_t)> static void sse2_map(char *s, size_t n) {
+    if (n < 16) return Short(s, n);
+    for (size_t i = 0; i + 16 < n; i += 16) {
+        __m128i *p = reinterpret_cast<__m128i *>(s + i);
+        _mm_storeu_si128(p, Map(_mm_loadu_si128(p)));
+    }
+    __m128i *last = reinterpret_cast<__m128i *>(s + n - 16);
+    _mm_storeu_si128(last, Map(_mm_loadu_si128(last)));
+}
+
+// All ones in the bytes of a block that are the same in both
+template<__m128i (*Fold)(__m128i)> static __m128i sse2_same(const char *a, const char *b) {
+    __m128i va = Fold(_mm_loadu_si128(reinterpret_cast<const __m128i *>(a)));
+    __m128i vb = Fold(_mm_loadu_si128(reinterpret_cast<const __m128i *>(b)));
+    return _mm_cmpeq_epi8(va, vb);
+}
+
+static bool sse2_all(__m128i v) { return _mm_movemask_epi8(v) == 0xffff; }
+
+template<__m128i (*Fold)(__m128i), bool (*Short)(const char *, const char *, size_t)>
+static bool sse2_iequal(const char *a, const char *b, size_t n) {
+    if (n < 16) return Short(a, b, n);
+    // Four blocks between branches
+    size_t i = 0;
+    for (; i + 64 < n; i += 64) {
+        __m128i same = _mm_and_si128(
+            _mm_and_si128(sse2_same<Fold>(a + i, b + i), sse2_same<Fold>(a + i + 16, b + i + 16)),
+            _mm_and_si128(sse2_same<Fold>(a + i + 32, b + i + 32), sse2_same<Fold>(a + i + 48, b + i + 48)));
+        if (!sse2_all(same)) return false;
+    }
+    for (; i + 16 < n; i += 16) {
+        if (!sse2_all(sse2_same<Fold>(a + i, b + i))) return false;
+    }
+    return sse2_all(sse2_same<Fold>(a + n - 16, b + n - 16));
+}
+
+static constexpr AsciiKernels sse2_kernels{
+    "sse2",
+    sse2_map<sse2_lower_block, scalar_lower>,
+    sse2_map<sse2_upper_block, scalar_upper>,
+    sse2_iequal<sse2_lower_block, scalar_iequal>,
+};
+
+// -- AVX2
+
+CPI_TARGET_AVX2 static __m256i avx2_letters(__m256i v, char first) {
+    __m256i moved = _mm256_add_epi8(v, _mm256_set1_epi8(static_cast<char>(128 - first)));
+    return _mm256_cmpgt_epi8(_mm256_set1_epi8(static_cast<char>(-128 + 26)), moved);
+}
+
+CPI_TARGET_AVX2 static __m256i avx2_lower_block(__m256i v) {
+    return _mm256_or_si256(v, _mm256_and_si256(avx2_letters(v, 'A'), _mm256_set1_epi8(0x20)));
+}
+
+CPI_TARGET_AVX2 static __m256i avx2_upper_block(__m256i v) {
+    return _mm256_xor_si256(v, _mm256_and_si256(avx2_letters(v, 'a'), _mm256_set1_epi8(0x20)));
+}
+
+template<__m256i (*Map)(__m256i), void (*Short)(char *, size_t)> CPI_TARGET_AVX2 static void avx2_map(char *s, size_t n) {
+    if (n < 32) return Short(s, n);
+    for (size_t i = 0; i + 32 < n; i += 32) {
+        __m256i *p = reinterpret_cast<__m256i *>(s + i);
+        _mm256_storeu_si256(p, Map(_mm256_loadu_si256(p)));
+    }
+    __m256i *last = reinterpret_cast<__m256i *>(s + n - 32);
+    _mm256_storeu_si256(last, Map(_mm256_loadu_si256(last)));
+}
+
+template<__m256i (*Fold)(__m256i)> CPI_TARGET_AVX2 static __m256i avx2_same(const char *a, const char *b) {
+    __m256i va = Fold(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(a)));
+    __m256i vb = Fold(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(b)));
+    return _mm256_cmpeq_epi8(va, vb);
+}
+
+CPI_TARGET_AVX2 static bool avx2_all(__m256i v) { return _mm256_movemask_epi8(v) == -1; }
+
+template<__m256i (*Fold)(__m256i), bool (*Short)(const char *, const char *, size_t)>
+CPI_TARGET_AVX2 static bool avx2_iequal(const char *a, const char *b, size_t n) {
+    if (n < 32) return Short(a, b, n);
+    size_t i = 0;
+    for (; i + 128 < n; i += 128) {
+        __m256i same = _mm256_and_si256(
+            _mm256_and_si256(avx2_same<Fold>(a + i, b + i), avx2_same<Fold>(a + i + 32, b + i + 32)),
+            _mm256_and_si256(avx2_same<Fold>(a + i + 64, b + i + 64), avx2_same<Fold>(a + i + 96, b + i + 96)));
+        if (!avx2_all(same)) return false;
+    }
+    for (; i + 32 < n; i += 32) {
+        if (!avx2_all(avx2_same<Fold>(a + i, b + i))) return false;
+    }
+    return avx2_all(avx2_same<Fold>(a + n - 32, b + n - 32));
+}
+
+static constexpr AsciiKernels avx2_kernels{
+    "avx2",
+    avx2_map<avx2_lower_block, sse2_map<sse2_lower_block, scalar_lower>>,
+    avx2_map<avx2_upper_block, sse2_map<sse2_upper_block, scalar_upper>>,
+    avx2_iequal<avx2_lower_block, sse2_iequal<sse2_lower_block, scalar_iequal>>,
+};
+
+static bool has_avx2() {
+#if defined(__GNUC__)
+    return __builtin_cpu_supports("avx2");
+#else
+    // The CPU has it, and the OS saves the YMM registers
+    int r[4];
+    __cpuid(r, 0);
+    if (r[0] < 7) return false;
+    __cpuid(r, 1);
+    bool osxsave = r[2] & (1 << 27);
+    if (!osxsave || (_xgetbv(0) & 6) != 6) return false;
+    __cpuidex(r, 7, 0);
+    return r[1] & (1 << 5);
+#endif
+}
+
+#endif
+
+std::vector<const AsciiKernels *> ascii_supported_kernels() {
+    std::vector<const AsciiKernels *> all{ &scalar_kernels };
+#ifdef CPI_X86
+    all.push_back(&sse2_kernels);
+    if (has_avx2()) all.push_back(&avx2_kernels);
+#endif
+    return all;
+}
+
+const AsciiKernels &ascii_kernels() {
+    static const AsciiKernels &best = *ascii_supported_kernels().back();
+    return best;
+}
+
+void ascii_lower(char *s, size_t n) {
+    ascii_kernels().lower_(s, n);
+}
+
+void ascii_upper(char *s, size_t n) {
+    ascii_kernels().upper_(s, n);
+}
+
+bool ascii_iequal(std::string_view a, std::string_view b) {
+    return a.size() == b.size() && ascii_kernels().iequal_(a.data(), b.data(), a.size());
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "util.hpp"
+
+// ASCII case mapping and case-insensitive comparison, for UCASE and LCASE
+// and for keywords and identifiers, which are case-insensitive. Bytes
+// outside A-Z and a-z are left alone, whatever the locale.
+//
+// Each operation has a scalar version and vector ones. The widest the CPU
+// supports is picked the first time any is used. Plain equality is memcmp,
+// which the C library already vectorises and dispatches the same way.
+
+void ascii_lower(char *s, size_t n);
+void ascii_upper(char *s, size_t n);
+// Equal apart from the case of letters
+bool ascii_iequal(std::string_view a, std::string_view b);
+
+// One implementation of all of the above. Lengths passed to these are equal.
+struct AsciiKernels {
+    const char *name_;
+    void (*lower_)(char *s, size_t n);
+    void (*upper_)(char *s, size_t n);
+    bool (*iequal_)(const char *a, const char *b, size_t n);
+};
+
+// The one in use
+const AsciiKernels &ascii_kernels();
+// Every one this CPU can run, scalar first, for tests and benchmarks
+std::vector<const AsciiKernels *> ascii_supported_kernels();
@@ -0,0 +1,201 @@
+#pragma once
+
+#include "util.hpp"
+#include "cpi.hpp"
+
+// Nodes live in flat pools inside Ast and refer to each other by index, so
+// the tree can be annotated in place and copied around without fixing up
+// pointers.
+using NodeId = uint32_t;
+inline constexpr NodeId no_node = UINT32_MAX;
+
+enum struct Op : uint8_t {
+    Add, Sub, Mul, Div, Mod, IntDiv, Concat,
+    Eq, Ne, Lt, Le, Gt, Ge,
+    And, Or, Not, Neg,
+
+    // Inserted by the type checker
+    ToReal,   // INTEGER -> REAL
+    ToString, // CHAR -> STRING
+    Expect,   // Run-time type check of a value whose type is only known at run time
+};
+
+enum struct Builtin : uint8_t {
+    Length, Left, Right, Mid, Ucase, Lcase, Eof, Randombetween, Rnd,
+};
+
+enum struct ExprKind : uint8_t { Literal, Variable, Unary, Binary, Call, Element };
+
+// Where a variable's slot is: among the globals, in the frame of the running
+// procedure, or, for a BYREF parameter, wherever its slot in that frame says.
+enum struct Scope : uint8_t { Global, Local, Ref };
+
+// Typed kernels take their operands untagged; the checker has already proven
+// which member of the Cell is live.
+using Kernel = void (*)(Cell &dst, const Cell &l, const Cell &r);
+
+// A comparison kernel that returns its result instead of storing it, for
+// conditions that are branched on straight away.
+using Predicate = bool (*)(const Cell &l, const Cell &r);
+
+struct Expr {
+    ExprKind kind_;
+    Op op_ = Op::Add;
+    int line_ = 0;
+
+    NodeId lhs_ = no_node; // Unary operand, or left operand
+    NodeId rhs_ = no_node;
+    std::vector<NodeId> args_{}; // Call; Element: one index per dimension
+
+    // Literal: index into Ast::consts_. Variable, Element: slot index, in
+    // scope_. Call: Builtin.
+    uint32_t index_ = 0;
+    Scope scope_ = Scope::Global;
+    std::string name_{}; // Variable or builtin as written; Eof: the file name
+    // Element: the field after the indices, as in A[1].Name, with the names
+    // of nested records joined by '.', and its place within an element,
+    // resolved by check()
+    std::string path_{};
+    uint32_t field_ = 0;
+
+    // Set by check(). nullopt when the type is only known at run time, in
+    // which case the value carries its own tag and kernel_ is null.
+    std::optional<AtomicDt> type_{};
+    Kernel kernel_ = nullptr;
+    Predicate predicate_ = nullptr; // Typed comparisons
+};
+
+enum struct StmtKind : uint8_t {
+    Declare, Constant, Assign, Input, Output,
+    OpenFile, ReadFile, WriteFile, CloseFile,
+    Case, For, If, While, Repeat,
+    Procedure, Call, Type,
+    Copy, // An Assign of a whole ARRAY or record, made one by check()
+};
+
+struct Stmt {
+    StmtKind kind_;
+    int line_ = 0;
+
+    std::string name_{};        // Variable, or file name for file statements; Procedure, Call, Type: its name
+    uint32_t slot_ = 0;         // Resolved by check()
+    Scope scope_ = Scope::Global;
+    std::optional<AtomicDt> type_{}; // Declare, unless it is of a Layout. For: type of the control variable, set by check()
+    FileMode mode_ = FileMode::Read; // OpenFile
+
+    // Assign, WriteFile, Constant, Case: one value. Output: every value.
+    // For: start, end and, if given, STEP. If, While, Repeat: the condition.
+    // Assign to an Element: the value, then the Element. Copy: the variable
+    // copied from. Call: the arguments.
+    std::vector<NodeId> exprs_{};
+
+    // Case: index into Ast::cases_. Declare without type_: into
+    // Ast::layouts_. Procedure, Call: into Ast::procs_, the latter set by check()
+    uint32_t index_ = 0;
+    std::vector<NodeId> body_{}; // For, While, Repeat, Procedure; If: THEN; Type: its DECLAREs
+    std::vector<NodeId> else_{}; // If
+};
+
+// <lo_> TO <hi_> : <body_>, or <lo_> : <body_> with hi_ a copy of lo_
+struct CaseClause {
+    int line_ = 0;
+    Slot lo_;
+    Slot hi_;
+    std::vector<NodeId> body_;
+};
+
+enum struct CaseDispatch : uint8_t {
+    Linear, // Clauses tested in order
+    Jump,   // jump_ indexed by the INTEGER or CHAR value less base_
+    Search, // Binary search of ranges_
+};
+
+struct CaseRange {
+    Slot lo_;
+    Slot hi_;
+    uint32_t clause_;
+};
+
+struct Case {
+    std::vector<CaseClause> clauses_;
+    std::vector<NodeId> otherwise_;
+
+    // Chosen by check() once the labels have the type of the value. An
+    // index of clauses_.size() stands for OTHERWISE.
+    CaseDispatch dispatch_ = CaseDispatch::Linear;
+    AtomicDt key_ = AtomicDt::Integer;
+    int64_t base_ = 0;
+    std::vector<uint32_t> jump_;
+    std::vector<CaseRange> ranges_; // Sorted and disjoint
+};
+
+struct SlotInfo {
+    std::string name_;
+    std::optional<AtomicDt> type_; // nullopt: typed by whatever is stored at run time, unless layout_
+    bool constant_ = false;
+    std::optional<uint32_t> layout_{}; // An ARRAY or record: index into Ast::layouts_
+    bool byref_ = false;
+};
+
+// The bounds of one dimension of an ARRAY
+struct Dim {
+    int lo_;
+    int hi_;
+};
+
+// A record TYPE, its fields flattened: a field of a record type stands for
+// each of that record's own fields, named with a '.' between.
+struct Record {
+    std::string name_;
+    std::vector<std::pair<std::string, AtomicDt>> fields_;
+};
+
+// The type of an ARRAY or record variable. Its values are stored flattened,
+// one element after another, a row at a time, and each element as the
+// fields of its record, if it has one.
+struct Layout {
+    std::vector<Dim> dims_; // Empty for a record
+    // ARRAY OF <type>, as a parameter, takes the bounds of the argument
+    bool bounded_ = true;
+    std::optional<AtomicDt> element_{}; // Or the record named
+    std::string record_name_{};
+    uint32_t record_ = 0;   // Index into Ast::records_, set by check()
+    uint32_t stride_ = 1;   // Values per element, set by check()
+};
+
+struct ProcParam {
+    std::string name_;
+    bool byref_ = false;
+    std::optional<AtomicDt> type_{}; // Or Ast::layouts_[layout_]
+    uint32_t layout_ = 0;
+};
+
+struct Procedure {
+    NodeId stmt_ = no_node; // Whose body_ is the procedure's
+    std::vector<ProcParam> params_;
+    // The procedure's frame, set by check(): its parameters, then its other
+    // variables
+    std::vector<SlotInfo> slots_{};
+};
+
+struct Ast {
+    std::vector<Expr> exprs_;
+    std::vector<Stmt> stmts_;
+    std::vector<NodeId> top_; // Top level statements in program order
+    std::vector<Slot> consts_;
+    std::vector<SlotInfo> slots_; // Globals, filled in by check()
+    std::vector<Case> cases_;
+    std::vector<Layout> layouts_;
+    std::vector<Record> records_; // Filled in by check()
+    std::vector<Procedure> procs_;
+
+    NodeId add(Expr e) { exprs_.push_back(std::move(e)); return static_cast<NodeId>(exprs_.size() - 1); }
+    NodeId add(Stmt s) { stmts_.push_back(std::move(s)); return static_cast<NodeId>(stmts_.size() - 1); }
+    Expr &expr(NodeId id) { return exprs_[id]; }
+    const Expr &expr(NodeId id) const { return exprs_[id]; }
+    Stmt &stmt(NodeId id) { return stmts_[id]; }
+    const Stmt &stmt(NodeId id) const { return stmts_[id]; }
+};
+
+// Appends a message per syntax error to `errors`.
+Ast parse(std::string_view source, std::vector<std::string> &errors);
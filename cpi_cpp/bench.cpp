@@ -0,0 +1,302 @@
+#include "util.hpp"
+#include "exec.hpp"
+#include "engine.hpp"
+#include "cases.hpp"
+#include "ascii.hpp"
+#include "alloc.hpp"
+
+#include <chrono>
+
+// Microbenchmarks for the executor. Not part of the tests: build cpi_bench
+// with optimisations and compare the numbers between runs of the same kind.
+
+// Calls f(0) .. f(iterations - 1). Each call may do `per_call` units of work,
+// e.g. loop iterations inside one program run; the time and the heap
+// allocations are reported per unit.
+template<typename F> static void bench(std::string_view name, size_t iterations, F f, size_t per_call = 1) {
+    uint64_t allocations = alloc_counts().allocations_;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; ++i) {
+        f(i);
+    }
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    double units = static_cast<double>(iterations * per_call);
+    std::println("{:48} {:10.1f} ns/iter {:8.2f} allocs/iter", name, elapsed.count() / units,
+        (alloc_counts().allocations_ - allocations) / units);
+}
+
+static Program must_compile(std::string source, bool fold = true) {
+    Program p = compile(std::move(source), fold);
+    if (!p.errors_.empty()) {
+        throw std::runtime_error(p.errors_.front());
+    }
+    return p;
+}
+
+// Runs the program once per line of input, keeping variables between runs
+static void bench_runs(std::string_view name, const Program &p, const std::vector<std::string> &inputs) {
+    std::string text;
+    for (const auto &line : inputs) {
+        text += line + "\n";
+    }
+    Interpreter interp;
+    std::istringstream in(text);
+    std::ostringstream out;
+    Engine engine(p.ast_, interp, in, out);
+    bench(name, inputs.size(), [&](size_t) { engine.run(); });
+}
+
+// -- CASE: a 200-way menu dispatcher, as our users write them
+
+static constexpr int menu_ways = 200;
+
+static std::string menu_source(bool strings) {
+    std::string s = strings ? "DECLARE Choice : STRING\n" : "DECLARE Choice : INTEGER\n";
+    s += "DECLARE Total : INTEGER\nINPUT Choice\nCASE OF Choice\n";
+    for (int i = 1; i <= menu_ways; ++i) {
+        s += strings ? std::format("   \"item{}\" : Total <- Total + {}\n", i, i) : std::format("   {} : Total <- Total + {}\n", i, i);
+    }
+    s += "   OTHERWISE : Total <- Total - 1\nENDCASE\n";
+    return s;
+}
+
+static void bench_case() {
+    for (bool strings : { false, true }) {
+        Program p = must_compile(menu_source(strings));
+        Program linear = p;
+        linear.ast_.cases_[0].dispatch_ = CaseDispatch::Linear;
+
+        std::vector<std::string> inputs;
+        std::vector<Slot> keys;
+        for (int i = 0; i < 100000; ++i) {
+            int choice = i * 7919 % (menu_ways + 10) + 1;
+            inputs.push_back(strings ? std::format("item{}", choice) : std::to_string(choice));
+            keys.push_back(strings ? to_slot(atomic_value(String(inputs.back()))) : to_slot(atomic_value(Integer(choice))));
+        }
+
+        std::string kind = strings ? "string" : "integer";
+        const Case &fast = p.ast_.cases_[0];
+        const Case &slow = linear.ast_.cases_[0];
+        uint32_t sink = 0;
+        bench(std::format("case {} select, {}", kind, fast.dispatch_ == CaseDispatch::Jump ? "jump table" : "binary search"),
+            keys.size(), [&](size_t i) { sink += select_clause(fast, keys[i]); });
+        bench(std::format("case {} select, linear", kind), keys.size(), [&](size_t i) { sink += select_clause(slow, keys[i]); });
+        bench_runs(std::format("case {} program, {}", kind, fast.dispatch_ == CaseDispatch::Jump ? "jump table" : "binary search"), p, inputs);
+        bench_runs(std::format("case {} program, linear", kind), linear, inputs);
+        if (sink == 0) std::println("");
+    }
+}
+
+// -- FOR: counted loops
+
+static void bench_for() {
+    constexpr int iterations = 1000000;
+    Program p = must_compile(std::format(
+        "Total <- 0\n"
+        "FOR i <- 1 TO {}\n"
+        "   Total <- Total + i MOD 7\n"
+        "ENDFOR\n", iterations));
+    Interpreter interp;
+    std::istringstream in;
+    std::ostringstream out;
+    Engine engine(p.ast_, interp, in, out);
+    bench("for loop", 5, [&](size_t) { engine.run(); }, iterations);
+}
+
+// The same condition tested in place, where comparisons branch through their
+// predicate and AND/OR short-circuit, and materialised into a BOOLEAN first.
+static void bench_while() {
+    constexpr int iterations = 1000000;
+    const std::string condition = "i < Limit AND (i MOD 3 <> 1 OR Total >= 0) AND NOT Done";
+    auto run = [&](const char *name, const std::string &source) {
+        Program p = must_compile(source);
+        Interpreter interp;
+        std::istringstream in;
+        std::ostringstream out;
+        Engine engine(p.ast_, interp, in, out);
+        bench(name, 5, [&](size_t) { engine.run(); }, iterations);
+    };
+
+    run("while, condition inline", std::format(
+        "i <- 0\nTotal <- 0\nLimit <- {}\nDone <- FALSE\n"
+        "WHILE {} DO\n"
+        "   i <- i + 1\n"
+        "ENDWHILE\n", iterations, condition));
+    run("while, condition stored", std::format(
+        "i <- 0\nTotal <- 0\nLimit <- {}\nDone <- FALSE\n"
+        "Going <- {}\n"
+        "WHILE Going DO\n"
+        "   i <- i + 1\n"
+        "   Going <- {}\n"
+        "ENDWHILE\n", iterations, condition, condition));
+}
+
+// -- Constants: a loop over named constants, as the textbooks write them
+
+static void bench_constants() {
+    constexpr int iterations = 1000000;
+    std::string source =
+        "CONSTANT Pi = 3.14159\nCONSTANT Rate = 6.50\nCONSTANT Hours = 40\nCONSTANT Bonus = 100\n"
+        "CONSTANT Debug = FALSE\nCONSTANT Level = 2\n"
+        "Total <- 0.0\n";
+    source += std::format("FOR i <- 1 TO {}\n", iterations);
+    source +=
+        "   Total <- Total + 2 * Pi * (Rate * Hours + Bonus) / 1000\n"
+        "   IF Debug AND Total > 0\n"
+        "     THEN\n"
+        "       OUTPUT Total\n"
+        "   ENDIF\n"
+        "   CASE OF Level\n"
+        "     1 : Total <- Total - 1\n"
+        "     2 : Total <- Total + 1\n"
+        "   ENDCASE\n"
+        "ENDFOR\n";
+
+    for (bool fold : { true, false }) {
+        Program p = must_compile(source, fold);
+        Interpreter interp;
+        std::istringstream in;
+        std::ostringstream out;
+        Engine engine(p.ast_, interp, in, out);
+        bench(std::format("constants, {} ({} nodes)", fold ? "folded" : "not folded", reachable_exprs(p.ast_)),
+            5, [&](size_t) { engine.run(); }, iterations);
+    }
+}
+
+// -- Strings: building a string up in a loop. The time per append should not
+// grow with the length of the string.
+
+static void bench_strings() {
+    for (int iterations : { 1000, 10000, 100000 }) {
+        Program p = must_compile(std::format(
+            "s <- \"\"\n"
+            "FOR i <- 1 TO {}\n"
+            "   s <- s & \"ab\"\n"
+            "ENDFOR\n", iterations));
+        Interpreter interp;
+        std::istringstream in;
+        std::ostringstream out;
+        Engine engine(p.ast_, interp, in, out);
+        bench(std::format("string append, {} times", iterations), 5, [&](size_t) { engine.run(); }, iterations);
+    }
+}
+
+// -- OUTPUT of numbers, as a table of results would be printed
+
+static void bench_output() {
+    constexpr int iterations = 100000;
+    Program p = must_compile(std::format(
+        "Total <- 0.0\n"
+        "FOR i <- 1 TO {}\n"
+        "   Total <- Total + i / 7\n"
+        "   OUTPUT i, \" \", Total, \" \", i * 0.25\n"
+        "ENDFOR\n", iterations));
+    Interpreter interp;
+    std::istringstream in;
+    std::ostringstream out;
+    Engine engine(p.ast_, interp, in, out);
+    bench("output numbers", 5, [&](size_t) {
+        out.str("");
+        engine.run();
+    }, iterations);
+}
+
+// -- BYVALUE arrays: a procedure given a large array BYVALUE. Reading it
+// should cost the same whatever its size; only writing to it copies.
+
+static void bench_byvalue() {
+    for (bool write : { false, true }) {
+        for (int size : { 100, 100000 }) {
+            // Enough calls that declaring Big once per run does not count
+            int calls = write ? 100 : 100000;
+            Program p = must_compile(std::format(
+                "DECLARE Big : ARRAY[1:{}] OF INTEGER\n"
+                "PROCEDURE Use(A : ARRAY[1:{}] OF INTEGER)\n"
+                "   {}\n"
+                "ENDPROCEDURE\n"
+                "FOR i <- 1 TO {}\n"
+                "   CALL Use(Big)\n"
+                "ENDFOR\n", size, size, write ? "A[1] <- 1" : "n <- A[1]", calls));
+            Interpreter interp;
+            std::istringstream in;
+            std::ostringstream out;
+            Engine engine(p.ast_, interp, in, out);
+            bench(std::format("BYVALUE {} of {} elements", write ? "write" : "read", size), 3,
+                [&](size_t) { engine.run(); }, calls);
+        }
+    }
+}
+
+// -- Random numbers: dice rolls from a program, and the generator on its own
+// next to the standard library's
+
+static void bench_random() {
+    constexpr int iterations = 1000000;
+    Program p = must_compile(std::format(
+        "Total <- 0\n"
+        "FOR i <- 1 TO {}\n"
+        "   Total <- Total + RANDOMBETWEEN(1, 6)\n"
+        "ENDFOR\n", iterations));
+    Interpreter interp;
+    std::istringstream in;
+    std::ostringstream out;
+    Engine engine(p.ast_, interp, in, out);
+    bench("randombetween loop", 5, [&](size_t) { engine.run(); }, iterations);
+
+    uint64_t sink = 0;
+    Rng rng(1);
+    bench("xoshiro256** below(6)", iterations, [&](size_t) { sink += rng.below(6); });
+    std::mt19937_64 mt(1);
+    std::uniform_int_distribution<uint64_t> die(0, 5);
+    bench("mt19937_64 uniform_int_distribution(0, 5)", iterations, [&](size_t) { sink += die(mt); });
+    if (sink == 0) std::println("(unexpected: all zero)");
+}
+
+// -- ASCII kernels, per KB of text, for each implementation this CPU has.
+// Plain equality, which is memcmp, is there to compare with.
+
+static void bench_ascii() {
+    for (size_t size : { size_t{ 1 } << 10, size_t{ 1 } << 16, size_t{ 1 } << 20 }) {
+        std::string text;
+        for (size_t i = 0; text.size() < size; ++i) text += "Mixed Case Text, 123; ";
+        text.resize(size);
+        std::string copy = text;
+        std::string other = text;
+        ascii_upper(other.data(), other.size());
+        size_t iterations = (size_t{ 64 } << 20) / size;
+        size_t kbs = size >> 10;
+        size_t sink = 0;
+
+        for (const AsciiKernels *k : ascii_supported_kernels()) {
+            bench(std::format("lower {} KB, {}", kbs, k->name_), iterations, [&](size_t) {
+                k->lower_(copy.data(), copy.size());
+                copy[0] = 'A';
+            }, kbs);
+            bench(std::format("upper {} KB, {}", kbs, k->name_), iterations, [&](size_t) {
+                k->upper_(copy.data(), copy.size());
+                copy[0] = 'a';
+            }, kbs);
+            bench(std::format("equal ignoring case {} KB, {}", kbs, k->name_), iterations, [&](size_t) {
+                sink += k->iequal_(text.data(), other.data(), size);
+            }, kbs);
+        }
+        copy = text;
+        bench(std::format("equal {} KB, memcmp", kbs), iterations, [&](size_t) {
+            sink += std::string_view(text) == std::string_view(copy);
+        }, kbs);
+        if (sink == 0) std::println("(unexpected: nothing equal)");
+    }
+}
+
+int main() {
+    bench_case();
+    bench_for();
+    bench_while();
+    bench_constants();
+    bench_strings();
+    bench_output();
+    bench_byvalue();
+    bench_random();
+    bench_ascii();
+    return 0;
+}
@@ -0,0 +1,108 @@
+#include "cases.hpp"
+
+// Jump tables may be up to this many entries, and no sparser than
+// jump_density entries per label
+static constexpr int64_t max_jump_span = 4096;
+static constexpr int64_t jump_density = 8;
+
+static int64_t key_of(const Slot &s) {
+    if (s.type_ == AtomicDt::Char) return static_cast<unsigned char>(s.cell_.c_);
+    return s.cell_.i_;
+}
+
+static bool less(AtomicDt t, const Cell &l, const Cell &r) {
+    switch (t) {
+        case AtomicDt::Integer:
+        case AtomicDt::Date: return l.i_ < r.i_;
+        case AtomicDt::Real: return l.r_ < r.r_;
+        // As the jump table indexes them, and as STRINGs compare their bytes
+        case AtomicDt::Char: return static_cast<unsigned char>(l.c_) < static_cast<unsigned char>(r.c_);
+        case AtomicDt::String: return l.s_ < r.s_;
+        case AtomicDt::Boolean: return l.b_ < r.b_;
+    }
+    return false;
+}
+
+static bool within(AtomicDt t, const Cell &v, const Slot &lo, const Slot &hi) {
+    return !less(t, v, lo.cell_) && !less(t, hi.cell_, v);
+}
+
+static bool build_jump(Case &c) {
+    if (c.key_ != AtomicDt::Integer && c.key_ != AtomicDt::Char) return false;
+    if (c.clauses_.empty()) return false;
+
+    int64_t lo = INT64_MAX, hi = INT64_MIN;
+    for (const auto &clause : c.clauses_) {
+        lo = std::min(lo, key_of(clause.lo_));
+        hi = std::max(hi, key_of(clause.hi_));
+    }
+    int64_t span = hi - lo + 1;
+    if (span <= 0 || span > max_jump_span || span > jump_density * static_cast<int64_t>(c.clauses_.size())) {
+        return false;
+    }
+
+    auto otherwise = static_cast<uint32_t>(c.clauses_.size());
+    c.base_ = lo;
+    c.jump_.assign(static_cast<size_t>(span), otherwise);
+    // Last clause first, so that earlier clauses overwrite later ones
+    for (auto i = otherwise; i-- > 0;) {
+        for (int64_t k = key_of(c.clauses_[i].lo_); k <= key_of(c.clauses_[i].hi_); ++k) {
+            c.jump_[static_cast<size_t>(k - lo)] = i;
+        }
+    }
+    return true;
+}
+
+static bool build_search(Case &c) {
+    if (c.key_ == AtomicDt::Boolean) return false;
+
+    std::vector<CaseRange> ranges;
+    for (uint32_t i = 0; i < c.clauses_.size(); ++i) {
+        const auto &clause = c.clauses_[i];
+        // An empty range never matches
+        if (less(c.key_, clause.hi_.cell_, clause.lo_.cell_)) continue;
+        ranges.push_back(CaseRange{ clause.lo_, clause.hi_, i });
+    }
+    std::stable_sort(ranges.begin(), ranges.end(), [&](const CaseRange &a, const CaseRange &b) {
+        return less(c.key_, a.lo_.cell_, b.lo_.cell_);
+    });
+    for (size_t i = 1; i < ranges.size(); ++i) {
+        if (!less(c.key_, ranges[i - 1].hi_.cell_, ranges[i].lo_.cell_)) return false;
+    }
+
+    c.ranges_ = std::move(ranges);
+    return true;
+}
+
+void build_dispatch(Case &c) {
+    c.jump_.clear();
+    c.ranges_.clear();
+    if (build_jump(c)) c.dispatch_ = CaseDispatch::Jump;
+    else if (build_search(c)) c.dispatch_ = CaseDispatch::Search;
+    else c.dispatch_ = CaseDispatch::Linear;
+}
+
+uint32_t select_clause(const Case &c, const Slot &v) {
+    auto otherwise = static_cast<uint32_t>(c.clauses_.size());
+    switch (c.dispatch_) {
+        case CaseDispatch::Jump: {
+            // Unsigned, so that keys below base_ are out of range as well
+            auto at = static_cast<uint64_t>(key_of(v) - c.base_);
+            return at < c.jump_.size() ? c.jump_[at] : otherwise;
+        }
+        case CaseDispatch::Search: {
+            // First range whose upper bound is not below v
+            auto it = std::partition_point(c.ranges_.begin(), c.ranges_.end(), [&](const CaseRange &r) {
+                return less(c.key_, r.hi_.cell_, v.cell_);
+            });
+            if (it != c.ranges_.end() && !less(c.key_, v.cell_, it->lo_.cell_)) return it->clause_;
+            return otherwise;
+        }
+        case CaseDispatch::Linear:
+            for (uint32_t i = 0; i < otherwise; ++i) {
+                if (within(c.key_, v.cell_, c.clauses_[i].lo_, c.clauses_[i].hi_)) return i;
+            }
+            return otherwise;
+    }
+    return otherwise;
+}
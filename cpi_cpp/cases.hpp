@@ -0,0 +1,17 @@
+#pragma once
+
+#include "ast.hpp"
+
+// CASE dispatch. Clauses match in program order, so where labels overlap the
+// earliest clause wins whichever dispatch is used.
+//
+// INTEGER and CHAR labels that are dense enough become a jump table. Other
+// labels are sorted into disjoint ranges and binary searched. Only labels
+// that overlap, or are BOOLEAN, are left to be tested one by one.
+
+// Chooses the dispatch for a CASE whose labels all have type c.key_.
+void build_dispatch(Case &c);
+
+// Index of the clause that `v` selects, or c.clauses_.size() for OTHERWISE.
+// `v` must have type c.key_.
+uint32_t select_clause(const Case &c, const Slot &v);
@@ -0,0 +1,673 @@
+#include "check.hpp"
+#include "kernels.hpp"
+#include "cases.hpp"
+
+struct TypeError : std::invalid_argument {
+    using std::invalid_argument::invalid_argument;
+};
+
+static bool is_numeric(AtomicDt t) {
+    return t == AtomicDt::Integer || t == AtomicDt::Real;
+}
+
+struct Place {
+    Scope scope_;
+    uint32_t index_;
+};
+
+struct Checker {
+    Ast &ast_;
+    std::vector<std::string> errors_{};
+    std::unordered_map<std::string, uint32_t> names_{}; // Globals
+    std::unordered_map<std::string, uint32_t> records_{};
+    std::unordered_map<std::string, uint32_t> procs_{};
+    // While checking the body of a procedure: which, and its variables
+    std::optional<uint32_t> proc_{};
+    std::unordered_map<std::string, uint32_t> locals_{};
+
+    // A procedure's own variables hide the globals
+    std::optional<Place> find(const std::string &name) const {
+        if (proc_) {
+            if (auto search = locals_.find(name); search != locals_.end()) {
+                bool byref = ast_.procs_[*proc_].slots_[search->second].byref_;
+                return Place{ byref ? Scope::Ref : Scope::Local, search->second };
+            }
+        }
+        if (auto search = names_.find(name); search != names_.end()) return Place{ Scope::Global, search->second };
+        return std::nullopt;
+    }
+
+    // Not to be held across declare()
+    SlotInfo &info(Place p) {
+        return p.scope_ == Scope::Global ? ast_.slots_[p.index_] : ast_.procs_[*proc_].slots_[p.index_];
+    }
+
+    Place declare(const std::string &name, std::optional<AtomicDt> type, bool constant,
+        std::optional<uint32_t> layout = std::nullopt, bool byref = false) {
+        auto &names = proc_ ? locals_ : names_;
+        auto &slots = proc_ ? ast_.procs_[*proc_].slots_ : ast_.slots_;
+        if (names.contains(name)) throw TypeError(std::format("{} is already declared", name));
+        slots.push_back(SlotInfo{ name, type, constant, layout, byref });
+        auto slot = static_cast<uint32_t>(slots.size() - 1);
+        names.emplace(name, slot);
+        return Place{ proc_ ? (byref ? Scope::Ref : Scope::Local) : Scope::Global, slot };
+    }
+
+    // -- ARRAYs and records
+
+    std::string type_name(const Layout &l) const {
+        std::string element = l.element_ ? std::string(atomic_dt_name(*l.element_)) : ast_.records_[l.record_].name_;
+        if (l.dims_.empty() && l.bounded_) return std::format("a record of TYPE {}", element);
+        return std::format("an ARRAY OF {}", element);
+    }
+
+    // Resolves the record a Layout names, which gives the size of its elements
+    void resolve(uint32_t layout) {
+        Layout &l = ast_.layouts_[layout];
+        if (l.element_) return;
+        auto search = records_.find(l.record_name_);
+        if (search == records_.end()) throw TypeError(std::format("Unsupported type {}", l.record_name_));
+        l.record_ = search->second;
+        l.stride_ = static_cast<uint32_t>(ast_.records_[l.record_].fields_.size());
+    }
+
+    // Whether a value of Layout `have` can go where one of `want` is
+    // expected. Bounds are compared when both are known here; an ARRAY OF
+    // parameter only learns its bounds at run time.
+    bool compatible(uint32_t want, uint32_t have) const {
+        const Layout &w = ast_.layouts_[want];
+        const Layout &h = ast_.layouts_[have];
+        auto array = [](const Layout &l) { return !l.dims_.empty() || !l.bounded_; };
+        if (w.element_ != h.element_ || (!w.element_ && w.record_ != h.record_) || array(w) != array(h)) return false;
+        if (!w.bounded_ || !h.bounded_) return true;
+        return std::ranges::equal(w.dims_, h.dims_, [](Dim a, Dim b) { return a.lo_ == b.lo_ && a.hi_ == b.hi_; });
+    }
+
+    // TYPE <name> and its DECLAREs
+    void record(NodeId id) {
+        const Stmt &t = ast_.stmt(id);
+        if (records_.contains(t.name_)) throw TypeError(std::format("TYPE {} is already declared", t.name_));
+        Record r{ t.name_, {} };
+        auto add = [&](std::string name, AtomicDt type) {
+            for (const auto &f : r.fields_) {
+                if (f.first == name) throw TypeError(std::format("{} is already a field of {}", name, t.name_));
+            }
+            r.fields_.emplace_back(std::move(name), type);
+        };
+        for (NodeId f : t.body_) {
+            const Stmt &d = ast_.stmt(f);
+            if (d.type_) {
+                add(d.name_, *d.type_);
+                continue;
+            }
+            const Layout &l = ast_.layouts_[d.index_];
+            if (!l.dims_.empty()) throw TypeError(std::format("Field {} of {}: ARRAY fields are not supported", d.name_, t.name_));
+            auto inner = records_.find(l.record_name_);
+            if (inner == records_.end()) throw TypeError(std::format("Unsupported type {}", l.record_name_));
+            for (const auto &[name, type] : ast_.records_[inner->second].fields_) {
+                add(d.name_ + "." + name, type);
+            }
+        }
+        if (r.fields_.empty()) throw TypeError(std::format("TYPE {} has no fields", t.name_));
+        records_.emplace(t.name_, static_cast<uint32_t>(ast_.records_.size()));
+        ast_.records_.push_back(std::move(r));
+    }
+
+    // PROCEDURE <name>(<parameters>), before any CALL is checked
+    void signature(NodeId id) {
+        const Stmt &s = ast_.stmt(id);
+        if (procs_.contains(s.name_)) throw TypeError(std::format("PROCEDURE {} is already declared", s.name_));
+        procs_.emplace(s.name_, s.index_);
+        for (const auto &p : ast_.procs_[s.index_].params_) {
+            if (!p.type_) resolve(p.layout_);
+        }
+    }
+
+    // TYPEs and PROCEDUREs can be used before the line that declares them
+    void declarations(const std::vector<NodeId> &top) {
+        for (NodeId id : top) {
+            try {
+                if (ast_.stmt(id).kind_ == StmtKind::Type) record(id);
+                else if (ast_.stmt(id).kind_ == StmtKind::Procedure) signature(id);
+            } catch (std::invalid_argument &e) {
+                errors_.push_back(std::format("Line {}: {}", ast_.stmt(id).line_, e.what()));
+            }
+        }
+    }
+
+    // The bodies of the procedures, once every global is known
+    void procedures(const std::vector<NodeId> &top) {
+        for (NodeId id : top) {
+            if (ast_.stmt(id).kind_ != StmtKind::Procedure) continue;
+            uint32_t index = ast_.stmt(id).index_;
+            proc_ = index;
+            locals_.clear();
+            try {
+                for (size_t i = 0; i < ast_.procs_[index].params_.size(); ++i) {
+                    ProcParam p = ast_.procs_[index].params_[i];
+                    declare(p.name_, p.type_, false, p.type_ ? std::nullopt : std::optional(p.layout_), p.byref_);
+                }
+                block(ast_.stmt(id).body_);
+            } catch (std::invalid_argument &e) {
+                errors_.push_back(std::format("Line {}: {}", ast_.stmt(id).line_, e.what()));
+            }
+            proc_.reset();
+            locals_.clear();
+        }
+    }
+
+    // <array>[<index>, ...].<field>, or <record>.<field>
+    void element(NodeId id) {
+        std::string name = ast_.expr(id).name_;
+        auto place = find(name);
+        if (!place) throw TypeError(std::format("{} is used before it is declared", name));
+        auto layout = info(*place).layout_;
+        if (!layout) throw TypeError(std::format("{} is neither an ARRAY nor a record", name));
+
+        Layout l = ast_.layouts_[*layout];
+        size_t indices = ast_.expr(id).args_.size();
+        if (l.bounded_ && indices != l.dims_.size()) {
+            throw TypeError(l.dims_.empty()
+                ? std::format("{} is a record, not an ARRAY", name)
+                : std::format("{} has {} dimensions, not {}", name, l.dims_.size(), indices));
+        }
+        if (!l.bounded_ && indices == 0) throw TypeError(std::format("{} is an ARRAY; index it", name));
+        for (size_t i = 0; i < indices; ++i) {
+            expr(ast_.expr(id).args_[i]);
+            NodeId a = coerce(ast_.expr(id).args_[i], AtomicDt::Integer, "Array index");
+            ast_.expr(id).args_[i] = a;
+        }
+
+        std::string path = ast_.expr(id).path_;
+        AtomicDt type;
+        uint32_t field = 0;
+        if (l.element_) {
+            if (!path.empty()) throw TypeError(std::format("{} has no fields", name));
+            type = *l.element_;
+        } else {
+            const auto &fields = ast_.records_[l.record_].fields_;
+            if (path.empty()) throw TypeError(std::format("{} is of TYPE {}; use one of its fields", name, ast_.records_[l.record_].name_));
+            auto f = std::ranges::find(fields, path, [](const auto &f) { return f.first; });
+            if (f == fields.end()) throw TypeError(std::format("{} has no field {}", ast_.records_[l.record_].name_, path));
+            field = static_cast<uint32_t>(f - fields.begin());
+            type = f->second;
+        }
+
+        Expr &e = ast_.expr(id);
+        e.index_ = place->index_;
+        e.scope_ = place->scope_;
+        e.field_ = field;
+        set(id, type, nullptr);
+    }
+
+    // A whole ARRAY or record variable, where one is passed or copied.
+    // Returns its Layout.
+    uint32_t aggregate(NodeId id, std::string_view what) {
+        const Expr &e = ast_.expr(id);
+        auto place = e.kind_ == ExprKind::Variable ? find(e.name_) : std::nullopt;
+        if (!place || !info(*place).layout_) throw TypeError(std::format("{} must be an ARRAY or record variable", what));
+        ast_.expr(id).index_ = place->index_;
+        ast_.expr(id).scope_ = place->scope_;
+        return *info(*place).layout_;
+    }
+
+    // <variable> <- <variable>, of an ARRAY or record
+    void copy(NodeId id) {
+        std::string name = ast_.stmt(id).name_;
+        uint32_t from = aggregate(ast_.stmt(id).exprs_[0], std::format("A value assigned to {}", name));
+        if (!find(name)) declare(name, std::nullopt, false, from);
+        Place to = assignable(name);
+        auto layout = info(to).layout_;
+        if (!layout || !compatible(*layout, from)) {
+            throw TypeError(std::format("Cannot assign {}, {}, to {}", ast_.expr(ast_.stmt(id).exprs_[0]).name_, type_name(ast_.layouts_[from]), name));
+        }
+        Stmt &s = ast_.stmt(id);
+        s.kind_ = StmtKind::Copy;
+        s.slot_ = to.index_;
+        s.scope_ = to.scope_;
+    }
+
+    // CALL <procedure>(<arguments>)
+    void call_procedure(NodeId id) {
+        std::string name = ast_.stmt(id).name_;
+        auto search = procs_.find(name);
+        if (search == procs_.end()) throw TypeError(std::format("Unknown procedure {}", name));
+        ast_.stmt(id).index_ = search->second;
+        std::vector<ProcParam> params = ast_.procs_[search->second].params_;
+        if (ast_.stmt(id).exprs_.size() != params.size()) {
+            throw TypeError(std::format("{} takes {} arguments", name, params.size()));
+        }
+
+        for (size_t i = 0; i < params.size(); ++i) {
+            NodeId a = ast_.stmt(id).exprs_[i];
+            const ProcParam &p = params[i];
+            std::string what = std::format("Argument {} of {}", p.name_, name);
+            if (!p.type_) {
+                uint32_t have = aggregate(a, what);
+                if (!compatible(p.layout_, have)) {
+                    throw TypeError(std::format("{} must be {}, not {}", what, type_name(ast_.layouts_[p.layout_]), type_name(ast_.layouts_[have])));
+                }
+            } else if (p.byref_) {
+                // The variable itself, so of the very type
+                auto place = ast_.expr(a).kind_ == ExprKind::Variable ? find(ast_.expr(a).name_) : std::nullopt;
+                if (!place || info(*place).layout_ || info(*place).type_ != p.type_) {
+                    throw TypeError(std::format("{} is BYREF, so must be a variable of type {}", what, atomic_dt_name(*p.type_)));
+                }
+                if (info(*place).constant_) throw TypeError(std::format("{} is BYREF, so cannot be CONSTANT {}", what, ast_.expr(a).name_));
+                expr(a);
+            } else {
+                expr(a);
+                NodeId v = coerce(a, *p.type_, what);
+                ast_.stmt(id).exprs_[i] = v;
+            }
+        }
+    }
+
+    // Wraps `operand` in a conversion or a run-time type check
+    NodeId wrap(NodeId operand, Op op, AtomicDt result) {
+        Expr e{ ExprKind::Unary };
+        e.op_ = op;
+        e.line_ = ast_.expr(operand).line_;
+        e.lhs_ = operand;
+        e.type_ = result;
+        if (op != Op::Expect) e.kernel_ = unary_kernel(op, *ast_.expr(operand).type_);
+        return ast_.add(std::move(e));
+    }
+
+    // Returns `id`, or a node that converts it, such that the result has type `want`
+    NodeId coerce(NodeId id, AtomicDt want, std::string_view what) {
+        auto have = ast_.expr(id).type_;
+        if (have == want) return id;
+        if (!have) return wrap(id, Op::Expect, want);
+        if (*have == AtomicDt::Integer && want == AtomicDt::Real) return wrap(id, Op::ToReal, want);
+        if (*have == AtomicDt::Char && want == AtomicDt::String) return wrap(id, Op::ToString, want);
+        throw TypeError(std::format("{} expects {} but got {}", what, atomic_dt_name(want), atomic_dt_name(*have)));
+    }
+
+    // A variable read with INPUT and not declared is typed from the text at
+    // run time, so "123" becomes an INTEGER. Compared with a STRING, CHAR,
+    // BOOLEAN or DATE it takes that type instead, and INPUT reads the text as
+    // one; then Password = "Secret" works whatever is typed. Numbers are
+    // left alone, as INTEGER and REAL already compare at run time.
+    std::optional<AtomicDt> settle(NodeId id, AtomicDt t) {
+        if (is_numeric(t) || ast_.expr(id).kind_ != ExprKind::Variable) return std::nullopt;
+        info(Place{ ast_.expr(id).scope_, ast_.expr(id).index_ }).type_ = t;
+        set(id, t, nullptr);
+        return t;
+    }
+
+    void set(NodeId id, std::optional<AtomicDt> type, Kernel kernel) {
+        ast_.expr(id).type_ = type;
+        ast_.expr(id).kernel_ = kernel;
+    }
+
+    std::optional<AtomicDt> expr(NodeId id) {
+        // Careful: ast_.add() may move the pool, so no references are held
+        // across calls that can insert nodes.
+        switch (ast_.expr(id).kind_) {
+            case ExprKind::Literal:
+                set(id, ast_.consts_[ast_.expr(id).index_].type_, nullptr);
+                break;
+            case ExprKind::Variable: {
+                auto place = find(ast_.expr(id).name_);
+                if (!place) throw TypeError(std::format("{} is used before it is declared or assigned", ast_.expr(id).name_));
+                if (auto layout = info(*place).layout_) {
+                    throw TypeError(std::format("{} is {}; use one of its {}", ast_.expr(id).name_, type_name(ast_.layouts_[*layout]),
+                        ast_.layouts_[*layout].element_ ? "elements" : "fields"));
+                }
+                ast_.expr(id).index_ = place->index_;
+                ast_.expr(id).scope_ = place->scope_;
+                set(id, info(*place).type_, nullptr);
+                break;
+            }
+            case ExprKind::Element:
+                element(id);
+                break;
+            case ExprKind::Unary:
+                unary(id);
+                break;
+            case ExprKind::Binary:
+                binary(id);
+                break;
+            case ExprKind::Call:
+                call(id);
+                break;
+        }
+        return ast_.expr(id).type_;
+    }
+
+    void unary(NodeId id) {
+        Op op = ast_.expr(id).op_;
+        auto t = expr(ast_.expr(id).lhs_);
+
+        if (op == Op::Not) {
+            NodeId operand = coerce(ast_.expr(id).lhs_, AtomicDt::Boolean, "NOT");
+            ast_.expr(id).lhs_ = operand;
+            set(id, AtomicDt::Boolean, unary_kernel(op, AtomicDt::Boolean));
+        } else if (!t) {
+            set(id, std::nullopt, nullptr);
+        } else if (auto k = unary_kernel(op, *t)) {
+            set(id, t, k);
+        } else {
+            throw TypeError(std::format("Cannot apply {} to {}", op_name(op), atomic_dt_name(*t)));
+        }
+    }
+
+    void binary(NodeId id) {
+        Op op = ast_.expr(id).op_;
+        auto lt = expr(ast_.expr(id).lhs_);
+        auto rt = expr(ast_.expr(id).rhs_);
+
+        auto both = [&](AtomicDt want) {
+            NodeId l = coerce(ast_.expr(id).lhs_, want, op_name(op));
+            NodeId r = coerce(ast_.expr(id).rhs_, want, op_name(op));
+            ast_.expr(id).lhs_ = l;
+            ast_.expr(id).rhs_ = r;
+        };
+        auto mismatch = [&]() {
+            return TypeError(std::format("Cannot apply {} to {} and {}", op_name(op),
+                lt ? atomic_dt_name(*lt) : "a run-time value", rt ? atomic_dt_name(*rt) : "a run-time value"));
+        };
+
+        switch (op) {
+            case Op::And:
+            case Op::Or:
+                both(AtomicDt::Boolean);
+                set(id, AtomicDt::Boolean, binary_kernel(op, AtomicDt::Boolean));
+                return;
+            case Op::Mod:
+            case Op::IntDiv:
+                both(AtomicDt::Integer);
+                set(id, AtomicDt::Integer, binary_kernel(op, AtomicDt::Integer));
+                return;
+            case Op::Concat:
+                both(AtomicDt::String);
+                set(id, AtomicDt::String, binary_kernel(op, AtomicDt::String));
+                return;
+            default:
+                break;
+        }
+
+        bool arithmetic = op == Op::Add || op == Op::Sub || op == Op::Mul || op == Op::Div;
+        if (!arithmetic && !lt && rt) lt = settle(ast_.expr(id).lhs_, *rt);
+        if (!arithmetic && lt && !rt) rt = settle(ast_.expr(id).rhs_, *lt);
+        if (arithmetic && ((lt && !is_numeric(*lt)) || (rt && !is_numeric(*rt)))) throw mismatch();
+
+        if (!lt || !rt) {
+            // Settled at run time. The result type is still known for
+            // division and comparisons.
+            std::optional<AtomicDt> result;
+            if (op == Op::Div) result = AtomicDt::Real;
+            else if (!arithmetic) result = AtomicDt::Boolean;
+            set(id, result, nullptr);
+            return;
+        }
+
+        AtomicDt operands = *lt;
+        if (is_numeric(*lt) && is_numeric(*rt) && (*lt != *rt || op == Op::Div)) {
+            operands = AtomicDt::Real;
+        } else if (*lt != *rt) {
+            throw mismatch();
+        }
+        both(operands);
+
+        Kernel k = binary_kernel(op, operands);
+        if (!k) throw mismatch();
+        set(id, arithmetic ? operands : AtomicDt::Boolean, k);
+        ast_.expr(id).predicate_ = compare_predicate(op, operands);
+    }
+
+    void call(NodeId id) {
+        auto builtin = static_cast<Builtin>(ast_.expr(id).index_);
+        std::string name = ast_.expr(id).name_;
+
+        auto args = [&](std::initializer_list<AtomicDt> want) {
+            if (ast_.expr(id).args_.size() != want.size()) {
+                throw TypeError(std::format("{} takes {} arguments", name, want.size()));
+            }
+            size_t i = 0;
+            for (auto t : want) {
+                expr(ast_.expr(id).args_[i]);
+                NodeId a = coerce(ast_.expr(id).args_[i], t, name);
+                ast_.expr(id).args_[i] = a;
+                ++i;
+            }
+        };
+
+        switch (builtin) {
+            case Builtin::Length:
+                args({ AtomicDt::String });
+                set(id, AtomicDt::Integer, nullptr);
+                break;
+            case Builtin::Left:
+            case Builtin::Right:
+                args({ AtomicDt::String, AtomicDt::Integer });
+                set(id, AtomicDt::String, nullptr);
+                break;
+            case Builtin::Mid:
+                args({ AtomicDt::String, AtomicDt::Integer, AtomicDt::Integer });
+                set(id, AtomicDt::String, nullptr);
+                break;
+            case Builtin::Ucase:
+            case Builtin::Lcase: {
+                // CHAR in the guide; STRING accepted as well
+                if (ast_.expr(id).args_.size() != 1) throw TypeError(std::format("{} takes 1 argument", name));
+                auto t = expr(ast_.expr(id).args_[0]);
+                AtomicDt want = t == AtomicDt::Char ? AtomicDt::Char : AtomicDt::String;
+                args({ want });
+                set(id, want, nullptr);
+                break;
+            }
+            case Builtin::Eof:
+                set(id, AtomicDt::Boolean, nullptr);
+                break;
+            case Builtin::Randombetween:
+                args({ AtomicDt::Integer, AtomicDt::Integer });
+                set(id, AtomicDt::Integer, nullptr);
+                break;
+            case Builtin::Rnd:
+                args({});
+                set(id, AtomicDt::Real, nullptr);
+                break;
+        }
+    }
+
+    Place assignable(const std::string &name) {
+        auto place = find(name);
+        if (info(*place).constant_) throw TypeError(std::format("Cannot assign to CONSTANT {}", name));
+        return *place;
+    }
+
+    // A variable of an atomic type, to store a value in
+    Place scalar(const std::string &name) {
+        Place p = assignable(name);
+        if (auto layout = info(p).layout_) throw TypeError(std::format("{} is {}, not a single value", name, type_name(ast_.layouts_[*layout])));
+        return p;
+    }
+
+    void stmt(NodeId id) {
+        Stmt &s = ast_.stmt(id);
+        // Where the statement's variable is
+        auto at = [&](Place p) {
+            ast_.stmt(id).slot_ = p.index_;
+            ast_.stmt(id).scope_ = p.scope_;
+        };
+        switch (s.kind_) {
+            case StmtKind::Declare:
+                if (s.type_) {
+                    at(declare(s.name_, s.type_, false));
+                } else {
+                    resolve(s.index_);
+                    at(declare(s.name_, std::nullopt, false, s.index_));
+                }
+                break;
+            case StmtKind::Constant:
+                at(declare(s.name_, expr(s.exprs_[0]), true));
+                break;
+            case StmtKind::Assign: {
+                if (s.exprs_.size() > 1) {
+                    // To an element or field, whose type is fixed
+                    AtomicDt want = *expr(s.exprs_[1]);
+                    expr(ast_.stmt(id).exprs_[0]);
+                    NodeId v = coerce(ast_.stmt(id).exprs_[0], want, std::format("Assignment to {}", ast_.stmt(id).name_));
+                    ast_.stmt(id).exprs_[0] = v;
+                    break;
+                }
+                const Expr &value = ast_.expr(s.exprs_[0]);
+                auto from = value.kind_ == ExprKind::Variable ? find(value.name_) : std::nullopt;
+                auto to = find(s.name_);
+                if ((from && info(*from).layout_) || (to && info(*to).layout_)) {
+                    copy(id);
+                    break;
+                }
+                auto t = expr(s.exprs_[0]);
+                if (!find(s.name_)) declare(s.name_, t, false);
+                Place p = scalar(s.name_);
+                at(p);
+                if (auto want = info(p).type_) {
+                    NodeId v = coerce(ast_.stmt(id).exprs_[0], *want, std::format("Assignment to {}", ast_.stmt(id).name_));
+                    ast_.stmt(id).exprs_[0] = v;
+                }
+                break;
+            }
+            case StmtKind::Input:
+                if (!find(s.name_)) declare(s.name_, std::nullopt, false);
+                at(scalar(ast_.stmt(id).name_));
+                break;
+            case StmtKind::ReadFile: {
+                // Lines of a text file are strings
+                std::string name = ast_.expr(s.exprs_[0]).name_;
+                if (!find(name)) declare(name, AtomicDt::String, false);
+                at(scalar(name));
+                expr(ast_.stmt(id).exprs_[0]);
+                break;
+            }
+            case StmtKind::Call:
+                call_procedure(id);
+                break;
+            case StmtKind::Procedure:
+            case StmtKind::Type:
+            case StmtKind::Copy:
+                break;
+            case StmtKind::Output:
+            case StmtKind::WriteFile:
+                for (size_t i = 0; i < s.exprs_.size(); ++i) {
+                    expr(ast_.stmt(id).exprs_[i]);
+                }
+                break;
+            case StmtKind::OpenFile:
+            case StmtKind::CloseFile:
+                break;
+            case StmtKind::Case:
+                case_of(id);
+                break;
+            case StmtKind::For:
+                for_loop(id);
+                break;
+            case StmtKind::If:
+            case StmtKind::While:
+            case StmtKind::Repeat: {
+                // REPEAT runs its body before the condition, which may use
+                // variables first assigned in the body
+                if (s.kind_ == StmtKind::Repeat) block(s.body_);
+                expr(ast_.stmt(id).exprs_[0]);
+                NodeId condition = coerce(ast_.stmt(id).exprs_[0], AtomicDt::Boolean, "Condition");
+                ast_.stmt(id).exprs_[0] = condition;
+                if (ast_.stmt(id).kind_ != StmtKind::Repeat) block(ast_.stmt(id).body_);
+                block(ast_.stmt(id).else_);
+                break;
+            }
+        }
+    }
+
+    void for_loop(NodeId id) {
+        bool integers = true;
+        for (NodeId e : ast_.stmt(id).exprs_) {
+            auto t = expr(e);
+            if (t && *t != AtomicDt::Integer) integers = false;
+        }
+
+        std::string name = ast_.stmt(id).name_;
+        if (!find(name)) declare(name, integers ? AtomicDt::Integer : AtomicDt::Real, false);
+        Place place = assignable(name);
+        auto t = info(place).type_;
+        if (t != AtomicDt::Integer && t != AtomicDt::Real) {
+            throw TypeError(std::format("FOR control variable {} must be INTEGER or REAL", name));
+        }
+
+        Stmt &s = ast_.stmt(id);
+        s.slot_ = place.index_;
+        s.scope_ = place.scope_;
+        s.type_ = t;
+        for (auto &e : s.exprs_) {
+            e = coerce(e, *t, "FOR");
+        }
+        block(ast_.stmt(id).body_);
+    }
+
+    // Converts a CASE label the way coerce() converts an expression
+    static void convert_label(Slot &label, AtomicDt want) {
+        if (label.type_ == want) return;
+        if (label.type_ == AtomicDt::Integer && want == AtomicDt::Real) {
+            label.cell_.r_ = static_cast<double>(label.cell_.i_);
+        } else if (label.type_ == AtomicDt::Char && want == AtomicDt::String) {
+            label.cell_.s_.assign(1, label.cell_.c_);
+        } else {
+            throw TypeError(std::format("CASE label is {}, expected {}", atomic_dt_name(label.type_), atomic_dt_name(want)));
+        }
+        label.type_ = want;
+    }
+
+    void case_of(NodeId id) {
+        uint32_t index = ast_.stmt(id).index_;
+        auto t = expr(ast_.stmt(id).exprs_[0]);
+
+        // A value only typed at run time takes the type of the labels
+        if (!t) {
+            for (const auto &clause : ast_.cases_[index].clauses_) {
+                for (auto l : { clause.lo_.type_, clause.hi_.type_ }) {
+                    if (!t || (*t == AtomicDt::Integer && l == AtomicDt::Real) || (*t == AtomicDt::Char && l == AtomicDt::String)) t = l;
+                }
+            }
+            if (t && !settle(ast_.stmt(id).exprs_[0], *t)) {
+                NodeId v = wrap(ast_.stmt(id).exprs_[0], Op::Expect, *t);
+                ast_.stmt(id).exprs_[0] = v;
+            }
+        }
+
+        Case &c = ast_.cases_[index];
+        c.key_ = t.value_or(AtomicDt::Integer);
+        for (auto &clause : c.clauses_) {
+            try {
+                convert_label(clause.lo_, c.key_);
+                convert_label(clause.hi_, c.key_);
+            } catch (std::invalid_argument &e) {
+                errors_.push_back(std::format("Line {}: {}", clause.line_, e.what()));
+            }
+        }
+        build_dispatch(c);
+
+        for (size_t i = 0; i < c.clauses_.size(); ++i) {
+            block(ast_.cases_[index].clauses_[i].body_);
+        }
+        block(ast_.cases_[index].otherwise_);
+    }
+
+    void block(const std::vector<NodeId> &stmts) {
+        for (NodeId id : stmts) {
+            try {
+                stmt(id);
+            } catch (std::invalid_argument &e) {
+                errors_.push_back(std::format("Line {}: {}", ast_.stmt(id).line_, e.what()));
+            }
+        }
+    }
+};
+
+std::vector<std::string> check(Ast &ast) {
+    Checker c{ ast };
+    c.declarations(ast.top_);
+    c.block(ast.top_);
+    c.procedures(ast.top_);
+    return c.errors_;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include "ast.hpp"
+
+// Type checking pass. Resolves every variable to a slot, annotates every
+// expression with its AtomicDt and picks a typed kernel for it, inserting
+// INTEGER -> REAL and CHAR -> STRING conversions where the language allows
+// them. Variables that are not declared take the type of whatever is first
+// assigned to them; only values read with INPUT into an undeclared variable
+// are left to be typed at run time, unless they are compared with something
+// that is not a number, whose type they then take.
+//
+// ARRAYs and TYPE records are laid out once and checked element by element;
+// assigning one whole to another becomes a Copy. PROCEDUREs are declared
+// before anything else is checked, so a CALL may come before its PROCEDURE,
+// and each has its own slots for its parameters and locals.
+//
+// Returns one message per type error. The program must not run unless it
+// is empty.
+std::vector<std::string> check(Ast &ast);
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "util.hpp"
+
+#include <memory>
+
+// Shared, copy-on-write storage for the values of an ARRAY or record.
+// Copying a Cow is O(1) and shares the T. The first write through a Cow
+// whose T is shared copies it, so every copy still behaves as a deep one,
+// made only if it is needed. A default constructed Cow holds nothing until
+// one is assigned to it.
+//
+// The count of sharers is atomic, but a T must not be written through one
+// Cow while another thread copies a Cow sharing it.
+template<typename T> struct Cow {
+    Cow() = default;
+    explicit Cow(T v) : p_{ std::make_shared<T>(std::move(v)) } {}
+
+    explicit operator bool() const { return p_ != nullptr; }
+    const T &get() const { return *p_; }
+    const T *operator->() const { return p_.get(); }
+
+    // Whether a write would copy first
+    bool shared() const { return p_.use_count() > 1; }
+
+    T &mutate() {
+        if (shared()) p_ = std::make_shared<T>(*p_);
+        return *p_;
+    }
+
+    bool shares(const Cow &o) const { return p_ == o.p_; }
+
+private:
+    std::shared_ptr<T> p_;
+};
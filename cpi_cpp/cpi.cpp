@@ -1,22 +1,66 @@
 #include "cpi.hpp"
+#include "files.hpp"
+#include "kernels.hpp"
+
+#include <charconv>
 
 Integer::Integer(std::string sv) : data_{ std::stoi(sv) } {
 }
 
+Integer::Integer(int i) : data_{ i } {
+}
+
 std::string Integer::to_string() {
     return std::to_string(data_);
 }
 
-Real::Real(std::string sv) : data_{ std::stof(sv) } {
+// Like std::stoi and std::stod, skipping leading space and taking a leading
+// +, but not depending on the locale, and not throwing, so that trying a type
+// is cheap. The number must be the whole of the rest of the text.
+template<typename T> static std::errc parse_number(std::string_view text, T &n) {
+    size_t at = 0;
+    while (at < text.size() && std::isspace(static_cast<unsigned char>(text[at]))) ++at;
+    if (at < text.size() && text[at] == '+' && (at + 1 == text.size() || text[at + 1] != '-')) ++at;
+    auto [end, ec] = std::from_chars(text.data() + at, text.data() + text.size(), n);
+    if (ec == std::errc{} && end != text.data() + text.size()) return std::errc::invalid_argument;
+    return ec;
+}
+
+template<typename T> static T number_or_throw(std::string_view text, std::string_view type) {
+    T n{};
+    std::errc ec = parse_number(text, n);
+    if (ec == std::errc::result_out_of_range) throw std::out_of_range(std::format("{} out of range", type));
+    if (ec != std::errc{}) throw std::invalid_argument(std::format("Cannot parse as {}", type));
+    return n;
+}
+
+// The shortest text that reads back as the same double. A whole number gets
+// ".0", so that it reads back as a REAL and not an INTEGER.
+static void append_real(std::string &out, double r) {
+    char buf[32];
+    char *end = std::to_chars(buf, buf + sizeof buf, r).ptr;
+    out.append(buf, end);
+    if (std::find_if(buf, end, [](char c) { return c == '.' || c == 'e' || c == 'n'; }) == end) out += ".0";
+}
+
+Real::Real(std::string sv) : data_{ number_or_throw<double>(sv, "REAL") } {
+}
+
+Real::Real(double r) : data_{ r } {
 }
 
 std::string Real::to_string() {
-    return std::to_string(data_);
+    std::string s;
+    append_real(s, data_);
+    return s;
 }
 
 Char::Char(std::string sv) : data_{ sv[0] } {
 }
 
+Char::Char(char c) : data_{ c } {
+}
+
 std::string Char::to_string() {
     std::string s = "";
     s.push_back(data_);
@@ -37,6 +81,9 @@ Boolean::Boolean(std::string sv) : data_{} {
     else throw std::invalid_argument("Cannot parse as bool");
 }
 
+Boolean::Boolean(bool b) : data_{ b } {
+}
+
 std::string Boolean::to_string() {
     return std::to_string(data_);
 }
@@ -55,6 +102,9 @@ Date::Date(std::string sv) : d_{}, m_{}, y_{} {
     y_ = std::stoi(year);
 }
 
+Date::Date(int d, int m, int y) : d_{ d }, m_{ m }, y_{ y } {
+}
+
 std::string Date::to_string() {
     return std::format("{:02d}/{:02d}/{:04d}", d_, m_, y_);
 }
@@ -79,3 +129,199 @@ Identifier::Identifier(std::string s) : as_string_{} {
 
     as_string_ = s;
 }
+
+std::string_view atomic_dt_name(AtomicDt t) {
+    switch (t) {
+        case AtomicDt::Integer: return "INTEGER";
+        case AtomicDt::Real:    return "REAL";
+        case AtomicDt::Char:    return "CHAR";
+        case AtomicDt::String:  return "STRING";
+        case AtomicDt::Boolean: return "BOOLEAN";
+        case AtomicDt::Date:    return "DATE";
+    }
+    return "?";
+}
+
+Slot default_slot(AtomicDt t) {
+    Slot s{ t, {} };
+    if (t == AtomicDt::Real) s.cell_.r_ = 0.0;
+    return s;
+}
+
+Slot to_slot(const Value &v) {
+    auto a = std::get_if<AtomicDtValue>(&v.value_);
+    if (!a) {
+        throw std::invalid_argument("Custom type values have no atomic representation");
+    }
+
+    Slot s{ a->type_, {} };
+    std::visit([&s](auto &&x) {
+        using T = std::decay_t<decltype(x)>;
+        if constexpr (std::is_same_v<T, Integer>) s.cell_.i_ = x.data_;
+        else if constexpr (std::is_same_v<T, Real>) s.cell_.r_ = x.data_;
+        else if constexpr (std::is_same_v<T, Char>) s.cell_.c_ = x.data_;
+        else if constexpr (std::is_same_v<T, String>) s.cell_.s_ = Str(x.data_);
+        else if constexpr (std::is_same_v<T, Boolean>) s.cell_.b_ = x.data_;
+        else s.cell_.i_ = x.y_ * 10000 + x.m_ * 100 + x.d_;
+    }, a->data_);
+    return s;
+}
+
+Value to_value(const Slot &s) {
+    const Cell &c = s.cell_;
+    switch (s.type_) {
+        case AtomicDt::Integer: return atomic_value(Integer(c.i_));
+        case AtomicDt::Real:    return atomic_value(Real(c.r_));
+        case AtomicDt::Char:    return atomic_value(Char(c.c_));
+        case AtomicDt::String:  return atomic_value(String(c.s_.str()));
+        case AtomicDt::Boolean: return atomic_value(Boolean(c.b_));
+        case AtomicDt::Date:    return atomic_value(Date(c.i_ % 100, c.i_ / 100 % 100, c.i_ / 10000));
+    }
+    throw std::invalid_argument("Slot has no type");
+}
+
+std::string slot_to_string(const Slot &s) {
+    const Cell &c = s.cell_;
+    switch (s.type_) {
+        case AtomicDt::Integer:
+        case AtomicDt::Real: {
+            std::string text;
+            append_slot(text, s);
+            return text;
+        }
+        case AtomicDt::Char:    return Char(c.c_).to_string();
+        case AtomicDt::String:  return c.s_.str();
+        case AtomicDt::Boolean: return c.b_ ? "TRUE" : "FALSE";
+        case AtomicDt::Date:    return Date(c.i_ % 100, c.i_ / 100 % 100, c.i_ / 10000).to_string();
+    }
+    return "";
+}
+
+void append_slot(std::string &out, const Slot &s) {
+    switch (s.type_) {
+        case AtomicDt::Integer: {
+            char buf[16];
+            out.append(buf, std::to_chars(buf, buf + sizeof buf, s.cell_.i_).ptr);
+            break;
+        }
+        case AtomicDt::Real:   append_real(out, s.cell_.r_); break;
+        case AtomicDt::String: out += s.cell_.s_.view(); break;
+        default:               out += slot_to_string(s); break;
+    }
+}
+
+Slot parse_slot(AtomicDt t, std::string_view text) {
+    Slot s{ t, {} };
+    switch (t) {
+        case AtomicDt::Integer:
+            s.cell_.i_ = number_or_throw<int>(text, "INTEGER");
+            return s;
+        case AtomicDt::Real:
+            s.cell_.r_ = number_or_throw<double>(text, "REAL");
+            return s;
+        case AtomicDt::Char:
+            if (text.size() != 1) throw std::invalid_argument("Expected one character");
+            s.cell_.c_ = text[0];
+            return s;
+        case AtomicDt::String:
+            s.cell_.s_ = Str(text);
+            return s;
+        case AtomicDt::Boolean: return to_slot(atomic_value(Boolean(std::string(text))));
+        case AtomicDt::Date:    return to_slot(atomic_value(Date(std::string(text))));
+    }
+    throw std::invalid_argument("Unknown type");
+}
+
+Slot infer_slot(std::string_view text) {
+    Slot s{ AtomicDt::Integer, {} };
+    if (parse_number(text, s.cell_.i_) == std::errc{}) return s;
+    s.type_ = AtomicDt::Real;
+    if (parse_number(text, s.cell_.r_) == std::errc{}) return s;
+    return parse_slot(AtomicDt::String, text);
+}
+
+// -- Generic operators
+// Both operands are inspected at run time, through the dynamic dispatch table.
+
+static Slot apply(Op op, const Value &l, const Value &r) {
+    Slot d;
+    apply_dynamic(op, d, to_slot(l), to_slot(r));
+    return d;
+}
+
+Value Interpreter::addition(const Value &l, const Value &r) { return to_value(apply(Op::Add, l, r)); }
+Value Interpreter::subtraction(const Value &l, const Value &r) { return to_value(apply(Op::Sub, l, r)); }
+Value Interpreter::multiplication(const Value &l, const Value &r) { return to_value(apply(Op::Mul, l, r)); }
+Real Interpreter::division(const Value &l, const Value &r) { return Real(apply(Op::Div, l, r).cell_.r_); }
+String Interpreter::concatenation(const Value &l, const Value &r) { return String(apply(Op::Concat, l, r).cell_.s_.str()); }
+Integer Interpreter::mod(const Value &l, const Value &r) { return Integer(apply(Op::Mod, l, r).cell_.i_); }
+Integer Interpreter::div(const Value &l, const Value &r) { return Integer(apply(Op::IntDiv, l, r).cell_.i_); }
+
+Boolean Interpreter::greater_than(const Value &l, const Value &r) { return Boolean(apply(Op::Gt, l, r).cell_.b_); }
+Boolean Interpreter::lesser_than(const Value &l, const Value &r) { return Boolean(apply(Op::Lt, l, r).cell_.b_); }
+Boolean Interpreter::greater_than_or_equal_to(const Value &l, const Value &r) { return Boolean(apply(Op::Ge, l, r).cell_.b_); }
+Boolean Interpreter::lesser_than_or_equal_to(const Value &l, const Value &r) { return Boolean(apply(Op::Le, l, r).cell_.b_); }
+Boolean Interpreter::equal_to(const Value &l, const Value &r) { return Boolean(apply(Op::Eq, l, r).cell_.b_); }
+Boolean Interpreter::not_equal_to(const Value &l, const Value &r) { return Boolean(apply(Op::Ne, l, r).cell_.b_); }
+
+Boolean Interpreter::op_and(Boolean l, Boolean r) { return Boolean(l.data_ && r.data_); }
+Boolean Interpreter::op_or(Boolean l, Boolean r) { return Boolean(l.data_ || r.data_); }
+Boolean Interpreter::op_not(Boolean operand) { return Boolean(!operand.data_); }
+
+// -- Random numbers
+
+uint64_t random_seed() {
+    std::random_device device;
+    return (static_cast<uint64_t>(device()) << 32) ^ device();
+}
+
+// Inclusive of both ends, as in the guide
+Integer Interpreter::randombetween(Integer min, Integer max) {
+    if (min.data_ > max.data_) {
+        throw std::invalid_argument(std::format("RANDOMBETWEEN({}, {}) has no numbers to choose from", min.data_, max.data_));
+    }
+    uint64_t span = static_cast<uint64_t>(static_cast<int64_t>(max.data_) - min.data_) + 1;
+    return Integer(static_cast<int>(min.data_ + static_cast<int64_t>(rng_.below(span))));
+}
+
+// In [0, 1)
+Real Interpreter::rnd() {
+    return Real(rng_.unit());
+}
+
+// -- Files
+
+static FileBackend &files_of(Interpreter &interp) {
+    if (!interp.files_) {
+        throw std::logic_error("Interpreter has no file backend");
+    }
+    return *interp.files_;
+}
+
+void Interpreter::openfile(const std::string &file_identifier, FileMode mode) {
+    if (!files_of(*this).open(file_identifier, mode)) {
+        throw std::runtime_error(std::format("Unable to open file \"{}\"", file_identifier));
+    }
+}
+
+void Interpreter::readfile(const std::string &file_identifier, std::string &line) {
+    if (!files_of(*this).read_line(file_identifier, line)) {
+        throw std::runtime_error(std::format("Unable to read from file \"{}\"", file_identifier));
+    }
+}
+
+Boolean Interpreter::eof(const std::string &file_identifier) {
+    return Boolean(files_of(*this).eof(file_identifier));
+}
+
+void Interpreter::writefile(const std::string &file_identifier, const std::string &line) {
+    if (!files_of(*this).write_line(file_identifier, line)) {
+        throw std::runtime_error(std::format("Unable to write to file \"{}\"", file_identifier));
+    }
+}
+
+void Interpreter::closefile(const std::string &file_identifier) {
+    if (!files_of(*this).close(file_identifier)) {
+        throw std::runtime_error(std::format("File \"{}\" is not open", file_identifier));
+    }
+}
@@ -1,21 +1,26 @@
 #pragma once
 
 #include "util.hpp"
+#include "str.hpp"
+#include "rng.hpp"
 
 struct Integer {
     Integer(std::string);
+    Integer(int);
     std::string to_string();
     int data_;
 };
 
 struct Real {
     Real(std::string);
+    Real(double);
     std::string to_string();
-    float data_;
+    double data_;
 };
 
 struct Char {
     Char(std::string);
+    Char(char);
     std::string to_string();
     char data_;
 };
@@ -28,12 +33,14 @@ struct String {
 
 struct Boolean {
     Boolean(std::string);
+    Boolean(bool);
     std::string to_string();
     bool data_;
 };
 
 struct Date {
     Date(std::string);
+    Date(int d, int m, int y);
     std::string to_string();
     int d_;
     int m_;
@@ -74,6 +81,48 @@ struct Value {
     std::variant<AtomicDtValue, CustomDtValue> value_;
 };
 
+template<typename T> Value atomic_value(T v) {
+    AtomicDt t;
+    if constexpr (std::is_same_v<T, Integer>) t = AtomicDt::Integer;
+    else if constexpr (std::is_same_v<T, Real>) t = AtomicDt::Real;
+    else if constexpr (std::is_same_v<T, Char>) t = AtomicDt::Char;
+    else if constexpr (std::is_same_v<T, String>) t = AtomicDt::String;
+    else if constexpr (std::is_same_v<T, Boolean>) t = AtomicDt::Boolean;
+    else t = AtomicDt::Date;
+    return Value{ AtomicDtValue{ std::move(v), t } };
+}
+
+std::string_view atomic_dt_name(AtomicDt t);
+
+// One atomic value with its type kept elsewhere: in the program, for
+// expressions whose type is known before execution, or in a Slot.
+struct Cell {
+    union {
+        int i_ = 0; // INTEGER, and DATE as yyyymmdd so that dates compare as integers
+        double r_;  // REAL
+        char c_;    // CHAR
+        bool b_;    // BOOLEAN
+    };
+    Str s_; // STRING
+};
+
+struct Slot {
+    AtomicDt type_;
+    Cell cell_;
+};
+
+Slot default_slot(AtomicDt t);
+Slot to_slot(const Value &v);
+Value to_value(const Slot &s);
+std::string slot_to_string(const Slot &s);
+// slot_to_string(s) onto the end of `out`, without a string of its own
+void append_slot(std::string &out, const Slot &s);
+
+// Parses text from INPUT or a file as a value of type `t`.
+Slot parse_slot(AtomicDt t, std::string_view text);
+// Parses text whose type is not known: INTEGER, else REAL, else STRING.
+Slot infer_slot(std::string_view text);
+
 struct Variable {
     Identifier name_;
     Value value_;
@@ -86,7 +135,23 @@ enum struct ParamPassType { Byref, Byval, };
 struct Statement {
 };
 
+struct FileBackend;
+
+// A seed that differs from run to run
+uint64_t random_seed();
+
+// The operations of the language, one method each. Those the Engine or the
+// tests call take their arguments without copying: values and names by const
+// reference, and READFILE a line to read into.
 struct Interpreter {
+    // With a seed, RANDOMBETWEEN and RND repeat from run to run
+    explicit Interpreter(std::optional<uint64_t> seed = std::nullopt) : rng_{ seed ? *seed : random_seed() } {}
+
+    // Where OPENFILE and friends go. Must be set before any file statement runs.
+    FileBackend *files_ = nullptr;
+    // For RANDOMBETWEEN and RND
+    Rng rng_;
+
     void comment(std::string comment);
     void decl_var(Identifier identifier, Datatype type);
     void decl_const(Identifier identifier, Value value);
@@ -95,18 +160,19 @@ struct Interpreter {
     void defn_custom_type(Identifier identifier, std::vector<std::tuple<Identifier, Datatype>> data_collection);
     void input(Identifier identifier);
     void output(std::vector<Value> values);
-    Value addition(Value l, Value r);
-    Value subtraction(Value l, Value r);
-    Value multiplication(Value l, Value r);
-    Real division(Value l, Value r);
-    Integer mod(Value v);
-    Integer div(Integer v);
-    Boolean greater_than(Value l, Value r);
-    Boolean lesser_than(Value l, Value r);
-    Boolean greater_than_or_equal_to(Value l, Value r);
-    Boolean lesser_than_or_equal_to(Value l, Value r);
-    Boolean equal_to(Value l, Value r);
-    Boolean not_equal_to(Value l, Value r);
+    Value addition(const Value &l, const Value &r);
+    Value subtraction(const Value &l, const Value &r);
+    Value multiplication(const Value &l, const Value &r);
+    Real division(const Value &l, const Value &r);
+    String concatenation(const Value &l, const Value &r);
+    Integer mod(const Value &l, const Value &r);
+    Integer div(const Value &l, const Value &r);
+    Boolean greater_than(const Value &l, const Value &r);
+    Boolean lesser_than(const Value &l, const Value &r);
+    Boolean greater_than_or_equal_to(const Value &l, const Value &r);
+    Boolean lesser_than_or_equal_to(const Value &l, const Value &r);
+    Boolean equal_to(const Value &l, const Value &r);
+    Boolean not_equal_to(const Value &l, const Value &r);
     Boolean op_and(Boolean l, Boolean r);
     Boolean op_or(Boolean l, Boolean r);
     Boolean op_not(Boolean operand);
@@ -121,12 +187,13 @@ struct Interpreter {
     void call_procedure(Identifier identifier, std::optional<std::vector<Value>> values);
     void defn_function(Identifier identifier, std::optional<std::vector<std::tuple<ParamPassType, Identifier, Datatype>>> params, Datatype returns, std::vector<Statement> stmts);
     void call_function();
-    void openfile(std::string file_identifier, FileMode mode);
-    void readfile(std::string file_identifier, Variable &var);
-    void eof(std::string file_identifier);
-    void writefile(std::string file_identifier, String string);
-    void closefile(std::string file_identifier);
+    void openfile(const std::string &file_identifier, FileMode mode);
+    // Into `line`, reusing its buffer
+    void readfile(const std::string &file_identifier, std::string &line);
+    Boolean eof(const std::string &file_identifier);
+    void writefile(const std::string &file_identifier, const std::string &line);
+    void closefile(const std::string &file_identifier);
     void seek(std::string file_identifier, Integer address);
     void getrecord(std::string file_identifier, Variable &var);
     void putrecord(std::string file_identifier, Variable &var);
-};
\ No newline at end of file
+};
@@ -0,0 +1,314 @@
+#include "daemon.hpp"
+#include "files.hpp"
+
+// FNV-1a
+uint64_t source_hash(std::string_view source) {
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (unsigned char c : source) {
+        h ^= c;
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
+
+#if defined(_WIN32)
+
+Daemon::Daemon(std::string, size_t, std::optional<uint64_t>, RunLimits) : listen_fd_{ -1 } {
+    throw std::runtime_error("Daemon mode requires Unix domain sockets");
+}
+Daemon::~Daemon() {}
+void Daemon::serve() {}
+void Daemon::stop() {}
+size_t Daemon::cache_size() { return 0; }
+
+Response daemon_request(std::string, const Request &) {
+    throw std::runtime_error("Daemon mode requires Unix domain sockets");
+}
+
+#else
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <cerrno>
+#include <chrono>
+#include <system_error>
+#include <unistd.h>
+
+// A client hanging up early must not take the daemon down with SIGPIPE.
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+static bool write_all(int fd, const void *src, size_t sz) {
+    auto p = static_cast<const char *>(src);
+    while (sz) {
+        ssize_t n = ::send(fd, p, sz, MSG_NOSIGNAL);
+        if (n <= 0) return false;
+        p += n;
+        sz -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+static bool read_all(int fd, void *dst, size_t sz) {
+    auto p = static_cast<char *>(dst);
+    while (sz) {
+        ssize_t n = ::read(fd, p, sz);
+        if (n <= 0) return false;
+        p += n;
+        sz -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+static bool write_frame(int fd, const std::string &s) {
+    uint32_t len = static_cast<uint32_t>(s.size());
+    return write_all(fd, &len, sizeof len) && write_all(fd, s.data(), s.size());
+}
+
+// Reads one frame of a message, which has `budget` bytes left of the most it
+// may carry.
+static bool read_frame(int fd, std::string &s, uint32_t &budget) {
+    uint32_t len;
+    if (!read_all(fd, &len, sizeof len) || len > budget) return false;
+    budget -= len;
+    s.resize(len);
+    return read_all(fd, s.data(), len);
+}
+
+static bool write_files(int fd, const std::vector<NamedFile> &files) {
+    uint32_t count = static_cast<uint32_t>(files.size());
+    if (!write_all(fd, &count, sizeof count)) return false;
+    for (const auto &f : files) {
+        if (!write_frame(fd, f.name_) || !write_frame(fd, f.contents_)) return false;
+    }
+    return true;
+}
+
+// Every file costs at least its two lengths, so the count cannot make the
+// message outgrow its budget either.
+static bool read_files(int fd, std::vector<NamedFile> &files, uint32_t &budget) {
+    uint32_t count;
+    if (!read_all(fd, &count, sizeof count) || count > budget / (2 * sizeof count)) return false;
+    files.resize(count);
+    for (auto &f : files) {
+        if (!read_frame(fd, f.name_, budget) || !read_frame(fd, f.contents_, budget)) return false;
+    }
+    return true;
+}
+
+static sockaddr_un make_addr(const std::string &path) {
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof addr.sun_path) {
+        throw std::invalid_argument("Socket path too long");
+    }
+    std::copy(path.begin(), path.end(), addr.sun_path);
+    return addr;
+}
+
+Daemon::Daemon(std::string socket_path, size_t workers, std::optional<uint64_t> seed, RunLimits limits)
+    : socket_path_{ socket_path }, worker_count_{ workers ? workers : 1 }, seed_{ seed }, limits_{ limits }, listen_fd_{ -1 },
+      stopping_{ false }, cache_hits_{ 0 }, cache_misses_{ 0 } {
+    auto addr = make_addr(socket_path_);
+
+    listen_fd_ = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd_ < 0) {
+        throw std::runtime_error("Unable to create socket");
+    }
+
+    ::unlink(socket_path_.c_str());
+    if (::bind(listen_fd_, reinterpret_cast<sockaddr *>(&addr), sizeof addr) < 0
+        || ::listen(listen_fd_, 64) < 0) {
+        ::close(listen_fd_);
+        throw std::runtime_error("Unable to listen on " + socket_path_);
+    }
+}
+
+Daemon::~Daemon() {
+    stop();
+    ::close(listen_fd_);
+    ::unlink(socket_path_.c_str());
+}
+
+void Daemon::stop() {
+    if (stopping_.exchange(true)) return;
+
+    // Wakes the blocking accept() in serve()
+    ::shutdown(listen_fd_, SHUT_RDWR);
+    queue_cv_.notify_all();
+}
+
+void Daemon::serve() {
+    std::vector<std::thread> pool;
+    for (size_t i = 0; i < worker_count_; ++i) {
+        pool.emplace_back([this] { worker(); });
+    }
+
+    int error = 0;
+    while (!stopping_) {
+        int fd = ::accept(listen_fd_, nullptr, nullptr);
+        if (fd < 0) {
+            if (stopping_) break;
+            switch (errno) {
+                case EINTR:
+                case ECONNABORTED:
+                    continue;
+                // Out of descriptors or memory: wait for connections to close
+                case EMFILE:
+                case ENFILE:
+                case ENOBUFS:
+                case ENOMEM:
+                    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                    continue;
+                default:
+                    error = errno;
+                    break;
+            }
+            break;
+        }
+
+        // A client that stops sending or reading must not hold a worker
+        timeval timeout{ io_timeout_seconds, 0 };
+        ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
+        ::setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof timeout);
+
+        std::lock_guard lock(queue_mutex_);
+        pending_.push_back(fd);
+        queue_cv_.notify_one();
+    }
+
+    stopping_ = true;
+    queue_cv_.notify_all();
+    for (auto &t : pool) t.join();
+    if (error) {
+        throw std::system_error(error, std::generic_category(), "accept");
+    }
+}
+
+void Daemon::worker() {
+    while (true) {
+        int fd;
+        {
+            std::unique_lock lock(queue_mutex_);
+            queue_cv_.wait(lock, [this] { return stopping_ || !pending_.empty(); });
+            if (pending_.empty()) return;
+            fd = pending_.front();
+            pending_.pop_front();
+        }
+
+        // Out of memory for a request ends its connection, not the daemon
+        try {
+            Request req;
+            uint32_t budget = max_message_bytes;
+            if (read_frame(fd, req.source_, budget) && read_frame(fd, req.input_, budget) && read_files(fd, req.files_, budget)) {
+                Response res = handle(req);
+                if (write_all(fd, &res.status_, sizeof res.status_) && write_frame(fd, res.output_)) {
+                    write_files(fd, res.files_);
+                }
+            }
+        } catch (std::exception &) {
+        }
+        ::close(fd);
+    }
+}
+
+std::shared_ptr<const Program> Daemon::lookup(const std::string &source) {
+    uint64_t key = source_hash(source);
+    {
+        std::lock_guard lock(cache_mutex_);
+        if (auto search = cache_.find(key); search != cache_.end() && search->second.program_->source_ == source) {
+            lru_.splice(lru_.begin(), lru_, search->second.lru_);
+            cache_hits_ += 1;
+            return search->second.program_;
+        }
+    }
+
+    // Compile outside the lock; two workers racing on the same new source
+    // both compile it and the last one in wins, which is harmless.
+    auto program = std::make_shared<const Program>(compile(source));
+    cache_misses_ += 1;
+
+    std::lock_guard lock(cache_mutex_);
+    if (auto search = cache_.find(key); search != cache_.end()) {
+        search->second.program_ = program;
+        lru_.splice(lru_.begin(), lru_, search->second.lru_);
+        return program;
+    }
+    if (cache_.size() == max_cached_programs) {
+        cache_.erase(lru_.back());
+        lru_.pop_back();
+    }
+    lru_.push_front(key);
+    cache_.emplace(key, Cached{ program, lru_.begin() });
+    return program;
+}
+
+size_t Daemon::cache_size() {
+    std::lock_guard lock(cache_mutex_);
+    return cache_.size();
+}
+
+// What a response counts against the client's max_message_bytes: its frames,
+// and for each file the two lengths that its count is checked against.
+static size_t message_bytes(const Response &res) {
+    size_t n = res.output_.size();
+    for (const auto &f : res.files_) {
+        n += 2 * sizeof(uint32_t) + f.name_.size() + f.contents_.size();
+    }
+    return n;
+}
+
+Response Daemon::handle(const Request &req) {
+    Response res;
+    try {
+        auto program = lookup(req.source_);
+
+        // Requests are sandboxed: file statements never reach the disk.
+        MemoryFiles files;
+        for (const auto &f : req.files_) {
+            files.preload(f.name_, f.contents_);
+        }
+        std::istringstream in(req.input_);
+        std::ostringstream out;
+        int32_t status = run(*program, in, out, files, seed_, limits_);
+        res = Response{ status, out.str(), files.written() };
+    } catch (std::exception &e) {
+        return Response{ 1, std::format("The daemon could not run the program: {}\n", e.what()), {} };
+    }
+
+    if (size_t n = message_bytes(res); n > max_message_bytes) {
+        return Response{ 1, std::format("The response, {} bytes, is over the limit of {} bytes\n", n, max_message_bytes), {} };
+    }
+    return res;
+}
+
+Response daemon_request(std::string socket_path, const Request &req) {
+    auto addr = make_addr(socket_path);
+
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        throw std::runtime_error("Unable to create socket");
+    }
+    if (::connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof addr) < 0) {
+        ::close(fd);
+        throw std::runtime_error("Unable to connect to " + socket_path);
+    }
+
+    Response res{ 1, "", {} };
+    uint32_t budget = Daemon::max_message_bytes;
+    bool ok = write_frame(fd, req.source_)
+        && write_frame(fd, req.input_)
+        && write_files(fd, req.files_)
+        && read_all(fd, &res.status_, sizeof res.status_)
+        && read_frame(fd, res.output_, budget)
+        && read_files(fd, res.files_, budget);
+    ::close(fd);
+
+    if (!ok) {
+        throw std::runtime_error("Daemon closed the connection");
+    }
+    return res;
+}
+
+#endif
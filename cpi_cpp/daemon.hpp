@@ -0,0 +1,103 @@
+#pragma once
+
+#include "util.hpp"
+#include "exec.hpp"
+#include "files.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+// Server mode: listens on a Unix domain socket and runs programs on behalf of
+// clients, so that repeated runs pay neither process startup nor compilation.
+//
+// Wire format, all lengths and counts are native-endian uint32_t:
+//   request:  <len> <source bytes> <len> <input bytes> <count> <file>...
+//   response: <status> <len> <output bytes> <count> <file>...
+//   file:     <len> <name bytes> <len> <contents bytes>
+//
+// Files in the request are what the program can OPENFILE for READ; those in
+// the response are the ones it wrote. Nothing else reaches the disk.
+//
+// Clients are not trusted: a message longer than max_message_bytes in all,
+// or a client silent for longer than io_timeout, ends the connection without
+// a response. Programs run within the daemon's RunLimits. A program that goes
+// past them, a request the daemon fails to handle, and a response that would
+// be longer than max_message_bytes, all get a response with status 1 and the
+// reason as its output.
+
+struct Request {
+    std::string source_;
+    std::string input_;
+    std::vector<NamedFile> files_;
+};
+
+struct Response {
+    int32_t status_;
+    std::string output_;
+    std::vector<NamedFile> files_;
+};
+
+uint64_t source_hash(std::string_view source);
+
+struct Daemon {
+    static constexpr uint32_t max_message_bytes = 16u << 20;
+    static constexpr int io_timeout_seconds = 10;
+    // Compiled programs kept; the least recently used goes first
+    static constexpr size_t max_cached_programs = 256;
+    static constexpr RunLimits default_limits{
+        .max_steps_ = 500'000'000,
+        .max_time_ = std::chrono::seconds(5),
+        .max_output_bytes_ = 4u << 20,
+    };
+
+    // With a seed, every request runs with its random numbers seeded by it
+    Daemon(std::string socket_path, size_t workers, std::optional<uint64_t> seed = std::nullopt,
+        RunLimits limits = default_limits);
+    ~Daemon();
+
+    // Blocks until stop() is called from another thread.
+    void serve();
+    void stop();
+
+    // Exposed for tests and diagnostics.
+    size_t cache_hits() const { return cache_hits_; }
+    size_t cache_misses() const { return cache_misses_; }
+    size_t cache_size();
+
+private:
+    std::shared_ptr<const Program> lookup(const std::string &source);
+    Response handle(const Request &req);
+    void worker();
+
+    std::string socket_path_;
+    size_t worker_count_;
+    std::optional<uint64_t> seed_;
+    RunLimits limits_;
+    int listen_fd_;
+    std::atomic<bool> stopping_;
+
+    std::mutex queue_mutex_;
+    std::condition_variable queue_cv_;
+    std::deque<int> pending_;
+
+    // Keyed by source hash. The source is kept in the Program and compared on
+    // lookup, so a hash collision costs a recompile instead of a wrong answer.
+    // lru_ holds the keys, most recently used first.
+    struct Cached {
+        std::shared_ptr<const Program> program_;
+        std::list<uint64_t>::iterator lru_;
+    };
+    std::mutex cache_mutex_;
+    std::unordered_map<uint64_t, Cached> cache_;
+    std::list<uint64_t> lru_;
+    std::atomic<size_t> cache_hits_;
+    std::atomic<size_t> cache_misses_;
+};
+
+// Bundled client: sends one request and waits for the response.
+Response daemon_request(std::string socket_path, const Request &req);
@@ -0,0 +1,510 @@
+#include "engine.hpp"
+#include "cases.hpp"
+#include "ascii.hpp"
+
+Engine::Engine(const Ast &ast, Interpreter &interp, std::istream &in, std::ostream &out)
+    : ast_{ ast }, interp_{ interp }, in_{ in }, out_{ out }, slots_{}, aggregates_(ast.slots_.size()), quick_(ast.exprs_.size()) {
+    slots_.reserve(ast.slots_.size());
+    for (const auto &info : ast.slots_) {
+        slots_.push_back(default_slot(info.type_.value_or(AtomicDt::Integer)));
+    }
+}
+
+// Already names the line it came from
+struct LineError : std::runtime_error {
+    using std::runtime_error::runtime_error;
+};
+
+void Engine::run() {
+    steps_ = 0;
+    output_bytes_ = 0;
+    deadline_ = std::chrono::steady_clock::time_point::max();
+    if (limits_.max_time_) deadline_ = std::chrono::steady_clock::now() + *limits_.max_time_;
+    block(ast_.top_);
+}
+
+// The clock is only read every this many steps
+static constexpr uint64_t steps_per_clock_check = 4096;
+
+void Engine::block(std::span<const NodeId> stmts) {
+    if (++steps_ > limits_.max_steps_) {
+        throw std::runtime_error(std::format("Stopped after {} steps", limits_.max_steps_));
+    }
+    if (steps_ % steps_per_clock_check == 0 && std::chrono::steady_clock::now() > deadline_) {
+        throw std::runtime_error(std::format("Stopped after running for {} ms", limits_.max_time_->count()));
+    }
+    for (NodeId id : stmts) {
+        try {
+            exec(id);
+        } catch (LineError &) {
+            throw;
+        } catch (std::exception &e) {
+            throw LineError(std::format("Line {}: {}", ast_.stmt(id).line_, e.what()));
+        }
+    }
+}
+
+size_t Engine::place(Scope scope, uint32_t index) const {
+    switch (scope) {
+        case Scope::Global: return index;
+        case Scope::Local: return base_ + index;
+        case Scope::Ref: return static_cast<size_t>(slots_[base_ + index].cell_.i_);
+    }
+    return index;
+}
+
+const SlotInfo &Engine::info(Scope scope, uint32_t index) const {
+    return scope == Scope::Global ? ast_.slots_[index] : proc_->slots_[index];
+}
+
+static bool same_bounds(const Layout &a, const Layout &b) {
+    return std::ranges::equal(a.dims_, b.dims_, [](Dim x, Dim y) { return x.lo_ == y.lo_ && x.hi_ == y.hi_; });
+}
+
+// The values of a freshly declared ARRAY or record, each the default of its type
+Aggregate Engine::make_aggregate(uint32_t layout) const {
+    const Layout &l = ast_.layouts_[layout];
+    size_t count = 1;
+    for (Dim d : l.dims_) {
+        auto n = static_cast<size_t>(int64_t{ d.hi_ } - d.lo_ + 1);
+        if (count > max_aggregate_values / n) count = max_aggregate_values + 1;
+        else count *= n;
+    }
+    if (count > max_aggregate_values / l.stride_) {
+        throw std::length_error(std::format("An ARRAY may hold at most {} values", max_aggregate_values));
+    }
+
+    std::vector<Slot> values;
+    if (l.element_) {
+        values.assign(count, default_slot(*l.element_));
+    } else {
+        const auto &fields = ast_.records_[l.record_].fields_;
+        values.reserve(count * l.stride_);
+        for (size_t i = 0; i < count; ++i) {
+            for (const auto &f : fields) values.push_back(default_slot(f.second));
+        }
+    }
+    return Aggregate{ layout, Cow<std::vector<Slot>>(std::move(values)) };
+}
+
+// Where in its Aggregate an Element is, after checking its indices
+size_t Engine::offset(const Expr &e, const Aggregate &a) {
+    if (!a.values_) throw std::invalid_argument(std::format("{} is used before it is declared", e.name_));
+    const Layout &l = ast_.layouts_[a.layout_];
+    if (e.args_.size() != l.dims_.size()) {
+        throw std::invalid_argument(std::format("{} has {} dimensions, not {}", e.name_, l.dims_.size(), e.args_.size()));
+    }
+    size_t at = 0;
+    for (size_t i = 0; i < e.args_.size(); ++i) {
+        Slot scratch;
+        int index = operand(e.args_[i], scratch).cell_.i_;
+        Dim d = l.dims_[i];
+        if (index < d.lo_ || index > d.hi_) {
+            throw std::invalid_argument(std::format("Index {} is outside the bounds {}:{} of {}", index, d.lo_, d.hi_, e.name_));
+        }
+        at = at * static_cast<size_t>(int64_t{ d.hi_ } - d.lo_ + 1) + static_cast<size_t>(int64_t{ index } - d.lo_);
+    }
+    return at * l.stride_ + e.field_;
+}
+
+const Slot &Engine::read_element(const Expr &e) {
+    const Aggregate &a = aggregates_[place(e.scope_, e.index_)];
+    size_t at = offset(e, a);
+    return a.values_.get()[at];
+}
+
+Slot &Engine::write_element(const Expr &e) {
+    Aggregate &a = aggregates_[place(e.scope_, e.index_)];
+    size_t at = offset(e, a);
+    if (a.values_.shared()) copies_ += 1;
+    return a.values_.mutate()[at];
+}
+
+// Settles an Op::Expect node: the value must already have type `t`, or
+// convert to it the same way the checker would have converted a known type.
+static void expect(Slot &s, AtomicDt t) {
+    if (s.type_ == t) return;
+    if (s.type_ == AtomicDt::Integer && t == AtomicDt::Real) {
+        s.cell_.r_ = static_cast<double>(s.cell_.i_);
+    } else if (s.type_ == AtomicDt::Char && t == AtomicDt::String) {
+        s.cell_.s_.assign(1, s.cell_.c_);
+    } else {
+        throw std::invalid_argument(std::format("Expected {} but got {}", atomic_dt_name(t), atomic_dt_name(s.type_)));
+    }
+    s.type_ = t;
+}
+
+static void builtin(Engine &en, const Expr &e, Slot &dst) {
+    // MID takes the most
+    Slot args[3];
+    assert(e.args_.size() <= std::size(args));
+    for (size_t i = 0; i < e.args_.size(); ++i) {
+        en.eval(e.args_[i], args[i]);
+    }
+
+    // A view of the argument's buffer rather than a copy
+    // In 64 bits, so that MID's start - 1 cannot overflow
+    auto substring = [&](const Str &s, int64_t start, int64_t length) {
+        if (start < 0 || length < 0 || static_cast<uint64_t>(start + length) > s.size()) {
+            throw std::invalid_argument(std::format("{} is out of range of \"{}\"", e.name_, s.view()));
+        }
+        dst.type_ = AtomicDt::String;
+        dst.cell_.s_ = s.substr(start, length);
+    };
+
+    switch (static_cast<Builtin>(e.index_)) {
+        case Builtin::Length:
+            dst.type_ = AtomicDt::Integer;
+            dst.cell_.i_ = static_cast<int>(args[0].cell_.s_.size());
+            break;
+        case Builtin::Left:
+            substring(args[0].cell_.s_, 0, args[1].cell_.i_);
+            break;
+        case Builtin::Right:
+            substring(args[0].cell_.s_, static_cast<int64_t>(args[0].cell_.s_.size()) - args[1].cell_.i_, args[1].cell_.i_);
+            break;
+        case Builtin::Mid:
+            substring(args[0].cell_.s_, int64_t{ args[1].cell_.i_ } - 1, args[2].cell_.i_);
+            break;
+        case Builtin::Ucase:
+        case Builtin::Lcase: {
+            bool up = static_cast<Builtin>(e.index_) == Builtin::Ucase;
+            dst = std::move(args[0]);
+            if (dst.type_ == AtomicDt::Char) (up ? ascii_upper : ascii_lower)(&dst.cell_.c_, 1);
+            else (up ? ascii_upper : ascii_lower)(dst.cell_.s_.mutable_data(), dst.cell_.s_.size());
+            break;
+        }
+        case Builtin::Eof:
+            dst.type_ = AtomicDt::Boolean;
+            dst.cell_.b_ = en.interp_.eof(e.name_).data_;
+            break;
+        case Builtin::Randombetween:
+            dst.type_ = AtomicDt::Integer;
+            dst.cell_.i_ = en.interp_.randombetween(Integer(args[0].cell_.i_), Integer(args[1].cell_.i_)).data_;
+            break;
+        case Builtin::Rnd:
+            dst.type_ = AtomicDt::Real;
+            dst.cell_.r_ = en.interp_.rnd().data_;
+            break;
+    }
+}
+
+void Engine::quick(NodeId id, Op op, Slot &dst, const Slot &l, const Slot &r) {
+    QuickSite &q = quick_[id];
+    if (q.kernel_ && q.l_ == l.type_ && q.r_ == r.type_) {
+        return q.kernel_(dst, l, r);
+    }
+
+    if (q.kernel_) {
+        q.kernel_ = nullptr;
+        despecialised_ += 1;
+        q.respecialisations_ += 1;
+    }
+    if (q.respecialisations_ < QuickSite::max_respecialisations) {
+        if (auto k = dynamic_kernel(op, l.type_, r.type_)) {
+            q = QuickSite{ k, l.type_, r.type_, q.respecialisations_ };
+            quickened_ += 1;
+        }
+    }
+    apply_dynamic(op, dst, l, r);
+}
+
+void Engine::eval(NodeId id, Slot &dst) {
+    const Expr &e = ast_.expr(id);
+    switch (e.kind_) {
+        case ExprKind::Literal:
+            dst = ast_.consts_[e.index_];
+            return;
+        case ExprKind::Variable:
+            dst = slots_[place(e.scope_, e.index_)];
+            return;
+        case ExprKind::Element:
+            dst = read_element(e);
+            return;
+        case ExprKind::Call:
+            builtin(*this, e, dst);
+            return;
+        case ExprKind::Unary: {
+            if (e.op_ == Op::Expect) {
+                eval(e.lhs_, dst);
+                expect(dst, *e.type_);
+                return;
+            }
+            Slot a;
+            eval(e.lhs_, a);
+            if (e.kernel_) {
+                dst.type_ = *e.type_;
+                e.kernel_(dst.cell_, a.cell_, a.cell_);
+            } else {
+                quick(id, e.op_, dst, a, a);
+            }
+            return;
+        }
+        case ExprKind::Binary: {
+            if (e.op_ == Op::And || e.op_ == Op::Or) {
+                bool b = test(id);
+                dst.type_ = AtomicDt::Boolean;
+                dst.cell_.b_ = b;
+                return;
+            }
+            Slot l, r;
+            eval(e.lhs_, l);
+            eval(e.rhs_, r);
+            if (e.kernel_) {
+                dst.type_ = *e.type_;
+                e.kernel_(dst.cell_, l.cell_, r.cell_);
+            } else {
+                quick(id, e.op_, dst, l, r);
+            }
+            return;
+        }
+    }
+}
+
+// Variables and literals are used where they are rather than copied
+const Slot &Engine::operand(NodeId id, Slot &scratch) {
+    const Expr &e = ast_.expr(id);
+    if (e.kind_ == ExprKind::Variable) return slots_[place(e.scope_, e.index_)];
+    if (e.kind_ == ExprKind::Literal) return ast_.consts_[e.index_];
+    if (e.kind_ == ExprKind::Element) return read_element(e);
+    eval(id, scratch);
+    return scratch;
+}
+
+bool Engine::test(NodeId id) {
+    const Expr &e = ast_.expr(id);
+    if (e.kind_ == ExprKind::Binary) {
+        if (e.op_ == Op::And) return test(e.lhs_) && test(e.rhs_);
+        if (e.op_ == Op::Or) return test(e.lhs_) || test(e.rhs_);
+        if (e.predicate_) {
+            Slot l, r;
+            return e.predicate_(operand(e.lhs_, l).cell_, operand(e.rhs_, r).cell_);
+        }
+    } else if (e.kind_ == ExprKind::Unary && e.op_ == Op::Not) {
+        return !test(e.lhs_);
+    }
+    Slot v;
+    return operand(id, v).cell_.b_;
+}
+
+void Engine::exec(NodeId id) {
+    const Stmt &s = ast_.stmt(id);
+
+    // Text from outside the program takes the declared type, if any
+    auto store = [&](std::string_view text, std::string_view from) {
+        const SlotInfo &v = info(s.scope_, s.slot_);
+        try {
+            slots_[place(s.scope_, s.slot_)] = v.type_ ? parse_slot(*v.type_, text) : infer_slot(text);
+        } catch (std::exception &) {
+            throw std::invalid_argument(std::format("{} \"{}\" is not a valid {}", from, text,
+                atomic_dt_name(v.type_.value_or(AtomicDt::String))));
+        }
+    };
+
+    switch (s.kind_) {
+        case StmtKind::Declare:
+            if (s.type_) slots_[place(s.scope_, s.slot_)] = default_slot(*s.type_);
+            else aggregates_[place(s.scope_, s.slot_)] = make_aggregate(s.index_);
+            break;
+        case StmtKind::Constant:
+        case StmtKind::Assign:
+            if (s.exprs_.size() > 1) {
+                Slot v;
+                eval(s.exprs_[0], v);
+                write_element(ast_.expr(s.exprs_[1])) = std::move(v);
+            } else {
+                eval(s.exprs_[0], slots_[place(s.scope_, s.slot_)]);
+            }
+            break;
+        case StmtKind::Copy: {
+            const Expr &from = ast_.expr(s.exprs_[0]);
+            const Aggregate &src = aggregates_[place(from.scope_, from.index_)];
+            Aggregate &dst = aggregates_[place(s.scope_, s.slot_)];
+            if (!src.values_) throw std::invalid_argument(std::format("{} is used before it is declared", from.name_));
+            if (dst.values_ && !same_bounds(ast_.layouts_[dst.layout_], ast_.layouts_[src.layout_])) {
+                throw std::invalid_argument(std::format("Cannot assign {} to {}, whose bounds differ", from.name_, s.name_));
+            }
+            dst = src;
+            break;
+        }
+        case StmtKind::Call:
+            call(s);
+            break;
+        case StmtKind::Procedure:
+        case StmtKind::Type:
+            break;
+        case StmtKind::Input:
+            if (!std::getline(in_, line_)) {
+                throw std::runtime_error(std::format("No input left for \"{}\"", info(s.scope_, s.slot_).name_));
+            }
+            trim(line_);
+            store(line_, "Input");
+            break;
+        case StmtKind::Output: {
+            line_.clear();
+            Slot v;
+            for (NodeId e : s.exprs_) {
+                eval(e, v);
+                append_slot(line_, v);
+            }
+            line_ += '\n';
+            output_bytes_ += line_.size();
+            if (output_bytes_ > limits_.max_output_bytes_) {
+                throw std::runtime_error(std::format("OUTPUT is over its limit of {} bytes", limits_.max_output_bytes_));
+            }
+            out_.write(line_.data(), static_cast<std::streamsize>(line_.size()));
+            break;
+        }
+        case StmtKind::OpenFile:
+            interp_.openfile(s.name_, s.mode_);
+            break;
+        case StmtKind::ReadFile:
+            interp_.readfile(s.name_, line_);
+            store(line_, "Line");
+            break;
+        case StmtKind::WriteFile: {
+            Slot v;
+            eval(s.exprs_[0], v);
+            line_.clear();
+            append_slot(line_, v);
+            interp_.writefile(s.name_, line_);
+            break;
+        }
+        case StmtKind::CloseFile:
+            interp_.closefile(s.name_);
+            break;
+        case StmtKind::If:
+            block(test(s.exprs_[0]) ? s.body_ : s.else_);
+            break;
+        case StmtKind::While:
+            while (test(s.exprs_[0])) {
+                block(s.body_);
+            }
+            break;
+        case StmtKind::Repeat:
+            do {
+                block(s.body_);
+            } while (!test(s.exprs_[0]));
+            break;
+        case StmtKind::For:
+            if (s.type_ == AtomicDt::Integer) counted_for(s);
+            else real_for(s);
+            break;
+        case StmtKind::Case: {
+            const Case &c = ast_.cases_[s.index_];
+            Slot v;
+            eval(s.exprs_[0], v);
+            uint32_t clause = select_clause(c, v);
+            block(clause < c.clauses_.size() ? c.clauses_[clause].body_ : c.otherwise_);
+            break;
+        }
+    }
+}
+
+// INTEGER loops. The bounds and STEP are evaluated once, on entry, and the
+// trip count is fixed from them; the loop counter is a local, copied into the
+// control variable at the top of each iteration.
+void Engine::counted_for(const Stmt &s) {
+    Slot v;
+    eval(s.exprs_[0], v);
+    int64_t from = v.cell_.i_;
+    eval(s.exprs_[1], v);
+    int64_t to = v.cell_.i_;
+    int64_t step = 1;
+    if (s.exprs_.size() > 2) {
+        eval(s.exprs_[2], v);
+        step = v.cell_.i_;
+    }
+    if (step == 0) throw std::invalid_argument("FOR STEP must not be 0");
+
+    int64_t trips = 0;
+    if (step > 0 && to >= from) trips = (to - from) / step + 1;
+    else if (step < 0 && from >= to) trips = (from - to) / -step + 1;
+
+    int64_t counter = from;
+    for (int64_t n = 0; n < trips; ++n, counter += step) {
+        Slot &control = slots_[place(s.scope_, s.slot_)];
+        control.type_ = AtomicDt::Integer;
+        control.cell_.i_ = static_cast<int>(counter);
+        block(s.body_);
+    }
+}
+
+// REAL loops step by repeated addition, as written, so the count is not
+// fixed up front.
+void Engine::real_for(const Stmt &s) {
+    Slot v;
+    eval(s.exprs_[0], v);
+    double counter = v.cell_.r_;
+    eval(s.exprs_[1], v);
+    double to = v.cell_.r_;
+    double step = 1.0;
+    if (s.exprs_.size() > 2) {
+        eval(s.exprs_[2], v);
+        step = v.cell_.r_;
+    }
+    if (step == 0.0) throw std::invalid_argument("FOR STEP must not be 0");
+
+    for (; step > 0.0 ? counter <= to : counter >= to; counter += step) {
+        Slot &control = slots_[place(s.scope_, s.slot_)];
+        control.type_ = AtomicDt::Real;
+        control.cell_.r_ = counter;
+        block(s.body_);
+    }
+}
+
+// Runs a procedure in a new frame, its parameters first. Arguments are
+// evaluated in the caller's frame. A BYREF parameter is given the index of
+// the caller's slot, and an ARRAY or record passed BYVALUE shares the
+// caller's values until either writes to them.
+void Engine::call(const Stmt &s) {
+    const Procedure &p = ast_.procs_[s.index_];
+    if (depth_ == max_call_depth) throw std::runtime_error(std::format("More than {} nested CALLs", max_call_depth));
+
+    // Back to the caller's frame however the call ends
+    struct Frame {
+        Engine &en_;
+        size_t size_;
+        size_t base_;
+        const Procedure *proc_;
+        size_t depth_;
+        ~Frame() {
+            en_.slots_.resize(size_);
+            en_.aggregates_.resize(size_);
+            en_.base_ = base_;
+            en_.proc_ = proc_;
+            en_.depth_ = depth_;
+        }
+    } frame{ *this, slots_.size(), base_, proc_, depth_ };
+
+    size_t base = slots_.size();
+    slots_.resize(base + p.slots_.size());
+    aggregates_.resize(base + p.slots_.size());
+    for (size_t i = 0; i < p.params_.size(); ++i) {
+        const ProcParam &param = p.params_[i];
+        const Expr &arg = ast_.expr(s.exprs_[i]);
+        if (!param.type_) {
+            size_t at = place(arg.scope_, arg.index_);
+            const Aggregate &a = aggregates_[at];
+            if (!a.values_) throw std::invalid_argument(std::format("{} is used before it is declared", arg.name_));
+            const Layout &want = ast_.layouts_[param.layout_];
+            if (want.bounded_ && !same_bounds(want, ast_.layouts_[a.layout_])) {
+                throw std::invalid_argument(std::format("{} does not have the bounds of parameter {}", arg.name_, param.name_));
+            }
+            if (param.byref_) slots_[base + i].cell_.i_ = static_cast<int>(at);
+            else aggregates_[base + i] = a;
+        } else if (param.byref_) {
+            slots_[base + i].cell_.i_ = static_cast<int>(place(arg.scope_, arg.index_));
+        } else {
+            eval(s.exprs_[i], slots_[base + i]);
+        }
+    }
+    for (size_t i = p.params_.size(); i < p.slots_.size(); ++i) {
+        slots_[base + i] = default_slot(p.slots_[i].type_.value_or(AtomicDt::Integer));
+    }
+
+    base_ = base;
+    proc_ = &p;
+    depth_ += 1;
+    block(ast_.stmt(p.stmt_).body_);
+}
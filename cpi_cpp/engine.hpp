@@ -0,0 +1,103 @@
+#pragma once
+
+#include "ast.hpp"
+#include "kernels.hpp"
+#include "cow.hpp"
+
+#include <chrono>
+#include <limits>
+#include <span>
+
+// Operand types a dynamic node saw when it last specialised, and the handler
+// for them. While the operands keep those types the node calls the handler
+// directly; when they change it despecialises and looks again, up to
+// max_respecialisations times, after which it stays on the table.
+struct QuickSite {
+    static constexpr uint8_t max_respecialisations = 4;
+
+    DynamicKernel kernel_ = nullptr;
+    AtomicDt l_ = AtomicDt::Integer;
+    AtomicDt r_ = AtomicDt::Integer;
+    uint8_t respecialisations_ = 0;
+};
+
+// An ARRAY or record variable: its values, flattened as its Layout says, in
+// a Cow, so that copying the variable, as assignment and BYVALUE do, is O(1)
+// until one of the copies is written to.
+struct Aggregate {
+    uint32_t layout_ = 0; // The declared one, whose bounds indices are checked against
+    Cow<std::vector<Slot>> values_;
+};
+
+// Bounds on a run of a program. One that goes past any of them stops with a
+// run-time error. A step is one entry into a block of statements, so every
+// loop iteration and CALL takes at least one.
+struct RunLimits {
+    uint64_t max_steps_ = std::numeric_limits<uint64_t>::max();
+    std::optional<std::chrono::milliseconds> max_time_{};
+    size_t max_output_bytes_ = std::numeric_limits<size_t>::max();
+};
+
+// Executes a checked Ast. Expressions with a kernel run on untagged cells;
+// the rest quicken on the operand types they see at run time.
+struct Engine {
+    Engine(const Ast &ast, Interpreter &interp, std::istream &in, std::ostream &out);
+
+    // Throws std::runtime_error naming the line of the failing statement.
+    // The limits_ apply to each run on its own.
+    void run();
+
+    void block(std::span<const NodeId> stmts);
+    void exec(NodeId stmt);
+    void eval(NodeId expr, Slot &dst);
+
+    // Evaluates a BOOLEAN expression for a branch. AND and OR short-circuit,
+    // and typed comparisons test their operands in place without storing a
+    // BOOLEAN.
+    bool test(NodeId expr);
+
+    const Ast &ast_;
+    Interpreter &interp_;
+    std::istream &in_;
+    std::ostream &out_;
+    RunLimits limits_{};
+    // The globals, then a frame for each procedure being run, innermost
+    // last. A BYREF parameter's slot holds, in cell_.i_, the index of the
+    // slot it refers to.
+    std::vector<Slot> slots_;
+    // Alongside slots_, for the variables that are ARRAYs or records
+    std::vector<Aggregate> aggregates_;
+    size_t base_ = 0; // Of the innermost frame
+    const Procedure *proc_ = nullptr;
+    size_t depth_ = 0;
+    static constexpr size_t max_call_depth = 1000;
+    // Declaring more is an error rather than an allocation that may not fit
+    static constexpr size_t max_aggregate_values = size_t{ 1 } << 24;
+    // INPUT, OUTPUT and the file statements build their text here, so that
+    // once it has grown to the longest line they allocate nothing.
+    std::string line_;
+    // Spent so far in this run
+    uint64_t steps_ = 0;
+    size_t output_bytes_ = 0;
+    std::chrono::steady_clock::time_point deadline_{};
+
+    // Per Engine rather than in the Ast, which may be shared between threads.
+    std::vector<QuickSite> quick_;
+    size_t quickened_ = 0;
+    size_t despecialised_ = 0;
+    // Writes to an ARRAY or record that was shared, and so copied it first
+    size_t copies_ = 0;
+
+private:
+    size_t place(Scope scope, uint32_t index) const;
+    const SlotInfo &info(Scope scope, uint32_t index) const;
+    Aggregate make_aggregate(uint32_t layout) const;
+    size_t offset(const Expr &e, const Aggregate &a);
+    const Slot &read_element(const Expr &e);
+    Slot &write_element(const Expr &e);
+    void call(const Stmt &s);
+    const Slot &operand(NodeId expr, Slot &scratch);
+    void counted_for(const Stmt &s);
+    void real_for(const Stmt &s);
+    void quick(NodeId id, Op op, Slot &dst, const Slot &l, const Slot &r);
+};
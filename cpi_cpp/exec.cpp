@@ -0,0 +1,156 @@
+#include "exec.hpp"
+#include "files.hpp"
+#include "check.hpp"
+#include "engine.hpp"
+
+bool exec_stmt(VarsInScope &vars, std::string stmt, std::istream &in, std::ostream &out) {
+    trim(stmt);
+
+    // First word hints at the statement type
+    auto [first_word, rest] = split(stmt);
+    lower(first_word);
+
+    if ("declare" == first_word) {
+        // Name : type splitter
+        auto [name, type] = name_colon_type(rest);
+
+        trim(name);
+        lower(name);
+        if (vars.contains(name)) {
+            std::println(out, "Variable \"{}\" declared previously in this scope.", name);
+            return false;
+        }
+
+        // Create default value
+        auto default_val_from_type = [](std::string var_type) -> Data {
+            assert(adt_integer == var_type);
+            {
+                int64_t num = 0;
+                Data dat{ num };
+                return dat;
+            }
+        };
+        trim(type);
+        lower(type);
+        Data default_value = default_val_from_type(type);
+
+        // Assign default value
+        VarData v{ type, default_value };
+        vars.insert(std::make_pair(name, v));
+    } else if ("input" == first_word) {
+        trim(rest);
+        lower(rest);
+
+        auto search = vars.find(rest);
+        if (search == vars.end()) {
+            std::println(out, "Variable \"{}\" not found in this scope", rest);
+            return false;
+        }
+
+        std::string line;
+        if (!std::getline(in, line)) {
+            std::println(out, "No input left for \"{}\"", rest);
+            return false;
+        }
+        trim(line);
+
+        try {
+            search->second.data = static_cast<int64_t>(std::stoll(line));
+        } catch (std::exception &) {
+            std::println(out, "Input \"{}\" is not a valid {}", line, search->second.type);
+            return false;
+        }
+    } else if ("output" == first_word) {
+        // Get output expr
+        trim(rest);
+
+        // Eval output expr
+        if (auto search = vars.find(rest); search != vars.end()) {
+            auto &v = search->second;
+            std::visit([&out](auto &&arg) { std::println(out, "{}", arg); }, v.data);
+        } else {
+            std::println(out, "Variable \"{}\" not found in this scope", rest);
+            return false;
+        }
+    } else { // Assignment
+        std::string ass_op_eq = "=";
+        std::string ass_op_ar = "<-";
+        std::string assop;
+
+        auto &lhs = first_word;
+
+        ltrim(rest);
+        auto loc_eq = rest.find(ass_op_eq);
+        auto loc_arrow = rest.find(ass_op_ar);
+        if (loc_eq == 0) {
+            assop = ass_op_eq;
+        } else if (loc_arrow == 0) {
+            assop = ass_op_ar;
+        } else {
+            std::println(out, "Assignment operator not found at beginning of rhs");
+            return false;
+        }
+
+        auto rhs = rest.substr(rest.find(assop) + assop.size(), rest.size());
+        trim(rhs);
+        lower(rhs);
+
+        if (auto search_lhs = vars.find(lhs); search_lhs != vars.end()) {
+            if (auto search_rhs = vars.find(rhs); search_rhs != vars.end()) {
+                if (search_lhs->second.type == search_rhs->second.type) {
+                    search_lhs->second.data = search_rhs->second.data;
+                    return true;
+                } else {
+                    std::println(out, "LHS type ({}) and RHS type ({}) do not match", search_lhs->second.type, search_rhs->second.type);
+                    return false;
+                }
+            } else {
+                std::println(out, "RHS \"{}\" not found in this scope", rhs);
+                return false;
+            }
+        } else {
+            std::println(out, "LHS \"{}\" not found in this scope", lhs);
+            return false;
+        }
+    }
+    return true;
+}
+
+Program compile(std::string source, bool fold) {
+    Program program{ source, {}, {}, {} };
+    program.ast_ = parse(program.source_, program.errors_);
+    if (program.errors_.empty()) {
+        program.errors_ = check(program.ast_);
+    }
+    if (program.errors_.empty() && fold) {
+        program.folded_ = ::fold(program.ast_);
+    }
+    return program;
+}
+
+int run(const Program &program, std::istream &in, std::ostream &out, std::optional<uint64_t> seed) {
+    DiskFiles disk;
+    return run(program, in, out, disk, seed);
+}
+
+int run(const Program &program, std::istream &in, std::ostream &out, FileBackend &files, std::optional<uint64_t> seed,
+    const RunLimits &limits) {
+    if (!program.errors_.empty()) {
+        for (const auto &e : program.errors_) {
+            std::println(out, "{}", e);
+        }
+        return 1;
+    }
+
+    Interpreter interp(seed);
+    interp.files_ = &files;
+    try {
+        Engine engine(program.ast_, interp, in, out);
+        engine.limits_ = limits;
+        engine.run();
+    } catch (std::exception &e) {
+        std::println(out, "{}", e.what());
+        return 1;
+    }
+    return 0;
+}
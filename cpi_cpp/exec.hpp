@@ -0,0 +1,59 @@
+#pragma once
+
+#include "util.hpp"
+#include "ast.hpp"
+#include "fold.hpp"
+#include "engine.hpp"
+
+using Data = std::variant<int64_t, std::vector<unsigned char>>;
+struct VarData {
+    std::string type;
+    Data data;
+};
+using VarsInScope = std::unordered_map<std::string, VarData>;
+using Scopes = std::vector<VarsInScope>;
+
+inline const std::string name_type_sep = ":";
+inline const std::string adt_integer = "integer";
+
+inline auto split = [](std::string s) -> std::tuple<std::string, std::string> {
+    auto space = s.find(" ");
+    return std::make_tuple(
+        s.substr(0, space),
+        s.substr(space + 1, s.size())
+    );
+};
+
+inline auto name_colon_type = [](std::string s) -> std::tuple<std::string, std::string> {
+    auto colon = s.find(":");
+    return std::make_tuple(
+        s.substr(0, colon),
+        s.substr(colon + 1, s.size())
+    );
+};
+
+bool exec_stmt(VarsInScope &vars, std::string stmt, std::istream &in = std::cin, std::ostream &out = std::cout);
+
+// A parsed and type checked program, ready to be run any number of times
+// without going back to the source text. If errors_ is not empty the program
+// is rejected and none of it runs.
+struct Program {
+    std::string source_;
+    Ast ast_;
+    std::vector<std::string> errors_;
+    FoldStats folded_;
+};
+
+// Folds constants unless `fold` is false, which leaves the checked Ast as it
+// was written.
+Program compile(std::string source, bool fold = true);
+
+struct FileBackend;
+
+// Runs the program with fresh variables. Returns the exit status: 0 if every
+// statement executed, 1 on a compile or run-time error, which is printed to
+// `out`. Files are on the real disk unless a backend is given. With a seed,
+// RANDOMBETWEEN and RND give the same numbers every run.
+int run(const Program &program, std::istream &in, std::ostream &out, std::optional<uint64_t> seed = std::nullopt);
+int run(const Program &program, std::istream &in, std::ostream &out, FileBackend &files, std::optional<uint64_t> seed = std::nullopt,
+    const RunLimits &limits = {});
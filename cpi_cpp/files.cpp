@@ -0,0 +1,165 @@
+#include "files.hpp"
+
+static std::string file_key(std::string name) {
+    trim(name);
+    lower(name);
+    return name;
+}
+
+bool DiskFiles::open(const std::string &name, FileMode mode) {
+    auto key = file_key(name);
+    if (open_.contains(key)) return false;
+
+    std::ios::openmode om;
+    switch (mode) {
+        case FileMode::Read:   om = std::ios::in; break;
+        case FileMode::Write:  om = std::ios::out | std::ios::trunc; break;
+        case FileMode::Append: om = std::ios::out | std::ios::app; break;
+        default: return false;
+    }
+
+    std::fstream stream(name, om | std::ios::binary);
+    if (!stream) return false;
+
+    open_.emplace(key, Handle{ mode, std::move(stream) });
+    return true;
+}
+
+bool DiskFiles::read_line(const std::string &name, std::string &line) {
+    auto search = open_.find(file_key(name));
+    if (search == open_.end() || search->second.mode_ != FileMode::Read) return false;
+    return static_cast<bool>(std::getline(search->second.stream_, line));
+}
+
+bool DiskFiles::write_line(const std::string &name, const std::string &line) {
+    auto search = open_.find(file_key(name));
+    if (search == open_.end() || search->second.mode_ == FileMode::Read) return false;
+    search->second.stream_ << line << '\n';
+    return static_cast<bool>(search->second.stream_);
+}
+
+bool DiskFiles::eof(const std::string &name) {
+    auto search = open_.find(file_key(name));
+    if (search == open_.end()) return true;
+    auto &s = search->second.stream_;
+    return s.peek() == std::char_traits<char>::eof();
+}
+
+bool DiskFiles::close(const std::string &name) {
+    return open_.erase(file_key(name)) == 1;
+}
+
+void MemoryFiles::preload(const std::string &name, std::string contents) {
+    files_[file_key(name)] = std::move(contents);
+}
+
+bool read_manifest(const std::string &manifest_path, std::vector<NamedFile> &files) {
+    std::ifstream manifest(manifest_path);
+    if (!manifest) return false;
+
+    std::string line;
+    while (std::getline(manifest, line)) {
+        trim(line);
+        if (line.empty()) continue;
+
+        auto sep = line.find_first_of(" \t");
+        if (sep == std::string::npos) return false;
+        std::string name = line.substr(0, sep);
+        std::string host_path = line.substr(sep + 1);
+        trim(host_path);
+
+        std::ifstream host(host_path, std::ios::binary);
+        if (!host) return false;
+        std::ostringstream ss;
+        ss << host.rdbuf();
+        files.push_back(NamedFile{ name, ss.str() });
+    }
+    return true;
+}
+
+bool MemoryFiles::load_manifest(const std::string &manifest_path) {
+    std::vector<NamedFile> files;
+    if (!read_manifest(manifest_path, files)) return false;
+    for (auto &f : files) {
+        preload(f.name_, std::move(f.contents_));
+    }
+    return true;
+}
+
+std::optional<std::string> MemoryFiles::contents(const std::string &name) const {
+    if (auto search = files_.find(file_key(name)); search != files_.end()) {
+        return search->second;
+    }
+    return std::nullopt;
+}
+
+std::vector<NamedFile> MemoryFiles::written() const {
+    std::vector<NamedFile> files;
+    for (const auto &[key, name] : written_) {
+        files.push_back(NamedFile{ name, files_.at(key) });
+    }
+    return files;
+}
+
+bool MemoryFiles::open(const std::string &name, FileMode mode) {
+    auto key = file_key(name);
+    if (open_.contains(key)) return false;
+
+    switch (mode) {
+        case FileMode::Read:
+            if (!files_.contains(key)) return false;
+            break;
+        case FileMode::Write:
+            files_[key].clear();
+            break;
+        case FileMode::Append:
+            files_[key];
+            break;
+        default:
+            return false;
+    }
+
+    if (mode != FileMode::Read && std::ranges::find(written_, key, &std::pair<std::string, std::string>::first) == written_.end()) {
+        written_.emplace_back(key, name);
+    }
+    open_.emplace(key, Handle{ mode, 0 });
+    return true;
+}
+
+bool MemoryFiles::read_line(const std::string &name, std::string &line) {
+    auto key = file_key(name);
+    auto search = open_.find(key);
+    if (search == open_.end() || search->second.mode_ != FileMode::Read) return false;
+
+    auto &data = files_[key];
+    auto &pos = search->second.pos_;
+    if (pos >= data.size()) return false;
+
+    auto nl = data.find('\n', pos);
+    if (nl == std::string::npos) nl = data.size();
+    line.assign(data, pos, nl - pos);
+    pos = nl + 1;
+    return true;
+}
+
+bool MemoryFiles::write_line(const std::string &name, const std::string &line) {
+    auto key = file_key(name);
+    auto search = open_.find(key);
+    if (search == open_.end() || search->second.mode_ == FileMode::Read) return false;
+
+    auto &data = files_[key];
+    data += line;
+    data += '\n';
+    return true;
+}
+
+bool MemoryFiles::eof(const std::string &name) {
+    auto key = file_key(name);
+    auto search = open_.find(key);
+    if (search == open_.end()) return true;
+    return search->second.pos_ >= files_[key].size();
+}
+
+bool MemoryFiles::close(const std::string &name) {
+    return open_.erase(file_key(name)) == 1;
+}
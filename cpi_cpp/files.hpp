@@ -0,0 +1,76 @@
+#pragma once
+
+#include "util.hpp"
+#include "cpi.hpp"
+
+#include <fstream>
+
+// Storage behind OPENFILE, READFILE, WRITEFILE, EOF and CLOSEFILE.
+// Files are identified by the name used in OPENFILE, case-insensitively, so
+// "FileB.txt" and "FILEB.txt" refer to the same open file.
+struct FileBackend {
+    virtual ~FileBackend() = default;
+
+    virtual bool open(const std::string &name, FileMode mode) = 0;
+    virtual bool read_line(const std::string &name, std::string &line) = 0;
+    virtual bool write_line(const std::string &name, const std::string &line) = 0;
+    virtual bool eof(const std::string &name) = 0;
+    virtual bool close(const std::string &name) = 0;
+};
+
+// The real disk, relative to the working directory.
+struct DiskFiles : FileBackend {
+    bool open(const std::string &name, FileMode mode) override;
+    bool read_line(const std::string &name, std::string &line) override;
+    bool write_line(const std::string &name, const std::string &line) override;
+    bool eof(const std::string &name) override;
+    bool close(const std::string &name) override;
+
+private:
+    struct Handle {
+        FileMode mode_;
+        std::fstream stream_;
+    };
+    std::unordered_map<std::string, Handle> open_;
+};
+
+// A whole file, as carried between a client and the daemon.
+struct NamedFile {
+    std::string name_;
+    std::string contents_;
+};
+
+// Each line of a manifest is "<name> <host path>". Reads every host file,
+// once, into `files` under <name>. False if the manifest or a file listed in
+// it cannot be read.
+bool read_manifest(const std::string &manifest_path, std::vector<NamedFile> &files);
+
+// Files held entirely in memory, for sandboxed and batch runs. Nothing
+// touches the disk after preloading; written files are kept for inspection.
+struct MemoryFiles : FileBackend {
+    void preload(const std::string &name, std::string contents);
+
+    // Preloads the files listed in a manifest, as read_manifest reads them.
+    bool load_manifest(const std::string &manifest_path);
+
+    // Contents of every file, including those written by the program.
+    std::optional<std::string> contents(const std::string &name) const;
+    // The files opened for WRITE or APPEND, under the name first used for
+    // each, in the order they were first opened.
+    std::vector<NamedFile> written() const;
+
+    bool open(const std::string &name, FileMode mode) override;
+    bool read_line(const std::string &name, std::string &line) override;
+    bool write_line(const std::string &name, const std::string &line) override;
+    bool eof(const std::string &name) override;
+    bool close(const std::string &name) override;
+
+private:
+    struct Handle {
+        FileMode mode_;
+        size_t pos_;
+    };
+    std::unordered_map<std::string, std::string> files_;
+    std::unordered_map<std::string, Handle> open_;
+    std::vector<std::pair<std::string, std::string>> written_; // Key and name
+};
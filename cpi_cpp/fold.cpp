@@ -0,0 +1,194 @@
+#include "fold.hpp"
+#include "cases.hpp"
+
+struct Folder {
+    Ast &ast_;
+    FoldStats stats_;
+    std::vector<std::optional<uint32_t>> values_; // Slot -> index into consts_ of a CONSTANT's value
+    int depth_ = 0;
+    std::vector<NodeId> procs_{};
+
+    bool literal(NodeId id) const {
+        return ast_.expr(id).kind_ == ExprKind::Literal;
+    }
+    const Slot &value(NodeId id) const {
+        return ast_.consts_[ast_.expr(id).index_];
+    }
+
+    // Nodes are only ever rewritten in place, never added, so references
+    // into exprs_ stay valid throughout.
+    void make_literal(Expr &e, uint32_t index) {
+        e.kind_ = ExprKind::Literal;
+        e.index_ = index;
+        e.lhs_ = e.rhs_ = no_node;
+        e.args_.clear();
+        e.kernel_ = nullptr;
+        e.predicate_ = nullptr;
+    }
+    void make_literal(Expr &e, Slot v) {
+        ast_.consts_.push_back(std::move(v));
+        make_literal(e, static_cast<uint32_t>(ast_.consts_.size() - 1));
+        stats_.exprs_ += 1;
+    }
+
+    // Evaluates a typed operator on literal operands. False if it throws.
+    bool evaluate(Expr &e, const Slot &l, const Slot &r) {
+        Slot result;
+        result.type_ = *e.type_;
+        try {
+            e.kernel_(result.cell_, l.cell_, r.cell_);
+        } catch (std::exception &) {
+            return false;
+        }
+        make_literal(e, std::move(result));
+        return true;
+    }
+
+    void expr(NodeId id) {
+        Expr &e = ast_.expr(id);
+        switch (e.kind_) {
+            case ExprKind::Literal:
+                break;
+            case ExprKind::Variable:
+                if (e.scope_ == Scope::Global && e.index_ < values_.size() && values_[e.index_]) {
+                    make_literal(e, *values_[e.index_]);
+                    stats_.constants_ += 1;
+                }
+                break;
+            case ExprKind::Call:
+            case ExprKind::Element:
+                for (NodeId a : e.args_) expr(a);
+                break;
+            case ExprKind::Unary:
+                expr(e.lhs_);
+                if (!literal(e.lhs_)) break;
+                if (e.op_ == Op::Expect) {
+                    // A literal of the expected type needs no check
+                    if (value(e.lhs_).type_ == *e.type_) make_literal(e, ast_.expr(e.lhs_).index_);
+                } else if (e.kernel_) {
+                    evaluate(e, value(e.lhs_), value(e.lhs_));
+                }
+                break;
+            case ExprKind::Binary:
+                expr(e.lhs_);
+                expr(e.rhs_);
+                if ((e.op_ == Op::And || e.op_ == Op::Or) && literal(e.lhs_) && value(e.lhs_).type_ == AtomicDt::Boolean) {
+                    // FALSE AND x is FALSE and TRUE OR x is TRUE without x;
+                    // otherwise the result is x
+                    bool l = value(e.lhs_).cell_.b_;
+                    if (l == (e.op_ == Op::Or)) {
+                        make_literal(e, ast_.expr(e.lhs_).index_);
+                    } else {
+                        e = Expr(ast_.expr(e.rhs_));
+                    }
+                    stats_.exprs_ += 1;
+                } else if (e.kernel_ && literal(e.lhs_) && literal(e.rhs_)) {
+                    evaluate(e, value(e.lhs_), value(e.rhs_));
+                }
+                break;
+        }
+    }
+
+    // Folds the statements of a block, replacing those whose branch is known
+    // by the statements that would run.
+    void block(std::vector<NodeId> &stmts) {
+        std::vector<NodeId> out;
+        out.reserve(stmts.size());
+        depth_ += 1;
+        for (NodeId id : stmts) {
+            for (NodeId e : ast_.stmt(id).exprs_) expr(e);
+
+            Stmt &s = ast_.stmt(id);
+            switch (s.kind_) {
+                case StmtKind::Constant:
+                    // A top level CONSTANT is in force for every statement
+                    // after it, which is all that can refer to it
+                    if (depth_ == 1 && s.scope_ == Scope::Global && literal(s.exprs_[0])) {
+                        if (values_.size() <= s.slot_) values_.resize(s.slot_ + 1);
+                        values_[s.slot_] = ast_.expr(s.exprs_[0]).index_;
+                        continue;
+                    }
+                    break;
+                case StmtKind::If:
+                    block(s.body_);
+                    block(s.else_);
+                    if (literal(s.exprs_[0])) {
+                        const auto &taken = value(s.exprs_[0]).cell_.b_ ? s.body_ : s.else_;
+                        out.insert(out.end(), taken.begin(), taken.end());
+                        stats_.branches_ += 1;
+                        continue;
+                    }
+                    break;
+                case StmtKind::While:
+                    block(s.body_);
+                    if (literal(s.exprs_[0]) && !value(s.exprs_[0]).cell_.b_) {
+                        stats_.branches_ += 1;
+                        continue;
+                    }
+                    break;
+                case StmtKind::Repeat:
+                case StmtKind::For:
+                    block(s.body_);
+                    break;
+                case StmtKind::Procedure:
+                    // Folded once every top level CONSTANT is known
+                    procs_.push_back(id);
+                    break;
+                case StmtKind::Case: {
+                    Case &c = ast_.cases_[s.index_];
+                    for (auto &clause : c.clauses_) block(clause.body_);
+                    block(c.otherwise_);
+                    if (literal(s.exprs_[0]) && value(s.exprs_[0]).type_ == c.key_) {
+                        uint32_t clause = select_clause(c, value(s.exprs_[0]));
+                        const auto &taken = clause < c.clauses_.size() ? c.clauses_[clause].body_ : c.otherwise_;
+                        out.insert(out.end(), taken.begin(), taken.end());
+                        stats_.branches_ += 1;
+                        continue;
+                    }
+                    break;
+                }
+                default:
+                    break;
+            }
+            out.push_back(id);
+        }
+        depth_ -= 1;
+        stmts = std::move(out);
+    }
+};
+
+FoldStats fold(Ast &ast) {
+    Folder f{ ast, {}, std::vector<std::optional<uint32_t>>(ast.slots_.size()) };
+    f.block(ast.top_);
+    for (NodeId id : f.procs_) {
+        f.block(ast.stmt(id).body_);
+    }
+    return f.stats_;
+}
+
+static size_t count_expr(const Ast &ast, NodeId id) {
+    if (id == no_node) return 0;
+    const Expr &e = ast.expr(id);
+    size_t n = 1 + count_expr(ast, e.lhs_) + count_expr(ast, e.rhs_);
+    for (NodeId a : e.args_) n += count_expr(ast, a);
+    return n;
+}
+
+static size_t count_block(const Ast &ast, const std::vector<NodeId> &stmts) {
+    size_t n = 0;
+    for (NodeId id : stmts) {
+        const Stmt &s = ast.stmt(id);
+        for (NodeId e : s.exprs_) n += count_expr(ast, e);
+        n += count_block(ast, s.body_) + count_block(ast, s.else_);
+        if (s.kind_ == StmtKind::Case) {
+            const Case &c = ast.cases_[s.index_];
+            for (const auto &clause : c.clauses_) n += count_block(ast, clause.body_);
+            n += count_block(ast, c.otherwise_);
+        }
+    }
+    return n;
+}
+
+size_t reachable_exprs(const Ast &ast) {
+    return count_block(ast, ast.top_);
+}
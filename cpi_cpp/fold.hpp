@@ -0,0 +1,26 @@
+#pragma once
+
+#include "ast.hpp"
+
+// Compile-time evaluation, run on an Ast that has passed check().
+//
+// CONSTANTs declared at the top level are substituted into the expressions
+// that use them, and their declarations dropped. Operators whose operands
+// are then all literals are evaluated with their kernel and replaced by the
+// result; AND and OR fold as soon as their left operand is known. An
+// operation that would fail, such as DIV by zero, is left for run time so
+// that the error is still reported there, against its line.
+//
+// IF and CASE with a literal condition or subject are replaced by the
+// statements of the branch taken, and WHILE FALSE loops are dropped.
+struct FoldStats {
+    size_t constants_ = 0; // Uses of a CONSTANT replaced by its value
+    size_t exprs_ = 0;     // Operators replaced by their result
+    size_t branches_ = 0;  // IF, CASE and WHILE statements settled
+};
+
+FoldStats fold(Ast &ast);
+
+// Expression nodes reachable from the top level statements: the size of what
+// the Engine walks, as folding leaves dead nodes in the pool.
+size_t reachable_exprs(const Ast &ast);
@@ -0,0 +1,310 @@
+#include "kernels.hpp"
+
+#include <climits>
+
+template<auto M, typename F> static void arith(Cell &d, const Cell &l, const Cell &r) {
+    d.*M = F{}(l.*M, r.*M);
+}
+
+// CHARs order by their bytes as unsigned, as the bytes of STRINGs do, so
+// that characters outside ASCII sort after it.
+template<typename T> static decltype(auto) ordered(const T &v) {
+    if constexpr (std::is_same_v<T, char>) return static_cast<unsigned char>(v);
+    else return (v);
+}
+
+template<auto M, typename F> static void cmp(Cell &d, const Cell &l, const Cell &r) {
+    d.b_ = F{}(ordered(l.*M), ordered(r.*M));
+}
+
+template<auto M, typename F> static bool pred(const Cell &l, const Cell &r) {
+    return F{}(ordered(l.*M), ordered(r.*M));
+}
+
+// INTEGER arithmetic whose result does not fit is a run-time error, like
+// division by zero, rather than undefined behaviour.
+template<Op O> static int checked_int(int a, int b) {
+    int v;
+#if defined(__GNUC__) || defined(__clang__)
+    bool over;
+    if constexpr (O == Op::Add) over = __builtin_add_overflow(a, b, &v);
+    else if constexpr (O == Op::Sub) over = __builtin_sub_overflow(a, b, &v);
+    else over = __builtin_mul_overflow(a, b, &v);
+#else
+    // The exact result of any of these fits in 64 bits
+    int64_t wide;
+    if constexpr (O == Op::Add) wide = int64_t{ a } + b;
+    else if constexpr (O == Op::Sub) wide = int64_t{ a } - b;
+    else wide = int64_t{ a } * b;
+    bool over = wide < INT_MIN || wide > INT_MAX;
+    v = static_cast<int>(wide);
+#endif
+    if (over) throw std::runtime_error(std::format("INTEGER overflow in {} {} {}", a, op_name(O), b));
+    return v;
+}
+
+template<Op O> static void arith_int(Cell &d, const Cell &l, const Cell &r) {
+    d.i_ = checked_int<O>(l.i_, r.i_);
+}
+
+// INT_MIN DIV -1 is one more than INT_MAX; INT_MIN MOD -1 is 0, but the
+// hardware traps on it as on the division.
+static void mod_int(Cell &d, const Cell &l, const Cell &r) {
+    if (r.i_ == 0) throw std::runtime_error("MOD by zero");
+    d.i_ = r.i_ == -1 ? 0 : l.i_ % r.i_;
+}
+
+static void div_int(Cell &d, const Cell &l, const Cell &r) {
+    if (r.i_ == 0) throw std::runtime_error("DIV by zero");
+    if (r.i_ == -1 && l.i_ == INT_MIN) throw std::runtime_error(std::format("INTEGER overflow in {} DIV -1", INT_MIN));
+    d.i_ = l.i_ / r.i_;
+}
+
+// Appends in place when l's buffer has room after it, see Str
+static void concat(Cell &d, const Cell &l, const Cell &r) {
+    Str s = l.s_;
+    s += r.s_;
+    d.s_ = std::move(s);
+}
+
+static void and_bool(Cell &d, const Cell &l, const Cell &r) { d.b_ = l.b_ && r.b_; }
+static void or_bool(Cell &d, const Cell &l, const Cell &r) { d.b_ = l.b_ || r.b_; }
+static void not_bool(Cell &d, const Cell &l, const Cell &) { d.b_ = !l.b_; }
+static void neg_int(Cell &d, const Cell &l, const Cell &) {
+    if (l.i_ == INT_MIN) throw std::runtime_error(std::format("INTEGER overflow in -({})", INT_MIN));
+    d.i_ = -l.i_;
+}
+static void neg_real(Cell &d, const Cell &l, const Cell &) { d.r_ = -l.r_; }
+static void int_to_real(Cell &d, const Cell &l, const Cell &) { d.r_ = static_cast<double>(l.i_); }
+static void char_to_string(Cell &d, const Cell &l, const Cell &) { d.s_.assign(1, l.c_); }
+
+template<auto M> static Kernel compare_kernel(Op op) {
+    switch (op) {
+        case Op::Eq: return cmp<M, std::equal_to<>>;
+        case Op::Ne: return cmp<M, std::not_equal_to<>>;
+        case Op::Lt: return cmp<M, std::less<>>;
+        case Op::Le: return cmp<M, std::less_equal<>>;
+        case Op::Gt: return cmp<M, std::greater<>>;
+        case Op::Ge: return cmp<M, std::greater_equal<>>;
+        default: return nullptr;
+    }
+}
+
+Kernel binary_kernel(Op op, AtomicDt operands) {
+    switch (operands) {
+        case AtomicDt::Integer:
+            switch (op) {
+                case Op::Add: return arith_int<Op::Add>;
+                case Op::Sub: return arith_int<Op::Sub>;
+                case Op::Mul: return arith_int<Op::Mul>;
+                case Op::Mod: return mod_int;
+                case Op::IntDiv: return div_int;
+                default: return compare_kernel<&Cell::i_>(op);
+            }
+        case AtomicDt::Real:
+            switch (op) {
+                case Op::Add: return arith<&Cell::r_, std::plus<>>;
+                case Op::Sub: return arith<&Cell::r_, std::minus<>>;
+                case Op::Mul: return arith<&Cell::r_, std::multiplies<>>;
+                case Op::Div: return arith<&Cell::r_, std::divides<>>;
+                default: return compare_kernel<&Cell::r_>(op);
+            }
+        case AtomicDt::Char:
+            return compare_kernel<&Cell::c_>(op);
+        case AtomicDt::String:
+            if (op == Op::Concat) return concat;
+            return compare_kernel<&Cell::s_>(op);
+        case AtomicDt::Boolean:
+            switch (op) {
+                case Op::And: return and_bool;
+                case Op::Or: return or_bool;
+                case Op::Eq: return cmp<&Cell::b_, std::equal_to<>>;
+                case Op::Ne: return cmp<&Cell::b_, std::not_equal_to<>>;
+                default: return nullptr;
+            }
+        case AtomicDt::Date:
+            return compare_kernel<&Cell::i_>(op);
+    }
+    return nullptr;
+}
+
+template<auto M> static Predicate predicate_of(Op op) {
+    switch (op) {
+        case Op::Eq: return pred<M, std::equal_to<>>;
+        case Op::Ne: return pred<M, std::not_equal_to<>>;
+        case Op::Lt: return pred<M, std::less<>>;
+        case Op::Le: return pred<M, std::less_equal<>>;
+        case Op::Gt: return pred<M, std::greater<>>;
+        case Op::Ge: return pred<M, std::greater_equal<>>;
+        default: return nullptr;
+    }
+}
+
+Predicate compare_predicate(Op op, AtomicDt operands) {
+    switch (operands) {
+        case AtomicDt::Integer:
+        case AtomicDt::Date: return predicate_of<&Cell::i_>(op);
+        case AtomicDt::Real: return predicate_of<&Cell::r_>(op);
+        case AtomicDt::Char: return predicate_of<&Cell::c_>(op);
+        case AtomicDt::String: return predicate_of<&Cell::s_>(op);
+        case AtomicDt::Boolean:
+            if (op == Op::Eq || op == Op::Ne) return predicate_of<&Cell::b_>(op);
+            return nullptr;
+    }
+    return nullptr;
+}
+
+Kernel unary_kernel(Op op, AtomicDt operand) {
+    switch (op) {
+        case Op::Not: return operand == AtomicDt::Boolean ? not_bool : nullptr;
+        case Op::Neg:
+            if (operand == AtomicDt::Integer) return neg_int;
+            if (operand == AtomicDt::Real) return neg_real;
+            return nullptr;
+        case Op::ToReal: return operand == AtomicDt::Integer ? int_to_real : nullptr;
+        case Op::ToString: return operand == AtomicDt::Char ? char_to_string : nullptr;
+        default: return nullptr;
+    }
+}
+
+std::string_view op_name(Op op) {
+    switch (op) {
+        case Op::Add: return "+";
+        case Op::Sub: return "-";
+        case Op::Mul: return "*";
+        case Op::Div: return "/";
+        case Op::Mod: return "MOD";
+        case Op::IntDiv: return "DIV";
+        case Op::Concat: return "&";
+        case Op::Eq: return "=";
+        case Op::Ne: return "<>";
+        case Op::Lt: return "<";
+        case Op::Le: return "<=";
+        case Op::Gt: return ">";
+        case Op::Ge: return ">=";
+        case Op::And: return "AND";
+        case Op::Or: return "OR";
+        case Op::Not: return "NOT";
+        case Op::Neg: return "-";
+        default: return "?";
+    }
+}
+
+// -- Dynamic dispatch
+
+template<AtomicDt T> constexpr bool numeric_v = T == AtomicDt::Integer || T == AtomicDt::Real;
+template<AtomicDt T> constexpr bool textual_v = T == AtomicDt::Char || T == AtomicDt::String;
+
+template<AtomicDt T> static double real_of(const Cell &c) {
+    if constexpr (T == AtomicDt::Integer) return static_cast<double>(c.i_);
+    else return c.r_;
+}
+
+// The live member of a cell holding a T. DATE is yyyymmdd, so it orders as an int.
+template<AtomicDt T> static const auto &member(const Cell &c) {
+    if constexpr (T == AtomicDt::Integer || T == AtomicDt::Date) return c.i_;
+    else if constexpr (T == AtomicDt::Real) return c.r_;
+    else if constexpr (T == AtomicDt::Char) return c.c_;
+    else if constexpr (T == AtomicDt::String) return c.s_;
+    else return c.b_;
+}
+
+template<Op O, typename T> static auto apply(const T &a, const T &b) {
+    if constexpr (O == Op::Add) return a + b;
+    else if constexpr (O == Op::Sub) return a - b;
+    else if constexpr (O == Op::Mul) return a * b;
+    else if constexpr (O == Op::Div) return a / b;
+    else if constexpr (O == Op::Eq) return a == b;
+    else if constexpr (O == Op::Ne) return a != b;
+    else if constexpr (O == Op::Lt) return a < b;
+    else if constexpr (O == Op::Le) return a <= b;
+    else if constexpr (O == Op::Gt) return a > b;
+    else return a >= b;
+}
+
+template<Op O, AtomicDt L, AtomicDt R> static void dyn_arith(Slot &d, const Slot &l, const Slot &r) {
+    if constexpr (L == AtomicDt::Integer && R == AtomicDt::Integer && O != Op::Div) {
+        d.cell_.i_ = checked_int<O>(l.cell_.i_, r.cell_.i_);
+        d.type_ = AtomicDt::Integer;
+    } else {
+        d.cell_.r_ = apply<O>(real_of<L>(l.cell_), real_of<R>(r.cell_));
+        d.type_ = AtomicDt::Real;
+    }
+}
+
+template<Op O, AtomicDt L, AtomicDt R> static void dyn_compare(Slot &d, const Slot &l, const Slot &r) {
+    bool b;
+    if constexpr (L != R) b = apply<O>(real_of<L>(l.cell_), real_of<R>(r.cell_));
+    else b = apply<O>(ordered(member<L>(l.cell_)), ordered(member<R>(r.cell_)));
+    d.cell_.b_ = b;
+    d.type_ = AtomicDt::Boolean;
+}
+
+template<AtomicDt T> static void append(Str &s, const Cell &c) {
+    if constexpr (T == AtomicDt::Char) s += c.c_;
+    else s += c.s_;
+}
+
+template<AtomicDt L, AtomicDt R> static void dyn_concat(Slot &d, const Slot &l, const Slot &r) {
+    Str s;
+    if constexpr (L == AtomicDt::String) s = l.cell_.s_;
+    else append<L>(s, l.cell_);
+    append<R>(s, r.cell_);
+    d.cell_.s_ = std::move(s);
+    d.type_ = AtomicDt::String;
+}
+
+// Wraps a typed kernel whose result type is fixed
+template<Kernel K, AtomicDt Result> static void dyn_typed(Slot &d, const Slot &l, const Slot &r) {
+    K(d.cell_, l.cell_, r.cell_);
+    d.type_ = Result;
+}
+
+template<Op O, AtomicDt L, AtomicDt R> static constexpr DynamicKernel dynamic_handler() {
+    constexpr bool numeric = numeric_v<L> && numeric_v<R>;
+    constexpr bool same = L == R;
+    constexpr bool booleans = same && L == AtomicDt::Boolean;
+
+    if constexpr ((O == Op::Add || O == Op::Sub || O == Op::Mul || O == Op::Div) && numeric) {
+        return dyn_arith<O, L, R>;
+    } else if constexpr ((O == Op::Mod || O == Op::IntDiv) && same && L == AtomicDt::Integer) {
+        return O == Op::Mod ? dyn_typed<mod_int, AtomicDt::Integer> : dyn_typed<div_int, AtomicDt::Integer>;
+    } else if constexpr (O == Op::Concat && textual_v<L> && textual_v<R>) {
+        return dyn_concat<L, R>;
+    } else if constexpr (O == Op::Eq || O == Op::Ne) {
+        if constexpr (numeric || same) return dyn_compare<O, L, R>;
+        else return nullptr;
+    } else if constexpr (O == Op::Lt || O == Op::Le || O == Op::Gt || O == Op::Ge) {
+        if constexpr (numeric || (same && !booleans)) return dyn_compare<O, L, R>;
+        else return nullptr;
+    } else if constexpr ((O == Op::And || O == Op::Or) && booleans) {
+        return O == Op::And ? dyn_typed<and_bool, AtomicDt::Boolean> : dyn_typed<or_bool, AtomicDt::Boolean>;
+    } else if constexpr (O == Op::Not && booleans) {
+        return dyn_typed<not_bool, AtomicDt::Boolean>;
+    } else if constexpr (O == Op::Neg && same && L == AtomicDt::Integer) {
+        return dyn_typed<neg_int, AtomicDt::Integer>;
+    } else if constexpr (O == Op::Neg && same && L == AtomicDt::Real) {
+        return dyn_typed<neg_real, AtomicDt::Real>;
+    } else {
+        return nullptr;
+    }
+}
+
+template<size_t... I> static constexpr auto make_dynamic_table(std::index_sequence<I...>) {
+    return std::array<DynamicKernel, sizeof...(I)>{
+        dynamic_handler<
+            static_cast<Op>(I / (atomic_dts * atomic_dts)),
+            static_cast<AtomicDt>(I / atomic_dts % atomic_dts),
+            static_cast<AtomicDt>(I % atomic_dts)>()...
+    };
+}
+
+constinit const std::array<DynamicKernel, dynamic_ops * atomic_dts * atomic_dts> dynamic_table =
+    make_dynamic_table(std::make_index_sequence<dynamic_ops * atomic_dts * atomic_dts>{});
+
+void throw_operand_mismatch(Op op, AtomicDt l, AtomicDt r) {
+    if (op == Op::Not || op == Op::Neg) {
+        throw std::invalid_argument(std::format("Cannot apply {} to {}", op_name(op), atomic_dt_name(l)));
+    }
+    throw std::invalid_argument(std::format("Cannot apply {} to {} and {}", op_name(op), atomic_dt_name(l), atomic_dt_name(r)));
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "ast.hpp"
+
+// Monomorphic kernels, one per operator and operand type. The checker picks
+// one for every expression whose operand types it has proven, after
+// inserting any INTEGER -> REAL or CHAR -> STRING conversions, so a kernel
+// never has to look at a type tag.
+//
+// Unary kernels ignore their right operand.
+
+// nullptr if the operator does not apply to operands of that type.
+Kernel binary_kernel(Op op, AtomicDt operands);
+Kernel unary_kernel(Op op, AtomicDt operand);
+// The predicate form of a comparison kernel; nullptr for other operators.
+Predicate compare_predicate(Op op, AtomicDt operands);
+
+std::string_view op_name(Op op);
+
+// -- Dynamic dispatch
+// For operands whose types are only known at run time. One handler per
+// (operator, lhs type, rhs type), generated at compile time, so evaluating a
+// dynamic operation is a table load and an indirect call. Handlers set the
+// result tag, promoting INTEGER to REAL when the operands are mixed.
+// Unary operators are looked up with the operand type on both sides.
+using DynamicKernel = void (*)(Slot &dst, const Slot &l, const Slot &r);
+
+inline constexpr size_t dynamic_ops = static_cast<size_t>(Op::Neg) + 1;
+inline constexpr size_t atomic_dts = static_cast<size_t>(AtomicDt::Date) + 1;
+
+extern const std::array<DynamicKernel, dynamic_ops * atomic_dts * atomic_dts> dynamic_table;
+
+// nullptr if the operator does not apply to those operand types.
+inline DynamicKernel dynamic_kernel(Op op, AtomicDt l, AtomicDt r) {
+    return dynamic_table[(static_cast<size_t>(op) * atomic_dts + static_cast<size_t>(l)) * atomic_dts + static_cast<size_t>(r)];
+}
+
+[[noreturn]] void throw_operand_mismatch(Op op, AtomicDt l, AtomicDt r);
+
+inline void apply_dynamic(Op op, Slot &dst, const Slot &l, const Slot &r) {
+    if (auto k = dynamic_kernel(op, l.type_, r.type_)) return k(dst, l, r);
+    throw_operand_mismatch(op, l.type_, r.type_);
+}
@@ -2,123 +2,18 @@
 
 #include "util.hpp"
 #include "cpi.hpp"
+#include "exec.hpp"
+#include "daemon.hpp"
+#include "files.hpp"
+#include "kernels.hpp"
+#include "engine.hpp"
+#include "ascii.hpp"
+#ifdef CPI_COUNT_ALLOCS
+#include "alloc.hpp"
+#endif
 
-using Data = std::variant<int64_t, std::vector<unsigned char>>;
-struct VarData {
-    std::string type;
-    Data data;
-};
-using VarsInScope = std::unordered_map<std::string, VarData>;
-using Scopes = std::vector<VarsInScope>;
-
-const std::string name_type_sep = ":";
-const std::string adt_integer = "integer";
-
-auto split = [](std::string s) -> std::tuple<std::string, std::string> {
-    auto space = s.find(" ");
-    return std::make_tuple(
-        s.substr(0, space),
-        s.substr(space + 1, s.size())
-    );
-};
-
-auto name_colon_type = [](std::string s) -> std::tuple<std::string, std::string> {
-    auto colon = s.find(":");
-    return std::make_tuple(
-        s.substr(0, colon),
-        s.substr(colon + 1, s.size())
-    );
-};
-
-static bool exec_stmt(VarsInScope &vars, std::string stmt) {
-    trim(stmt);
-
-    // First word hints at the statement type
-    auto [first_word, rest] = split(stmt);
-    lower(first_word);
-
-    if ("declare" == first_word) {
-        // Name : type splitter
-        auto [name, type] = name_colon_type(rest);
-
-        trim(name);
-        lower(name);
-        if (vars.contains(name)) {
-            std::println("Variable \"{}\" declared previously in this scope.", name);
-            return false;
-        }
-
-        // Create default value
-        auto default_val_from_type = [](std::string var_type) -> Data {
-            assert(adt_integer == var_type);
-            {
-                int64_t num = 0;
-                Data dat{ num };
-                return dat;
-            }
-        };
-        trim(type);
-        lower(type);
-        Data default_value = default_val_from_type(type);
-
-        // Assign default value
-        VarData v{ type, default_value };
-        vars.insert(std::make_pair(name, v));
-    } else if ("output" == first_word) {
-        // Get output expr
-        trim(rest);
-
-        // Eval output expr
-        if (auto search = vars.find(rest); search != vars.end()) {
-            auto &v = search->second;
-            std::visit([](auto &&arg) { std::print("{}", arg); }, v.data);
-        } else {
-            std::println("Variable \"{}\" not found in this scope", rest);
-            return false;
-        }
-    } else { // Assignment
-        std::string ass_op_eq = "=";
-        std::string ass_op_ar = "<-";
-        std::string assop;
-
-        auto &lhs = first_word;
-
-        ltrim(rest);
-        auto loc_eq = rest.find(ass_op_eq);
-        auto loc_arrow = rest.find(ass_op_ar);
-        if (loc_eq == 0) {
-            assop = ass_op_eq;
-        } else if (loc_arrow == 0) {
-            assop = ass_op_ar;
-        } else {
-            std::println("Assignment operator not found at beginning of rhs");
-            return false;
-        }
-
-        auto rhs = rest.substr(rest.find(assop) + assop.size(), rest.size());
-        trim(rhs);
-        lower(rhs);
-
-        if (auto search_lhs = vars.find(lhs); search_lhs != vars.end()) {
-            if (auto search_rhs = vars.find(rhs); search_rhs != vars.end()) {
-                if (search_lhs->second.type == search_rhs->second.type) {
-                    search_lhs->second.data = search_rhs->second.data;
-                    return true;
-                } else {
-                    std::println("LHS type ({}) and RHS type ({}) do not match", search_lhs->second.type, search_rhs->second.type);
-                    return false;
-                }
-            } else {
-                std::println("RHS \"{}\" not found in this scope", rhs);
-                return false;
-            }
-        } else {
-            std::println("LHS \"{}\" not found in this scope", lhs);
-            return false;
-        }
-    }
-    return true;
-}
+#include <filesystem>
+#include <fstream>
 
 // TODO: Implement tests. Every branch of this code.
 
@@ -274,6 +169,805 @@ bool run_tests() {
             }
             return false;
         }),
+
+        tst("Compile strips comments and blank lines", []() -> bool {
+            Program p = compile("// header\n\nDECLARE x : INTEGER // trailing\n   OUTPUT x\n");
+            return p.errors_.empty()
+                && p.ast_.top_.size() == 2
+                && p.ast_.stmt(p.ast_.top_[0]).kind_ == StmtKind::Declare
+                && p.ast_.stmt(p.ast_.top_[1]).kind_ == StmtKind::Output;
+        }),
+
+        tst("Type check annotates expressions", []() -> bool {
+            Program p = compile("DECLARE r : REAL\nr <- 1 + 2.5\nOUTPUT r * 2, \" \", 7 DIV 2\n", false);
+            if (!p.errors_.empty()) return false;
+
+            // 1 is widened to REAL before the addition runs on the REAL kernel
+            const Ast &ast = p.ast_;
+            const Expr &sum = ast.expr(ast.stmt(ast.top_[1]).exprs_[0]);
+            bool ok = sum.type_ == AtomicDt::Real && sum.kernel_ != nullptr;
+            ok &= ast.expr(sum.lhs_).op_ == Op::ToReal;
+
+            std::istringstream in;
+            std::ostringstream out;
+            ok &= 0 == run(p, in, out);
+            ok &= out.str() == "7.0 3\n";
+            return ok;
+        }),
+
+        tst("Type errors stop the program before it runs", []() -> bool {
+            Program p = compile(
+                "OUTPUT \"starting\"\n"
+                "DECLARE n : INTEGER\n"
+                "n <- \"ten\"\n"
+                "OUTPUT n MOD 2.5\n"
+                "OUTPUT missing\n");
+            bool ok = p.errors_.size() == 3;
+            ok &= p.errors_[0].starts_with("Line 3:");
+
+            std::istringstream in;
+            std::ostringstream out;
+            ok &= 1 == run(p, in, out);
+            ok &= out.str().find("starting") == std::string::npos;
+            return ok;
+        }),
+
+        tst("Input without a declaration is typed at run time", []() -> bool {
+            Program p = compile("INPUT x\nOUTPUT x + 1\nOUTPUT x / 2 > 1\n");
+            if (!p.errors_.empty()) return false;
+
+            std::istringstream ints("4\n");
+            std::ostringstream int_out;
+            bool ok = 0 == run(p, ints, int_out);
+            ok &= int_out.str() == "5\nTRUE\n";
+
+            std::istringstream reals("1.5\n");
+            std::ostringstream real_out;
+            ok &= 0 == run(p, reals, real_out);
+            ok &= real_out.str().starts_with("2.5\nFALSE\n");
+
+            std::istringstream text("hi\n");
+            std::ostringstream text_out;
+            ok &= 1 == run(p, text, text_out);
+            ok &= text_out.str().starts_with("Line 2:");
+            return ok;
+        }),
+
+        tst("Dynamic dispatch table", []() -> bool {
+            auto slot = [](auto v) { return to_slot(atomic_value(v)); };
+            Slot d;
+
+            apply_dynamic(Op::Add, d, slot(Integer(2)), slot(Real(0.5)));
+            bool ok = d.type_ == AtomicDt::Real && d.cell_.r_ == 2.5;
+            apply_dynamic(Op::Mul, d, slot(Integer(6)), slot(Integer(7)));
+            ok &= d.type_ == AtomicDt::Integer && d.cell_.i_ == 42;
+            apply_dynamic(Op::Concat, d, slot(String("ab")), slot(Char('c')));
+            ok &= d.type_ == AtomicDt::String && d.cell_.s_ == "abc";
+            apply_dynamic(Op::Lt, d, slot(Date("31/12/2023")), slot(Date("01/01/2024")));
+            ok &= d.type_ == AtomicDt::Boolean && d.cell_.b_;
+
+            ok &= dynamic_kernel(Op::Add, AtomicDt::String, AtomicDt::Integer) == nullptr;
+            ok &= dynamic_kernel(Op::Lt, AtomicDt::Boolean, AtomicDt::Boolean) == nullptr;
+            ok &= dynamic_kernel(Op::Eq, AtomicDt::Boolean, AtomicDt::Boolean) != nullptr;
+
+            Interpreter interp;
+            ok &= interp.greater_than(atomic_value(Real(1.5)), atomic_value(Integer(1))).data_;
+            try {
+                interp.addition(atomic_value(String("a")), atomic_value(Integer(1)));
+                ok = false;
+            } catch (std::invalid_argument &) {
+            }
+            return ok;
+        }),
+
+        tst("REAL text is the shortest that reads back the same", []() -> bool {
+            Program p = compile("INPUT x\nOUTPUT x, \" \", x * 3, \" \", 1 / 3, \" \", x * 20\n");
+            std::istringstream in("0.1\n");
+            std::ostringstream out;
+            bool ok = 0 == run(p, in, out);
+            ok &= out.str() == "0.1 0.30000000000000004 0.3333333333333333 2.0\n";
+
+            for (double r : { 0.0, -1.5, 1.0 / 3, 1e-7, 6.02214076e23, 123456789.0, 5e-324 }) {
+                Slot s{ AtomicDt::Real, {} };
+                s.cell_.r_ = r;
+                Slot back = parse_slot(AtomicDt::Real, slot_to_string(s));
+                ok &= back.cell_.r_ == r && infer_slot(slot_to_string(s)).type_ == AtomicDt::Real;
+            }
+            ok &= parse_slot(AtomicDt::Real, " +2.5").cell_.r_ == 2.5;
+            ok &= infer_slot("7").type_ == AtomicDt::Integer;
+            try {
+                parse_slot(AtomicDt::Real, "2.5x");
+                ok = false;
+            } catch (std::invalid_argument &) {
+            }
+            return ok;
+        }),
+
+        tst("Random numbers are in range and repeat with a seed", []() -> bool {
+            Rng a(42), b(42), c(43);
+            bool ok = true;
+            for (int i = 0; i < 100; ++i) {
+                uint64_t x = a.next();
+                ok &= x == b.next() && x != c.next();
+            }
+
+            // Unbiased: each face within 5% of its share
+            std::array<int, 6> faces{};
+            for (int i = 0; i < 60000; ++i) faces[a.below(6)] += 1;
+            for (int n : faces) ok &= n > 9500 && n < 10500;
+            ok &= a.below(1) == 0;
+
+            Interpreter interp;
+            for (int i = 0; i < 1000; ++i) {
+                int n = interp.randombetween(Integer(INT_MIN), Integer(INT_MAX)).data_;
+                ok &= interp.randombetween(Integer(-3), Integer(3)).data_ >= -3 && n >= INT_MIN;
+                double r = interp.rnd().data_;
+                ok &= r >= 0.0 && r < 1.0;
+            }
+
+            Program p = compile(
+                "FOR i <- 1 TO 1000\n"
+                "   n <- RANDOMBETWEEN(-3, 3)\n"
+                "   r <- RND()\n"
+                "   IF n < -3 OR n > 3 OR r < 0.0 OR r >= 1.0\n"
+                "     THEN\n"
+                "       OUTPUT \"out of range\"\n"
+                "   ENDIF\n"
+                "ENDFOR\n"
+                "OUTPUT RANDOMBETWEEN(1, 1000000), \" \", RND()\n");
+            auto output = [&](std::optional<uint64_t> seed) {
+                std::istringstream in;
+                std::ostringstream out;
+                run(p, in, out, seed);
+                return out.str();
+            };
+            std::string first = output(7);
+            ok &= first == output(7) && first != output(8) && first.find("range") == std::string::npos;
+
+            std::istringstream in;
+            std::ostringstream out;
+            ok &= 1 == run(compile("OUTPUT RANDOMBETWEEN(5, 1)\n"), in, out);
+            return ok;
+        }),
+
+        tst("Dynamic nodes quicken and despecialise", []() -> bool {
+            Program p = compile("INPUT x\nOUTPUT x * 2\n");
+            if (!p.errors_.empty()) return false;
+
+            Interpreter interp;
+            std::istringstream in("4\n5\n1.5\n");
+            std::ostringstream out;
+            Engine engine(p.ast_, interp, in, out);
+            engine.run();
+            engine.run();
+            bool ok = engine.quickened_ == 1 && engine.despecialised_ == 0;
+            engine.run();
+            ok &= engine.quickened_ == 2 && engine.despecialised_ == 1;
+            ok &= out.str() == "8\n10\n3.0\n";
+            return ok;
+        }),
+
+#ifdef CPI_COUNT_ALLOCS
+        // Only the cpi_tests build links the counters
+        tst("A warmed-up loop allocates nothing", []() -> bool {
+            Program p = compile(
+                "DECLARE s : STRING\n"
+                "s <- \"a string too long to be stored inline\"\n"
+                "Total <- 0\n"
+                "i <- 0\n"
+                "WHILE i < 100\n"
+                "   i <- i + 1\n"
+                "   CASE OF i MOD 4\n"
+                "      0 : Total <- Total + LENGTH(s)\n"
+                "      1 : Total <- Total - 1\n"
+                "      OTHERWISE : Total <- Total * 1\n"
+                "   ENDCASE\n"
+                "   IF Total > 1000 THEN\n"
+                "      Total <- Total - 1000\n"
+                "   ENDIF\n"
+                "   OUTPUT MID(s, 3, 20), \" \", Total, \" \", i / 2\n"
+                "ENDWHILE\n");
+            if (!p.errors_.empty()) return false;
+
+            struct Discard : std::streambuf {
+                int overflow(int c) override { return c; }
+                std::streamsize xsputn(const char *, std::streamsize n) override { return n; }
+            } discard;
+            Interpreter interp;
+            std::istringstream in;
+            std::ostream out(&discard);
+            Engine engine(p.ast_, interp, in, out);
+            engine.run();
+            AllocCounts before = alloc_counts();
+            engine.run();
+            AllocCounts after = alloc_counts();
+            return after.allocations_ == before.allocations_ && after.bytes_ == before.bytes_;
+        }),
+#endif
+
+        tst("CASE dispatch", []() -> bool {
+            auto outputs = [](const Program &p, std::string input) {
+                std::istringstream in(input);
+                std::ostringstream out;
+                if (0 != run(p, in, out)) return std::string("failed: ") + out.str();
+                return out.str();
+            };
+
+            // Adapted from examples/eg_formatted_case_statements.txt
+            Program moves = compile(
+                "DECLARE Move : CHAR\n"
+                "Position <- 50\n"
+                "INPUT Move\n"
+                "CASE OF Move\n"
+                "   'W': Position <- Position - 10\n"
+                "   'S': Position <- Position + 10\n"
+                "   'A': Position <- Position - 1\n"
+                "   'D': Position <- Position + 1\n"
+                "   OTHERWISE : OUTPUT \"Beep\"\n"
+                "ENDCASE\n"
+                "OUTPUT Position\n");
+            bool ok = moves.errors_.empty();
+            ok &= moves.ast_.cases_[0].dispatch_ == CaseDispatch::Jump;
+            ok &= outputs(moves, "S\n") == "60\n";
+            ok &= outputs(moves, "A\n") == "49\n";
+            ok &= outputs(moves, "X\n") == "Beep\n50\n";
+
+            // Ranges, multi-line bodies, first match wins on overlap
+            Program grades = compile(
+                "INPUT Mark\n"
+                "CASE OF Mark\n"
+                "   90 TO 100 : OUTPUT \"A\"\n"
+                "   -5 TO 89 :\n"
+                "      OUTPUT \"pass\"\n"
+                "      OUTPUT \"or not\"\n"
+                "   50 : OUTPUT \"never\"\n"
+                "   OTHERWISE\n"
+                "      OUTPUT \"out of range\"\n"
+                "ENDCASE\n");
+            ok &= grades.errors_.empty();
+            ok &= grades.ast_.cases_[0].dispatch_ == CaseDispatch::Linear;
+            ok &= outputs(grades, "95\n") == "A\n";
+            ok &= outputs(grades, "50\n") == "pass\nor not\n";
+            ok &= outputs(grades, "-6\n") == "out of range\n";
+            ok &= outputs(grades, "101\n") == "out of range\n";
+
+            // CHARs beyond ASCII order above it whichever dispatch is used
+            auto high = [&](std::string clauses, CaseDispatch want) {
+                Program p = compile("DECLARE c : CHAR\nINPUT c\nCASE OF c\n" + clauses + "   OTHERWISE : OUTPUT \"low\"\nENDCASE\n");
+                return p.errors_.empty() && p.ast_.cases_[0].dispatch_ == want && outputs(p, "\xe9\n") == "high\n";
+            };
+            ok &= high("   '\xe8' TO '\xea' : OUTPUT \"high\"\n", CaseDispatch::Jump);
+            ok &= high("   'a' TO '\xff' : OUTPUT \"high\"\n", CaseDispatch::Search);
+            ok &= high("   'a' TO '\xff' : OUTPUT \"high\"\n   'b' : OUTPUT \"b\"\n", CaseDispatch::Linear);
+            ok &= outputs(compile("DECLARE c : CHAR\nINPUT c\nOUTPUT c > 'z'\n"), "\xe9\n") == "TRUE\n";
+
+            // Strings and sparse numbers are binary searched
+            Program words = compile(
+                "DECLARE w : STRING\n"
+                "INPUT w\n"
+                "CASE OF w\n"
+                "   \"apple\" : OUTPUT 1\n"
+                "   \"b\" TO \"d\" : OUTPUT 2\n"
+                "   'z' : OUTPUT 3\n"
+                "ENDCASE\n"
+                "CASE OF LENGTH(w) * 1000\n"
+                "   1000 : OUTPUT \"one\"\n"
+                "   100000 : OUTPUT \"hundred\"\n"
+                "ENDCASE\n");
+            ok &= words.errors_.empty();
+            ok &= words.ast_.cases_[0].dispatch_ == CaseDispatch::Search;
+            ok &= words.ast_.cases_[1].dispatch_ == CaseDispatch::Search;
+            ok &= outputs(words, "apple\n") == "1\n";
+            ok &= outputs(words, "cat\n") == "2\n";
+            ok &= outputs(words, "z\n") == "3\none\n";
+            ok &= outputs(words, "dog\n") == "";
+
+            Program unclosed = compile("DECLARE n : INTEGER\nCASE OF n\n   1 : OUTPUT 1\n");
+            ok &= unclosed.errors_.size() == 1 && unclosed.errors_[0].starts_with("Line 2:");
+            Program mistyped = compile("DECLARE n : INTEGER\nCASE OF n\n   \"x\" : OUTPUT 1\nENDCASE\n");
+            ok &= mistyped.errors_.size() == 1 && mistyped.errors_[0].starts_with("Line 3:");
+            return ok;
+        }),
+
+        tst("FOR loops", []() -> bool {
+            auto outputs = [](std::string source, std::string input = "") {
+                Program p = compile(source);
+                std::istringstream in(input);
+                std::ostringstream out;
+                if (0 != run(p, in, out)) return std::string("failed: ") + out.str();
+                return out.str();
+            };
+
+            // Adapted from examples/eg_nested_for_loops.txt
+            bool ok = outputs(
+                "Total = 0\n"
+                "MaxRow <- 3\n"
+                "FOR Row = 1 TO MaxRow\n"
+                "   RowTotal = 0\n"
+                "   FOR Column = 1 TO 10\n"
+                "       RowTotal <- RowTotal + Row * Column\n"
+                "   ENDFOR Column\n"
+                "   OUTPUT \"Total for Row \", Row, \" is \", RowTotal\n"
+                "   Total <- Total + RowTotal\n"
+                "ENDFOR Row\n"
+                "OUTPUT \"The grand total is \", Total\n")
+                == "Total for Row 1 is 55\nTotal for Row 2 is 110\nTotal for Row 3 is 165\nThe grand total is 330\n";
+
+            // STEP -1 as in examples/eg_handling_random_files.txt, and NEXT
+            ok &= outputs("FOR Position = 20 TO 17 STEP -1\n   OUTPUT Position\nNEXT Position\n") == "20\n19\n18\n17\n";
+            ok &= outputs("FOR i <- 1 TO 10 STEP 4\n   OUTPUT i\nENDFOR\n") == "1\n5\n9\n";
+            ok &= outputs("FOR i <- 5 TO 1\n   OUTPUT i\nENDFOR\nOUTPUT \"done\"\n") == "done\n";
+
+            // Bounds are evaluated once
+            ok &= outputs("n <- 3\nFOR i <- 1 TO n\n   n <- n + 1\nENDFOR\nOUTPUT n\n") == "6\n";
+            // Bounds read at run time are checked once, on entry
+            ok &= outputs("INPUT n\nFOR i <- 1 TO n\n   OUTPUT i\nENDFOR\n", "2\n") == "1\n2\n";
+
+            ok &= outputs("FOR x <- 0 TO 1 STEP 0.5\n   OUTPUT x\nENDFOR\n") == "0.0\n0.5\n1.0\n";
+            ok &= outputs("FOR i <- 1 TO 2 STEP 0\nENDFOR\n").starts_with("failed: Line 1:");
+
+            ok &= compile("FOR i <- 1 TO 2\nENDFOR j\n").errors_.size() == 2;
+            ok &= compile("FOR i <- 1 TO 2\n").errors_.size() == 1;
+            ok &= compile("DECLARE s : STRING\nFOR s <- 1 TO 2\nENDFOR\n").errors_.size() == 1;
+            return ok;
+        }),
+
+        tst("IF, WHILE and REPEAT", []() -> bool {
+            auto outputs = [](std::string source, std::string input = "") {
+                Program p = compile(source);
+                std::istringstream in(input);
+                std::ostringstream out;
+                if (0 != run(p, in, out)) return std::string("failed: ") + out.str();
+                return out.str();
+            };
+
+            // Adapted from examples/eg_nested_if_statements.txt
+            std::string champion =
+                "INPUT ChallengerScore\nChampionScore <- 50\nHighestScore <- 70\n"
+                "IF ChallengerScore > ChampionScore\n"
+                "   THEN\n"
+                "       IF ChallengerScore > HighestScore\n"
+                "           THEN\n"
+                "               OUTPUT \"Challenger is champion and highest scorer\"\n"
+                "           ELSE\n"
+                "               OUTPUT \"Challenger is the new champion\"\n"
+                "       ENDIF\n"
+                "   ELSE\n"
+                "       OUTPUT \"Champion is still the champion\"\n"
+                "       IF ChampionScore > HighestScore THEN\n"
+                "           OUTPUT \"Champion is also the highest scorer\"\n"
+                "       ENDIF\n"
+                "ENDIF\n";
+            bool ok = outputs(champion, "80\n") == "Challenger is champion and highest scorer\n";
+            ok &= outputs(champion, "60\n") == "Challenger is the new champion\n";
+            ok &= outputs(champion, "10\n") == "Champion is still the champion\n";
+
+            // examples/eg_while_loop.txt and examples/eg_repeat_until_statement.txt
+            ok &= outputs("Number <- 40\nWHILE Number > 9 DO\n   Number <- Number - 9\nENDWHILE\nOUTPUT Number\n") == "4\n";
+            ok &= outputs(
+                "REPEAT\n"
+                "   OUTPUT \"Please enter the password\"\n"
+                "   INPUT Password\n"
+                "UNTIL Password = \"Secret\"\n", "guess\nSecret\n")
+                == "Please enter the password\nPlease enter the password\n";
+            // Numeric text compared with a STRING is read as one
+            ok &= outputs(
+                "REPEAT\n"
+                "   INPUT Password\n"
+                "UNTIL Password = \"Secret\"\n"
+                "OUTPUT LENGTH(Password)\n", "12345\nSecret\n") == "6\n";
+            ok &= outputs("INPUT Pin\nIF Pin = \"0042\" THEN\n   OUTPUT Pin\nENDIF\n", "0042\n") == "0042\n";
+            ok &= outputs("INPUT Answer\nCASE OF Answer\n   \"1\" : OUTPUT \"one\"\nENDCASE\n", "1\n") == "one\n";
+
+            // The right operand of AND and OR is only evaluated when needed
+            ok &= outputs("n <- 0\nIF n <> 0 AND 10 DIV n > 1\n  THEN OUTPUT \"big\"\n  ELSE OUTPUT \"skipped\"\nENDIF\n") == "skipped\n";
+            ok &= outputs("n <- 0\nb <- n = 0 OR 10 DIV n > 1\nOUTPUT b\n") == "TRUE\n";
+            ok &= outputs("n <- 0\nb <- n = 1 OR 10 DIV n > 1\n").starts_with("failed: Line 2:");
+
+            ok &= compile("IF 1 THEN\nENDIF\n").errors_.size() == 1;
+            ok &= compile("WHILE TRUE\n").errors_.size() == 1;
+            ok &= compile("ELSE\nUNTIL TRUE\n").errors_.size() == 2;
+            return ok;
+        }),
+
+        tst("INTEGER overflow is a run-time error", []() -> bool {
+            auto outputs = [](std::string source, std::string input) {
+                std::istringstream in(input);
+                std::ostringstream out;
+                if (0 != run(compile(source), in, out)) return std::string("failed: ") + out.str();
+                return out.str();
+            };
+
+            bool ok = true;
+            ok &= outputs("DECLARE n : INTEGER\nINPUT n\nOUTPUT n + 1\n", "2147483646\n") == "2147483647\n";
+            ok &= outputs("DECLARE n : INTEGER\nINPUT n\nOUTPUT n + 1\n", "2147483647\n").starts_with("failed: Line 3: INTEGER overflow");
+            ok &= outputs("DECLARE n : INTEGER\nINPUT n\nOUTPUT n - 2\n", "-2147483647\n").starts_with("failed: Line 3: INTEGER overflow");
+            ok &= outputs("DECLARE n : INTEGER\nINPUT n\nOUTPUT n * n\n", "65536\n").starts_with("failed: Line 3: INTEGER overflow");
+            ok &= outputs("DECLARE n : INTEGER\nINPUT n\nOUTPUT -(n - 1)\n", "-2147483647\n").starts_with("failed: Line 3: INTEGER overflow");
+            ok &= outputs("DECLARE n : INTEGER\nINPUT n\nn <- n - 1\nOUTPUT n MOD -1\n", "-2147483647\n") == "0\n";
+            ok &= outputs("DECLARE n : INTEGER\nINPUT n\nn <- n - 1\nOUTPUT n DIV -1\n", "-2147483647\n").starts_with("failed: Line 4: INTEGER overflow");
+            // Types known only at run time take the same checks
+            ok &= outputs("INPUT n\nOUTPUT n * 2\n", "2000000000\n").starts_with("failed: Line 2: INTEGER overflow");
+            ok &= outputs("s <- \"abc\"\nDECLARE n : INTEGER\nINPUT n\nn <- n - 1\nOUTPUT MID(s, n, 1)\n", "-2147483647\n").starts_with("failed: Line 5:");
+            // Folding leaves an overflowing constant to fail when it runs
+            ok &= outputs("OUTPUT \"first\"\nOUTPUT 2147483647 + 1\n", "").starts_with("failed: first\nLine 2: INTEGER overflow");
+            return ok;
+        }),
+
+        tst("Arrays, records and procedures", []() -> bool {
+            auto outputs = [](std::string source) {
+                std::istringstream in;
+                std::ostringstream out;
+                if (0 != run(compile(source), in, out)) return std::string("failed: ") + out.str();
+                return out.str();
+            };
+
+            // Adapted from examples/eg_using_custom_types.txt
+            std::string records =
+                "TYPE Student\n   DECLARE Surname : STRING\n   DECLARE YearGroup : INTEGER\nENDTYPE\n"
+                "DECLARE Pupil1 : Student\nDECLARE Pupil2 : Student\nDECLARE Form : ARRAY[1:30] OF Student\n"
+                "Pupil1.Surname <- \"Johnson\"\nPupil1.YearGroup <- 6\nPupil2 <- Pupil1\nPupil2.YearGroup <- 7\n"
+                "FOR Index <- 1 TO 30\n   Form[Index].YearGroup <- Form[Index].YearGroup + Index\nENDFOR Index\n"
+                "OUTPUT Pupil1.Surname, Pupil1.YearGroup, Pupil2.YearGroup, Form[30].YearGroup\n";
+            bool ok = outputs(records) == "Johnson6730\n";
+            ok &= outputs("DECLARE G : ARRAY[1:3, 0:2] OF CHAR\nG[2, 0] <- 'X'\nOUTPUT G[2, 0], G[1, 2] = G[3, 0]\n") == "XTRUE\n";
+            ok &= outputs("DECLARE A : ARRAY[1:3] OF INTEGER\nOUTPUT A[4]\n").starts_with("failed: Line 2:");
+            ok &= outputs("DECLARE A : ARRAY[1:3] OF INTEGER\nDECLARE B : ARRAY[0:2] OF INTEGER\nA <- B\n").starts_with("failed: Line 3:");
+
+            // examples/eg_passing_parameters_by_reference.txt: BYREF carries over to Y
+            ok &= outputs(
+                "PROCEDURE SWAP(BYREF X : INTEGER, Y : INTEGER)\n   Temp <- X\n   X <- Y\n   Y <- Temp\nENDPROCEDURE\n"
+                "A <- 1\nB <- 2\nCALL SWAP(A, B)\nOUTPUT A, B\n") == "21\n";
+            ok &= outputs(
+                "DECLARE Nums : ARRAY[1:3] OF INTEGER\n"
+                "PROCEDURE Fill(BYREF A : ARRAY OF INTEGER, BYVALUE V : INTEGER)\n"
+                "   FOR I <- 1 TO 3\n      A[I] <- V * I\n   ENDFOR\n   V <- 0\nENDPROCEDURE\n"
+                "PROCEDURE Show(A : ARRAY[1:3] OF INTEGER)\n   A[1] <- 100\n   OUTPUT A[1], A[3]\nENDPROCEDURE\n"
+                "W <- 2\nCALL Fill(Nums, W)\nCALL Show(Nums)\nOUTPUT Nums[1], W\n") == "1006\n22\n";
+            // Each call has its own locals
+            ok &= outputs(
+                "PROCEDURE Down(N : INTEGER)\n   IF N > 0 THEN\n      OUTPUT N\n      CALL Down(N - 1)\n      OUTPUT N\n   ENDIF\nENDPROCEDURE\n"
+                "CALL Down(2)\n") == "2\n1\n1\n2\n";
+            ok &= outputs("PROCEDURE Loop\n   CALL Loop\nENDPROCEDURE\nCALL Loop\n").starts_with("failed: Line 2:");
+
+            ok &= compile("DECLARE A : ARRAY[1:3] OF INTEGER\nA[1, 2] <- 0\n").errors_.size() == 1;
+            ok &= compile("PROCEDURE P(BYREF Q : REAL)\nENDPROCEDURE\nCALL P(1.5)\nCALL P()\n").errors_.size() == 2;
+            ok &= compile("DECLARE A : ARRAY[1:3] OF INTEGER\nOUTPUT A\n").errors_.size() == 1;
+            return ok;
+        }),
+
+        tst("BYVALUE arrays copy only when written", []() -> bool {
+            Program p = compile(
+                "DECLARE Big : ARRAY[1:1000] OF INTEGER\n"
+                "PROCEDURE Peek(A : ARRAY[1:1000] OF INTEGER)\n   OUTPUT A[1000]\nENDPROCEDURE\n"
+                "PROCEDURE Poke(A : ARRAY[1:1000] OF INTEGER)\n   A[1000] <- 1\n   A[999] <- 1\nENDPROCEDURE\n"
+                "CALL Peek(Big)\nCALL Peek(Big)\nCALL Poke(Big)\nOUTPUT Big[1000]\nCopy <- Big\nCopy[1] <- 5\nOUTPUT Big[1]\n");
+            if (!p.errors_.empty()) return false;
+
+            Interpreter interp;
+            std::istringstream in;
+            std::ostringstream out;
+            Engine engine(p.ast_, interp, in, out);
+            engine.run();
+            return engine.copies_ == 2 && out.str() == "0\n0\n0\n0\n";
+        }),
+
+        tst("Constant folding", []() -> bool {
+            auto outputs = [](const Program &p) {
+                std::istringstream in;
+                std::ostringstream out;
+                if (0 != run(p, in, out)) return std::string("failed: ") + out.str();
+                return out.str();
+            };
+
+            std::string source =
+                "CONSTANT Pi = 3.14159\n"
+                "CONSTANT Sides = 6\n"
+                "CONSTANT Mode = 2\n"
+                "DECLARE r : REAL\n"
+                "INPUT r\n"
+                "Area <- Pi * r * r\n"
+                "OUTPUT Area, \" \", 2 * Pi * 10, \" \", Sides * (Sides - 1) DIV 2\n"
+                "IF Sides > 4\n"
+                "  THEN\n"
+                "    OUTPUT \"many\"\n"
+                "  ELSE\n"
+                "    OUTPUT \"few\"\n"
+                "ENDIF\n"
+                "CASE OF Mode\n"
+                "  1 : OUTPUT \"one\"\n"
+                "  2 : OUTPUT \"two\"\n"
+                "  OTHERWISE OUTPUT \"other\"\n"
+                "ENDCASE\n"
+                "WHILE Sides < 0 DO\n"
+                "  OUTPUT \"never\"\n"
+                "ENDWHILE\n";
+            Program folded = compile(source);
+            Program plain = compile(source, false);
+            if (!folded.errors_.empty()) return false;
+
+            // Runs the same as the program written out
+            auto with_input = [](const Program &p) {
+                std::istringstream in("2\n");
+                std::ostringstream out;
+                run(p, in, out);
+                return out.str();
+            };
+            bool ok = with_input(folded) == with_input(plain);
+            ok &= with_input(folded) == "12.56636 62.8318 15\nmany\ntwo\n";
+
+            // The CONSTANTs, the IF, the CASE and the WHILE are gone
+            const Ast &ast = folded.ast_;
+            ok &= ast.top_.size() == 6;
+            ok &= ast.stmt(ast.top_[4]).kind_ == StmtKind::Output && ast.stmt(ast.top_[5]).kind_ == StmtKind::Output;
+            ok &= folded.folded_.constants_ == 7;
+            ok &= folded.folded_.branches_ == 3;
+
+            // 2 * Pi * 10 is a single literal
+            const Stmt &out = ast.stmt(ast.top_[3]);
+            const Expr &circumference = ast.expr(out.exprs_[2]);
+            ok &= circumference.kind_ == ExprKind::Literal && ast.consts_[circumference.index_].type_ == AtomicDt::Real;
+
+            // Errors are still raised when the line runs, not at compile time
+            Program div = compile("OUTPUT \"start\"\nOUTPUT 1 DIV 0\n");
+            ok &= div.errors_.empty();
+            ok &= outputs(div) == "failed: start\nLine 2: DIV by zero\n";
+
+            // and not at all when short-circuited away
+            Program or_ = compile("b <- TRUE OR 1 DIV 0 = 1\nOUTPUT b\n");
+            ok &= reachable_exprs(or_.ast_) < reachable_exprs(compile("b <- TRUE OR 1 DIV 0 = 1\nOUTPUT b\n", false).ast_);
+            ok &= outputs(or_) == "TRUE\n";
+            return ok;
+        }),
+
+        tst("Strings share buffers and append in place", []() -> bool {
+            Str a("a string too long");
+            a += " to be inline"; // Into a new buffer, with room after it
+            Str b = a;
+            bool ok = b.same_bytes(a) && b == a;
+
+            // Views of the same buffer
+            Str sub = a.substr(2, 20);
+            ok &= sub.data() == a.data() + 2 && sub == "string too long to b";
+            ok &= a.substr(0, 8) == "a string";
+
+            // The first append claims the space after a; the second can't
+            Str c = a;
+            c += " and then some";
+            Str d = a;
+            d += "!";
+            ok &= c.data() == a.data() && c == "a string too long to be inline and then some";
+            ok &= d.data() != a.data() && d == "a string too long to be inline!";
+            ok &= a == "a string too long to be inline";
+
+            // Changing a shared string copies it first
+            Str e = a;
+            e.mutable_data()[0] = 'A';
+            ok &= e == "A string too long to be inline" && a == "a string too long to be inline";
+
+            ok &= intern("an interned literal string").same_bytes(intern("an interned literal string"));
+
+            Program p = compile(
+                "DECLARE s : STRING\n"
+                "s <- \"\"\n"
+                "FOR i <- 1 TO 1000\n"
+                "   s <- s & \"ab\"\n"
+                "ENDFOR\n"
+                "t <- MID(s, 3, 20)\n"
+                "OUTPUT LENGTH(s), \" \", LEFT(UCASE(t), 4), \" \", t, \" \", RIGHT(s, 3)\n");
+            std::istringstream in;
+            std::ostringstream out;
+            ok &= 0 == run(p, in, out);
+            ok &= out.str() == "2000 ABAB abababababababababab bab\n";
+            return ok;
+        }),
+
+        tst("ASCII kernels agree with the scalar ones", []() -> bool {
+            // Letters, the bytes either side of them, and non-ASCII bytes
+            std::string all = "@AZ[`az{ Hello, World! \x80\xc1\xe1\xff";
+            while (all.size() < 300) all += all;
+            bool ok = true;
+            for (const AsciiKernels *k : ascii_supported_kernels()) {
+                for (size_t off : { 0, 1, 7 }) {
+                    for (size_t n = 0; n + off <= 200; n += (n < 70 ? 1 : 13)) {
+                        std::string want = all.substr(off, n), got = want;
+                        for (char &c : want) c = c >= 'A' && c <= 'Z' ? c + 32 : c;
+                        k->lower_(got.data(), n);
+                        ok &= got == want;
+                        std::string up = all.substr(off, n);
+                        k->upper_(up.data(), n);
+                        for (char &c : want) c = c >= 'a' && c <= 'z' ? c - 32 : c;
+                        ok &= up == want;
+
+                        ok &= k->iequal_(got.data(), up.data(), n);
+                        if (n > 0) {
+                            // A difference in the last byte, and in the case bit of the
+                            // first, which only matters if it is not a letter
+                            got[n - 1] ^= 1;
+                            ok &= !k->iequal_(got.data(), up.data(), n);
+                            got[n - 1] ^= 1;
+                            bool letter = got[0] >= 'a' && got[0] <= 'z';
+                            got[0] ^= 0x20;
+                            ok &= k->iequal_(got.data(), up.data(), n) == letter;
+                        }
+                    }
+                }
+            }
+            ok &= ascii_iequal("EndIf", "ENDIF") && !ascii_iequal("ENDIF", "ENDI") && !ascii_iequal("[", "{");
+
+            Program p = compile("OUTPUT UCASE(\"Mixed Case, 1 to 2: zZ\"), LCASE('Q'), LCASE(\"MIXED case text that is longer than a vector\")\n");
+            std::istringstream in;
+            std::ostringstream out;
+            ok &= 0 == run(p, in, out);
+            ok &= out.str() == "MIXED CASE, 1 TO 2: ZZqmixed case text that is longer than a vector\n";
+            return ok;
+        }),
+
+        tst("Run with input", []() -> bool {
+            Program p = compile("DECLARE a : INTEGER\nDECLARE b : INTEGER\nINPUT a\nb <- a\nOUTPUT b\n");
+            std::istringstream in("42\n");
+            std::ostringstream out;
+            bool ok = 0 == run(p, in, out);
+            ok &= out.str() == "42\n";
+
+            std::istringstream bad("forty two\n");
+            std::ostringstream bad_out;
+            ok &= 1 == run(p, bad, bad_out);
+            return ok;
+        }),
+
+        tst("Daemon round trip", []() -> bool {
+            auto path = (std::filesystem::temp_directory_path() / std::format("cpi_test_{}.sock", std::random_device{}())).string();
+
+            Daemon d(path, 2);
+            std::thread server([&d] { d.serve(); });
+
+            Request req{ "DECLARE n : INTEGER\nINPUT n\nOUTPUT n\n", "7\n", {} };
+            Response first = daemon_request(path, req);
+            req.input_ = "8\n";
+            Response second = daemon_request(path, req);
+            bool ok = true;
+            ok &= first.status_ == 0 && first.output_ == "7\n";
+            ok &= second.status_ == 0 && second.output_ == "8\n";
+            ok &= d.cache_misses() == 1 && d.cache_hits() == 1;
+
+            // The cache keeps the most recently used programs only
+            for (size_t i = 0; i < Daemon::max_cached_programs; ++i) {
+                daemon_request(path, Request{ std::format("OUTPUT {}\n", i), "", {} });
+            }
+            ok &= d.cache_size() == Daemon::max_cached_programs;
+            daemon_request(path, req);
+            ok &= d.cache_misses() == 2 + Daemon::max_cached_programs;
+
+            // An oversized frame ends the connection without a response
+            try {
+                daemon_request(path, Request{ std::string(Daemon::max_message_bytes + 1, ' '), "", {} });
+                ok = false;
+            } catch (std::runtime_error &) {
+            }
+            ok &= daemon_request(path, req).output_ == "8\n";
+
+            d.stop();
+            server.join();
+            return ok;
+        }),
+
+        tst("Daemon limits", []() -> bool {
+            auto path = (std::filesystem::temp_directory_path() / std::format("cpi_test_{}.sock", std::random_device{}())).string();
+
+            Daemon d(path, 1, std::nullopt, RunLimits{ .max_steps_ = 10000, .max_time_ = std::nullopt, .max_output_bytes_ = 100 });
+            std::thread server([&d] { d.serve(); });
+
+            bool ok = true;
+            Response res = daemon_request(path, Request{ "WHILE TRUE\nENDWHILE\n", "", {} });
+            ok &= res.status_ == 1 && res.output_ == "Line 1: Stopped after 10000 steps\n";
+            res = daemon_request(path, Request{ "PROCEDURE P\n   CALL P\nENDPROCEDURE\nCALL P\n", "", {} });
+            ok &= res.status_ == 1 && res.output_.starts_with("Line 2:");
+            res = daemon_request(path, Request{ "FOR i <- 1 TO 100\n   OUTPUT i\nENDFOR\n", "", {} });
+            ok &= res.status_ == 1 && res.output_.ends_with("OUTPUT is over its limit of 100 bytes\n") && res.output_.size() < 200;
+            d.stop();
+            server.join();
+
+            Daemon slow(path, 1, std::nullopt, RunLimits{ .max_time_ = std::chrono::milliseconds(50) });
+            std::thread slow_server([&slow] { slow.serve(); });
+            res = daemon_request(path, Request{ "WHILE TRUE\nENDWHILE\n", "", {} });
+            ok &= res.status_ == 1 && res.output_ == "Line 1: Stopped after running for 50 ms\n";
+
+            // A response the client would refuse is replaced by one it can act on
+            res = daemon_request(path, Request{
+                "s <- \"0123456789abcdef\"\nFOR i <- 1 TO 20\n   s <- s & s\nENDFOR\n"
+                "OPENFILE Big.txt FOR WRITE\nWRITEFILE Big.txt, s\nCLOSEFILE Big.txt\n", "", {} });
+            ok &= res.status_ == 1 && res.output_.starts_with("The response, ") && res.files_.empty();
+            ok &= daemon_request(path, Request{ "OUTPUT 1\n", "", {} }).output_ == "1\n";
+            slow.stop();
+            slow_server.join();
+            return ok;
+        }),
+
+        tst("File handling example against memory, disk and the daemon", []() -> bool {
+            // The text of examples/eg_file_handling_operations.txt
+            Program p = compile(
+                "DECLARE LineOfText : STRING\n"
+                "OPENFILE FileA.txt FOR READ\n"
+                "OPENFILE FileB.txt FOR WRITE\n"
+                "WHILE NOT EOF(FileA.txt) DO\n"
+                "   READFILE FileA.txt, LineOfText\n"
+                "   IF LineOfText = \"\"\n"
+                "       THEN\n"
+                "           WRITEFILE FileB.txt, \"-------------------------\"\n"
+                "       ELSE\n"
+                "           WRITEFILE FILEB.txt, LineOfText\n"
+                "   ENDIF\n"
+                "ENDWHILE\n"
+                "CLOSEFILE FileA.txt\n"
+                "CLOSEFILE FileB.txt\n");
+            if (!p.errors_.empty()) return false;
+
+            std::string input = "first\n\nsecond\n";
+            std::string expected = "first\n-------------------------\nsecond\n";
+
+            MemoryFiles mem;
+            mem.preload("FileA.txt", input);
+            std::istringstream in;
+            std::ostringstream out;
+            bool ok = 0 == run(p, in, out, mem);
+            auto written = mem.written();
+            ok &= written.size() == 1 && written[0].name_ == "FileB.txt" && written[0].contents_ == expected;
+
+            auto dir = std::filesystem::temp_directory_path() / std::format("cpi_test_{}", std::random_device{}());
+            std::filesystem::create_directories(dir);
+            auto cwd = std::filesystem::current_path();
+            std::filesystem::current_path(dir);
+            std::ofstream("FileA.txt", std::ios::binary) << input;
+            ok &= 0 == run(p, in, out);
+            std::ifstream result("FileB.txt", std::ios::binary);
+            std::ostringstream ss;
+            ss << result.rdbuf();
+            result.close();
+            std::filesystem::current_path(cwd);
+            std::filesystem::remove_all(dir);
+            ok &= ss.str() == expected;
+
+            auto path = (std::filesystem::temp_directory_path() / std::format("cpi_test_{}.sock", std::random_device{}())).string();
+            Daemon d(path, 1);
+            std::thread server([&d] { d.serve(); });
+            Response res = daemon_request(path, Request{ p.source_, "", { NamedFile{ "FileA.txt", input } } });
+            Response missing = daemon_request(path, Request{ p.source_, "", {} });
+            d.stop();
+            server.join();
+            ok &= res.status_ == 0 && res.files_.size() == 1;
+            ok &= res.files_[0].name_ == "FileB.txt" && res.files_[0].contents_ == expected;
+            ok &= missing.status_ == 1 && missing.files_.empty();
+            return ok;
+        }),
+
+        tst("Memory files from manifest", []() -> bool {
+            auto dir = std::filesystem::temp_directory_path() / std::format("cpi_test_{}", std::random_device{}());
+            std::filesystem::create_directories(dir);
+            std::ofstream(dir / "scores.txt") << "10\n20\n";
+            std::ofstream(dir / "manifest") << "Scores.txt " << (dir / "scores.txt").string() << "\n";
+
+            MemoryFiles mem;
+            bool ok = mem.load_manifest((dir / "manifest").string());
+            std::filesystem::remove_all(dir);
+
+            Program p = compile(
+                "DECLARE s : INTEGER\n"
+                "OPENFILE Scores.txt FOR READ\n"
+                "OPENFILE Out.txt FOR WRITE\n"
+                "READFILE Scores.txt, s\n"
+                "WRITEFILE Out.txt, s\n"
+                "READFILE SCORES.TXT, s\n"
+                "WRITEFILE Out.txt, s\n"
+                "CLOSEFILE Scores.txt\n"
+                "CLOSEFILE Out.txt\n");
+            std::istringstream in;
+            std::ostringstream out;
+            ok &= 0 == run(p, in, out, mem);
+            ok &= mem.contents("Out.txt") == "10\n20\n";
+            ok &= !mem.open("Missing.txt", FileMode::Read);
+            return ok;
+        }),
     };
 
     bool all_ok = true;
@@ -287,6 +981,96 @@ bool run_tests() {
     return all_ok;
 }
 
-int main() {
-    assert(run_tests());
+static std::string read_file(const std::string &path) {
+    std::ifstream f(path, std::ios::binary);
+    if (!f) {
+        throw std::runtime_error(std::format("Unable to open {}", path));
+    }
+    std::ostringstream ss;
+    ss << f.rdbuf();
+    return ss.str();
+}
+
+// Saves the files a program wrote to memory in the working directory. Only
+// the last part of each name is used, so nothing lands outside it.
+// Saves each file in the working directory under the last part of its name.
+// False if any name has no last part that can be a file, such as "" or "..",
+// or a file cannot be written; each is reported on stderr.
+static bool save_files(const std::vector<NamedFile> &files) {
+    bool ok = true;
+    for (const auto &f : files) {
+        auto path = std::filesystem::path(f.name_).filename();
+        if (path.empty() || path == "." || path == "..") {
+            std::println(std::cerr, "Not saving \"{}\", which does not name a file", f.name_);
+            ok = false;
+            continue;
+        }
+        std::ofstream out(path, std::ios::binary);
+        if (!(out << f.contents_)) {
+            std::println(std::cerr, "Unable to write {}", path.string());
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+// Usage:
+//   cpi_cpp                             Run the test suite
+//   cpi_cpp <file>                      Run a program, reading INPUT from stdin
+//   cpi_cpp --serve <socket> [workers]  Run programs on behalf of clients
+//   cpi_cpp --client <socket> <file>    Run a program on the daemon, stdin as input
+// Either of the ways of running programs takes --seed <n> to run them with
+// the same random numbers each time, and --manifest <file> to run them
+// against files held in memory, preloaded from those the manifest lists,
+// rather than the disk. Files the program writes are then saved in the
+// working directory once it finishes.
+int main(int argc, char **argv) {
+    std::vector<std::string> args(argv + 1, argv + argc);
+
+    std::optional<uint64_t> seed;
+    if (auto at = std::ranges::find(args, "--seed"); at != args.end() && at + 1 != args.end()) {
+        seed = std::stoull(*(at + 1));
+        args.erase(at, at + 2);
+    }
+
+    std::optional<std::vector<NamedFile>> files;
+    if (auto at = std::ranges::find(args, "--manifest"); at != args.end() && at + 1 != args.end()) {
+        files.emplace();
+        if (!read_manifest(*(at + 1), *files)) {
+            std::println(std::cerr, "Unable to read the files in manifest {}", *(at + 1));
+            return 1;
+        }
+        args.erase(at, at + 2);
+    }
+
+    if (args.empty()) {
+        assert(run_tests());
+        return 0;
+    }
+
+    std::string mode = args[0];
+    if (mode == "--serve" && args.size() >= 2) {
+        size_t workers = args.size() >= 3 ? std::stoul(args[2]) : std::thread::hardware_concurrency();
+        Daemon d(args[1], workers, seed);
+        d.serve();
+        return 0;
+    } else if (mode == "--client" && args.size() >= 3) {
+        std::ostringstream input;
+        input << std::cin.rdbuf();
+        Request req{ read_file(args[2]), input.str(), files.value_or(std::vector<NamedFile>{}) };
+        Response res = daemon_request(args[1], req);
+        std::print("{}", res.output_);
+        if (files && !save_files(res.files_)) return 1;
+        return res.status_;
+    } else if (files) {
+        MemoryFiles mem;
+        for (auto &f : *files) {
+            mem.preload(f.name_, std::move(f.contents_));
+        }
+        int status = run(compile(read_file(args[0])), std::cin, std::cout, mem, seed);
+        if (!save_files(mem.written())) return 1;
+        return status;
+    } else {
+        return run(compile(read_file(args[0])), std::cin, std::cout, seed);
+    }
 }
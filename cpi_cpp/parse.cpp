@@ -0,0 +1,870 @@
+#include "ast.hpp"
+#include "ascii.hpp"
+
+// -- Lexer
+
+enum struct TokKind { Ident, Int, Real, Str, Chr, Date, Sym, Raw, End };
+
+struct Token {
+    TokKind kind_;
+    std::string text_;
+};
+
+static void replace_all(std::string &s, std::string_view from, std::string_view to) {
+    for (size_t at = s.find(from); at != std::string::npos; at = s.find(from, at + to.size())) {
+        s.replace(at, from.size(), to);
+    }
+}
+
+// Sources copied out of the pseudocode guide come with typographic
+// characters and escaped quotes. Map them onto plain ASCII first.
+static std::string normalise(std::string line) {
+    replace_all(line, "\\\"", "\"");
+    replace_all(line, "\xE2\x86\x90", "<-"); // Leftwards arrow
+    replace_all(line, "\xEF\x82\xAC", "<-"); // Leftwards arrow from the Symbol font, as pasted from the guide
+    replace_all(line, "\xE2\x80\x93", "-");  // En dash
+    replace_all(line, "\xEA\x9E\x8C", "'");  // Latin small letter saltillo
+    return line;
+}
+
+// Position of a // comment outside of any string literal
+static size_t comment_start(std::string_view s) {
+    bool quoted = false;
+    for (size_t i = 0; i < s.size(); ++i) {
+        if (s[i] == '"') quoted = !quoted;
+        else if (!quoted && s[i] == '/' && i + 1 < s.size() && s[i + 1] == '/') return i;
+    }
+    return std::string_view::npos;
+}
+
+// Position of the : ending a CASE clause label, skipping literals
+static size_t label_colon(std::string_view s) {
+    for (size_t i = 0; i < s.size(); ++i) {
+        if (s[i] == '"') {
+            i = s.find('"', i + 1);
+            if (i == std::string_view::npos) break;
+        } else if (s[i] == '\'' && i + 2 < s.size() && s[i + 2] == '\'') {
+            i += 2;
+        } else if (s[i] == ':') {
+            return i;
+        }
+    }
+    return std::string_view::npos;
+}
+
+static bool is_date_at(std::string_view s, size_t i) {
+    // dd/mm/yyyy
+    auto digits = [&](size_t at, size_t n) {
+        if (at + n > s.size()) return false;
+        for (size_t k = 0; k < n; ++k) if (!std::isdigit(static_cast<unsigned char>(s[at + k]))) return false;
+        return true;
+    };
+    return digits(i, 2) && s.size() > i + 2 && s[i + 2] == '/'
+        && digits(i + 3, 2) && s.size() > i + 5 && s[i + 5] == '/'
+        && digits(i + 6, 4) && (s.size() == i + 10 || !std::isdigit(static_cast<unsigned char>(s[i + 10])));
+}
+
+static std::vector<Token> lex(std::string_view s) {
+    std::vector<Token> toks;
+    size_t i = 0;
+    auto at = [&](size_t k) -> char { return k < s.size() ? s[k] : '\0'; };
+
+    while (i < s.size()) {
+        char c = s[i];
+        if (std::isspace(static_cast<unsigned char>(c))) {
+            ++i;
+        } else if (c == '/' && at(i + 1) == '/') {
+            break;
+        } else if (std::isalpha(static_cast<unsigned char>(c))) {
+            size_t start = i;
+            while (std::isalnum(static_cast<unsigned char>(at(i)))) ++i;
+            std::string word(s.substr(start, i - start));
+            toks.push_back({ TokKind::Ident, word });
+
+            // EOF takes a file name, which is not an expression
+            lower(word);
+            size_t j = i;
+            while (at(j) == ' ') ++j;
+            if (word == "eof" && at(j) == '(') {
+                auto close = s.find(')', j);
+                if (close == std::string_view::npos) throw std::invalid_argument("Expected ) after file name");
+                std::string name(s.substr(j + 1, close - j - 1));
+                trim(name);
+                toks.push_back({ TokKind::Sym, "(" });
+                toks.push_back({ TokKind::Raw, name });
+                toks.push_back({ TokKind::Sym, ")" });
+                i = close + 1;
+            }
+        } else if (std::isdigit(static_cast<unsigned char>(c))) {
+            size_t start = i;
+            if (is_date_at(s, i)) {
+                i += 10;
+                toks.push_back({ TokKind::Date, std::string(s.substr(start, i - start)) });
+                continue;
+            }
+            while (std::isdigit(static_cast<unsigned char>(at(i)))) ++i;
+            TokKind k = TokKind::Int;
+            if (at(i) == '.' && std::isdigit(static_cast<unsigned char>(at(i + 1)))) {
+                k = TokKind::Real;
+                ++i;
+                while (std::isdigit(static_cast<unsigned char>(at(i)))) ++i;
+            }
+            toks.push_back({ k, std::string(s.substr(start, i - start)) });
+        } else if (c == '"') {
+            auto close = s.find('"', i + 1);
+            if (close == std::string_view::npos) throw std::invalid_argument("Unterminated string literal");
+            toks.push_back({ TokKind::Str, std::string(s.substr(i + 1, close - i - 1)) });
+            i = close + 1;
+        } else if (c == '\'') {
+            if (at(i + 2) != '\'') throw std::invalid_argument("Character literals hold exactly one character");
+            toks.push_back({ TokKind::Chr, std::string(1, at(i + 1)) });
+            i += 3;
+        } else {
+            static const std::string_view two[] = { "<-", "<=", ">=", "<>" };
+            std::string sym(1, c);
+            for (auto t : two) {
+                if (s.substr(i, 2) == t) sym = t;
+            }
+            if (sym.size() == 1 && std::string_view("+-*/&=<>(),:[].").find(c) == std::string_view::npos) {
+                throw std::invalid_argument(std::format("Unexpected character '{}'", c));
+            }
+            toks.push_back({ TokKind::Sym, sym });
+            i += sym.size();
+        }
+    }
+
+    toks.push_back({ TokKind::End, "" });
+    return toks;
+}
+
+// -- Parser
+
+struct SyntaxError : std::invalid_argument {
+    using std::invalid_argument::invalid_argument;
+};
+
+// A statement whose body is still being parsed
+struct Frame {
+    static constexpr uint32_t no_part = UINT32_MAX;
+    static constexpr uint32_t otherwise = UINT32_MAX - 1;
+
+    StmtKind kind_;
+    NodeId stmt_;
+    int line_;
+    uint32_t part_ = no_part; // Case: clause taking statements, or otherwise. If: 0 THEN, 1 ELSE
+};
+
+static std::string_view block_start(StmtKind k) {
+    switch (k) {
+        case StmtKind::Case: return "CASE";
+        case StmtKind::For: return "FOR";
+        case StmtKind::If: return "IF";
+        case StmtKind::While: return "WHILE";
+        case StmtKind::Procedure: return "PROCEDURE";
+        case StmtKind::Type: return "TYPE";
+        default: return "REPEAT";
+    }
+}
+
+static std::string_view block_end(StmtKind k) {
+    switch (k) {
+        case StmtKind::Case: return "ENDCASE";
+        case StmtKind::For: return "ENDFOR";
+        case StmtKind::If: return "ENDIF";
+        case StmtKind::While: return "ENDWHILE";
+        case StmtKind::Procedure: return "ENDPROCEDURE";
+        case StmtKind::Type: return "ENDTYPE";
+        default: return "UNTIL";
+    }
+}
+
+struct Parser {
+    Ast ast_;
+    std::vector<Token> toks_;
+    size_t pos_ = 0;
+    int line_ = 0;
+    std::vector<Frame> frames_;
+
+    const Token &peek() const { return toks_[pos_]; }
+    Token next() { Token t = toks_[pos_]; if (t.kind_ != TokKind::End) ++pos_; return t; }
+
+    bool at_word(std::string_view w) const {
+        return peek().kind_ == TokKind::Ident && ascii_iequal(peek().text_, w);
+    }
+
+    bool accept_sym(std::string_view s) {
+        if (peek().kind_ == TokKind::Sym && peek().text_ == s) { ++pos_; return true; }
+        return false;
+    }
+
+    void expect_sym(std::string_view s) {
+        if (!accept_sym(s)) throw SyntaxError(std::format("Expected '{}'", s));
+    }
+
+    void expect_end() {
+        if (peek().kind_ != TokKind::End) throw SyntaxError(std::format("Unexpected '{}'", peek().text_));
+    }
+
+    std::string expect_ident() {
+        if (peek().kind_ != TokKind::Ident) throw SyntaxError("Expected an identifier");
+        std::string name = next().text_;
+        lower(name);
+        return name;
+    }
+
+    // Equal literals share one interned buffer
+    static Slot string_literal(std::string_view text) {
+        Slot s = default_slot(AtomicDt::String);
+        s.cell_.s_ = intern(text);
+        return s;
+    }
+
+    NodeId literal(Slot s) {
+        ast_.consts_.push_back(std::move(s));
+        Expr e{ ExprKind::Literal };
+        e.line_ = line_;
+        e.index_ = static_cast<uint32_t>(ast_.consts_.size() - 1);
+        return ast_.add(std::move(e));
+    }
+
+    NodeId unary(Op op, NodeId operand) {
+        Expr e{ ExprKind::Unary };
+        e.op_ = op;
+        e.line_ = line_;
+        e.lhs_ = operand;
+        return ast_.add(std::move(e));
+    }
+
+    NodeId binary(Op op, NodeId l, NodeId r) {
+        Expr e{ ExprKind::Binary };
+        e.op_ = op;
+        e.line_ = line_;
+        e.lhs_ = l;
+        e.rhs_ = r;
+        return ast_.add(std::move(e));
+    }
+
+    NodeId expr() { return or_expr(); }
+
+    NodeId or_expr() {
+        NodeId l = and_expr();
+        while (at_word("or")) { next(); l = binary(Op::Or, l, and_expr()); }
+        return l;
+    }
+
+    NodeId and_expr() {
+        NodeId l = not_expr();
+        while (at_word("and")) { next(); l = binary(Op::And, l, not_expr()); }
+        return l;
+    }
+
+    NodeId not_expr() {
+        if (at_word("not")) { next(); return unary(Op::Not, not_expr()); }
+        return cmp_expr();
+    }
+
+    NodeId cmp_expr() {
+        static const std::pair<std::string_view, Op> ops[] = {
+            { "=", Op::Eq }, { "<>", Op::Ne }, { "<", Op::Lt },
+            { "<=", Op::Le }, { ">", Op::Gt }, { ">=", Op::Ge },
+        };
+        NodeId l = add_expr();
+        while (true) {
+            bool found = false;
+            for (auto [sym, op] : ops) {
+                if (accept_sym(sym)) { l = binary(op, l, add_expr()); found = true; break; }
+            }
+            if (!found) return l;
+        }
+    }
+
+    NodeId add_expr() {
+        NodeId l = mul_expr();
+        while (true) {
+            if (accept_sym("+")) l = binary(Op::Add, l, mul_expr());
+            else if (accept_sym("-")) l = binary(Op::Sub, l, mul_expr());
+            else if (accept_sym("&")) l = binary(Op::Concat, l, mul_expr());
+            else return l;
+        }
+    }
+
+    NodeId mul_expr() {
+        NodeId l = unary_expr();
+        while (true) {
+            if (accept_sym("*")) l = binary(Op::Mul, l, unary_expr());
+            else if (accept_sym("/")) l = binary(Op::Div, l, unary_expr());
+            else if (at_word("mod")) { next(); l = binary(Op::Mod, l, unary_expr()); }
+            else if (at_word("div")) { next(); l = binary(Op::IntDiv, l, unary_expr()); }
+            else return l;
+        }
+    }
+
+    NodeId unary_expr() {
+        if (accept_sym("-")) return unary(Op::Neg, unary_expr());
+        return primary();
+    }
+
+    NodeId primary() {
+        Token t = next();
+        switch (t.kind_) {
+            case TokKind::Int: return literal(to_slot(atomic_value(Integer(t.text_))));
+            case TokKind::Real: return literal(to_slot(atomic_value(Real(t.text_))));
+            case TokKind::Str: return literal(string_literal(t.text_));
+            case TokKind::Chr: return literal(to_slot(atomic_value(Char(t.text_))));
+            case TokKind::Date: return literal(to_slot(atomic_value(Date(t.text_))));
+            case TokKind::Sym:
+                if (t.text_ == "(") {
+                    NodeId inner = expr();
+                    expect_sym(")");
+                    return inner;
+                }
+                break;
+            case TokKind::Ident: {
+                std::string name = t.text_;
+                lower(name);
+                if (name == "true" || name == "false") {
+                    return literal(to_slot(atomic_value(Boolean(name))));
+                }
+                if (accept_sym("(")) return call(name);
+                if (peek().kind_ == TokKind::Sym && (peek().text_ == "[" || peek().text_ == ".")) return element(name);
+
+                Expr e{ ExprKind::Variable };
+                e.line_ = line_;
+                e.name_ = name;
+                return ast_.add(std::move(e));
+            }
+            default:
+                break;
+        }
+        throw SyntaxError(t.kind_ == TokKind::End ? "Expected an expression" : std::format("Unexpected '{}'", t.text_));
+    }
+
+    // <array>[<index>[, <index>]], then any number of .<field>
+    NodeId element(const std::string &name) {
+        Expr e{ ExprKind::Element };
+        e.line_ = line_;
+        e.name_ = name;
+        if (accept_sym("[")) {
+            do { e.args_.push_back(expr()); } while (accept_sym(","));
+            expect_sym("]");
+        }
+        while (accept_sym(".")) {
+            if (!e.path_.empty()) e.path_ += '.';
+            e.path_ += expect_ident();
+        }
+        return ast_.add(std::move(e));
+    }
+
+    NodeId call(const std::string &name) {
+        static const std::unordered_map<std::string, Builtin> builtins = {
+            { "length", Builtin::Length }, { "left", Builtin::Left }, { "right", Builtin::Right },
+            { "mid", Builtin::Mid }, { "substring", Builtin::Mid },
+            { "ucase", Builtin::Ucase }, { "lcase", Builtin::Lcase }, { "eof", Builtin::Eof },
+            { "randombetween", Builtin::Randombetween }, { "rnd", Builtin::Rnd },
+        };
+        auto search = builtins.find(name);
+        if (search == builtins.end()) throw SyntaxError(std::format("Unknown function {}", name));
+
+        Expr e{ ExprKind::Call };
+        e.line_ = line_;
+        e.index_ = static_cast<uint32_t>(search->second);
+        e.name_ = name;
+
+        if (search->second == Builtin::Eof) {
+            if (peek().kind_ != TokKind::Raw) throw SyntaxError("Expected a file name");
+            e.name_ = next().text_;
+            expect_sym(")");
+        } else if (!accept_sym(")")) {
+            do { e.args_.push_back(expr()); } while (accept_sym(","));
+            expect_sym(")");
+        }
+        return ast_.add(std::move(e));
+    }
+
+    Stmt stmt_of(StmtKind k) {
+        Stmt s{ k };
+        s.line_ = line_;
+        return s;
+    }
+
+    static std::optional<AtomicDt> atomic_dt_of(std::string name) {
+        lower(name);
+        if (name == "integer") return AtomicDt::Integer;
+        if (name == "real") return AtomicDt::Real;
+        if (name == "char") return AtomicDt::Char;
+        if (name == "string") return AtomicDt::String;
+        if (name == "boolean") return AtomicDt::Boolean;
+        if (name == "date") return AtomicDt::Date;
+        return std::nullopt;
+    }
+
+    int bound() {
+        bool negative = accept_sym("-");
+        if (peek().kind_ != TokKind::Int) throw SyntaxError("Array bounds must be INTEGER literals");
+        int b = Integer(next().text_).data_;
+        return negative ? -b : b;
+    }
+
+    // An atomic type, which goes in `atomic`, or ARRAY[<lo>:<hi>[, <lo>:<hi>]]
+    // OF <type>, or the name of a record TYPE, which go in a Layout whose
+    // index is returned. A parameter may leave out the bounds.
+    uint32_t datatype(std::optional<AtomicDt> &atomic, bool parameter) {
+        std::string name = expect_ident();
+        atomic = atomic_dt_of(name);
+        if (atomic) return 0;
+
+        Layout l;
+        if (name == "array") {
+            if (accept_sym("[")) {
+                do {
+                    int lo = bound();
+                    expect_sym(":");
+                    int hi = bound();
+                    if (lo > hi) throw SyntaxError(std::format("Array bounds {}:{} are empty", lo, hi));
+                    l.dims_.push_back(Dim{ lo, hi });
+                } while (accept_sym(","));
+                expect_sym("]");
+                if (l.dims_.size() > 2) throw SyntaxError("Arrays have one or two dimensions");
+            } else if (parameter) {
+                l.bounded_ = false;
+            } else {
+                throw SyntaxError("Expected ARRAY[<lower>:<upper>]");
+            }
+            if (!at_word("of")) throw SyntaxError("Expected OF <type>");
+            next();
+            std::string element = expect_ident();
+            if (element == "array") throw SyntaxError("Arrays of arrays are not supported; give the ARRAY two dimensions");
+            l.element_ = atomic_dt_of(element);
+            if (!l.element_) l.record_name_ = element;
+        } else {
+            l.record_name_ = name;
+        }
+        ast_.layouts_.push_back(std::move(l));
+        return static_cast<uint32_t>(ast_.layouts_.size() - 1);
+    }
+
+    // Where the next statement goes
+    std::vector<NodeId> &body() {
+        if (frames_.empty()) return ast_.top_;
+        const Frame &f = frames_.back();
+        if (f.kind_ == StmtKind::If && f.part_ == 1) return ast_.stmt(f.stmt_).else_;
+        if (f.kind_ != StmtKind::Case) return ast_.stmt(f.stmt_).body_;
+
+        Case &c = ast_.cases_[ast_.stmt(f.stmt_).index_];
+        if (f.part_ == Frame::no_part) throw SyntaxError("Expected a CASE clause");
+        if (f.part_ == Frame::otherwise) return c.otherwise_;
+        return c.clauses_[f.part_].body_;
+    }
+
+    // Adds a statement with a body, which the following lines go into
+    void open(Stmt s, uint32_t part = Frame::no_part) {
+        StmtKind kind = s.kind_;
+        NodeId id = ast_.add(std::move(s));
+        body().push_back(id);
+        frames_.push_back(Frame{ kind, id, line_, part });
+    }
+
+    void close(StmtKind kind, std::string_view end) {
+        if (frames_.empty() || frames_.back().kind_ != kind) {
+            throw SyntaxError(std::format("{} without a matching {}", end, block_start(kind)));
+        }
+        frames_.pop_back();
+    }
+
+    // A statement may follow THEN, ELSE or a CASE label on the same line
+    void trailing_statement(const std::string &text) {
+        std::string rest = text.substr(toks_[0].text_.size());
+        trim(rest);
+        if (!rest.empty()) {
+            NodeId id = statement(rest);
+            body().push_back(id);
+        }
+    }
+
+    // One line of source, which may open or close a block
+    void line(const std::string &text) {
+        toks_ = lex(text);
+        pos_ = 0;
+
+        if (!frames_.empty() && frames_.back().kind_ == StmtKind::Type && !at_word("declare") && !at_word("endtype")) {
+            throw SyntaxError("A TYPE holds only DECLAREs of its fields");
+        }
+
+        if (!frames_.empty() && frames_.back().kind_ == StmtKind::Case && case_label(text)) return;
+
+        if (at_word("case")) {
+            next();
+            if (!at_word("of")) throw SyntaxError("Expected CASE OF <value>");
+            next();
+            Stmt s = stmt_of(StmtKind::Case);
+            s.exprs_.push_back(expr());
+            expect_end();
+            s.index_ = static_cast<uint32_t>(ast_.cases_.size());
+            ast_.cases_.emplace_back();
+            return open(std::move(s));
+        }
+        if (at_word("endcase")) {
+            next();
+            expect_end();
+            return close(StmtKind::Case, "ENDCASE");
+        }
+        if (at_word("for")) {
+            // FOR <identifier> <- <expr> TO <expr> [STEP <expr>]
+            next();
+            Stmt s = stmt_of(StmtKind::For);
+            s.name_ = expect_ident();
+            if (!accept_sym("<-") && !accept_sym("=")) throw SyntaxError("Expected FOR <variable> <- <start> TO <end>");
+            s.exprs_.push_back(expr());
+            if (!at_word("to")) throw SyntaxError("Expected TO");
+            next();
+            s.exprs_.push_back(expr());
+            if (at_word("step")) {
+                next();
+                s.exprs_.push_back(expr());
+            }
+            expect_end();
+            return open(std::move(s));
+        }
+        bool next_ends_loop = at_word("next")
+            && (toks_[1].kind_ == TokKind::End || (toks_[1].kind_ == TokKind::Ident && toks_[2].kind_ == TokKind::End));
+        if (at_word("endfor") || next_ends_loop) {
+            // ENDFOR or NEXT, optionally naming the control variable
+            std::string end = next().text_;
+            if (peek().kind_ == TokKind::Ident && !frames_.empty() && frames_.back().kind_ == StmtKind::For) {
+                std::string name = expect_ident();
+                if (name != ast_.stmt(frames_.back().stmt_).name_) {
+                    throw SyntaxError(std::format("{} {} does not match FOR {}", end, name, ast_.stmt(frames_.back().stmt_).name_));
+                }
+            }
+            expect_end();
+            lower(end);
+            return close(StmtKind::For, end == "next" ? "NEXT" : "ENDFOR");
+        }
+        if (at_word("if")) {
+            // IF <condition> [THEN], with THEN allowed on the next line
+            next();
+            Stmt s = stmt_of(StmtKind::If);
+            s.exprs_.push_back(expr());
+            if (at_word("then")) next();
+            expect_end();
+            return open(std::move(s), 0);
+        }
+        if (at_word("then") || at_word("else")) {
+            bool then = at_word("then");
+            if (frames_.empty() || frames_.back().kind_ != StmtKind::If || (then && !body().empty()) || frames_.back().part_ == 1) {
+                throw SyntaxError(std::format("Unexpected {}", then ? "THEN" : "ELSE"));
+            }
+            if (!then) frames_.back().part_ = 1;
+            return trailing_statement(text);
+        }
+        if (at_word("endif")) {
+            next();
+            expect_end();
+            return close(StmtKind::If, "ENDIF");
+        }
+        if (at_word("while")) {
+            // WHILE <condition> [DO]
+            next();
+            Stmt s = stmt_of(StmtKind::While);
+            s.exprs_.push_back(expr());
+            if (at_word("do")) next();
+            expect_end();
+            return open(std::move(s));
+        }
+        if (at_word("endwhile")) {
+            next();
+            expect_end();
+            return close(StmtKind::While, "ENDWHILE");
+        }
+        if (at_word("repeat")) {
+            next();
+            expect_end();
+            return open(stmt_of(StmtKind::Repeat));
+        }
+        if (at_word("until")) {
+            next();
+            NodeId condition = expr();
+            expect_end();
+            NodeId id = frames_.empty() ? no_node : frames_.back().stmt_;
+            close(StmtKind::Repeat, "UNTIL");
+            ast_.stmt(id).exprs_.push_back(condition);
+            return;
+        }
+
+        if (at_word("procedure")) {
+            // PROCEDURE <name>[(<parameter>, ...)], each parameter
+            // [BYREF | BYVALUE] <name> : <type>. Parameters are passed by
+            // value unless BYREF is given, which carries on to those after
+            // it until a BYVALUE.
+            next();
+            if (!frames_.empty()) throw SyntaxError("PROCEDURE must be at the top level");
+            Stmt s = stmt_of(StmtKind::Procedure);
+            s.name_ = expect_ident();
+            s.index_ = static_cast<uint32_t>(ast_.procs_.size());
+            Procedure p;
+            if (accept_sym("(") && !accept_sym(")")) {
+                bool byref = false;
+                do {
+                    if (at_word("byref") || at_word("byvalue")) {
+                        byref = at_word("byref");
+                        next();
+                    }
+                    ProcParam param;
+                    param.name_ = expect_ident();
+                    param.byref_ = byref;
+                    expect_sym(":");
+                    param.layout_ = datatype(param.type_, true);
+                    p.params_.push_back(std::move(param));
+                } while (accept_sym(","));
+                expect_sym(")");
+            }
+            expect_end();
+            ast_.procs_.push_back(std::move(p));
+            open(std::move(s));
+            ast_.procs_.back().stmt_ = frames_.back().stmt_;
+            return;
+        }
+        if (at_word("endprocedure")) {
+            next();
+            expect_end();
+            return close(StmtKind::Procedure, "ENDPROCEDURE");
+        }
+        if (at_word("type") && toks_[1].kind_ == TokKind::Ident) {
+            // TYPE <name>, then a DECLARE for each field
+            next();
+            if (!frames_.empty()) throw SyntaxError("TYPE must be at the top level");
+            Stmt s = stmt_of(StmtKind::Type);
+            s.name_ = expect_ident();
+            expect_end();
+            return open(std::move(s));
+        }
+        if (at_word("endtype")) {
+            next();
+            expect_end();
+            return close(StmtKind::Type, "ENDTYPE");
+        }
+
+        NodeId id = statement(text);
+        body().push_back(id);
+    }
+
+    // <literal> [TO <literal>] : [statement], or OTHERWISE [:] [statement].
+    // Returns false if the line is not a clause label.
+    bool case_label(const std::string &text) {
+        Frame &f = frames_.back();
+        Case &c = ast_.cases_[ast_.stmt(f.stmt_).index_];
+        size_t colon = label_colon(text);
+
+        std::string rest;
+        if (at_word("otherwise")) {
+            if (f.part_ == Frame::otherwise) throw SyntaxError("Only one OTHERWISE is allowed");
+            rest = colon == std::string::npos ? text.substr(toks_[0].text_.size()) : text.substr(colon + 1);
+            trim(rest);
+            f.part_ = Frame::otherwise;
+        } else {
+            if (colon == std::string::npos) return false;
+            toks_ = lex(text.substr(0, colon));
+            pos_ = 0;
+            auto lo = label_value();
+            if (!lo) return false;
+            auto hi = lo;
+            if (at_word("to")) {
+                next();
+                hi = label_value();
+                if (!hi) throw SyntaxError("Expected a value after TO");
+            }
+            expect_end();
+            if (f.part_ == Frame::otherwise) throw SyntaxError("OTHERWISE must be the last clause");
+            c.clauses_.push_back(CaseClause{ line_, std::move(*lo), std::move(*hi), {} });
+            f.part_ = static_cast<uint32_t>(c.clauses_.size() - 1);
+            rest = text.substr(colon + 1);
+            trim(rest);
+        }
+
+        if (!rest.empty()) {
+            NodeId id = statement(rest);
+            body().push_back(id);
+        }
+        return true;
+    }
+
+    std::optional<Slot> label_value() {
+        bool negative = accept_sym("-");
+        Token t = peek();
+        std::optional<Slot> v;
+        switch (t.kind_) {
+            case TokKind::Int: v = to_slot(atomic_value(Integer(t.text_))); break;
+            case TokKind::Real: v = to_slot(atomic_value(Real(t.text_))); break;
+            case TokKind::Str: v = string_literal(t.text_); break;
+            case TokKind::Chr: v = to_slot(atomic_value(Char(t.text_))); break;
+            case TokKind::Date: v = to_slot(atomic_value(Date(t.text_))); break;
+            case TokKind::Ident:
+                if (at_word("true") || at_word("false")) v = to_slot(atomic_value(Boolean(t.text_)));
+                break;
+            default:
+                break;
+        }
+        if (!v) return std::nullopt;
+        next();
+        if (negative) {
+            if (v->type_ == AtomicDt::Integer) v->cell_.i_ = -v->cell_.i_;
+            else if (v->type_ == AtomicDt::Real) v->cell_.r_ = -v->cell_.r_;
+            else throw SyntaxError("Only numbers can be negative");
+        }
+        return v;
+    }
+
+    // `text` is the whole statement, needed where file names are not tokens.
+    NodeId statement(const std::string &text) {
+        toks_ = lex(text);
+        pos_ = 0;
+
+        std::string keyword = peek().kind_ == TokKind::Ident ? peek().text_ : "";
+        lower(keyword);
+
+        // Everything after the keyword
+        std::string rest = text.substr(keyword.size());
+        trim(rest);
+
+        if (keyword == "declare") {
+            next();
+            Stmt s = stmt_of(StmtKind::Declare);
+            s.name_ = expect_ident();
+            expect_sym(":");
+            s.index_ = datatype(s.type_, false);
+            expect_end();
+            return ast_.add(std::move(s));
+        } else if (keyword == "constant") {
+            next();
+            Stmt s = stmt_of(StmtKind::Constant);
+            s.name_ = expect_ident();
+            expect_sym("=");
+            bool negative = accept_sym("-");
+            auto kind = peek().kind_;
+            if (kind == TokKind::Sym || kind == TokKind::End || kind == TokKind::Raw
+                || (kind == TokKind::Ident && !at_word("true") && !at_word("false"))) {
+                throw SyntaxError("CONSTANT values must be literals");
+            }
+            NodeId value = primary();
+            if (negative) value = unary(Op::Neg, value);
+            expect_end();
+            s.exprs_.push_back(value);
+            return ast_.add(std::move(s));
+        } else if (keyword == "input") {
+            next();
+            Stmt s = stmt_of(StmtKind::Input);
+            s.name_ = expect_ident();
+            expect_end();
+            return ast_.add(std::move(s));
+        } else if (keyword == "output") {
+            next();
+            Stmt s = stmt_of(StmtKind::Output);
+            do { s.exprs_.push_back(expr()); } while (accept_sym(","));
+            expect_end();
+            return ast_.add(std::move(s));
+        } else if (keyword == "openfile") {
+            // <file> FOR <mode>
+            Stmt s = stmt_of(StmtKind::OpenFile);
+            auto mode_at = rest.find_last_of(" \t");
+            std::string mode = mode_at == std::string::npos ? "" : rest.substr(mode_at + 1);
+            std::string head = mode_at == std::string::npos ? "" : rest.substr(0, mode_at);
+            trim(head);
+            auto for_at = head.find_last_of(" \t");
+            std::string for_kw = for_at == std::string::npos ? "" : head.substr(for_at + 1);
+            lower(for_kw);
+            lower(mode);
+            if (for_kw != "for") throw SyntaxError("Expected OPENFILE <file> FOR <mode>");
+            s.name_ = head.substr(0, for_at);
+            trim(s.name_);
+
+            if (mode == "read") s.mode_ = FileMode::Read;
+            else if (mode == "write") s.mode_ = FileMode::Write;
+            else if (mode == "append") s.mode_ = FileMode::Append;
+            else if (mode == "random") s.mode_ = FileMode::Random;
+            else throw SyntaxError(std::format("Unknown file mode {}", mode));
+            return ast_.add(std::move(s));
+        } else if (keyword == "readfile" || keyword == "writefile") {
+            // <file>, <variable or expression>
+            auto comma = rest.find(',');
+            if (comma == std::string::npos) throw SyntaxError(std::format("Expected {} <file>, <value>", keyword));
+            Stmt s = stmt_of(keyword == "readfile" ? StmtKind::ReadFile : StmtKind::WriteFile);
+            s.name_ = rest.substr(0, comma);
+            trim(s.name_);
+
+            toks_ = lex(rest.substr(comma + 1));
+            pos_ = 0;
+            if (s.kind_ == StmtKind::ReadFile) {
+                s.exprs_.push_back(primary());
+                if (ast_.expr(s.exprs_[0]).kind_ != ExprKind::Variable) throw SyntaxError("READFILE reads into a variable");
+            } else {
+                s.exprs_.push_back(expr());
+            }
+            expect_end();
+            return ast_.add(std::move(s));
+        } else if (keyword == "closefile") {
+            Stmt s = stmt_of(StmtKind::CloseFile);
+            s.name_ = rest;
+            return ast_.add(std::move(s));
+        } else if (keyword == "call") {
+            // CALL <procedure>[(<argument>, ...)]
+            next();
+            Stmt s = stmt_of(StmtKind::Call);
+            s.name_ = expect_ident();
+            if (accept_sym("(") && !accept_sym(")")) {
+                do { s.exprs_.push_back(expr()); } while (accept_sym(","));
+                expect_sym(")");
+            }
+            expect_end();
+            return ast_.add(std::move(s));
+        }
+
+        // <identifier> <- <expr>, also accepting = as the examples do. The
+        // identifier may be indexed or have a field.
+        if (peek().kind_ == TokKind::Ident) {
+            size_t save = pos_;
+            std::string name = expect_ident();
+            NodeId target = no_node;
+            if (peek().kind_ == TokKind::Sym && (peek().text_ == "[" || peek().text_ == ".")) target = element(name);
+            if (accept_sym("<-") || accept_sym("=")) {
+                Stmt s = stmt_of(StmtKind::Assign);
+                s.name_ = name;
+                s.exprs_.push_back(expr());
+                if (target != no_node) s.exprs_.push_back(target);
+                expect_end();
+                return ast_.add(std::move(s));
+            }
+            pos_ = save;
+        }
+
+        throw SyntaxError(keyword.empty() ? "Expected a statement" : std::format("Unsupported statement {}", keyword));
+    }
+};
+
+Ast parse(std::string_view source, std::vector<std::string> &errors) {
+    Parser p;
+
+    std::istringstream lines{ std::string(source) };
+    std::string line;
+    while (std::getline(lines, line)) {
+        p.line_ += 1;
+        line = normalise(line);
+
+        try {
+            if (auto comment = comment_start(line); comment != std::string::npos) {
+                line.erase(comment);
+            }
+            trim(line);
+            if (line.empty()) continue;
+
+            p.line(line);
+        } catch (std::exception &e) {
+            errors.push_back(std::format("Line {}: {}", p.line_, e.what()));
+        }
+    }
+
+    for (const auto &f : p.frames_) {
+        errors.push_back(std::format("Line {}: {} without {}", f.line_, block_start(f.kind_), block_end(f.kind_)));
+    }
+
+    return std::move(p.ast_);
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "util.hpp"
+
+#include <bit>
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+
+// xoshiro256**: 256 bits of state, a few shifts and rotates per number, and
+// passes the statistical tests that matter here. Each Interpreter owns one,
+// so programs running on different threads share nothing, and a run seeded
+// the same way produces the same numbers.
+struct Rng {
+    // The state is filled from the seed by splitmix64, as the authors of
+    // xoshiro recommend, so that nearby seeds give unrelated streams.
+    explicit Rng(uint64_t seed) {
+        for (auto &word : s_) {
+            seed += 0x9e3779b97f4a7c15;
+            uint64_t z = seed;
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+            word = z ^ (z >> 31);
+        }
+    }
+
+    uint64_t next() {
+        uint64_t result = std::rotl(s_[1] * 5, 7) * 9;
+        uint64_t t = s_[1] << 17;
+        s_[2] ^= s_[0];
+        s_[3] ^= s_[1];
+        s_[1] ^= s_[2];
+        s_[0] ^= s_[3];
+        s_[2] ^= t;
+        s_[3] = std::rotl(s_[3], 45);
+        return result;
+    }
+
+    // Uniform in [0, n), n > 0, by Lemire's method: the high word of a 128-bit
+    // product is the number, and the low word says whether it falls in the
+    // biased part of the range. That needs a division only then, which is
+    // about once in 2^64 / n draws.
+    uint64_t below(uint64_t n) {
+        uint64_t high;
+        uint64_t low = mul(next(), n, high);
+        if (low < n) {
+            uint64_t threshold = (0 - n) % n;
+            while (low < threshold) low = mul(next(), n, high);
+        }
+        return high;
+    }
+
+    // Uniform in [0, 1), from the top 53 bits
+    double unit() { return static_cast<double>(next() >> 11) * 0x1.0p-53; }
+
+private:
+    static uint64_t mul(uint64_t a, uint64_t b, uint64_t &high) {
+#if defined(_MSC_VER) && !defined(__clang__)
+        return _umul128(a, b, &high);
+#else
+        unsigned __int128 p = static_cast<unsigned __int128>(a) * b;
+        high = static_cast<uint64_t>(p >> 64);
+        return static_cast<uint64_t>(p);
+#endif
+    }
+
+    uint64_t s_[4];
+};
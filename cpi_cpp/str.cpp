@@ -0,0 +1,165 @@
+#include "str.hpp"
+
+#include <cstring>
+#include <mutex>
+
+struct Str::Buf {
+    explicit Buf(size_t cap) : refs_{ 1 }, used_{ 0 }, cap_{ cap } {}
+
+    static Buf *make(size_t cap) {
+        return new (::operator new(sizeof(Buf) + cap)) Buf(cap);
+    }
+
+    char *chars() { return reinterpret_cast<char *>(this + 1); }
+
+    std::atomic<uint32_t> refs_;
+    std::atomic<size_t> used_; // Bytes from the start that some Str has claimed
+    size_t cap_;
+};
+
+Str::Str(std::string_view s) : size_{ s.size() } {
+    if (size_ <= inline_cap) {
+        std::memcpy(in_, s.data(), size_);
+        return;
+    }
+    Buf *b = Buf::make(size_);
+    std::memcpy(b->chars(), s.data(), size_);
+    b->used_.store(size_, std::memory_order_relaxed);
+    out_ = { b, 0 };
+}
+
+Str::Str(const Str &o) noexcept : size_{ o.size_ } {
+    std::memcpy(in_, o.in_, inline_cap);
+    if (size_ > inline_cap) out_.buf_->refs_.fetch_add(1, std::memory_order_relaxed);
+}
+
+Str::Str(Str &&o) noexcept : size_{ o.size_ } {
+    std::memcpy(in_, o.in_, inline_cap);
+    o.size_ = 0;
+}
+
+Str &Str::operator=(const Str &o) noexcept {
+    if (this != &o) {
+        Str copy(o);
+        *this = std::move(copy);
+    }
+    return *this;
+}
+
+Str &Str::operator=(Str &&o) noexcept {
+    if (this != &o) {
+        release();
+        std::memcpy(in_, o.in_, inline_cap);
+        size_ = o.size_;
+        o.size_ = 0;
+    }
+    return *this;
+}
+
+Str::~Str() {
+    release();
+}
+
+void Str::release() noexcept {
+    if (size_ <= inline_cap) return;
+    Buf *b = out_.buf_;
+    if (b->refs_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        b->~Buf();
+        ::operator delete(b);
+    }
+    size_ = 0;
+}
+
+const char *Str::data() const {
+    return size_ <= inline_cap ? in_ : out_.buf_->chars() + out_.off_;
+}
+
+// Moves the bytes to a buffer of their own with room for `cap`
+void Str::reserve_copy(size_t cap) {
+    Buf *b = Buf::make(cap);
+    size_t n = size_;
+    std::memcpy(b->chars(), data(), n);
+    b->used_.store(n, std::memory_order_relaxed);
+    release();
+    out_ = { b, 0 };
+    size_ = n;
+}
+
+Str &Str::operator+=(std::string_view s) {
+    size_t n = s.size();
+    size_t total = size_ + n;
+    if (n == 0) return *this;
+    if (total <= inline_cap) {
+        std::memcpy(in_ + size_, s.data(), n);
+        size_ = total;
+        return *this;
+    }
+
+    // Claim the bytes after ours. Nobody can see them yet, so `s` is not in
+    // them even if it is a view of this buffer.
+    if (size_ > inline_cap) {
+        Buf *b = out_.buf_;
+        size_t end = out_.off_ + size_;
+        size_t expected = end;
+        if (end + n <= b->cap_ && b->used_.compare_exchange_strong(expected, end + n, std::memory_order_relaxed)) {
+            std::memcpy(b->chars() + end, s.data(), n);
+            size_ = total;
+            return *this;
+        }
+    }
+
+    // Doubling keeps a run of appends linear. `s` is copied before the old
+    // buffer can go.
+    Buf *b = Buf::make(std::max(2 * total, size_t{ 64 }));
+    std::memcpy(b->chars(), data(), size_);
+    std::memcpy(b->chars() + size_, s.data(), n);
+    b->used_.store(total, std::memory_order_relaxed);
+    release();
+    out_ = { b, 0 };
+    size_ = total;
+    return *this;
+}
+
+void Str::assign(size_t n, char c) {
+    if (n <= inline_cap) {
+        release();
+        std::memset(in_, c, n);
+        size_ = n;
+    } else {
+        *this = Str(std::string(n, c));
+    }
+}
+
+Str Str::substr(size_t pos, size_t n) const {
+    assert(pos <= size_ && n <= size_ - pos);
+    if (n <= inline_cap) return Str(view().substr(pos, n));
+    Str s;
+    s.out_ = { out_.buf_, out_.off_ + pos };
+    s.size_ = n;
+    out_.buf_->refs_.fetch_add(1, std::memory_order_relaxed);
+    return s;
+}
+
+char *Str::mutable_data() {
+    if (size_ <= inline_cap) return in_;
+    if (out_.buf_->refs_.load(std::memory_order_acquire) != 1) reserve_copy(size_);
+    return out_.buf_->chars() + out_.off_;
+}
+
+bool Str::same_bytes(const Str &o) const {
+    return size_ > inline_cap && o.size_ > inline_cap && out_.buf_ == o.out_.buf_ && out_.off_ == o.out_.off_;
+}
+
+Str intern(std::string_view s) {
+    if (s.size() <= Str::inline_cap) return Str(s);
+
+    // Never destroyed, so that interned Strs outlive any static that holds one
+    static std::mutex lock;
+    static auto *table = new std::unordered_map<std::string_view, Str>();
+
+    std::lock_guard guard(lock);
+    if (auto it = table->find(s); it != table->end()) return it->second;
+    Str str(s);
+    std::string_view key = str.view(); // In the buffer, which the table keeps
+    return table->emplace(key, std::move(str)).first->second;
+}
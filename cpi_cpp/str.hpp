@@ -0,0 +1,74 @@
+#pragma once
+
+#include "util.hpp"
+
+#include <atomic>
+#include <compare>
+
+// A STRING value. Up to inline_cap bytes are stored in the Str itself.
+// Longer strings live in a reference counted buffer, so copying a Str is
+// O(1) and LEFT, RIGHT and MID return views into the same buffer.
+//
+// A buffer is never changed under a Str that can see it. Appending writes
+// past the end of this Str, which succeeds in place only if no other Str has
+// already claimed the bytes there. So S <- S & X, where the old S is one copy
+// and the new S another, grows a single buffer by doubling, and building a
+// string in a loop is linear rather than quadratic. Claims are atomic, so
+// Strs that share a buffer may be used from different threads.
+struct Str {
+    static constexpr size_t inline_cap = 16;
+
+    Str() noexcept : size_{ 0 } {}
+    explicit Str(std::string_view s);
+    Str(const Str &o) noexcept;
+    Str(Str &&o) noexcept;
+    Str &operator=(const Str &o) noexcept;
+    Str &operator=(Str &&o) noexcept;
+    ~Str();
+
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    const char *data() const;
+    std::string_view view() const { return { data(), size_ }; }
+    std::string str() const { return std::string(view()); }
+
+    Str &operator+=(std::string_view s);
+    Str &operator+=(const Str &s) { return *this += s.view(); }
+    Str &operator+=(char c) { return *this += std::string_view(&c, 1); }
+    void assign(size_t n, char c);
+
+    // [pos, pos + n), sharing this Str's buffer. Must be in range.
+    Str substr(size_t pos, size_t n) const;
+
+    // The bytes, to change in place. A shared buffer is copied first.
+    char *mutable_data();
+
+    // Whether this and `o` are views of the same bytes, which makes
+    // comparing them trivial. Interned literals often are.
+    bool same_bytes(const Str &o) const;
+
+    friend bool operator==(const Str &a, const Str &b) {
+        return a.size_ == b.size_ && (a.same_bytes(b) || a.view() == b.view());
+    }
+    friend std::strong_ordering operator<=>(const Str &a, const Str &b) { return a.view() <=> b.view(); }
+    friend bool operator==(const Str &a, std::string_view b) { return a.view() == b; }
+
+private:
+    struct Buf;
+    void release() noexcept;
+    void reserve_copy(size_t cap);
+
+    union {
+        char in_[inline_cap];
+        struct {
+            Buf *buf_;
+            size_t off_;
+        } out_;
+    };
+    size_t size_; // Inline if no more than inline_cap
+};
+
+// The one Str for each distinct text. Literals are interned when parsed, so
+// equal ones share a buffer and compare without looking at their bytes.
+// Interned buffers are kept until the process exits.
+Str intern(std::string_view s);
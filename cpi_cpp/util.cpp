@@ -1,4 +1,5 @@
 #include "util.hpp"
+#include "ascii.hpp"
 
 void ltrim(std::string &s) {
     s.erase(s.begin(), std::find_if(s.begin(), s.end(), [](unsigned char ch) {
@@ -18,13 +19,5 @@ void trim(std::string &s) {
 };
 
 void lower(std::string &s) {
-    std::transform(
-        s.begin(), s.end(),
-        s.begin(),
-        [](char c) -> char {
-        if (c <= 'Z' && c >= 'A')
-            return c - ('Z' - 'z');
-        return c;
-    }
-    );
+    ascii_lower(s.data(), s.size());
 };
\ No newline at end of file
@@ -3,6 +3,7 @@
 #include <print>
 #include <unordered_map>
 #include <vector>
+#include <array>
 #include <string>
 #include <cassert>
 #include <algorithm>
@@ -14,6 +15,8 @@
 #include <cctype>
 #include <stdexcept>
 #include <functional>
+#include <iostream>
+#include <random>
 
 void ltrim(std::string &s);
 void trim(std::string &s);
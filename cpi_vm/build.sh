@@ -1 +1,2 @@
-clang main.c -o cpi -DCPI_RUN_TESTS=1 -DPLATFORM_APPLE -g -fsanitize=address -fsanitize=undefined
+clang elaisa_executor.c -o cpi -DCPI_RUN_TESTS=1 -DPLATFORM_APPLE -g -fsanitize=address -fsanitize=undefined
+clang elaisa_executor.c -o cpi_bench -DCPI_RUN_BENCH=1 -DPLATFORM_APPLE -O2
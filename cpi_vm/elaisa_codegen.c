@@ -0,0 +1,303 @@
+/* Code generation from a three-address form of pseudocode, with linear-scan
+   register allocation of its locals.
+
+   A compiler front end lowers a PROCEDURE body to a list of Ir, in which
+   locals are numbered from 0 and constants are bytes. cg_generate() gives
+   each local a live interval, allocates the intervals to GPRs in one pass
+   in order of their start, and emits elaisa code in which a local is either
+   a GPR operand or, if it was spilled, its home word in vm_mem.
+
+   Every local has a home, a slot of the current frame: local n is SLT 2 + n,
+   after the frame's two header words. Since the homes are in the frame, a
+   procedure that calls itself keeps each call's locals apart. The first
+   cg_params locals are parameters, which the caller writes to those slots
+   before CALL, as IR_ARG does.
+
+   Intervals are widened over any loop they are live in, so that a value
+   carried around a back edge keeps one location. When the registers run out
+   the interval with the lowest spill weight goes to memory, where a use
+   weighs CG_LOOP_WEIGHT times more for each loop it is nested in: loop
+   counters and accumulators stay in registers and locals only touched
+   outside the loop are spilled first.
+
+   CALL clobbers every GPR, so a local held in a register across a call is
+   saved to its home before the call and reloaded after. The callee's frame
+   starts past the homes.
+
+   The code is built as a Code, which the peephole pass tidies and fuses into
+   superinstructions when cg_optimize is set, before it is encoded. */
+
+enum {
+ IR_SET,    /* dst <- constant */
+ IR_MOV,    /* dst <- src */
+ IR_ARITH,  /* dst op<- src, op as for ARITH */
+ IR_ARITHK, /* dst op<- constant */
+ IR_BRC,    /* IF dst cond src GOTO label, cond as for BRC */
+ IR_BRCK,   /* IF dst cond constant GOTO label */
+ IR_JMP,    /* GOTO label */
+ IR_LABEL,  /* label: */
+ IR_CALL,   /* dst <- CALL target; dst may be CG_NONE */
+ IR_ARG,    /* Argument dst of the next CALL <- src */
+ IR_RET     /* RETURN dst, which may be CG_NONE, in r0 */
+};
+
+typedef struct Ir Ir;
+struct Ir {
+ byte ir_op;
+ byte ir_sub; /* Arithmetic operator or branch condition */
+ word ir_dst;
+ word ir_src; /* Local, constant or CALL target */
+ word ir_label;
+};
+
+#define CG_MAX_VARS 64
+#define CG_HEADER 2 /* Frame header words, before local 0's home */
+#define CG_NONE 0xFFFFFFFF
+#define CG_SPILLED 0xFF
+#define CG_LOOP_WEIGHT 8
+
+/* r0 holds results and r1-r4 arguments to ECALL, so locals get r5 up */
+#define CG_FIRST_REG 5
+#define CG_MAX_REGS (GPR_COUNT - CG_FIRST_REG)
+
+typedef struct Codegen Codegen;
+struct Codegen {
+ const Ir *cg_ir;
+ word cg_len;
+ word cg_vars;
+ word cg_regs; /* How many GPRs to allocate, up to CG_MAX_REGS */
+ word cg_params; /* Locals that arrive as arguments, in their homes */
+ int cg_optimize; /* Run the peephole pass */
+
+ /* Results */
+ byte cg_reg[CG_MAX_VARS]; /* GPR of each local, or CG_SPILLED */
+ word cg_start[CG_MAX_VARS], cg_end[CG_MAX_VARS], cg_weight[CG_MAX_VARS];
+ Code cg_code;
+ word cg_spilled; /* Locals left in memory */
+ word cg_saves; /* Registers saved around calls */
+};
+
+/* Whether `ir` reads or writes `var` */
+int cg_refers(const Ir *ir, word var) {
+ int src_is_var = ir->ir_op == IR_MOV || ir->ir_op == IR_ARITH || ir->ir_op == IR_BRC || ir->ir_op == IR_ARG;
+ int dst_is_var = ir->ir_op != IR_JMP && ir->ir_op != IR_LABEL && ir->ir_op != IR_ARG;
+ return (dst_is_var && ir->ir_dst == var) || (src_is_var && ir->ir_src == var);
+}
+
+/* Header and homes. A callee's frame starts this many slots on. */
+word cg_frame(const Codegen *cg) {
+ return CG_HEADER + cg->cg_vars;
+}
+
+word cg_label_pos(const Codegen *cg, word label) {
+ word i;
+ for (i = 0; i < cg->cg_len; ++i) {
+  if (cg->cg_ir[i].ir_op == IR_LABEL && cg->cg_ir[i].ir_label == label) return i;
+ }
+ return CG_NONE;
+}
+
+/* Whether instruction `i` branches back to a label at or before it, and if
+   so where that label is */
+int cg_back_edge(const Codegen *cg, word i, word *to) {
+ byte op = cg->cg_ir[i].ir_op;
+ if (op != IR_JMP && op != IR_BRC && op != IR_BRCK) return 0;
+ *to = cg_label_pos(cg, cg->cg_ir[i].ir_label);
+ return *to <= i;
+}
+
+void cg_intervals(Codegen *cg) {
+ word i, v, to;
+ int changed = 1;
+
+ for (v = 0; v < cg->cg_vars; ++v) {
+  cg->cg_start[v] = CG_NONE;
+  cg->cg_end[v] = 0;
+  cg->cg_weight[v] = 0;
+ }
+ for (i = 0; i < cg->cg_len; ++i) {
+  word weight = 1;
+  for (to = 0; to < cg->cg_len; ++to) {
+   word l;
+   if (cg_back_edge(cg, to, &l) && l <= i && i <= to && weight < 0x1000000) weight *= CG_LOOP_WEIGHT;
+  }
+  for (v = 0; v < cg->cg_vars; ++v) {
+   if (!cg_refers(&cg->cg_ir[i], v)) continue;
+   if (cg->cg_start[v] == CG_NONE) cg->cg_start[v] = i;
+   cg->cg_end[v] = i;
+   cg->cg_weight[v] += weight;
+  }
+ }
+
+ /* A parameter holds its argument from the start */
+ for (v = 0; v < cg->cg_params && v < cg->cg_vars; ++v) {
+  if (cg->cg_start[v] != CG_NONE) cg->cg_start[v] = 0;
+ }
+
+ /* A local live anywhere in a loop is live all the way round it. Widening
+    over an inner loop can make a local overlap an outer one, so repeat. */
+ while (changed) {
+  changed = 0;
+  for (i = 0; i < cg->cg_len; ++i) {
+   if (!cg_back_edge(cg, i, &to)) continue;
+   for (v = 0; v < cg->cg_vars; ++v) {
+    if (cg->cg_start[v] == CG_NONE || cg->cg_start[v] > i || cg->cg_end[v] < to) continue;
+    if (cg->cg_start[v] > to) cg->cg_start[v] = to, changed = 1;
+    if (cg->cg_end[v] < i) cg->cg_end[v] = i, changed = 1;
+   }
+  }
+ }
+}
+
+void cg_allocate(Codegen *cg) {
+ word order[CG_MAX_VARS], active[CG_MAX_REGS];
+ word n = 0, n_active = 0, i, j;
+ byte free_regs[CG_MAX_REGS];
+ word n_free = 0;
+ word regs = cg->cg_regs < CG_MAX_REGS ? cg->cg_regs : CG_MAX_REGS;
+
+ for (i = regs; i > 0; --i) free_regs[n_free++] = (byte)(CG_FIRST_REG + i - 1);
+ for (i = 0; i < cg->cg_vars; ++i) {
+  cg->cg_reg[i] = CG_SPILLED;
+  if (cg->cg_start[i] == CG_NONE) continue;
+  /* Insertion sort by start */
+  for (j = n; j > 0 && cg->cg_start[order[j - 1]] > cg->cg_start[i]; --j) order[j] = order[j - 1];
+  order[j] = i;
+  ++n;
+ }
+
+ for (i = 0; i < n; ++i) {
+  word v = order[i], cheapest = CG_NONE;
+
+  /* Expire intervals that ended before this one starts */
+  for (j = 0; j < n_active; ) {
+   if (cg->cg_end[active[j]] < cg->cg_start[v]) {
+    free_regs[n_free++] = cg->cg_reg[active[j]];
+    active[j] = active[--n_active];
+   } else {
+    ++j;
+   }
+  }
+
+  if (n_free) {
+   cg->cg_reg[v] = free_regs[--n_free];
+   active[n_active++] = v;
+   continue;
+  }
+  for (j = 0; j < n_active; ++j) {
+   if (cheapest == CG_NONE || cg->cg_weight[active[j]] < cg->cg_weight[active[cheapest]]) cheapest = j;
+  }
+  if (cheapest != CG_NONE && cg->cg_weight[active[cheapest]] < cg->cg_weight[v]) {
+   /* Take the register of a local that is used less */
+   cg->cg_reg[v] = cg->cg_reg[active[cheapest]];
+   cg->cg_reg[active[cheapest]] = CG_SPILLED;
+   active[cheapest] = v;
+  }
+ }
+
+ cg->cg_spilled = 0;
+ for (i = 0; i < cg->cg_vars; ++i) cg->cg_spilled += cg->cg_reg[i] == CG_SPILLED;
+}
+
+struct Rmab cg_home(word var) {
+ return slt((byte)(CG_HEADER + var));
+}
+
+struct Rmab cg_operand(const Codegen *cg, word var) {
+ if (cg->cg_reg[var] != CG_SPILLED) return gpr(cg->cg_reg[var]);
+ return cg_home(var);
+}
+
+void cg_push(Codegen *cg, byte instr, struct Rmab dst, byte op, struct Rmab src, word label) {
+ code_push(&cg->cg_code, make_instr(instr, dst, op, src, 0), label);
+}
+
+/* Saves (or restores) the registers of locals live across the call at `i` */
+void cg_around_call(Codegen *cg, word i, int save) {
+ word v;
+ for (v = 0; v < cg->cg_vars; ++v) {
+  if (cg->cg_reg[v] == CG_SPILLED || cg->cg_start[v] >= i || cg->cg_end[v] <= i) continue;
+  if (save) {
+   cg_push(cg, 1, cg_home(v), 0, gpr(cg->cg_reg[v]), CODE_NO_LABEL);
+   cg->cg_saves += 1;
+  } else {
+   cg_push(cg, 1, gpr(cg->cg_reg[v]), 0, cg_home(v), CODE_NO_LABEL);
+  }
+ }
+}
+
+/* Allocates registers and emits the code at `at`. Returns the address just
+   past the code, or CG_NONE if the Ir is out of bounds. The code runs in a
+   frame of cg_frame() slots, whose homes must be within the stack. */
+word cg_generate(Codegen *cg, byte *mem, word at) {
+ struct Rmab none = { 0 };
+ Code *c = &cg->cg_code;
+ word i;
+
+ if (cg->cg_vars > CG_MAX_VARS) return CG_NONE;
+ cg_intervals(cg);
+ cg_allocate(cg);
+ cg->cg_saves = 0;
+ c->co_len = c->co_overflow = c->co_removed = c->co_fused = 0;
+ for (i = 0; i < CODE_MAX_LABELS; ++i) c->co_label_at[i] = CODE_NO_LABEL;
+
+ /* Parameters given registers are loaded from their homes on entry */
+ for (i = 0; i < cg->cg_params && i < cg->cg_vars; ++i) {
+  if (cg->cg_reg[i] != CG_SPILLED) cg_push(cg, 1, gpr(cg->cg_reg[i]), 0, cg_home(i), CODE_NO_LABEL);
+ }
+
+ for (i = 0; i < cg->cg_len; ++i) {
+  const Ir *ir = &cg->cg_ir[i];
+  struct Rmab dst = ir->ir_dst < cg->cg_vars ? cg_operand(cg, ir->ir_dst) : none;
+  word label = ir->ir_label < CODE_MAX_LABELS ? ir->ir_label : CODE_NO_LABEL;
+
+  if (ir->ir_op == IR_SET) {
+   if (dst.rmab_tag == 0) {
+    cg_push(cg, 1, dst, 0, byt((byte)ir->ir_src), CODE_NO_LABEL);
+   } else {
+    /* ASSGN to memory from a byte writes only that byte */
+    cg_push(cg, 1, gpr(1), 0, byt((byte)ir->ir_src), CODE_NO_LABEL);
+    cg_push(cg, 1, dst, 0, gpr(1), CODE_NO_LABEL);
+   }
+  } else if (ir->ir_op == IR_MOV) {
+   cg_push(cg, 1, dst, 0, cg_operand(cg, ir->ir_src), CODE_NO_LABEL);
+  } else if (ir->ir_op == IR_ARITH) {
+   cg_push(cg, 2, dst, ir->ir_sub, cg_operand(cg, ir->ir_src), CODE_NO_LABEL);
+  } else if (ir->ir_op == IR_ARITHK) {
+   cg_push(cg, 2, dst, ir->ir_sub, byt((byte)ir->ir_src), CODE_NO_LABEL);
+  } else if (ir->ir_op == IR_BRC || ir->ir_op == IR_BRCK) {
+   struct Rmab src = ir->ir_op == IR_BRC ? cg_operand(cg, ir->ir_src) : byt((byte)ir->ir_src);
+   if (label == CODE_NO_LABEL) return CG_NONE;
+   cg_push(cg, 7, dst, ir->ir_sub, src, label);
+  } else if (ir->ir_op == IR_JMP) {
+   if (label == CODE_NO_LABEL) return CG_NONE;
+   cg_push(cg, 6, none, 0, none, label);
+  } else if (ir->ir_op == IR_LABEL) {
+   code_label(c, ir->ir_label);
+  } else if (ir->ir_op == IR_CALL) {
+   cg_around_call(cg, i, 1);
+   code_push(c, make_instr(3, none, (byte)cg_frame(cg), none, ir->ir_src), CODE_NO_LABEL);
+   cg_around_call(cg, i, 0);
+   if (ir->ir_dst != CG_NONE) cg_push(cg, 1, dst, 0, gpr(0), CODE_NO_LABEL);
+  } else if (ir->ir_op == IR_ARG) {
+   /* The callee's local dst, in the frame that starts past this one */
+   if (cg_frame(cg) + CG_HEADER + ir->ir_dst > 0xFF) return CG_NONE;
+   cg_push(cg, 1, slt((byte)(cg_frame(cg) + CG_HEADER + ir->ir_dst)), 0, cg_operand(cg, ir->ir_src), CODE_NO_LABEL);
+  } else if (ir->ir_op == IR_RET) {
+   if (ir->ir_dst != CG_NONE) cg_push(cg, 1, gpr(0), 0, dst, CODE_NO_LABEL);
+   cg_push(cg, 4, none, 0, none, CODE_NO_LABEL);
+  }
+ }
+ if (c->co_overflow) return CG_NONE;
+
+ if (cg->cg_optimize) peephole(c);
+ return code_encode(c, mem, at);
+}
+
+/* The value of a local after the code has run in the frame at FP */
+word cg_value(const Codegen *cg, Vm *v, word var) {
+ word value;
+ if (cg->cg_reg[var] != CG_SPILLED) return v->vm_gpr[cg->cg_reg[var]];
+ read_word(&v->vm_mem[v->vm_fp + 4 * (CG_HEADER + var)], &value);
+ return value;
+}
@@ -3,8 +3,8 @@
 
 typedef void (*Fn)(void*);
 
-void call_fn_ptr_idx(Fn *fns, word idx) {
-	(fns + idx)();
+void call_fn_ptr_idx(Fn *fns, word idx, void *arg) {
+	fns[idx](arg);
 }
 
 struct Rmab {
@@ -13,21 +13,24 @@ struct Rmab {
  word rmab_m_mem;
  word rmab_a_ptr, rmab_a_len;
  byte rmab_b_byte;
+ byte rmab_s_slot; /* SLT, REF: word slot of the current frame */
 };
 
 
 void print_rmab_human(struct Rmab r) {
- if (r.rmab_tag > 3) printf("!!! ");
+ if (r.rmab_tag > 5) printf("!!! ");
  if (r.rmab_tag == 0) printf("GPR %2.2x ", r.rmab_r_reg);
  else if (r.rmab_tag == 1) printf("MEM 0x%8.8x ", r.rmab_m_mem);
  else if (r.rmab_tag == 2) printf("ARR 0x%x 0x%8.8x ", r.rmab_a_ptr, r.rmab_a_len);
  else if (r.rmab_tag == 3) printf("BYT 0x%2.2x ", r.rmab_b_byte);
+ else if (r.rmab_tag == 4) printf("SLT %2.2x ", r.rmab_s_slot);
+ else if (r.rmab_tag == 5) printf("REF %2.2x ", r.rmab_s_slot);
 }
 
 
 
 void print_rmab_bytes(struct Rmab r) {
- if (r.rmab_tag > 3) {
+ if (r.rmab_tag > 5) {
   printf("!! ");
   return;
  }
@@ -41,6 +44,8 @@ void print_rmab_bytes(struct Rmab r) {
   print_word_bytes(r.rmab_a_len);
  } else if (r.rmab_tag == 3) {
   print_byte(r.rmab_b_byte);
+ } else {
+  print_byte(r.rmab_s_slot);
  }
 }
 
@@ -59,6 +64,8 @@ int write_rmab(byte *adr, struct Rmab r) {
   adr += write_word(adr, r.rmab_a_len);
  } else if (r.rmab_tag == 3) {
   adr += write_byte(adr, r.rmab_b_byte);
+ } else if (r.rmab_tag == 4 || r.rmab_tag == 5) {
+  adr += write_byte(adr, r.rmab_s_slot);
  } else {
   return INVALID;
  }
@@ -78,6 +85,8 @@ int read_rmab(byte *adr, struct Rmab *r) {
   adr += read_word(adr, &r->rmab_a_len);
  } else if (r->rmab_tag == 3) {
   adr += read_byte(adr, &r->rmab_b_byte);
+ } else if (r->rmab_tag == 4 || r->rmab_tag == 5) {
+  adr += read_byte(adr, &r->rmab_s_slot);
  } else {
   return INVALID;
  }
@@ -89,8 +98,14 @@ struct Instr {
  byte param_instr;
  struct Rmab param_src, param_dst;
  byte param_op;
+ word param_target; /* JMP, BRC, CALL, ARITHJ: address to continue at */
+ struct Rmab param_aux; /* ARITH3: second source */
 };
 
+/* BRC conditions, comparing dst with src as unsigned words */
+const char *brc_names[] = { "==", "<>", "<", "<=", ">", ">=" };
+#define BRC_COND_COUNT 6
+
 void print_instr_human(Instr p) {
  if (p.param_instr == 0) {
   printf("ZTRAP");
@@ -98,28 +113,50 @@ void print_instr_human(Instr p) {
   printf("ASSGN ");
   print_rmab_human(p.param_dst);
   print_rmab_human(p.param_src);
- } else if (p.param_instr == 2) {
-  printf("ARITH ");
+ } else if (p.param_instr == 2 || p.param_instr == 10) {
+  printf(p.param_instr == 2 ? "ARITH " : "ARITHJ ");
   print_rmab_human(p.param_dst);
   {
    char *o[] = { "+=", "-=", "*=", "/=" };
    printf("%s ", p.param_op <= 3 ? o[p.param_op] : "!!");
   }
   print_rmab_human(p.param_src);
+  if (p.param_instr == 10) printf("-> 0x%8.8x", p.param_target);
  } else if (p.param_instr == 3) {
-  printf("CALL ");
-  print_rmab_human(p.param_src);
+  printf("CALL 0x%8.8x FRAME %u", p.param_target, p.param_op);
  } else if (p.param_instr == 4) {
   printf("RET");
  } else if (p.param_instr == 5) {
   printf("ECALL ");
   print_rmab_human(p.param_src);
+ } else if (p.param_instr == 6) {
+  printf("JMP 0x%8.8x", p.param_target);
+ } else if (p.param_instr == 7) {
+  printf("BRC ");
+  print_rmab_human(p.param_dst);
+  printf("%s ", p.param_op < BRC_COND_COUNT ? brc_names[p.param_op] : "!!");
+  print_rmab_human(p.param_src);
+  printf("-> 0x%8.8x", p.param_target);
+ } else if (p.param_instr == 8) {
+  printf("LEA ");
+  print_rmab_human(p.param_dst);
+  print_rmab_human(p.param_src);
+ } else if (p.param_instr == 9) {
+  printf("ARITH3 ");
+  print_rmab_human(p.param_dst);
+  printf("<- ");
+  print_rmab_human(p.param_src);
+  {
+   char *o[] = { "+", "-", "*", "/" };
+   printf("%s ", p.param_op <= 3 ? o[p.param_op] : "!!");
+  }
+  print_rmab_human(p.param_aux);
  } else printf("!!!");
  printf("\n");
 }
 
 void print_instr_bytes(Instr p) {
- if (p.param_instr > 5) { printf("!! "); return; }
+ if (p.param_instr > 10) { printf("!! "); return; }
  print_byte(p.param_instr);
  if (p.param_instr == 0) {
   ;
@@ -131,14 +168,40 @@ void print_instr_bytes(Instr p) {
   print_byte(p.param_op);
   print_rmab_bytes(p.param_src);
  } else if (p.param_instr == 3) {
-  print_rmab_bytes(p.param_src);
+  print_byte(p.param_op);
+  print_word_bytes(p.param_target);
  } else if (p.param_instr == 4) {
   ;
  } else if (p.param_instr == 5) {
   print_rmab_bytes(p.param_src);
+ } else if (p.param_instr == 6) {
+  print_word_bytes(p.param_target);
+ } else if (p.param_instr == 7) {
+  print_rmab_bytes(p.param_dst);
+  print_byte(p.param_op);
+  print_rmab_bytes(p.param_src);
+  print_word_bytes(p.param_target);
+ } else if (p.param_instr == 8) {
+  print_rmab_bytes(p.param_dst);
+  print_rmab_bytes(p.param_src);
+ } else if (p.param_instr == 9) {
+  print_rmab_bytes(p.param_dst);
+  print_byte(p.param_op);
+  print_rmab_bytes(p.param_src);
+  print_rmab_bytes(p.param_aux);
+ } else if (p.param_instr == 10) {
+  print_rmab_bytes(p.param_dst);
+  print_byte(p.param_op);
+  print_rmab_bytes(p.param_src);
+  print_word_bytes(p.param_target);
  } else printf("!! ");
 }
 
+/* MEM, SLT and REF operands name a word in vm_mem */
+int has_address(struct Rmab r) {
+ return r.rmab_tag == 1 || r.rmab_tag == 4 || r.rmab_tag == 5;
+}
+
 int write_instr(byte *adr, Instr p) {
  byte *start = adr;
  
@@ -155,23 +218,59 @@ int write_instr(byte *adr, Instr p) {
   adr += write_byte(adr, p.param_op);
   adr += write_rmab(adr, p.param_src);
  } else if (p.param_instr == 3) {
-  if (p.param_src.rmab_tag == 3) return INVALID;
-  adr += write_rmab(adr, p.param_src);
+  adr += write_byte(adr, p.param_op);
+  adr += write_word(adr, p.param_target);
  } else if (p.param_instr == 4) {
   ;
  } else if (p.param_instr == 5) {
-  if (p.param_src.rmab_tag == 3) return INVALID;
+  if (p.param_src.rmab_tag == 2) return INVALID;
   adr += write_rmab(adr, p.param_src);
+ } else if (p.param_instr == 6) {
+  adr += write_word(adr, p.param_target);
+ } else if (p.param_instr == 7) {
+  if (p.param_op >= BRC_COND_COUNT) return INVALID;
+  if (p.param_src.rmab_tag == 2 || p.param_dst.rmab_tag == 2) return INVALID;
+  adr += write_rmab(adr, p.param_dst);
+  adr += write_byte(adr, p.param_op);
+  adr += write_rmab(adr, p.param_src);
+  adr += write_word(adr, p.param_target);
+ } else if (p.param_instr == 8) {
+  if (!has_address(p.param_src) || p.param_dst.rmab_tag == 2 || p.param_dst.rmab_tag == 3) return INVALID;
+  adr += write_rmab(adr, p.param_dst);
+  adr += write_rmab(adr, p.param_src);
+ } else if (p.param_instr == 9) {
+  if (p.param_src.rmab_tag == 2 || p.param_aux.rmab_tag == 2) return INVALID;
+  if (p.param_dst.rmab_tag == 2 || p.param_dst.rmab_tag == 3) return INVALID;
+  adr += write_rmab(adr, p.param_dst);
+  adr += write_byte(adr, p.param_op);
+  adr += write_rmab(adr, p.param_src);
+  adr += write_rmab(adr, p.param_aux);
+ } else if (p.param_instr == 10) {
+  if (p.param_src.rmab_tag == 3 && p.param_dst.rmab_tag == 2) return INVALID;
+  adr += write_rmab(adr, p.param_dst);
+  adr += write_byte(adr, p.param_op);
+  adr += write_rmab(adr, p.param_src);
+  adr += write_word(adr, p.param_target);
  } else {
   return INVALID;
  }
  return adr - start;
 }
 
+/* Quickened forms of ARITH, written over the opcode byte by vm_step once an
+   ARITH has run. The encoding is otherwise ARITH's, so with a register
+   destination every operand sits at a fixed offset:
+   [0] opcode [1] dst tag [2] dst reg [3] arith op [4] src tag [5] src reg or byte */
+#define ARITH_GPR_GPR 0x82
+#define ARITH_GPR_BYTE 0x83
+
 int read_instr(byte *adr, Instr *p) {
  byte *start = adr;
  
  adr += read_byte(adr, &p->param_instr);
+ if (p->param_instr == ARITH_GPR_GPR || p->param_instr == ARITH_GPR_BYTE) {
+  p->param_instr = 2; /* Decodes as the instruction it was quickened from */
+ }
  if (p->param_instr == 0) {
   ;
  } else if (p->param_instr == 1) {
@@ -184,13 +283,32 @@ int read_instr(byte *adr, Instr *p) {
   adr += read_byte(adr, &p->param_op);
   adr += read_rmab(adr, &p->param_src);
  } else if (p->param_instr == 3) {
-  if (p->param_src.rmab_tag == 3) return INVALID;
-  adr += read_rmab(adr, &p->param_src);
+  adr += read_byte(adr, &p->param_op);
+  adr += read_word(adr, &p->param_target);
  } else if (p->param_instr == 4) {
   ;
  } else if (p->param_instr == 5) {
-  if (p->param_src.rmab_tag == 3) return INVALID;
   adr += read_rmab(adr, &p->param_src);
+ } else if (p->param_instr == 6) {
+  adr += read_word(adr, &p->param_target);
+ } else if (p->param_instr == 7) {
+  adr += read_rmab(adr, &p->param_dst);
+  adr += read_byte(adr, &p->param_op);
+  adr += read_rmab(adr, &p->param_src);
+  adr += read_word(adr, &p->param_target);
+ } else if (p->param_instr == 8) {
+  adr += read_rmab(adr, &p->param_dst);
+  adr += read_rmab(adr, &p->param_src);
+ } else if (p->param_instr == 9) {
+  adr += read_rmab(adr, &p->param_dst);
+  adr += read_byte(adr, &p->param_op);
+  adr += read_rmab(adr, &p->param_src);
+  adr += read_rmab(adr, &p->param_aux);
+ } else if (p->param_instr == 10) {
+  adr += read_rmab(adr, &p->param_dst);
+  adr += read_byte(adr, &p->param_op);
+  adr += read_rmab(adr, &p->param_src);
+  adr += read_word(adr, &p->param_target);
  } else {
   return INVALID;
  }
@@ -198,6 +316,7 @@ int read_instr(byte *adr, Instr *p) {
 }
 
 #define GPR_COUNT 16
+#define VM_FILE_COUNT 8
 typedef struct Vm Vm;
 struct Vm {
  byte *vm_mem;
@@ -206,17 +325,42 @@ struct Vm {
  word vm_rip;
  word vm_rflags;
 
+ /* The call stack is contiguous in vm_mem, from vm_stack_base up to
+    vm_stack_limit. A frame is two header words, the return address and the
+    caller's FP, followed by its slots; SLT n is the word at FP + 4 * n, so
+    arguments and locals start at slot 2. */
+ word vm_fp;
+ word vm_stack_base, vm_stack_limit;
+
  void (*vm_exception_callback)(Vm *, Instr p, const char*);
+
+ word vm_quickened; /* ARITH instructions rewritten to a quickened form */
+ word vm_despecialized; /* Quickened instructions whose guard failed */
+
+ const struct HostTable *vm_host; /* Set by vm_bind_host() */
+ const char *vm_host_error; /* Set by a host function that failed */
+ word vm_rng;
+ HostFile *vm_files[VM_FILE_COUNT];
+
+ struct Jit *vm_jit; /* Native code for hot loops in vm_run(), or 0 to interpret everything */
+
+ const qword *vm_fixed; /* Code in the fixed encoding, for vm_step_fixed() */
+ word vm_fixed_len;
+ int vm_guarded; /* vm_mem is from vm_map_mem(), with guard pages after it */
 };
 
+#include "elaisa_host.c"
+
 void print_vm(Vm *v) {
  int i = 0;
 
  printf("Vm { \n");
  printf("\tRIP = 0x%8.8x\n", v->vm_rip);
  printf("\tRFLAGS = 0x%8.8x\n", v->vm_rflags);
+ printf("\tFP = 0x%8.8x (stack 0x%8.8x..0x%8.8x)\n", v->vm_fp, v->vm_stack_base, v->vm_stack_limit);
  for (i=0; i<GPR_COUNT; ++i) printf("\tGPR %2.2X = 0x%8.8x\n", i, v->vm_gpr[i]);
  printf("\tHost exception callback @ 0x%p\n", (void*)v->vm_exception_callback);
+ printf("\tQuickened %u, despecialized %u\n", v->vm_quickened, v->vm_despecialized);
  printf("}\n");
 }
 
@@ -229,6 +373,78 @@ void vm_default_exception_callback(Vm *v, Instr p, const char *msg) {
  //exit(1);
 }
 
+/* *dst op= src. Returns an error message, or 0. */
+const char *arith_word(word *dst, byte op, word src) {
+ if (op == 0) *dst += src;
+ else if (op == 1) *dst -= src;
+ else if (op == 2) *dst *= src;
+ else if (op == 3) {
+  if (src == 0) return "Division by zero.";
+  *dst /= src;
+ } else return "Illegal instruction. Arithmetic operator out of range.";
+ return 0;
+}
+
+/* Where a MEM, SLT or REF operand lives in vm_mem. A REF slot holds the
+   address of the word it refers to, as passed for a BYREF parameter.
+   Returns an error message, or 0. */
+const char *operand_address(Vm *v, struct Rmab r, word *out) {
+ if (r.rmab_tag == 1) {
+  *out = r.rmab_m_mem;
+  return 0;
+ }
+ if (r.rmab_tag != 4 && r.rmab_tag != 5) return "Illegal instruction. Operand has no address.";
+ *out = v->vm_fp + 4 * (word)r.rmab_s_slot;
+ if (*out + 4 > v->vm_stack_limit) return "Stack slot out of range.";
+ if (r.rmab_tag == 5) read_word(&v->vm_mem[*out], out);
+ return 0;
+}
+
+/* The word an operand holds. Returns an error message, or 0. */
+const char *read_operand(Vm *v, struct Rmab r, word *out) {
+ word adr;
+ const char *err;
+
+ if (r.rmab_tag == 0) *out = v->vm_gpr[r.rmab_r_reg];
+ else if (r.rmab_tag == 3) *out = r.rmab_b_byte;
+ else if ((err = operand_address(v, r, &adr))) return err;
+ else read_word(&v->vm_mem[adr], out);
+ return 0;
+}
+
+/* Stores a word to a register, MEM, SLT or REF operand. Returns an error
+   message, or 0. */
+const char *write_operand(Vm *v, struct Rmab r, word value) {
+ word adr = 0;
+ const char *err;
+ if (r.rmab_tag == 0) v->vm_gpr[r.rmab_r_reg] = value;
+ else if ((err = operand_address(v, r, &adr))) return err;
+ else write_word(&v->vm_mem[adr], value);
+ return 0;
+}
+
+/* dst op= src, for a register or an operand with an address */
+const char *arith_operand(Vm *v, struct Rmab r, byte op, word src) {
+ word dst = 0, at = 0;
+ const char *err;
+ if (r.rmab_tag == 0) return arith_word(&v->vm_gpr[r.rmab_r_reg], op, src);
+ if (!has_address(r)) return "Illegal instruction. Arithmetic destination must be a register or memory.";
+ if ((err = operand_address(v, r, &at))) return err;
+ read_word(&v->vm_mem[at], &dst);
+ if ((err = arith_word(&dst, op, src))) return err;
+ write_word(&v->vm_mem[at], dst);
+ return 0;
+}
+
+int brc_taken(byte cond, word l, word r) {
+ if (cond == 0) return l == r;
+ if (cond == 1) return l != r;
+ if (cond == 2) return l < r;
+ if (cond == 3) return l <= r;
+ if (cond == 4) return l > r;
+ return l >= r;
+}
+
 void vm_exec_instr(Vm *v, Instr p) {
  if (p.param_instr == 0) {
   v->vm_exception_callback(v, p, "Zero trap");
@@ -236,7 +452,13 @@ void vm_exec_instr(Vm *v, Instr p) {
   if (p.param_dst.rmab_tag == 3 && p.param_src.rmab_tag == 2) {
    v->vm_exception_callback(v, p, "Illegal instruction. Assigning array to byte literal.");
   }
-  if (p.param_dst.rmab_tag == 0) {
+  if (p.param_dst.rmab_tag >= 4 || p.param_src.rmab_tag >= 4) {
+   /* Frame slots are whole words, whatever the source */
+   word src = 0;
+   const char *err = read_operand(v, p.param_src, &src);
+   if (!err) err = write_operand(v, p.param_dst, src);
+   if (err) v->vm_exception_callback(v, p, err);
+  } else if (p.param_dst.rmab_tag == 0) {
    if (p.param_src.rmab_tag == 0) {
     v->vm_gpr[p.param_dst.rmab_r_reg] = v->vm_gpr[p.param_src.rmab_r_reg];
    } else if (p.param_src.rmab_tag == 1) {
@@ -301,21 +523,419 @@ void vm_exec_instr(Vm *v, Instr p) {
   if (p.param_dst.rmab_tag == 3 && p.param_src.rmab_tag == 2) {
    v->vm_exception_callback(v, p, "Illegal instruction. Assigning array to byte literal.");
   }
+  {
+   word src = 0;
+   const char *err = read_operand(v, p.param_src, &src);
+   if (!err) err = arith_operand(v, p.param_dst, p.param_op, src);
+   if (err) v->vm_exception_callback(v, p, err);
+  }
  } else if (p.param_instr == 3) {
-    v->vm_exception_callback(v, p, "Illegal instruction. Unimplemented.");
+  /* The callee's frame starts where the caller's FRAME words end, so the
+     caller passes arguments by writing its slots FRAME + 2 onwards. */
+  word fp = v->vm_fp + 4 * (word)p.param_op;
+  if (fp < v->vm_fp || fp + 8 > v->vm_stack_limit) {
+   v->vm_exception_callback(v, p, "Stack overflow.");
+  } else {
+   write_word(&v->vm_mem[fp], v->vm_rip);
+   write_word(&v->vm_mem[fp + 4], v->vm_fp);
+   v->vm_fp = fp;
+   v->vm_rip = p.param_target;
+  }
  } else if (p.param_instr == 4) {
-    v->vm_exception_callback(v, p, "Illegal instruction. Unimplemented.");
+  if (v->vm_fp == v->vm_stack_base) {
+   v->vm_exception_callback(v, p, "Return without a call.");
+  } else {
+   read_word(&v->vm_mem[v->vm_fp], &v->vm_rip);
+   read_word(&v->vm_mem[v->vm_fp + 4], &v->vm_fp);
+  }
  } else if (p.param_instr == 5) {
-    v->vm_exception_callback(v, p, "Illegal instruction. Unimplemented.");
+  /* The index was resolved when the code was compiled */
+  word idx = 0;
+  const char *err = read_operand(v, p.param_src, &idx);
+  if (!err && !v->vm_host) err = "No host functions bound.";
+  if (!err && idx >= v->vm_host->ht_count) err = "Host function index out of range.";
+  if (!err) {
+   v->vm_host_error = 0;
+   call_fn_ptr_idx(v->vm_host->ht_fns, idx, v);
+   err = v->vm_host_error;
+  }
+  if (err) v->vm_exception_callback(v, p, err);
+ } else if (p.param_instr == 6) {
+  v->vm_rip = p.param_target;
+ } else if (p.param_instr == 7) {
+  /* Compare and branch in one instruction, so a condition never has to be
+     materialised into a register. A chain of BRCs short-circuits AND/OR. */
+  word l = 0, r = 0;
+  const char *err = read_operand(v, p.param_dst, &l);
+  if (!err) err = read_operand(v, p.param_src, &r);
+  if (!err && p.param_op >= BRC_COND_COUNT) err = "Illegal instruction. Branch condition out of range.";
+  if (err) v->vm_exception_callback(v, p, err);
+  else if (brc_taken(p.param_op, l, r)) v->vm_rip = p.param_target;
+ } else if (p.param_instr == 8) {
+  /* dst = address of src, to pass it BYREF */
+  word adr = 0;
+  const char *err = operand_address(v, p.param_src, &adr);
+  if (!err) {
+   word at = 0;
+   if (p.param_dst.rmab_tag == 0) v->vm_gpr[p.param_dst.rmab_r_reg] = adr;
+   else if (!(err = operand_address(v, p.param_dst, &at))) write_word(&v->vm_mem[at], adr);
+  }
+  if (err) v->vm_exception_callback(v, p, err);
+ } else if (p.param_instr == 9) {
+  /* Superinstruction for ASSGN dst <- src; ARITH dst op= aux */
+  word a = 0, b = 0;
+  const char *err = read_operand(v, p.param_src, &a);
+  if (!err) err = read_operand(v, p.param_aux, &b);
+  if (!err) err = arith_word(&a, p.param_op, b);
+  if (!err) err = write_operand(v, p.param_dst, a);
+  if (err) v->vm_exception_callback(v, p, err);
+ } else if (p.param_instr == 10) {
+  /* Superinstruction for ARITH dst op= src; JMP target */
+  word src = 0;
+  const char *err = read_operand(v, p.param_src, &src);
+  if (!err) err = arith_operand(v, p.param_dst, p.param_op, src);
+  if (err) v->vm_exception_callback(v, p, err);
+  else v->vm_rip = p.param_target;
  } else {
    v->vm_exception_callback(v, p, "Illegal instruction. Base instruction tag out of range.");
  }
 }
 
+/* The value of a register or byte operand encoded at `rmab`, or 0 if it is
+   some other kind */
+int fast_value(Vm *v, const byte *rmab, word *out) {
+ if (rmab[0] == 0) *out = v->vm_gpr[rmab[1]];
+ else if (rmab[0] == 3) *out = rmab[1];
+ else return 0;
+ return 1;
+}
+
+/* Executes the instruction at RIP. RIP moves past it before it runs, so a
+   branch that is taken simply overwrites it. Returns the length of the
+   instruction, or 0 if it could not be decoded.
+
+   ARITH quickens itself: after its first execution its opcode byte is
+   rewritten to a form specialised for its operand tags, which skips the
+   generic decoder. The quickened form guards on the tags it was specialised
+   for and writes ARITH back if they have changed, e.g. because the program
+   rewrote its own code, so that the generic path can requicken it.
+
+   BRC and the superinstructions ARITH3 and ARITHJ need no rewriting: with
+   register and byte operands, which are two bytes each, their layout is
+   fixed, so they are executed in place after a check of the tags. */
+int vm_step(Vm *v) {
+ byte *adr = &v->vm_mem[v->vm_rip];
+ Instr p = { 0 };
+ int len;
+
+ if (adr[0] == ARITH_GPR_GPR || adr[0] == ARITH_GPR_BYTE) {
+  byte src_tag = adr[0] == ARITH_GPR_GPR ? 0 : 3;
+  if (adr[1] == 0 && adr[4] == src_tag) {
+   word src = src_tag == 0 ? v->vm_gpr[adr[5]] : adr[5];
+   if (!arith_word(&v->vm_gpr[adr[2]], adr[3], src)) {
+    v->vm_rip += 6;
+    return 6;
+   }
+   /* Let the generic path raise the exception */
+  } else {
+   adr[0] = 2;
+   v->vm_despecialized += 1;
+  }
+ }
+
+ if (adr[0] == 7) {
+  /* [0] 7 [1] dst tag [2] dst [3] cond [4] src tag [5] src [6] target */
+  word l, r;
+  if (fast_value(v, adr + 1, &l) && fast_value(v, adr + 4, &r) && adr[3] < BRC_COND_COUNT) {
+   v->vm_rip += 10;
+   if (brc_taken(adr[3], l, r)) read_word(adr + 6, &v->vm_rip);
+   return 10;
+  }
+ } else if (adr[0] == 9 && adr[1] == 0) {
+  /* [0] 9 [1] 0 [2] dst reg [3] op [4] src tag [5] src [6] aux tag [7] aux */
+  word a, b;
+  if (fast_value(v, adr + 4, &a) && fast_value(v, adr + 6, &b) && !arith_word(&a, adr[3], b)) {
+   v->vm_gpr[adr[2]] = a;
+   v->vm_rip += 8;
+   return 8;
+  }
+ } else if (adr[0] == 10 && adr[1] == 0) {
+  /* [0] 10 [1] 0 [2] dst reg [3] op [4] src tag [5] src [6] target */
+  word src;
+  if (fast_value(v, adr + 4, &src) && !arith_word(&v->vm_gpr[adr[2]], adr[3], src)) {
+   read_word(adr + 6, &v->vm_rip);
+   return 10;
+  }
+ }
+
+ len = read_instr(adr, &p);
+ if (len == INVALID) {
+  v->vm_exception_callback(v, p, "Illegal instruction. Unable to decode.");
+  return 0;
+ }
+ v->vm_rip += len;
+ vm_exec_instr(v, p);
+
+ if (adr[0] == 2 && p.param_dst.rmab_tag == 0) {
+  if (p.param_src.rmab_tag == 0) adr[0] = ARITH_GPR_GPR;
+  else if (p.param_src.rmab_tag == 3) adr[0] = ARITH_GPR_BYTE;
+  if (adr[0] != 2) v->vm_quickened += 1;
+ }
+ return len;
+}
+
+/* Instruction builders, for code generation and hand assembly */
+struct Rmab gpr(byte r) { struct Rmab o = { 0 }; o.rmab_tag = 0; o.rmab_r_reg = r; return o; }
+struct Rmab mem_at(word m) { struct Rmab o = { 0 }; o.rmab_tag = 1; o.rmab_m_mem = m; return o; }
+struct Rmab byt(byte b) { struct Rmab o = { 0 }; o.rmab_tag = 3; o.rmab_b_byte = b; return o; }
+struct Rmab slt(byte s) { struct Rmab o = { 0 }; o.rmab_tag = 4; o.rmab_s_slot = s; return o; }
+struct Rmab ref(byte s) { struct Rmab o = { 0 }; o.rmab_tag = 5; o.rmab_s_slot = s; return o; }
+
+#include "elaisa_peephole.c"
+#include "elaisa_jit.c"
+#include "elaisa_fixed.c"
+
+word emit(byte *mem, word at, byte instr, struct Rmab dst, byte op, struct Rmab src, word target) {
+ return at + write_instr(&mem[at], make_instr(instr, dst, op, src, target));
+}
+
+/* Runs until RIP reaches `stop`. Returns the number of instructions
+   interpreted, which leaves out any run as native code by the JIT. */
+word vm_run(Vm *v, word stop) {
+ word steps = 0, from;
+ while (v->vm_rip != stop) {
+  from = v->vm_rip;
+  if (!vm_step(v)) break;
+  ++steps;
+  if (v->vm_jit && v->vm_rip < from) jit_backedge(v, from, stop);
+ }
+ return steps;
+}
+
+#include "elaisa_guard.c"
+#include "elaisa_codegen.c"
+
+#if defined CPI_RUN_TESTS || defined CPI_RUN_BENCH
+/* Hand assembly for the tests and benchmarks */
+/* FUNCTION Fib(n) RETURNS INTEGER, result in r0.
+   Frame: 4 words, SLT 2 = n, SLT 3 = Fib(n - 1); the callee's n is SLT 6. */
+word emit_fib(byte *mem, word at) {
+ struct Rmab none = { 0 };
+ word f = at, brc_end, rec;
+ at = emit(mem, at, 7, slt(2), 5, byt(2), 0); /* n >= 2 -> rec */
+ brc_end = at;
+ at = emit(mem, at, 1, gpr(0), 0, slt(2), 0);
+ at = emit(mem, at, 4, none, 0, none, 0);
+ rec = at;
+ write_word(&mem[brc_end - 4], rec);
+ at = emit(mem, at, 1, slt(6), 0, slt(2), 0);
+ at = emit(mem, at, 2, slt(6), 1, byt(1), 0);
+ at = emit(mem, at, 3, none, 4, none, f);
+ at = emit(mem, at, 1, slt(3), 0, gpr(0), 0);
+ at = emit(mem, at, 1, slt(6), 0, slt(2), 0);
+ at = emit(mem, at, 2, slt(6), 1, byt(2), 0);
+ at = emit(mem, at, 3, none, 4, none, f);
+ at = emit(mem, at, 2, gpr(0), 0, slt(3), 0);
+ at = emit(mem, at, 4, none, 0, none, 0);
+ return at;
+}
+
+/* FUNCTION Factorial(n) RETURNS INTEGER, result in r0.
+   Frame: 3 words, SLT 2 = n; the callee's n is SLT 5. */
+word emit_factorial(byte *mem, word at) {
+ struct Rmab none = { 0 };
+ word f = at, brc_end;
+ at = emit(mem, at, 7, slt(2), 4, byt(1), 0); /* n > 1 -> rec */
+ brc_end = at;
+ at = emit(mem, at, 1, gpr(0), 0, byt(1), 0);
+ at = emit(mem, at, 4, none, 0, none, 0);
+ write_word(&mem[brc_end - 4], at);
+ at = emit(mem, at, 1, slt(5), 0, slt(2), 0);
+ at = emit(mem, at, 2, slt(5), 1, byt(1), 0);
+ at = emit(mem, at, 3, none, 3, none, f);
+ at = emit(mem, at, 2, gpr(0), 2, slt(2), 0);
+ at = emit(mem, at, 4, none, 0, none, 0);
+ return at;
+}
+
+/* PROCEDURE Chain(n): calls itself n levels deep.
+   Frame: 3 words, SLT 2 = n; the callee's n is SLT 5. */
+word emit_chain(byte *mem, word at) {
+ struct Rmab none = { 0 };
+ word f = at, brc_end;
+ at = emit(mem, at, 7, slt(2), 0, byt(0), 0); /* n == 0 -> done */
+ brc_end = at;
+ at = emit(mem, at, 1, slt(5), 0, slt(2), 0);
+ at = emit(mem, at, 2, slt(5), 1, byt(1), 0);
+ at = emit(mem, at, 3, none, 3, none, f);
+ write_word(&mem[brc_end - 4], at);
+ at = emit(mem, at, 4, none, 0, none, 0);
+ return at;
+}
+
+/* Calls `f` with r1 as its one argument, from a 2 word top level frame.
+   Returns the address to stop at. */
+word emit_top_call(byte *mem, word at, word f) {
+ struct Rmab none = { 0 };
+ at = emit(mem, at, 1, slt(4), 0, gpr(1), 0);
+ return emit(mem, at, 3, none, 2, none, f);
+}
+
+/* Ir for
+     Sum <- 0 ... 
+     FOR i <- 0 TO n - 1
+       FOR j <- 0 TO n - 1
+         t <- j * 3               (or t <- f(), if `call` is not CG_NONE)
+         Sum <- Sum + t
+     Sum <- Sum + c4 + ... + c9   (locals set before the loops, as pressure)
+   with Sum local 0, i 1, j 2, t 3 and c4-c9 locals 4-9. */
+word emit_nested_loop_ir(Ir *ir, byte n, word call) {
+ word len = 0, c;
+ Ir op = { 0 };
+#define IR(o, sub_, dst_, src_, label_) \
+ (op.ir_op = (o), op.ir_sub = (sub_), op.ir_dst = (dst_), op.ir_src = (src_), op.ir_label = (label_), ir[len++] = op)
+ IR(IR_SET, 0, 0, 0, 0);
+ IR(IR_SET, 0, 1, 0, 0);
+ for (c = 4; c < 10; ++c) IR(IR_SET, 0, c, c, 0);
+ IR(IR_LABEL, 0, 0, 0, 0);
+ IR(IR_BRCK, 5, 1, n, 3);
+ IR(IR_SET, 0, 2, 0, 0);
+ IR(IR_LABEL, 0, 0, 0, 1);
+ IR(IR_BRCK, 5, 2, n, 2);
+ if (call == CG_NONE) {
+  IR(IR_MOV, 0, 3, 2, 0);
+  IR(IR_ARITHK, 2, 3, 3, 0);
+ } else {
+  IR(IR_CALL, 0, 3, call, 0);
+ }
+ IR(IR_ARITH, 0, 0, 3, 0);
+ IR(IR_ARITHK, 0, 2, 1, 0);
+ IR(IR_JMP, 0, 0, 0, 1);
+ IR(IR_LABEL, 0, 0, 0, 2);
+ IR(IR_ARITHK, 0, 1, 1, 0);
+ IR(IR_JMP, 0, 0, 0, 0);
+ IR(IR_LABEL, 0, 0, 0, 3);
+ for (c = 4; c < 10; ++c) IR(IR_ARITH, 0, 0, c, 0);
+#undef IR
+ return len;
+}
+
+/* A FUNCTION returning 1 that clobbers every register a local can be in */
+word emit_clobber(byte *mem, word at) {
+ struct Rmab none = { 0 };
+ byte r;
+ for (r = CG_FIRST_REG; r < GPR_COUNT; ++r) at = emit(mem, at, 1, gpr(r), 0, byt(0xEE), 0);
+ at = emit(mem, at, 1, gpr(0), 0, byt(1), 0);
+ return emit(mem, at, 4, none, 0, none, 0);
+}
+
+/* Ir for
+     FUNCTION Fib(n)
+       IF n < 2 THEN RETURN n
+       a <- Fib(n - 1)
+       b <- Fib(n - 2)
+       RETURN a + b
+   with n local 0, its one parameter, a 1 and b 2. n and a are live across
+   the calls. */
+word emit_fib_ir(Ir *ir, word fib) {
+ word len = 0;
+ Ir op = { 0 };
+#define IR(o, sub_, dst_, src_, label_) \
+ (op.ir_op = (o), op.ir_sub = (sub_), op.ir_dst = (dst_), op.ir_src = (src_), op.ir_label = (label_), ir[len++] = op)
+ IR(IR_BRCK, 5, 0, 2, 0);
+ IR(IR_RET, 0, 0, 0, 0);
+ IR(IR_LABEL, 0, 0, 0, 0);
+ IR(IR_MOV, 0, 1, 0, 0);
+ IR(IR_ARITHK, 1, 1, 1, 0);
+ IR(IR_ARG, 0, 0, 1, 0);
+ IR(IR_CALL, 0, 1, fib, 0);
+ IR(IR_MOV, 0, 2, 0, 0);
+ IR(IR_ARITHK, 1, 2, 2, 0);
+ IR(IR_ARG, 0, 0, 2, 0);
+ IR(IR_CALL, 0, 2, fib, 0);
+ IR(IR_ARITH, 0, 1, 2, 0);
+ IR(IR_RET, 0, 1, 0, 0);
+#undef IR
+ return len;
+}
+
+/* Whether an operand is a word of vm_mem: MEM, or a slot of the frame */
+int is_memory(struct Rmab r) {
+ return r.rmab_tag == 1 || r.rmab_tag == 4 || r.rmab_tag == 5;
+}
+
+/* xorshift32, for generated programs */
+word test_random(word *seed) {
+ *seed ^= *seed << 13;
+ *seed ^= *seed >> 17;
+ *seed ^= *seed << 5;
+ return *seed;
+}
+
+struct Rmab test_operand(word *seed, int source) {
+ word k = test_random(seed) % (source ? 10 : 8);
+ if (k < 4) return gpr((byte)(1 + k));
+ if (k < 6) return mem_at(0x400 + 4 * (k - 4));
+ if (k < 8) return slt((byte)(2 + k - 6));
+ return byt((byte)(test_random(seed) % 10));
+}
+
+/* FOR r15 <- r15 TO trips - 1 over `body` random ASSGN, ARITH, ARITH3 and
+   IF ... THEN on r1-r4, two MEM words at 0x400 and SLT 2 and 3. Division by
+   zero is likely. Returns the address to stop at. */
+word emit_random_loop(byte *mem, word at, word *seed, word body, byte trips) {
+ word top = at, exit_end, skip_end = 0, i;
+ at = emit(mem, at, 7, gpr(15), 5, byt(trips), 0);
+ exit_end = at;
+ for (i = 0; i < body; ++i) {
+  word kind = test_random(seed) % 4;
+  Instr p = make_instr(kind == 0 ? 1 : kind == 3 ? 9 : 2, test_operand(seed, 0),
+   (byte)(test_random(seed) % 4), test_operand(seed, 1), 0);
+  if (kind == 3) p.param_aux = test_operand(seed, 1);
+  if (kind == 2 && !skip_end) {
+   p = make_instr(7, test_operand(seed, 1), (byte)(test_random(seed) % BRC_COND_COUNT), test_operand(seed, 1), 0);
+   at += write_instr(&mem[at], p);
+   skip_end = at;
+   continue;
+  }
+  at += write_instr(&mem[at], p);
+  if (skip_end) write_word(&mem[skip_end - 4], at);
+  skip_end = 0;
+ }
+ at = emit(mem, at, 10, gpr(15), 0, byt(1), top);
+ write_word(&mem[exit_end - 4], at);
+ if (skip_end) write_word(&mem[skip_end - 4], at);
+ return at;
+}
+
+/* Writes a STRING, a length word followed by its bytes */
+void put_string(byte *mem, word adr, const char *s) {
+ word len = 0;
+ for (; s[len]; ++len) mem[adr + 4 + len] = (byte)s[len];
+ write_word(&mem[adr], len);
+}
+
+int string_is(byte *mem, word adr, const char *s) {
+ word len, i;
+ read_word(&mem[adr], &len);
+ for (i = 0; i < len && s[i] && mem[adr + 4 + i] == (byte)s[i]; ++i);
+ return i == len && !s[i];
+}
+
+byte mem_scratch[64];
+word vm_exceptions;
+const char *vm_first_exception;
+void vm_counting_exception_callback(Vm *v, Instr p, const char *msg) {
+ (void)v;
+ (void)p;
+ if (!vm_exceptions++) vm_first_exception = msg;
+}
+#endif
+
 int main(void) {
 #if defined CPI_RUN_TESTS
  int test_idx;
- for (test_idx = 0; test_idx <= 5; ++test_idx) {
+ for (test_idx = 0; test_idx <= 13; ++test_idx) {
   printf("\n===[test_idx %d]===\n", test_idx);
 
   if (test_idx == 0) {
@@ -439,7 +1059,7 @@ int main(void) {
    }
    {
     Instr p = { 
-     .param_instr = 6, 
+     .param_instr = 8, 
     };
     print_instr_bytes(p);
     printf("\n");
@@ -490,6 +1110,990 @@ int main(void) {
     print_vm(&v);
    }
   } else if (test_idx == 4) {
+   {
+    /* ARITH r1 += r2, run three times; then its source is patched to a byte */
+    Vm v = { 0 };
+    byte mem[6] = { 0 };
+    Instr p = {
+     .param_instr = 2,
+     .param_dst = { .rmab_tag = 0, .rmab_r_reg = 1 },
+     .param_op = 0,
+     .param_src = { .rmab_tag = 0, .rmab_r_reg = 2 },
+    };
+    int i;
+
+    v.vm_mem = mem;
+    v.vm_exception_callback = vm_default_exception_callback;
+    v.vm_gpr[2] = 5;
+    write_instr(mem, p);
+
+    for (i = 0; i < 3; ++i) {
+     v.vm_rip = 0;
+     vm_step(&v);
+    }
+    printf("%s: quickened to %2.2x, r1 = %u\n",
+     mem[0] == ARITH_GPR_GPR && v.vm_gpr[1] == 15 && v.vm_quickened == 1 ? "ok" : "FAIL",
+     mem[0], v.vm_gpr[1]);
+
+    mem[4] = 3;
+    mem[5] = 100;
+    v.vm_rip = 0;
+    vm_step(&v);
+    printf("%s: despecialized %u, requickened to %2.2x, r1 = %u\n",
+     mem[0] == ARITH_GPR_BYTE && v.vm_gpr[1] == 115 && v.vm_despecialized == 1 ? "ok" : "FAIL",
+     v.vm_despecialized, mem[0], v.vm_gpr[1]);
+
+    read_instr(mem, &p);
+    print_instr_human(p);
+   }
+  } else if (test_idx == 5) {
+   {
+    /* WHILE r1 < r2 AND (r1 <> 3 OR r3 == 0) DO r1 += 1; r4 += 1 ENDWHILE
+       Each condition is one BRC; AND falls through to the next test, OR
+       jumps straight into the body. */
+    Vm v = { 0 };
+    byte mem[128] = { 0 };
+    word top = 0, body, done, at;
+    word end1, end2, end3; /* Just past each BRC, whose target is its last word */
+    int steps = 0;
+    Instr p = { 0 };
+
+    v.vm_mem = mem;
+    v.vm_exception_callback = vm_default_exception_callback;
+    v.vm_gpr[2] = 10;
+    v.vm_gpr[3] = 1;
+
+    at = top;
+    /* BRC r1 >= r2 -> done */
+    p = (Instr){ .param_instr = 7, .param_dst = { .rmab_tag = 0, .rmab_r_reg = 1 }, .param_op = 5, .param_src = { .rmab_tag = 0, .rmab_r_reg = 2 } };
+    at += write_instr(&mem[at], p);
+    end1 = at;
+    /* BRC r1 <> 3 -> body */
+    p = (Instr){ .param_instr = 7, .param_dst = { .rmab_tag = 0, .rmab_r_reg = 1 }, .param_op = 1, .param_src = { .rmab_tag = 3, .rmab_b_byte = 3 } };
+    at += write_instr(&mem[at], p);
+    end2 = at;
+    /* BRC r3 <> 0 -> done */
+    p = (Instr){ .param_instr = 7, .param_dst = { .rmab_tag = 0, .rmab_r_reg = 3 }, .param_op = 1, .param_src = { .rmab_tag = 3, .rmab_b_byte = 0 } };
+    at += write_instr(&mem[at], p);
+    end3 = at;
+    body = at;
+    p = (Instr){ .param_instr = 2, .param_dst = { .rmab_tag = 0, .rmab_r_reg = 1 }, .param_op = 0, .param_src = { .rmab_tag = 3, .rmab_b_byte = 1 } };
+    at += write_instr(&mem[at], p);
+    p = (Instr){ .param_instr = 2, .param_dst = { .rmab_tag = 0, .rmab_r_reg = 4 }, .param_op = 0, .param_src = { .rmab_tag = 3, .rmab_b_byte = 1 } };
+    at += write_instr(&mem[at], p);
+    p = (Instr){ .param_instr = 6, .param_target = top };
+    at += write_instr(&mem[at], p);
+    done = at;
+
+    /* Patch the forward targets */
+    write_word(&mem[end1 - 4], done);
+    write_word(&mem[end2 - 4], body);
+    write_word(&mem[end3 - 4], done);
+
+    for (at = top; at < done; ) {
+     at += read_instr(&mem[at], &p);
+     print_instr_human(p);
+    }
+
+    v.vm_rip = top;
+    while (v.vm_rip != done && steps < 1000) {
+     if (!vm_step(&v)) break;
+     ++steps;
+    }
+    /* The loop stops at r1 == 3 because r3 is set */
+    printf("%s: r1 = %u, r4 = %u after %d steps\n",
+     v.vm_gpr[1] == 3 && v.vm_gpr[4] == 3 && v.vm_rip == done ? "ok" : "FAIL",
+     v.vm_gpr[1], v.vm_gpr[4], steps);
+
+    v.vm_gpr[1] = 0;
+    v.vm_gpr[3] = 0;
+    v.vm_rip = top;
+    while (v.vm_rip != done && steps < 1000) {
+     if (!vm_step(&v)) break;
+     ++steps;
+    }
+    printf("%s: with r3 clear the loop runs to r2, r1 = %u\n",
+     v.vm_gpr[1] == 10 && v.vm_rip == done ? "ok" : "FAIL", v.vm_gpr[1]);
+   }
+  } else if (test_idx == 6) {
+   {
+    /* Recursive FUNCTIONs */
+    static byte mem[0x2000];
+    Vm v = { 0 };
+    word fib = 0x40, fact, stop;
+    Instr p = { 0 };
+
+    v.vm_mem = mem;
+    v.vm_exception_callback = vm_default_exception_callback;
+    v.vm_stack_base = v.vm_fp = 0x1000;
+    v.vm_stack_limit = sizeof mem;
+
+    fact = emit_fib(mem, fib);
+    emit_factorial(mem, fact);
+    for (stop = fib; stop < fact; ) {
+     stop += read_instr(&mem[stop], &p);
+     print_instr_human(p);
+    }
+
+    stop = emit_top_call(mem, 0, fib);
+    v.vm_gpr[1] = 10;
+    v.vm_rip = 0;
+    vm_run(&v, stop);
+    printf("%s: Fib(10) = %u\n", v.vm_gpr[0] == 55 && v.vm_fp == v.vm_stack_base ? "ok" : "FAIL", v.vm_gpr[0]);
+
+    stop = emit_top_call(mem, 0, fact);
+    v.vm_gpr[1] = 10;
+    v.vm_rip = 0;
+    vm_run(&v, stop);
+    printf("%s: Factorial(10) = %u\n", v.vm_gpr[0] == 3628800 && v.vm_fp == v.vm_stack_base ? "ok" : "FAIL", v.vm_gpr[0]);
+   }
+  } else if (test_idx == 7) {
+   {
+    /* PROCEDURE Add(BYREF x, BYVALUE y): x <- x + y, y <- y + 100 */
+    static byte mem[0x2000];
+    struct Rmab none = { 0 };
+    Vm v = { 0 };
+    word add = 0x80, chain, at, stop;
+    word global = 0x100, x;
+
+    v.vm_mem = mem;
+    v.vm_exception_callback = vm_default_exception_callback;
+    v.vm_stack_base = v.vm_fp = 0x1000;
+    v.vm_stack_limit = sizeof mem;
+
+    at = emit(mem, add, 2, ref(2), 0, slt(3), 0);
+    at = emit(mem, at, 2, slt(3), 0, byt(100), 0);
+    chain = emit(mem, at, 4, none, 0, none, 0);
+    emit_chain(mem, chain);
+
+    /* Top level frame of 3 words, SLT 2 = y; Add's slots are SLT 5 and 6 */
+    write_word(&mem[global], 5);
+    at = emit(mem, 0, 1, slt(2), 0, byt(7), 0);
+    at = emit(mem, at, 8, slt(5), 0, mem_at(global), 0);
+    at = emit(mem, at, 1, slt(6), 0, slt(2), 0);
+    at = emit(mem, at, 3, none, 3, none, add);
+    /* And again, with y itself passed BYREF */
+    at = emit(mem, at, 8, slt(5), 0, slt(2), 0);
+    at = emit(mem, at, 1, slt(6), 0, byt(1), 0);
+    stop = emit(mem, at, 3, none, 3, none, add);
+    v.vm_rip = 0;
+    vm_run(&v, stop);
+    read_word(&mem[global], &x);
+    printf("%s: BYREF global = %u, y = %u\n",
+     x == 12 && mem[v.vm_fp + 8] == 8 && v.vm_fp == v.vm_stack_base ? "ok" : "FAIL", x, mem[v.vm_fp + 8]);
+
+    /* Recursion deeper than the stack faults on the first slot past its end.
+       The counting callback lets the program carry on, so it unwinds. */
+    v.vm_exception_callback = vm_counting_exception_callback;
+    stop = emit_top_call(mem, 0, chain);
+    v.vm_gpr[1] = 1000;
+    v.vm_rip = 0;
+    vm_run(&v, stop);
+    printf("%s: \"%s\" from a chain 1000 deep\n",
+     vm_exceptions > 0 && v.vm_fp == v.vm_stack_base ? "ok" : "FAIL", vm_first_exception);
+
+    vm_exceptions = 0;
+    emit(mem, 0, 4, none, 0, none, 0);
+    v.vm_rip = 0;
+    vm_step(&v);
+    printf("%s: \"%s\" at the top level\n", vm_exceptions == 1 ? "ok" : "FAIL", vm_first_exception);
+   }
+  } else if (test_idx == 8) {
+   {
+    /* Builtins through ECALL, with indices resolved before the code runs */
+    static byte mem[0x400];
+    struct Rmab none = { 0 };
+    Vm v = { 0 };
+    word length = host_index(&host_table, "LENGTH");
+    word mid = host_index(&host_table, "SUBSTRING");
+    word ucase = host_index(&host_table, "UCASE");
+    word between = host_index(&host_table, "RANDOMBETWEEN");
+    word at, stop, i, ok = 1;
+    Instr p = { 0 };
+
+    v.vm_mem = mem;
+    v.vm_exception_callback = vm_counting_exception_callback;
+    vm_exceptions = 0;
+
+    printf("%s: version %u refused, version %u bound\n",
+     !vm_bind_host(&v, &host_table, HOST_TABLE_VERSION + 1) && vm_bind_host(&v, &host_table, HOST_TABLE_VERSION) ? "ok" : "FAIL",
+     HOST_TABLE_VERSION + 1, HOST_TABLE_VERSION);
+    printf("%s: MID is %u, SUBSTRING is %u, NOSUCH is %x\n",
+     mid == HOST_MID && host_index(&host_table, "NOSUCH") == (word)INVALID ? "ok" : "FAIL",
+     host_index(&host_table, "MID"), mid, host_index(&host_table, "NOSUCH"));
+
+    /* r5 = LENGTH(s); UCASE(MID(s, 8, 5)) */
+    put_string(mem, 0x100, "Hello, world");
+    at = emit(mem, 0, 1, gpr(1), 0, byt(0x80), 0);
+    at = emit(mem, at, 2, gpr(1), 0, byt(0x80), 0);
+    at = emit(mem, at, 5, none, 0, byt((byte)length), 0);
+    at = emit(mem, at, 1, gpr(5), 0, gpr(0), 0);
+    at = emit(mem, at, 1, gpr(2), 0, byt(8), 0);
+    at = emit(mem, at, 1, gpr(3), 0, byt(5), 0);
+    at = emit(mem, at, 1, gpr(4), 0, byt(0xC0), 0);
+    at = emit(mem, at, 5, none, 0, byt((byte)mid), 0);
+    at = emit(mem, at, 1, gpr(1), 0, gpr(0), 0);
+    at = emit(mem, at, 1, gpr(2), 0, gpr(0), 0);
+    stop = emit(mem, at, 5, none, 0, byt((byte)ucase), 0);
+    for (at = 0; at < stop; ) {
+     at += read_instr(&mem[at], &p);
+     print_instr_human(p);
+    }
+    v.vm_rip = 0;
+    vm_run(&v, stop);
+    printf("%s: LENGTH = %u, UCASE(MID(...)) = \"%.5s\"\n",
+     v.vm_gpr[5] == 12 && string_is(mem, v.vm_gpr[0], "WORLD") && !vm_exceptions ? "ok" : "FAIL",
+     v.vm_gpr[5], (char *)&mem[v.vm_gpr[0] + 4]);
+
+    p = (Instr){ .param_instr = 5, .param_src = { .rmab_tag = 3, .rmab_b_byte = (byte)between } };
+    for (i = 0; i < 1000; ++i) {
+     v.vm_gpr[1] = 1;
+     v.vm_gpr[2] = 6;
+     vm_exec_instr(&v, p);
+     ok &= v.vm_gpr[0] >= 1 && v.vm_gpr[0] <= 6;
+    }
+    printf("%s: RANDOMBETWEEN(1, 6) stays in range\n", ok ? "ok" : "FAIL");
+
+    {
+     /* Negative bounds, and a range of 3 * 2^30 values, on which scaling
+        32 random bits would give a multiple of 3 half of the time */
+     word seen = 0, thirds = 0;
+     int lo = -1610612736;
+     ok = 1;
+     for (i = 0; i < 3000; ++i) {
+      v.vm_gpr[1] = (word)-5;
+      v.vm_gpr[2] = 5;
+      vm_exec_instr(&v, p);
+      ok &= (int)v.vm_gpr[0] >= -5 && (int)v.vm_gpr[0] <= 5;
+      seen |= 1u << ((int)v.vm_gpr[0] + 5);
+      v.vm_gpr[1] = (word)lo;
+      v.vm_gpr[2] = (word)(lo + 0x7FFFFFFF) + 0x40000000;
+      vm_exec_instr(&v, p);
+      thirds += (v.vm_gpr[0] - (word)lo) % 3 == 0;
+     }
+     ok &= !vm_exceptions && seen == 0x7FF && thirds > 850 && thirds < 1150;
+     v.vm_gpr[1] = 5;
+     v.vm_gpr[2] = (word)-5;
+     vm_exec_instr(&v, p);
+     ok &= vm_exceptions == 1;
+     vm_exceptions = 0;
+     printf("%s: RANDOMBETWEEN(-5, 5) gives all 11 values, %u of 3000 draws are multiples of 3, (5, -5) raises\n",
+      ok ? "ok" : "FAIL", thirds);
+    }
+
+    /* Write two lines, read them back to EOF */
+    put_string(mem, 0x200, "elaisa_host_test.txt");
+    put_string(mem, 0x240, "first");
+    put_string(mem, 0x260, "second");
+    v.vm_gpr[1] = 0x200; v.vm_gpr[2] = 1;
+    p.param_src.rmab_b_byte = HOST_OPENFILE; vm_exec_instr(&v, p);
+    v.vm_gpr[1] = v.vm_gpr[0]; v.vm_gpr[2] = 0x240;
+    p.param_src.rmab_b_byte = HOST_WRITEFILE; vm_exec_instr(&v, p);
+    v.vm_gpr[2] = 0x260;
+    vm_exec_instr(&v, p);
+    p.param_src.rmab_b_byte = HOST_CLOSEFILE; vm_exec_instr(&v, p);
+
+    v.vm_gpr[1] = 0x200; v.vm_gpr[2] = 0;
+    p.param_src.rmab_b_byte = HOST_OPENFILE; vm_exec_instr(&v, p);
+    v.vm_gpr[1] = v.vm_gpr[0]; v.vm_gpr[2] = 0x300; v.vm_gpr[3] = 0x40;
+    p.param_src.rmab_b_byte = HOST_READFILE; vm_exec_instr(&v, p);
+    ok = string_is(mem, 0x300, "first");
+    p.param_src.rmab_b_byte = HOST_EOF; vm_exec_instr(&v, p);
+    ok &= v.vm_gpr[0] == 0;
+    p.param_src.rmab_b_byte = HOST_READFILE; vm_exec_instr(&v, p);
+    ok &= string_is(mem, 0x300, "second");
+    p.param_src.rmab_b_byte = HOST_EOF; vm_exec_instr(&v, p);
+    ok &= v.vm_gpr[0] == 1;
+    p.param_src.rmab_b_byte = HOST_CLOSEFILE; vm_exec_instr(&v, p);
+    remove("elaisa_host_test.txt");
+    printf("%s: WRITEFILE, READFILE and EOF round trip, %u exception(s)\n", ok && !vm_exceptions ? "ok" : "FAIL", vm_exceptions);
+
+    /* Failures surface as exceptions */
+    vm_exec_instr(&v, p);
+    p.param_src.rmab_b_byte = HOST_COUNT;
+    vm_exec_instr(&v, p);
+    printf("%s: closing twice and a bad index raise %u exceptions, the first \"%s\"\n",
+     vm_exceptions == 2 ? "ok" : "FAIL", vm_exceptions, vm_first_exception);
+   }
+  } else if (test_idx == 9) {
+   {
+    /* Register allocation, with every register, two, and none */
+    static byte mem[0x2000];
+    word regs[] = { CG_MAX_REGS, 2, 0 };
+    word expect = 20 * 3 * (19 * 20 / 2) + 4 + 5 + 6 + 7 + 8 + 9;
+    word clobber = 0x1800, i, end;
+    Ir ir[64];
+    Codegen cg = { 0 };
+    Vm v = { 0 };
+
+    v.vm_mem = mem;
+    v.vm_exception_callback = vm_default_exception_callback;
+    v.vm_stack_base = v.vm_fp = 0x1C00;
+    v.vm_stack_limit = sizeof mem;
+    emit_clobber(mem, clobber);
+
+    cg.cg_ir = ir;
+    cg.cg_vars = 10;
+    cg.cg_len = emit_nested_loop_ir(ir, 20, CG_NONE);
+    for (i = 0; i < sizeof regs / sizeof regs[0]; ++i) {
+     cg.cg_regs = regs[i];
+     end = cg_generate(&cg, mem, 0);
+     v.vm_rip = 0;
+     vm_run(&v, end);
+     printf("%s: %u registers, %u locals spilled, Sum = %u\n",
+      cg_value(&cg, &v, 0) == expect ? "ok" : "FAIL", regs[i], cg.cg_spilled, cg_value(&cg, &v, 0));
+    }
+
+    /* With two registers they go to the inner loop's j and t */
+    cg.cg_regs = 2;
+    cg_generate(&cg, mem, 0);
+    printf("%s: j in %u, t in %u, i %s\n",
+     cg.cg_reg[2] != CG_SPILLED && cg.cg_reg[3] != CG_SPILLED && cg.cg_reg[1] == CG_SPILLED ? "ok" : "FAIL",
+     cg.cg_reg[2], cg.cg_reg[3], cg.cg_reg[1] == CG_SPILLED ? "spilled" : "in a register");
+
+    /* Locals live across a CALL survive it */
+    cg.cg_regs = CG_MAX_REGS;
+    cg.cg_len = emit_nested_loop_ir(ir, 20, clobber);
+    end = cg_generate(&cg, mem, 0);
+    v.vm_rip = 0;
+    vm_run(&v, end);
+    printf("%s: Sum = %u across calls, %u registers saved around them\n",
+     cg_value(&cg, &v, 0) == 400 + 39 && cg.cg_saves > 0 && v.vm_fp == v.vm_stack_base ? "ok" : "FAIL",
+     cg_value(&cg, &v, 0), cg.cg_saves);
+
+    /* A recursive FUNCTION keeps each call's saved and spilled locals in
+       its own frame */
+    {
+     word fib = 0x100, stop = emit_top_call(mem, 0, fib);
+     cg.cg_vars = 3;
+     cg.cg_params = 1;
+     cg.cg_len = emit_fib_ir(ir, fib);
+     for (i = 0; i < 2 * sizeof regs / sizeof regs[0]; ++i) {
+      cg.cg_regs = regs[i / 2];
+      cg.cg_optimize = i % 2;
+      cg_generate(&cg, mem, fib);
+      v.vm_gpr[1] = 15;
+      v.vm_rip = 0;
+      vm_run(&v, stop);
+      printf("%s: %u registers%s, generated Fib(15) = %u, %u registers saved around calls\n",
+       v.vm_gpr[0] == 610 && v.vm_fp == v.vm_stack_base ? "ok" : "FAIL",
+       regs[i / 2], cg.cg_optimize ? ", peephole" : "", v.vm_gpr[0], cg.cg_saves);
+     }
+    }
+   }
+  } else if (test_idx == 10) {
+   {
+    /* Peephole rules on a hand built Code */
+    static Code c;
+    static byte mem[0x100];
+    struct Rmab none = { 0 };
+    word i, end;
+    Instr p = { 0 };
+
+    for (i = 0; i < CODE_MAX_LABELS; ++i) c.co_label_at[i] = CODE_NO_LABEL;
+    code_push(&c, make_instr(1, gpr(5), 0, gpr(5), 0), CODE_NO_LABEL);  /* removed */
+    code_push(&c, make_instr(1, gpr(5), 0, gpr(6), 0), CODE_NO_LABEL);
+    code_push(&c, make_instr(1, gpr(6), 0, gpr(5), 0), CODE_NO_LABEL);  /* removed */
+    code_push(&c, make_instr(6, none, 0, none, 0), 0);                  /* removed, jumps to next */
+    code_label(&c, 0);
+    code_push(&c, make_instr(1, gpr(7), 0, gpr(5), 0), CODE_NO_LABEL);
+    code_push(&c, make_instr(2, gpr(7), 2, byt(3), 0), CODE_NO_LABEL);  /* fused into ARITH3 */
+    code_push(&c, make_instr(2, gpr(5), 0, byt(1), 0), CODE_NO_LABEL);
+    code_label(&c, 1);
+    code_push(&c, make_instr(6, none, 0, none, 0), 0);                  /* a target, so not fused */
+    code_push(&c, make_instr(2, gpr(8), 0, byt(1), 0), CODE_NO_LABEL);
+    code_push(&c, make_instr(6, none, 0, none, 0), 1);                  /* fused into ARITHJ */
+    peephole(&c);
+    end = code_encode(&c, mem, 0);
+    for (i = 0; i < end; ) {
+     i += read_instr(&mem[i], &p);
+     print_instr_human(p);
+    }
+    printf("%s: %u instructions left, %u removed, %u fused\n",
+     c.co_len == 5 && c.co_removed == 3 && c.co_fused == 2 && mem[5] == 9 ? "ok" : "FAIL",
+     c.co_len, c.co_removed, c.co_fused);
+   }
+   {
+    /* Pairs whose fusion would change what they compute are left alone */
+    static Code c;
+    static byte mem[0x200];
+    word i, end, before[2];
+    Vm v = { 0 };
+
+    for (i = 0; i < CODE_MAX_LABELS; ++i) c.co_label_at[i] = CODE_NO_LABEL;
+    /* ASSGN MEM <- BYT writes one byte, keeping the rest of the word */
+    code_push(&c, make_instr(1, mem_at(0x100), 0, byt(2), 0), CODE_NO_LABEL);
+    code_push(&c, make_instr(2, mem_at(0x100), 0, byt(1), 0), CODE_NO_LABEL);
+    /* REF 2 points at the MEM word being assigned */
+    code_push(&c, make_instr(1, mem_at(0x104), 0, gpr(1), 0), CODE_NO_LABEL);
+    code_push(&c, make_instr(2, mem_at(0x104), 0, ref(2), 0), CODE_NO_LABEL);
+    /* SLT 3 is the same word as the MEM */
+    code_push(&c, make_instr(1, mem_at(0x10C), 0, gpr(1), 0), CODE_NO_LABEL);
+    code_push(&c, make_instr(2, mem_at(0x10C), 0, slt(3), 0), CODE_NO_LABEL);
+    for (i = 0; i < 2; ++i) {
+     if (i) peephole(&c);
+     end = code_encode(&c, mem, 0);
+     v.vm_mem = mem;
+     v.vm_exception_callback = vm_default_exception_callback;
+     v.vm_stack_base = v.vm_fp = 0x100;
+     v.vm_stack_limit = sizeof mem;
+     v.vm_gpr[1] = 5;
+     write_word(&mem[0x100], 0x1100);
+     write_word(&mem[0x108], 0x104);
+     v.vm_rip = 0;
+     vm_run(&v, end);
+     read_word(&mem[0x100], &before[i]);
+     before[i] ^= mem[0x104] << 8 ^ mem[0x10C] << 16;
+    }
+    printf("%s: %u fused, 0x%x without the pass and 0x%x with it\n",
+     c.co_fused == 0 && before[0] == before[1] && before[0] == (0x1103 ^ 10 << 8 ^ 10 << 16) ? "ok" : "FAIL",
+     c.co_fused, before[0], before[1]);
+   }
+   {
+    /* The nested loop, optimised, gives the same answers in fewer steps */
+    static byte mem[0x2000];
+    static Codegen cg;
+    word regs[] = { CG_MAX_REGS, 2, 0 };
+    word expect = 20 * 3 * (19 * 20 / 2) + 39;
+    word i, end, plain, fused;
+    Ir ir[64];
+    Vm v = { 0 };
+
+    v.vm_mem = mem;
+    v.vm_exception_callback = vm_default_exception_callback;
+    v.vm_stack_base = v.vm_fp = 0x1000;
+    v.vm_stack_limit = sizeof mem;
+    cg.cg_ir = ir;
+    cg.cg_vars = 10;
+    cg.cg_len = emit_nested_loop_ir(ir, 20, CG_NONE);
+    for (i = 0; i < sizeof regs / sizeof regs[0]; ++i) {
+     cg.cg_regs = regs[i];
+     cg.cg_optimize = 0;
+     end = cg_generate(&cg, mem, 0);
+     v.vm_rip = 0;
+     plain = vm_run(&v, end);
+     cg.cg_optimize = 1;
+     end = cg_generate(&cg, mem, 0);
+     v.vm_rip = 0;
+     fused = vm_run(&v, end);
+     printf("%s: %u registers, Sum = %u in %u steps rather than %u, %u fused\n",
+      cg_value(&cg, &v, 0) == expect && fused < plain ? "ok" : "FAIL",
+      regs[i], cg_value(&cg, &v, 0), fused, plain, cg.cg_code.co_fused);
+    }
+   }
+  } else if (test_idx == 11) {
+   {
+    /* The JIT against the interpreter, on random loops. Every tenth runs
+       with SLT 3 past the end of the stack, where the loop is not entered. */
+    static byte plain[0x2000], jitted[0x2000];
+    static struct Jit jit;
+    word seed, i, same = 1, plain_exceptions, raised = 0;
+    Vm a = { 0 }, b = { 0 };
+
+    if (!jit_init(&jit, 2)) {
+     printf("ok: no JIT on this platform\n");
+     continue;
+    }
+    for (seed = 1; seed <= 300 && same; ++seed) {
+     word s = seed, stop, fp = seed % 10 ? 0x1000 : sizeof plain - 12;
+     for (i = 0; i < sizeof plain; ++i) plain[i] = (byte)(i * 7);
+     stop = emit_random_loop(plain, 0, &s, 2 + seed % 12, (byte)(5 + seed % 40));
+     memcpy(jitted, plain, sizeof plain);
+     jit_flush(&jit);
+
+     a = b = (Vm){ 0 };
+     a.vm_mem = plain;
+     b.vm_mem = jitted;
+     b.vm_jit = &jit;
+     a.vm_exception_callback = b.vm_exception_callback = vm_counting_exception_callback;
+     a.vm_stack_base = a.vm_fp = b.vm_stack_base = b.vm_fp = fp;
+     a.vm_stack_limit = b.vm_stack_limit = sizeof plain;
+     for (i = 1; i < 5; ++i) a.vm_gpr[i] = b.vm_gpr[i] = test_random(&s) % 50;
+
+     vm_exceptions = 0;
+     vm_run(&a, stop);
+     plain_exceptions = vm_exceptions;
+     vm_exceptions = 0;
+     vm_run(&b, stop);
+     raised += plain_exceptions;
+
+     same = plain_exceptions == vm_exceptions && a.vm_rip == b.vm_rip;
+     for (i = 0; i < GPR_COUNT; ++i) same &= a.vm_gpr[i] == b.vm_gpr[i];
+     /* Code the JIT ran is not quickened, so only data is compared */
+     for (i = stop; i < sizeof plain; ++i) same &= plain[i] == jitted[i];
+    }
+    printf("%s: %u random loops agree, %u compiled, %u entered, %u deoptimised, %u exceptions\n",
+     same && jit.jit_compiled > 0 && jit.jit_deopts > 0 ? "ok" : "FAIL",
+     seed - 1, jit.jit_compiled, jit.jit_entries, jit.jit_deopts, raised);
+   }
+   {
+    /* Generated code, with and without CALLs, which are not compiled */
+    static byte plain[0x2000], jitted[0x2000];
+    static Codegen cg;
+    static struct Jit jit;
+    word regs[] = { CG_MAX_REGS, 2, 0 };
+    word clobber = 0x1800, i, end, sum, sums[2];
+    word expect = 20 * 3 * (19 * 20 / 2) + 39;
+    Ir ir[64];
+    Vm v = { 0 };
+
+    if (!jit_init(&jit, 10)) {
+     printf("ok: no JIT on this platform\n");
+     continue;
+    }
+    cg.cg_ir = ir;
+    cg.cg_vars = 10;
+    for (i = 0; i < 2 * sizeof regs / sizeof regs[0]; ++i) {
+     byte *mem[2] = { plain, jitted };
+     word k;
+     cg.cg_regs = regs[i / 2];
+     cg.cg_optimize = i % 2;
+     cg.cg_len = emit_nested_loop_ir(ir, 20, CG_NONE);
+     for (k = 0; k < 2; ++k) {
+      end = cg_generate(&cg, mem[k], 0);
+      v = (Vm){ 0 };
+      v.vm_mem = mem[k];
+      v.vm_exception_callback = vm_default_exception_callback;
+      v.vm_stack_base = v.vm_fp = 0x1000;
+      v.vm_stack_limit = sizeof plain;
+      v.vm_jit = k ? &jit : 0;
+      jit_flush(&jit);
+      vm_run(&v, end);
+      sums[k] = cg_value(&cg, &v, 0);
+     }
+     printf("%s: %u registers%s, Sum = %u interpreted and %u with %u loops compiled\n",
+      sums[0] == expect && sums[1] == expect && jit.jit_compiled > 0 ? "ok" : "FAIL",
+      regs[i / 2], cg.cg_optimize ? ", peephole" : "", sums[0], sums[1], jit.jit_compiled);
+    }
+
+    jit_free(&jit);
+    jit_init(&jit, 10);
+    emit_clobber(jitted, clobber);
+    cg.cg_regs = CG_MAX_REGS;
+    cg.cg_len = emit_nested_loop_ir(ir, 20, clobber);
+    end = cg_generate(&cg, jitted, 0);
+    v = (Vm){ 0 };
+    v.vm_mem = jitted;
+    v.vm_exception_callback = vm_default_exception_callback;
+    v.vm_stack_base = v.vm_fp = 0x1C00;
+    v.vm_stack_limit = sizeof jitted;
+    v.vm_jit = &jit;
+    vm_run(&v, end);
+    sum = cg_value(&cg, &v, 0);
+    printf("%s: with CALLs Sum = %u, %u compiled, %u left to the interpreter\n",
+     sum == 400 + 39 && jit.jit_compiled == 0 && jit.jit_failed > 0 ? "ok" : "FAIL", sum, jit.jit_compiled, jit.jit_failed);
+    jit_free(&jit);
+   }
+  } else if (test_idx == 12) {
+   {
+    /* Every kind of operand round trips through the fixed encoding */
+    struct Rmab none = { 0 };
+    struct Rmab ops[] = { { 0 }, { 0 }, { 0 }, { 0 }, { 0 }, { 0 } };
+    word i, j, k, b, len, encoded = 0, refused = 0, ok = 1;
+    qword q;
+    Instr p, back;
+    ops[0] = gpr(15); ops[1] = mem_at(0x1234); ops[2] = mem_at(0x12345678);
+    ops[3] = byt(0xAB); ops[4] = slt(200); ops[5] = ref(3);
+    for (i = 1; i <= 10; ++i) for (j = 0; j < 6; ++j) for (k = 0; k < 6; ++k) {
+     p = make_instr((byte)i, ops[j], (byte)(i == 3 ? 250 : k % 4), ops[k], 0x40 + 8 * (word)k);
+     if (i == 9) p.param_aux = ops[(j + k) % 6];
+     if (i == 4) p = make_instr(4, none, 0, none, 0);
+     if (write_instr(mem_scratch, p) == INVALID) continue;
+     if (!write_fixed(&q, 0x100, p)) {
+      refused += 1;
+      continue;
+     }
+     encoded += 1;
+     back = (Instr){ 0 };
+     len = write_instr(mem_scratch, p);
+     ok &= read_fixed(q, 0x100, &back) && (word)write_instr(mem_scratch + 32, back) == len;
+     for (b = 0; b < len; ++b) ok &= mem_scratch[b] == mem_scratch[32 + b];
+    }
+    p = make_instr(9, mem_at(0x12345678), 0, gpr(1), 0);
+    p.param_aux = gpr(2);
+    printf("%s: %u instructions round trip, %u refused, ARITH3 to a 32 bit address %s\n",
+     ok && encoded >= 300 && refused > 0 && !write_fixed(&q, 0, p) ? "ok" : "FAIL", encoded, refused,
+     write_fixed(&q, 0, p) ? "encoded" : "refused");
+   }
+   {
+    /* Converted programs compute the same as the originals */
+    static byte mem[0x2000];
+    static qword fixed[0x200];
+    static word index[0x2000];
+    static Codegen cg;
+    word fib, fact, chain, end, n, stop, i;
+    word regs[] = { CG_MAX_REGS, 2, 0 };
+    word expect = 20 * 3 * (19 * 20 / 2) + 39;
+    Ir ir[64];
+    Vm v = { 0 };
+
+    v.vm_mem = mem;
+    v.vm_fixed = fixed;
+    v.vm_exception_callback = vm_default_exception_callback;
+    v.vm_stack_base = v.vm_fp = 0x1000;
+    v.vm_stack_limit = sizeof mem;
+
+    /* The top level call, then the functions, as one program. The call
+       returns to a ZTRAP, where it stops. */
+    stop = emit_top_call(mem, 0, 0);
+    fib = emit(mem, stop, 0, gpr(0), 0, gpr(0), 0);
+    emit_top_call(mem, 0, fib);
+    fact = emit_fib(mem, fib);
+    chain = emit_factorial(mem, fact);
+    end = emit_chain(mem, chain);
+    n = fixed_convert(mem, 0, end, fixed, 0x200, index);
+    v.vm_fixed_len = n;
+    v.vm_gpr[1] = 10;
+    v.vm_rip = 0;
+    vm_run_fixed(&v, 8 * index[stop]);
+    printf("%s: Fib(10) = %u from %u instructions in %u bytes rather than %u\n",
+     n != (word)INVALID && v.vm_gpr[0] == 55 && v.vm_fp == v.vm_stack_base ? "ok" : "FAIL",
+     v.vm_gpr[0], n, 8 * n, end);
+
+    cg.cg_ir = ir;
+    cg.cg_vars = 10;
+    cg.cg_len = emit_nested_loop_ir(ir, 20, CG_NONE);
+    for (i = 0; i < 2 * sizeof regs / sizeof regs[0]; ++i) {
+     cg.cg_regs = regs[i / 2];
+     cg.cg_optimize = i % 2;
+     end = cg_generate(&cg, mem, 0);
+     n = fixed_convert(mem, 0, end, fixed, 0x200, index);
+     v.vm_fixed_len = n;
+     v.vm_rip = 0;
+     vm_run_fixed(&v, 8 * n);
+     printf("%s: %u registers%s, Sum = %u in %u bytes rather than %u\n",
+      n != (word)INVALID && cg_value(&cg, &v, 0) == expect ? "ok" : "FAIL",
+      regs[i / 2], cg.cg_optimize ? ", peephole" : "", cg_value(&cg, &v, 0), 8 * n, end);
+    }
+
+    /* A branch out of the converted range has nowhere to go */
+    end = emit(mem, 0, 6, gpr(0), 0, gpr(0), 0x100);
+    printf("%s: a JMP out of the code is refused\n", fixed_convert(mem, 0, end, fixed, 0x200, index) == (word)INVALID ? "ok" : "FAIL");
+   }
+   {
+    /* Converted random loops against the originals, so that every operand
+       kind and exception goes both through the fields and through decoding.
+       Every tenth runs with SLT 3 past the end of the stack. */
+    static byte plain[0x2000], data[0x2000];
+    static qword fixed[0x200];
+    static word index[0x2000];
+    word seed, i, n, same = 1, plain_exceptions, raised = 0;
+    Vm a = { 0 }, b = { 0 };
+
+    for (seed = 1; seed <= 300 && same; ++seed) {
+     word s = seed, stop, fp = seed % 10 ? 0x1000 : sizeof plain - 12;
+     for (i = 0; i < sizeof plain; ++i) plain[i] = (byte)(i * 7);
+     stop = emit_random_loop(plain, 0, &s, 2 + seed % 12, (byte)(5 + seed % 40));
+     memcpy(data, plain, sizeof plain);
+     n = fixed_convert(plain, 0, stop, fixed, 0x200, index);
+
+     a = b = (Vm){ 0 };
+     a.vm_mem = plain;
+     b.vm_mem = data;
+     b.vm_fixed = fixed;
+     b.vm_fixed_len = n;
+     a.vm_exception_callback = b.vm_exception_callback = vm_counting_exception_callback;
+     a.vm_stack_base = a.vm_fp = b.vm_stack_base = b.vm_fp = fp;
+     a.vm_stack_limit = b.vm_stack_limit = sizeof plain;
+     for (i = 1; i < 5; ++i) a.vm_gpr[i] = b.vm_gpr[i] = test_random(&s) % 50;
+
+     vm_exceptions = 0;
+     vm_run(&a, stop);
+     plain_exceptions = vm_exceptions;
+     vm_exceptions = 0;
+     vm_run_fixed(&b, 8 * n);
+     raised += plain_exceptions;
+
+     same = n != (word)INVALID && plain_exceptions == vm_exceptions && b.vm_rip == 8 * n;
+     for (i = 0; i < GPR_COUNT; ++i) same &= a.vm_gpr[i] == b.vm_gpr[i];
+     for (i = stop; i < sizeof plain; ++i) same &= plain[i] == data[i];
+    }
+    printf("%s: %u converted random loops agree, %u exceptions\n", same ? "ok" : "FAIL", seed - 1, raised);
+   }
+  } else if (test_idx == 13) {
+   {
+    /* An access past vm_mem ends the run in an exception, whether it is
+       interpreted or run as native code, and the Vm can be run again */
+    struct Rmab none = { 0 };
+    struct Jit jit;
+    Vm v = { 0 };
+    word top, exit_end, skip_end, stop, jitted;
+    word far = 0x00F00000;
+
+    if (!vm_map_mem(&v, 0x10000)) {
+     printf("ok: no guard pages on this platform\n");
+     continue;
+    }
+    v.vm_exception_callback = vm_counting_exception_callback;
+    v.vm_stack_base = v.vm_fp = 0x1000;
+    v.vm_stack_limit = 0x10000;
+
+    vm_exceptions = 0;
+    stop = emit(v.vm_mem, 0, 1, gpr(1), 0, mem_at(far), 0);
+    v.vm_rip = 0;
+    vm_run_guarded(&v, stop);
+    printf("%s: a read past the end raises \"%s\"\n", vm_exceptions == 1 ? "ok" : "FAIL", vm_first_exception);
+
+    vm_exceptions = 0;
+    stop = emit(v.vm_mem, 0, 1, mem_at(0xFFFC), 0, byt(7), 0);
+    v.vm_rip = 0;
+    vm_run_guarded(&v, stop);
+    printf("%s: the last word can still be written\n", vm_exceptions == 0 && v.vm_mem[0xFFFC] == 7 ? "ok" : "FAIL");
+
+    /* FOR r15 <- 0 TO 99: IF r15 >= 60 THEN MEM far += 1. The loop is
+       compiled well before it strays. */
+    jitted = jit_init(&jit, 10);
+    v.vm_jit = jitted ? &jit : 0;
+    vm_exceptions = 0;
+    top = 0;
+    stop = emit(v.vm_mem, top, 7, gpr(15), 5, byt(100), 0);
+    exit_end = stop;
+    stop = skip_end = emit(v.vm_mem, stop, 7, gpr(15), 2, byt(60), 0);
+    stop = emit(v.vm_mem, stop, 2, mem_at(far), 0, byt(1), 0);
+    write_word(&v.vm_mem[skip_end - 4], stop);
+    stop = emit(v.vm_mem, stop, 10, gpr(15), 0, byt(1), top);
+    write_word(&v.vm_mem[exit_end - 4], stop);
+    stop = emit(v.vm_mem, stop, 4, none, 0, none, 0);
+    v.vm_gpr[15] = 0;
+    v.vm_rip = 0;
+    vm_run_guarded(&v, stop);
+    printf("%s: a write past the end from %s code raises \"%s\" at r15 = %u\n",
+     vm_exceptions == 1 && v.vm_gpr[15] == 60 && (!jitted || jit.jit_compiled == 1) ? "ok" : "FAIL",
+     jitted ? "native" : "interpreted", vm_first_exception, v.vm_gpr[15]);
+
+    if (jitted) jit_free(&jit);
+    vm_unmap_mem(&v);
+   }
+  }
+ }
+#elif defined CPI_RUN_BENCH
+ {
+  static byte mem[1 << 21];
+  Vm v = { 0 };
+  word fib = 0x40, fact, chain, stop;
+  long start;
+  double secs;
+  int i;
+
+  v.vm_mem = mem;
+  v.vm_exception_callback = vm_default_exception_callback;
+  v.vm_stack_base = v.vm_fp = 0x1000;
+  v.vm_stack_limit = sizeof mem;
+  fact = emit_fib(mem, fib);
+  chain = emit_factorial(mem, fact);
+  emit_chain(mem, chain);
+
+  /* Fib(n) makes 2 * Fib(n + 1) - 1 calls */
+  stop = emit_top_call(mem, 0, fib);
+  v.vm_gpr[1] = 27;
+  v.vm_rip = 0;
+  start = clock();
+  vm_run(&v, stop);
+  secs = (double)(clock() - start) / CLOCKS_PER_SEC;
+  printf("%32s %8.1f ns/call\n", "fib(27)", secs * 1e9 / (2 * 317811.0 - 1));
+
+  stop = emit_top_call(mem, 0, fact);
+  start = clock();
+  for (i = 0; i < 100000; ++i) {
+   v.vm_gpr[1] = 12;
+   v.vm_rip = 0;
+   vm_run(&v, stop);
+  }
+  secs = (double)(clock() - start) / CLOCKS_PER_SEC;
+  printf("%32s %8.1f ns/call\n", "factorial(12)", secs * 1e9 / (100000 * 12.0));
+
+  stop = emit_top_call(mem, 0, chain);
+  start = clock();
+  for (i = 0; i < 10; ++i) {
+   v.vm_gpr[1] = 100000;
+   v.vm_rip = 0;
+   vm_run(&v, stop);
+  }
+  secs = (double)(clock() - start) / CLOCKS_PER_SEC;
+  printf("%32s %8.1f ns/call\n", "call chain 100000 deep", secs * 1e9 / (10 * 100001.0));
+ }
+ {
+  /* fib(27) again, in guarded memory: the bounds cost nothing per access */
+  Vm v = { 0 };
+  word fib = 0x40, stop;
+  long start;
+  double secs;
+
+  if (vm_map_mem(&v, 1 << 21)) {
+   v.vm_exception_callback = vm_default_exception_callback;
+   v.vm_stack_base = v.vm_fp = 0x1000;
+   v.vm_stack_limit = 1 << 21;
+   emit_fib(v.vm_mem, fib);
+   stop = emit_top_call(v.vm_mem, 0, fib);
+   v.vm_gpr[1] = 27;
+   v.vm_rip = 0;
+   start = clock();
+   vm_run_guarded(&v, stop);
+   secs = (double)(clock() - start) / CLOCKS_PER_SEC;
+   printf("%32s %8.1f ns/call\n", "fib(27), guard pages", secs * 1e9 / (2 * 317811.0 - 1));
+   vm_unmap_mem(&v);
+  }
+ }
+ {
+  /* fib(27) again, converted to the fixed encoding */
+  static byte mem[0x2000];
+  static qword fixed[0x100];
+  static word index[0x2000];
+  Vm v = { 0 };
+  word fib, stop, end, n;
+  long start;
+  double secs;
+
+  v.vm_mem = mem;
+  v.vm_fixed = fixed;
+  v.vm_exception_callback = vm_default_exception_callback;
+  v.vm_stack_base = v.vm_fp = 0x1000;
+  v.vm_stack_limit = sizeof mem;
+  stop = emit_top_call(mem, 0, 0);
+  fib = emit(mem, stop, 0, gpr(0), 0, gpr(0), 0);
+  emit_top_call(mem, 0, fib);
+  end = emit_fib(mem, fib);
+  n = v.vm_fixed_len = fixed_convert(mem, 0, end, fixed, 0x100, index);
+  v.vm_gpr[1] = 27;
+  v.vm_rip = 0;
+  start = clock();
+  vm_run_fixed(&v, 8 * index[stop]);
+  secs = (double)(clock() - start) / CLOCKS_PER_SEC;
+  printf("%32s %8.1f ns/call, %u bytes rather than %u\n", "fib(27), fixed encoding", secs * 1e9 / (2 * 317811.0 - 1), 8 * n, end);
+ }
+ {
+  /* The nested loop with its locals in registers and in memory, without and
+     with the peephole pass. Memory operands and dispatches are counted on a
+     separate, stepped run. */
+  static byte mem[0x2000];
+  static Codegen cg;
+  word regs[] = { 0, 2, CG_MAX_REGS };
+  word end, i, n, mem_ops, steps, optimize;
+  Ir ir[64];
+  Vm v = { 0 };
+  Instr p = { 0 };
+  long start;
+  double secs;
+
+  v.vm_mem = mem;
+  v.vm_exception_callback = vm_default_exception_callback;
+  v.vm_stack_base = v.vm_fp = 0x1000;
+  v.vm_stack_limit = sizeof mem;
+  cg.cg_ir = ir;
+  cg.cg_vars = 10;
+  cg.cg_len = emit_nested_loop_ir(ir, 250, CG_NONE);
+  for (i = 0; i < 2 * sizeof regs / sizeof regs[0]; ++i) {
+   cg.cg_regs = regs[i / 2];
+   cg.cg_optimize = optimize = i % 2;
+   end = cg_generate(&cg, mem, 0);
+
+   mem_ops = steps = 0;
+   v.vm_rip = 0;
+   while (v.vm_rip != end) {
+    read_instr(&mem[v.vm_rip], &p);
+    mem_ops += is_memory(p.param_dst) + is_memory(p.param_src) + is_memory(p.param_aux);
+    vm_step(&v);
+    ++steps;
+   }
+
+   start = clock();
+   for (n = 0; n < 20; ++n) {
+    v.vm_rip = 0;
+    vm_run(&v, end);
+   }
+   secs = (double)(clock() - start) / CLOCKS_PER_SEC;
+   printf("%18s, %2u regs %8.1f ns/iter %6.2f memory operands/iter %5.2f dispatches/iter\n",
+    optimize ? "peephole" : "nested loop", regs[i / 2],
+    secs * 1e9 / (20 * 250.0 * 250.0), mem_ops / (250.0 * 250.0), steps / (250.0 * 250.0));
+  }
+ }
+ {
+  /* The peephole optimised nested loop, interpreted and as native code */
+  static byte mem[0x2000];
+  static Codegen cg;
+  static struct Jit jit;
+  word regs[] = { 0, 2, CG_MAX_REGS };
+  word end, i, n, sum = 0;
+  Ir ir[64];
+  Vm v = { 0 };
+  long start;
+  double secs;
+
+  v.vm_mem = mem;
+  v.vm_exception_callback = vm_default_exception_callback;
+  v.vm_stack_base = v.vm_fp = 0x1000;
+  v.vm_stack_limit = sizeof mem;
+  cg.cg_ir = ir;
+  cg.cg_vars = 10;
+  cg.cg_optimize = 1;
+  cg.cg_len = emit_nested_loop_ir(ir, 250, CG_NONE);
+  if (!jit_init(&jit, JIT_DEFAULT_THRESHOLD)) printf("No JIT on this platform\n");
+  for (i = 0; i < 2 * sizeof regs / sizeof regs[0] && jit.jit_arena; ++i) {
+   cg.cg_regs = regs[i / 2];
+   end = cg_generate(&cg, mem, 0);
+   jit_flush(&jit);
+   v.vm_jit = i % 2 ? &jit : 0;
+   start = clock();
+   for (n = 0; n < 20; ++n) {
+    v.vm_rip = 0;
+    vm_run(&v, end);
+    sum += cg_value(&cg, &v, 0);
+   }
+   secs = (double)(clock() - start) / CLOCKS_PER_SEC;
+   printf("%18s, %2u regs %8.1f ns/iter\n", i % 2 ? "jit" : "interpreted", regs[i / 2], secs * 1e9 / (20 * 250.0 * 250.0));
+  }
+  jit_free(&jit);
+  if (sum == 0) printf("\n");
+ }
+ {
+  /* Opcode pair profile over the programs above, unoptimised. ASSGN -> ARITH
+     is the most frequent pair that can fuse, as ARITH3; BRC -> ASSGN spans
+     a branch, and ARITH -> JMP, fused as ARITHJ, closes every loop. */
+  static byte mem[1 << 16];
+  static Codegen cg;
+  static word pairs[OPCODE_COUNT][OPCODE_COUNT];
+  const char *names[OPCODE_COUNT] = { "ZTRAP", "ASSGN", "ARITH", "CALL", "RET", "ECALL", "JMP", "BRC", "LEA", "ARITH3", "ARITHJ" };
+  word fib = 0x40, fact, chain, stop, i, j, k, total = 0;
+  word regs[] = { 0, 2, CG_MAX_REGS };
+  Ir ir[64];
+  Vm v = { 0 };
+
+  v.vm_mem = mem;
+  v.vm_exception_callback = vm_default_exception_callback;
+  v.vm_stack_base = v.vm_fp = 0x8000;
+  v.vm_stack_limit = sizeof mem;
+  fact = emit_fib(mem, fib);
+  chain = emit_factorial(mem, fact);
+  emit_chain(mem, chain);
+  v.vm_gpr[1] = 20;
+  stop = emit_top_call(mem, 0, fib);
+  v.vm_rip = 0;
+  vm_profile_pairs(&v, stop, pairs);
+  for (k = 0; k < 1000; ++k) {
+   stop = emit_top_call(mem, 0, fact);
+   v.vm_gpr[1] = 12;
+   v.vm_rip = 0;
+   vm_profile_pairs(&v, stop, pairs);
+  }
+
+  cg.cg_ir = ir;
+  cg.cg_vars = 10;
+  cg.cg_len = emit_nested_loop_ir(ir, 100, CG_NONE);
+  for (k = 0; k < sizeof regs / sizeof regs[0]; ++k) {
+   cg.cg_regs = regs[k];
+   stop = cg_generate(&cg, mem, 0x1000);
+   v.vm_rip = 0x1000;
+   vm_profile_pairs(&v, stop, pairs);
+  }
+
+  for (i = 0; i < OPCODE_COUNT; ++i) for (j = 0; j < OPCODE_COUNT; ++j) total += pairs[i][j];
+  for (k = 0; k < 6; ++k) {
+   word bi = 0, bj = 0;
+   for (i = 0; i < OPCODE_COUNT; ++i) for (j = 0; j < OPCODE_COUNT; ++j) {
+    if (pairs[i][j] > pairs[bi][bj]) bi = i, bj = j;
+   }
+   printf("%24s -> %-6s %5.1f%% of pairs\n", names[bi], names[bj], 100.0 * pairs[bi][bj] / total);
+   pairs[bi][bj] = 0;
   }
  }
 #else
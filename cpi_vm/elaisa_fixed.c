@@ -0,0 +1,279 @@
+/* A second encoding of elaisa code, in which every instruction is one
+   aligned 64 bit word, and a converter to it from the byte stream written by
+   write_instr().
+
+   Bits, from the least significant:
+     [0, 4)   opcode
+     [4, 7)   mode of operand A: the destination, or ECALL's source
+     [7, 10)  mode of operand B: the source
+     [10, 13) mode of operand C: ARITH3's second source
+     [13, 16) arithmetic operator or branch condition
+     [16, 32), [32, 48), [48, 64)  fields F0, F1 and F2
+   A mode is the operand's Rmab tag, except that FIXED_MEM32 is a MEM operand
+   whose address does not fit in 16 bits. Operands take fields in order, one
+   each: a register, byte or slot in its low 8 bits and a MEM address in all
+   16, while a FIXED_MEM32 takes two. JMP and CALL keep their target in F1
+   and F2, and CALL its frame size in F0. BRC and ARITHJ keep theirs in the
+   field after their operands, as a signed count of instructions from the
+   next one, so their operands must each fit in a field. So must ARITH3's.
+   ARR operands have no encoding.
+
+   Decoding is then a shift and a mask per field rather than a walk over
+   variable length tags, and every instruction is aligned. The code is not
+   smaller: most instructions take fewer than 8 bytes in the byte stream, so
+   converted code is about one and a half times as large. It is executed
+   from its own array, vm_fixed, with RIP the byte offset of an instruction
+   in it, so that return addresses and targets look as they do in vm_mem. */
+
+#define FIXED_MEM32 6
+#define FIXED_FIELDS 3
+
+/* Puts an operand in the fields from `f` on and sets its mode. Returns the
+   next free field, or FIXED_FIELDS + 1 if it does not fit. */
+word fixed_put(qword *q, word f, struct Rmab r, byte *mode) {
+ qword value;
+ word width = 1;
+ if (r.rmab_tag == 0) value = r.rmab_r_reg;
+ else if (r.rmab_tag == 3) value = r.rmab_b_byte;
+ else if (r.rmab_tag == 4 || r.rmab_tag == 5) value = r.rmab_s_slot;
+ else if (r.rmab_tag == 1) {
+  value = r.rmab_m_mem;
+  if (value > 0xFFFF) width = 2;
+ } else return FIXED_FIELDS + 1;
+ *mode = width == 2 ? FIXED_MEM32 : r.rmab_tag;
+ if (f + width > FIXED_FIELDS) return FIXED_FIELDS + 1;
+ *q |= value << (16 + 16 * f);
+ return f + width;
+}
+
+struct Rmab fixed_get(qword q, word *f, byte mode) {
+ struct Rmab r = { 0 };
+ word field = (word)(q >> (16 + 16 * *f)) & 0xFFFF;
+ r.rmab_tag = mode == FIXED_MEM32 ? 1 : mode;
+ if (mode == 0) r.rmab_r_reg = (byte)field;
+ else if (mode == 1) r.rmab_m_mem = field;
+ else if (mode == 3) r.rmab_b_byte = (byte)field;
+ else if (mode == 4 || mode == 5) r.rmab_s_slot = (byte)field;
+ else if (mode == FIXED_MEM32) {
+  r.rmab_m_mem = (word)(q >> (16 + 16 * *f));
+  *f += 1;
+ }
+ *f += 1;
+ return r;
+}
+
+/* Encodes `p`, which is to be at byte offset `adr`. Returns 0 if it has no
+   fixed encoding. */
+int write_fixed(qword *out, word adr, Instr p) {
+ qword q = p.param_instr;
+ word f = 0;
+ byte a = 0, b = 0, c = 0;
+ byte i = p.param_instr;
+
+ if (i > 10 || (i != 3 && p.param_op > 7)) return 0;
+ if (i == 1 || i == 2 || i == 7 || i == 8 || i == 9 || i == 10) {
+  f = fixed_put(&q, f, p.param_dst, &a);
+  f = fixed_put(&q, f, p.param_src, &b);
+  q |= (qword)p.param_op << 13;
+ } else if (i == 5) {
+  f = fixed_put(&q, f, p.param_src, &a);
+ }
+ if (i == 9) f = fixed_put(&q, f, p.param_aux, &c);
+ if (i == 3 || i == 6) {
+  if (i == 3) q = 3 | (qword)p.param_op << 16;
+  q |= (qword)p.param_target << 32;
+ } else if (i == 7 || i == 10) {
+  /* Instructions are 8 bytes, so the displacement is a multiple of 8 */
+  long long disp = ((long long)p.param_target - (adr + 8)) / 8;
+  if ((p.param_target - adr) % 8 || disp < -0x8000 || disp > 0x7FFF || f >= FIXED_FIELDS) return 0;
+  q |= (qword)(disp & 0xFFFF) << (16 + 16 * f);
+  f += 1;
+ }
+ if (f > FIXED_FIELDS) return 0;
+ *out = q | (qword)a << 4 | (qword)b << 7 | (qword)c << 10;
+ return 1;
+}
+
+/* Decodes the instruction at byte offset `adr`. Returns 0 if it is not
+   valid. */
+int read_fixed(qword q, word adr, Instr *p) {
+ byte i = q & 0xF;
+ byte a = (q >> 4) & 7, b = (q >> 7) & 7, c = (q >> 10) & 7;
+ word f = 0;
+
+ p->param_instr = i;
+ p->param_op = (q >> 13) & 7;
+ if (i == 1 || i == 2 || i == 7 || i == 8 || i == 9 || i == 10) {
+  p->param_dst = fixed_get(q, &f, a);
+  p->param_src = fixed_get(q, &f, b);
+  if (i == 9) p->param_aux = fixed_get(q, &f, c);
+  if (i == 7 || i == 10) p->param_target = adr + 8 + 8 * (word)(int)(short)((q >> (16 + 16 * f)) & 0xFFFF);
+ } else if (i == 5) {
+  p->param_src = fixed_get(q, &f, a);
+ } else if (i == 3 || i == 6) {
+  if (i == 3) p->param_op = (q >> 16) & 0xFF;
+  p->param_target = (word)(q >> 32);
+ } else if (i != 0 && i != 4) {
+  return 0;
+ }
+ return a != 2 && a != 7 && b != 2 && b != 7 && c != 2 && c != 7;
+}
+
+/* Converts the code in [from, to) of `mem` to `out`, which has room for
+   `cap` instructions. Branch targets are moved to where their instructions
+   now are, so every one must be in [from, to]. `index` is scratch for
+   to - from + 1 words. Returns the number of instructions, or INVALID if an
+   instruction has no fixed encoding or a branch leaves the code. */
+word fixed_convert(byte *mem, word from, word to, qword *out, word cap, word *index) {
+ word at, n = 0, i;
+ int len;
+
+ for (i = 0; i <= to - from; ++i) index[i] = INVALID;
+ for (at = from; at < to; at += len, ++n) {
+  Instr p = { 0 };
+  len = read_instr(&mem[at], &p);
+  if (len == INVALID || n == cap) return INVALID;
+  index[at - from] = n;
+ }
+ if (at != to) return INVALID;
+ index[to - from] = n;
+
+ for (at = from, i = 0; at < to; at += len, ++i) {
+  Instr q = { 0 };
+  len = read_instr(&mem[at], &q);
+  if (q.param_instr == 3 || q.param_instr == 6 || q.param_instr == 7 || q.param_instr == 10) {
+   if (q.param_target < from || q.param_target > to || index[q.param_target - from] == (word)INVALID) return INVALID;
+   q.param_target = 8 * index[q.param_target - from];
+  }
+  if (!write_fixed(&out[i], 8 * i, q)) return INVALID;
+ }
+ return n;
+}
+
+#define FIXED_FIELD(q, f) ((word)((q) >> (16 + 16 * (f))) & 0xFFFF)
+
+/* Where a MEM or SLT operand of mode `mode` in field `f` of `q` lives in
+   vm_mem. Returns 0 for any other mode, or a slot past the stack. */
+int fixed_address(Vm *v, qword q, word f, byte mode, word *adr) {
+ if (mode == 1) {
+  *adr = FIXED_FIELD(q, f);
+ } else if (mode == 4) {
+  *adr = v->vm_fp + 4 * (FIXED_FIELD(q, f) & 0xFF);
+  if (*adr + 4 > v->vm_stack_limit) return 0;
+ } else {
+  return 0;
+ }
+ return 1;
+}
+
+/* The word a register, byte, MEM or SLT operand holds. Returns 0 if it is
+   some other kind. */
+int fixed_value(Vm *v, qword q, word f, byte mode, word *out) {
+ word adr;
+ if (mode == 0) *out = v->vm_gpr[FIXED_FIELD(q, f) & 0xFF];
+ else if (mode == 3) *out = FIXED_FIELD(q, f);
+ else if (fixed_address(v, q, f, mode, &adr)) read_word(&v->vm_mem[adr], out);
+ else return 0;
+ return 1;
+}
+
+/* Stores a word to a register, MEM or SLT operand. Returns 0, having stored
+   nothing, if it is some other kind. */
+int fixed_store(Vm *v, qword q, word f, byte mode, word value) {
+ word adr;
+ if (mode == 0) v->vm_gpr[FIXED_FIELD(q, f) & 0xFF] = value;
+ else if (fixed_address(v, q, f, mode, &adr)) write_word(&v->vm_mem[adr], value);
+ else return 0;
+ return 1;
+}
+
+/* vm_step() for code in vm_fixed. Instructions run straight from the fields
+   of their word, with the operands read before anything is stored, so that
+   one that cannot, because of an operand of another kind or an exception,
+   has changed nothing and is decoded into an Instr for vm_exec_instr(). */
+int vm_step_fixed(Vm *v) {
+ Instr p = { 0 };
+ word i = v->vm_rip / 8;
+ qword q;
+ byte a, b, c, op;
+ word l, r, fp;
+
+ if (v->vm_rip % 8 || i >= v->vm_fixed_len) {
+  v->vm_exception_callback(v, p, "Illegal instruction. Unable to decode.");
+  return 0;
+ }
+ q = v->vm_fixed[i];
+ a = (q >> 4) & 7;
+ b = (q >> 7) & 7;
+ c = (q >> 10) & 7;
+ op = (q >> 13) & 7;
+
+ switch (q & 0xF) {
+ case 1:
+  /* A byte stored to MEM is a single byte */
+  if (!(a == 1 && b == 3) && fixed_value(v, q, 1, b, &r) && fixed_store(v, q, 0, a, r)) {
+   v->vm_rip += 8;
+   return 8;
+  }
+  break;
+ case 2:
+  if (fixed_value(v, q, 0, a, &l) && fixed_value(v, q, 1, b, &r) && !arith_word(&l, op, r) && fixed_store(v, q, 0, a, l)) {
+   v->vm_rip += 8;
+   return 8;
+  }
+  break;
+ case 3:
+  fp = v->vm_fp + 4 * (word)((q >> 16) & 0xFF);
+  if (fp >= v->vm_fp && fp + 8 <= v->vm_stack_limit) {
+   write_word(&v->vm_mem[fp], v->vm_rip + 8);
+   write_word(&v->vm_mem[fp + 4], v->vm_fp);
+   v->vm_fp = fp;
+   v->vm_rip = (word)(q >> 32);
+   return 8;
+  }
+  break;
+ case 4:
+  if (v->vm_fp != v->vm_stack_base) {
+   read_word(&v->vm_mem[v->vm_fp], &v->vm_rip);
+   read_word(&v->vm_mem[v->vm_fp + 4], &v->vm_fp);
+   return 8;
+  }
+  break;
+ case 6:
+  v->vm_rip = (word)(q >> 32);
+  return 8;
+ case 7:
+  if (fixed_value(v, q, 0, a, &l) && fixed_value(v, q, 1, b, &r) && op < BRC_COND_COUNT) {
+   v->vm_rip += 8;
+   if (brc_taken(op, l, r)) v->vm_rip += 8 * (word)(int)(short)FIXED_FIELD(q, 2);
+   return 8;
+  }
+  break;
+ case 9:
+  if (fixed_value(v, q, 1, b, &l) && fixed_value(v, q, 2, c, &r) && !arith_word(&l, op, r) && fixed_store(v, q, 0, a, l)) {
+   v->vm_rip += 8;
+   return 8;
+  }
+  break;
+ case 10:
+  if (fixed_value(v, q, 0, a, &l) && fixed_value(v, q, 1, b, &r) && !arith_word(&l, op, r) && fixed_store(v, q, 0, a, l)) {
+   v->vm_rip += 8 + 8 * (word)(int)(short)FIXED_FIELD(q, 2);
+   return 8;
+  }
+  break;
+ }
+
+ if (!read_fixed(q, v->vm_rip, &p)) {
+  v->vm_exception_callback(v, p, "Illegal instruction. Unable to decode.");
+  return 0;
+ }
+ v->vm_rip += 8;
+ vm_exec_instr(v, p);
+ return 8;
+}
+
+word vm_run_fixed(Vm *v, word stop) {
+ word steps = 0;
+ while (v->vm_rip != stop && vm_step_fixed(v)) ++steps;
+ return steps;
+}
@@ -0,0 +1,111 @@
+/* Guard pages after vm_mem, so that a program cannot read or write outside
+   its memory, without a bounds check on any access.
+
+   Addresses are words, and nothing reaches further past one than a STRING
+   of up to 2^32 bytes, so no access lands more than 8 GiB from the start of
+   vm_mem. vm_map_mem() reserves all of that with nothing mapped, and commits
+   only the memory asked for. An access past it faults.
+
+   vm_run_guarded() is vm_run() with that fault caught. The SIGSEGV handler
+   jumps back to it, and it raises "Memory access out of range." through
+   vm_exception_callback and returns. A fault cannot be resumed from, so
+   unlike other exceptions this one always ends the run. The Vm is left as
+   the faulting instruction left it. In the interpreter RIP is past it. In
+   native code from the JIT RIP is the start of the loop.
+
+   A fault anywhere else is passed on to the handler there was before. The
+   run being guarded is a global, so only one thread may use this. */
+
+#define GUARD_SPAN (((qword)2 << 32) + (1 << 16))
+
+#if defined ELAISA_GUARD
+
+struct Guard {
+ Vm *g_vm;
+ sigjmp_buf g_jmp;
+ struct Guard *g_outer; /* The guarded run this one was started from */
+};
+
+struct Guard *guard_run;
+struct sigaction guard_old_action;
+int guard_installed;
+
+void guard_handler(int sig, siginfo_t *info, void *ctx) {
+ struct Guard *g = guard_run;
+ byte *at = info->si_addr;
+ if (g && at >= g->g_vm->vm_mem && (qword)(at - g->g_vm->vm_mem) < GUARD_SPAN) siglongjmp(g->g_jmp, 1);
+
+ if (guard_old_action.sa_flags & SA_SIGINFO) guard_old_action.sa_sigaction(sig, info, ctx);
+ else if (guard_old_action.sa_handler != SIG_DFL && guard_old_action.sa_handler != SIG_IGN) guard_old_action.sa_handler(sig);
+ else sigaction(SIGSEGV, &guard_old_action, 0); /* The access faults again, and gets the default */
+}
+
+/* Gives `v` `size` bytes of zeroed memory with guard pages after it. Returns
+   0 if the address space could not be had. */
+int vm_map_mem(Vm *v, qword size) {
+ byte *mem;
+ if (size > GUARD_SPAN - (1 << 16)) return 0;
+ mem = mmap(0, GUARD_SPAN, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+ if (mem == MAP_FAILED) return 0;
+ if (size && mprotect(mem, size, PROT_READ | PROT_WRITE)) {
+  munmap(mem, GUARD_SPAN);
+  return 0;
+ }
+ if (!guard_installed) {
+  struct sigaction sa = { 0 };
+  sa.sa_sigaction = guard_handler;
+  sa.sa_flags = SA_SIGINFO;
+  sigemptyset(&sa.sa_mask);
+  if (sigaction(SIGSEGV, &sa, &guard_old_action)) {
+   munmap(mem, GUARD_SPAN);
+   return 0;
+  }
+  guard_installed = 1;
+ }
+ v->vm_mem = mem;
+ v->vm_guarded = 1;
+ return 1;
+}
+
+void vm_unmap_mem(Vm *v) {
+ if (v->vm_guarded) munmap(v->vm_mem, GUARD_SPAN);
+ v->vm_mem = 0;
+ v->vm_guarded = 0;
+}
+
+/* vm_run(), ending in an exception if the program touches a guard page.
+   Returns the number of instructions interpreted, or 0 after a fault. */
+word vm_run_guarded(Vm *v, word stop) {
+ struct Guard g;
+ word steps;
+ if (!v->vm_guarded) return vm_run(v, stop);
+
+ g.g_vm = v;
+ g.g_outer = guard_run;
+ if (sigsetjmp(g.g_jmp, 1)) {
+  Instr none = { 0 };
+  guard_run = g.g_outer;
+  v->vm_exception_callback(v, none, "Memory access out of range.");
+  return 0;
+ }
+ guard_run = &g;
+ steps = vm_run(v, stop);
+ guard_run = g.g_outer;
+ return steps;
+}
+
+#else
+
+int vm_map_mem(Vm *v, qword size) {
+ (void)v;
+ (void)size;
+ return 0;
+}
+
+void vm_unmap_mem(Vm *v) { (void)v; }
+
+word vm_run_guarded(Vm *v, word stop) {
+ return vm_run(v, stop);
+}
+
+#endif
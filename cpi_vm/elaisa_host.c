@@ -0,0 +1,244 @@
+/* Host functions reached through ECALL.
+
+   A builtin is called by its index into the host table, which the compiler
+   resolves once with host_index(); ECALL is then a single indirect call.
+   Arguments are passed in r1, r2, ... and the result is returned in r0.
+   A STRING argument is the address of a length word followed by its bytes,
+   and a function producing a STRING writes it to an address it is given.
+
+   The indices below are part of the compiled code, so reordering or removing
+   one must bump HOST_TABLE_VERSION. Code records the version it was compiled
+   against and vm_bind_host() refuses a table with any other. */
+
+#define HOST_TABLE_VERSION 1
+
+enum {
+ HOST_LENGTH,        /* r1 string -> r0 length */
+ HOST_MID,           /* r1 string, r2 start (from 1), r3 length, r4 destination -> r0 destination */
+ HOST_UCASE,         /* r1 string, r2 destination -> r0 destination */
+ HOST_LCASE,         /* r1 string, r2 destination -> r0 destination */
+ HOST_RANDOMBETWEEN, /* r1 low, r2 high -> r0 in [low, high] */
+ HOST_RND,           /* -> r0 in [0, 1) as a fraction of 2^32 */
+ HOST_EOF,           /* r1 file -> r0 1 at the end of the file, else 0 */
+ HOST_OPENFILE,      /* r1 file name, r2 mode 0 READ, 1 WRITE, 2 APPEND -> r0 file */
+ HOST_READFILE,      /* r1 file, r2 destination, r3 capacity -> r0 destination */
+ HOST_WRITEFILE,     /* r1 file, r2 string */
+ HOST_CLOSEFILE,     /* r1 file */
+ HOST_COUNT
+};
+
+struct HostTable {
+ word ht_version;
+ word ht_count;
+ Fn *ht_fns; /* Each is called with the Vm */
+ const char **ht_names;
+};
+
+byte *host_string(Vm *v, word adr, word *len) {
+ read_word(&v->vm_mem[adr], len);
+ return &v->vm_mem[adr + 4];
+}
+
+void host_set_string(Vm *v, word adr, const byte *s, word len) {
+ byte *dst = &v->vm_mem[adr + 4];
+ word i;
+ /* Forwards is safe for a substring written over its own source */
+ for (i = 0; i < len; ++i) dst[i] = s[i];
+ write_word(&v->vm_mem[adr], len);
+ v->vm_gpr[0] = adr;
+}
+
+/* A NUL terminated copy of a STRING, for the C library */
+int host_c_string(Vm *v, word adr, char *buf, word size) {
+ word len, i;
+ byte *s = host_string(v, adr, &len);
+ if (len >= size) return 0;
+ for (i = 0; i < len; ++i) buf[i] = (char)s[i];
+ buf[len] = 0;
+ return 1;
+}
+
+HostFile *host_file(Vm *v, word handle) {
+ HostFile *f = handle < VM_FILE_COUNT ? v->vm_files[handle] : 0;
+ if (!f) v->vm_host_error = "File is not open.";
+ return f;
+}
+
+/* xorshift32 */
+word host_random(Vm *v) {
+ word x = v->vm_rng ? v->vm_rng : 0x9E3779B9;
+ x ^= x << 13;
+ x ^= x >> 17;
+ x ^= x << 5;
+ return v->vm_rng = x;
+}
+
+void host_length(void *vm) {
+ Vm *v = vm;
+ host_string(v, v->vm_gpr[1], &v->vm_gpr[0]);
+}
+
+void host_mid(void *vm) {
+ Vm *v = vm;
+ word len, start = v->vm_gpr[2], n = v->vm_gpr[3];
+ byte *s = host_string(v, v->vm_gpr[1], &len);
+ if (start < 1 || start - 1 > len || n > len - (start - 1)) {
+  v->vm_host_error = "MID out of range of the string.";
+  return;
+ }
+ host_set_string(v, v->vm_gpr[4], s + start - 1, n);
+}
+
+void host_change_case(Vm *v, int upper) {
+ word len, i;
+ byte *s = host_string(v, v->vm_gpr[1], &len);
+ host_set_string(v, v->vm_gpr[2], s, len);
+ s = &v->vm_mem[v->vm_gpr[2] + 4];
+ for (i = 0; i < len; ++i) {
+  if (upper && s[i] >= 'a' && s[i] <= 'z') s[i] -= 'a' - 'A';
+  else if (!upper && s[i] >= 'A' && s[i] <= 'Z') s[i] += 'a' - 'A';
+ }
+}
+
+void host_ucase(void *vm) { host_change_case(vm, 1); }
+void host_lcase(void *vm) { host_change_case(vm, 0); }
+
+/* Uniform in [0, n), 0 < n <= 2^32, by Lemire's method, as in cpi_cpp's
+   Rng::below(): the high word of a 64 bit product is the number, and the
+   low word says whether it falls in the biased part of the range, which is
+   then drawn again. */
+word host_random_below(Vm *v, qword n) {
+ qword m;
+ word threshold;
+ if (n > 0xFFFFFFFFull) return host_random(v);
+ m = (qword)host_random(v) * n;
+ if ((word)m < n) {
+  threshold = (0 - (word)n) % (word)n;
+  while ((word)m < threshold) m = (qword)host_random(v) * n;
+ }
+ return (word)(m >> 32);
+}
+
+/* The bounds are INTEGERs, so signed */
+void host_randombetween(void *vm) {
+ Vm *v = vm;
+ int lo = (int)v->vm_gpr[1], hi = (int)v->vm_gpr[2];
+ if (hi < lo) {
+  v->vm_host_error = "RANDOMBETWEEN with high below low.";
+  return;
+ }
+ v->vm_gpr[0] = (word)lo + host_random_below(v, (qword)((long long)hi - lo) + 1);
+}
+
+void host_rnd(void *vm) {
+ Vm *v = vm;
+ v->vm_gpr[0] = host_random(v);
+}
+
+void host_eof(void *vm) {
+ Vm *v = vm;
+ HostFile *f = host_file(v, v->vm_gpr[1]);
+ int c;
+ if (!f) return;
+ c = fgetc(f);
+ v->vm_gpr[0] = c == -1;
+ if (c != -1) ungetc(c, f);
+}
+
+void host_openfile(void *vm) {
+ Vm *v = vm;
+ const char *modes[] = { "rb", "wb", "ab" };
+ char name[256];
+ word handle;
+ if (v->vm_gpr[2] > 2) {
+  v->vm_host_error = "OPENFILE mode out of range.";
+  return;
+ }
+ if (!host_c_string(v, v->vm_gpr[1], name, sizeof name)) {
+  v->vm_host_error = "File name too long.";
+  return;
+ }
+ for (handle = 0; handle < VM_FILE_COUNT && v->vm_files[handle]; ++handle);
+ if (handle == VM_FILE_COUNT) {
+  v->vm_host_error = "Too many open files.";
+  return;
+ }
+ v->vm_files[handle] = fopen(name, modes[v->vm_gpr[2]]);
+ if (!v->vm_files[handle]) {
+  v->vm_host_error = "Unable to open file.";
+  return;
+ }
+ v->vm_gpr[0] = handle;
+}
+
+void host_readfile(void *vm) {
+ Vm *v = vm;
+ HostFile *f = host_file(v, v->vm_gpr[1]);
+ word adr = v->vm_gpr[2], cap = v->vm_gpr[3], len = 0;
+ byte *dst = &v->vm_mem[adr + 4];
+ int c;
+ if (!f) return;
+ while ((c = fgetc(f)) != -1 && c != '\n') {
+  if (len == cap) {
+   v->vm_host_error = "Line longer than READFILE capacity.";
+   return;
+  }
+  dst[len++] = (byte)c;
+ }
+ if (len && dst[len - 1] == '\r') --len;
+ write_word(&v->vm_mem[adr], len);
+ v->vm_gpr[0] = adr;
+}
+
+void host_writefile(void *vm) {
+ Vm *v = vm;
+ HostFile *f = host_file(v, v->vm_gpr[1]);
+ word len;
+ byte *s = host_string(v, v->vm_gpr[2], &len);
+ if (!f) return;
+ if (fwrite(s, 1, len, f) != len || fputc('\n', f) == -1) v->vm_host_error = "Unable to write file.";
+}
+
+void host_closefile(void *vm) {
+ Vm *v = vm;
+ HostFile *f = host_file(v, v->vm_gpr[1]);
+ if (!f) return;
+ fclose(f);
+ v->vm_files[v->vm_gpr[1]] = 0;
+}
+
+Fn host_fns[HOST_COUNT] = {
+ host_length, host_mid, host_ucase, host_lcase, host_randombetween, host_rnd,
+ host_eof, host_openfile, host_readfile, host_writefile, host_closefile,
+};
+
+const char *host_names[HOST_COUNT] = {
+ "LENGTH", "MID", "UCASE", "LCASE", "RANDOMBETWEEN", "RND",
+ "EOF", "OPENFILE", "READFILE", "WRITEFILE", "CLOSEFILE",
+};
+
+const struct HostTable host_table = { HOST_TABLE_VERSION, HOST_COUNT, host_fns, host_names };
+
+int host_name_is(const char *a, const char *b) {
+ while (*a && *a == *b) ++a, ++b;
+ return *a == *b;
+}
+
+/* The index of a builtin, for the compiler to put in an ECALL. Returns
+   INVALID if there is no such builtin. SUBSTRING is another name for MID. */
+word host_index(const struct HostTable *t, const char *name) {
+ word i;
+ if (host_name_is(name, "SUBSTRING")) name = "MID";
+ for (i = 0; i < t->ht_count; ++i) {
+  if (host_name_is(t->ht_names[i], name)) return i;
+ }
+ return INVALID;
+}
+
+/* Returns 0, leaving the Vm unbound, if `t` is not the table the code was
+   compiled against. */
+int vm_bind_host(Vm *v, const struct HostTable *t, word compiled_version) {
+ if (t->ht_version != compiled_version) return 0;
+ v->vm_host = t;
+ return 1;
+}
@@ -0,0 +1,335 @@
+/* A baseline JIT from elaisa loops to x86-64.
+
+   vm_run() reports each backward branch it takes. Once a loop header has
+   been branched back to jit_threshold times, the code from the header to the
+   end of the branch is translated to native code, if every instruction in it
+   is supported, and from then on a back edge to that header runs the native
+   code rather than the interpreter.
+
+   The translation is a template per instruction, and keeps nothing in
+   machine registers from one instruction to the next: GPRs are read and
+   written in vm_gpr and operands in vm_mem, so the Vm is exact whenever the
+   native code returns. It returns the address the interpreter is to carry on
+   from, which is where a branch left the loop, the end of the loop if it fell
+   through, or, to deoptimise, an instruction it could not complete. Division
+   by zero deoptimises, so that the interpreter raises the exception.
+
+   Loops made of ASSGN, ARITH, JMP, BRC, ARITH3 and ARITHJ on GPR, MEM, BYT
+   and SLT operands are compiled. A loop with anything else in it, a CALL for
+   one, is left to the interpreter for good. SLT operands are addressed from
+   the FP the loop is entered with, and it is only entered if all of its
+   slots are inside the stack.
+
+   Native code is translated from the bytecode once, so code that rewrites a
+   loop after it has been compiled must call jit_flush(). */
+
+#define JIT_LOOP_BITS 6
+#define JIT_LOOPS (1 << JIT_LOOP_BITS) /* Loop headers tracked */
+#define JIT_MAX_INSTRS 128 /* Longest loop that is compiled */
+#define JIT_MAX_FIXUPS (2 * JIT_MAX_INSTRS + 1)
+#define JIT_INSTR_BYTES 64 /* Native code for one instruction, and its exits, fits in this */
+#define JIT_ARENA_SIZE (1 << 18)
+#define JIT_DEFAULT_THRESHOLD 50
+
+enum { JIT_EMPTY, JIT_COUNTING, JIT_COMPILED, JIT_FAILED };
+
+struct JitLoop {
+ byte jl_state;
+ word jl_start, jl_end; /* The loop is the code in [jl_start, jl_end) */
+ word jl_count; /* Back edges taken while JIT_COUNTING */
+ word jl_frame; /* Bytes from FP its SLT operands reach */
+ word jl_code; /* Offset of its native code in the arena */
+};
+
+struct Jit {
+ word jit_threshold;
+ byte *jit_arena; /* Executable, except while code is being written to it */
+ word jit_used;
+ struct JitLoop jit_loops[JIT_LOOPS];
+
+ word jit_compiled, jit_failed, jit_entries, jit_deopts; /* Statistics */
+
+ /* Branches in the loop being compiled, patched once it is laid out */
+ word jit_fix_at[JIT_MAX_FIXUPS], jit_fix_to[JIT_MAX_FIXUPS];
+ byte jit_fix_exit[JIT_MAX_FIXUPS]; /* Leave the loop even if the target is in it */
+ word jit_fix_count;
+};
+
+/* Native code is called as code(&vm_gpr[0], vm_mem, &vm_mem[vm_fp]) */
+typedef word (*JitCode)(word *gpr, byte *mem, byte *frame);
+
+#if defined ELAISA_JIT
+
+void jit_byte(struct Jit *j, byte b) {
+ j->jit_arena[j->jit_used++] = b;
+}
+
+void jit_word(struct Jit *j, word w) {
+ j->jit_used += write_word(&j->jit_arena[j->jit_used], w);
+}
+
+/* `opcode` with a 32 bit operand in memory, and `reg` in the ModRM reg
+   field. A GPR is at RDI + 4n, MEM at RSI + m and SLT at R8 + 4n. */
+void jit_modrm(struct Jit *j, byte opcode, byte reg, struct Rmab r) {
+ if (r.rmab_tag == 4) jit_byte(j, 0x41); /* REX.B, for R8 */
+ jit_byte(j, opcode);
+ if (r.rmab_tag == 0) {
+  jit_byte(j, 0x47 | reg << 3);
+  jit_byte(j, 4 * r.rmab_r_reg);
+ } else if (r.rmab_tag == 1) {
+  jit_byte(j, 0x86 | reg << 3);
+  jit_word(j, r.rmab_m_mem);
+ } else {
+  jit_byte(j, 0x80 | reg << 3);
+  jit_word(j, 4 * (word)r.rmab_s_slot);
+ }
+}
+
+/* EAX (0) or ECX (1) <- operand */
+void jit_load(struct Jit *j, byte reg, struct Rmab r) {
+ if (r.rmab_tag == 3) {
+  jit_byte(j, 0xB8 + reg);
+  jit_word(j, r.rmab_b_byte);
+ } else {
+  jit_modrm(j, 0x8B, reg, r);
+ }
+}
+
+void jit_store(struct Jit *j, byte reg, struct Rmab r) {
+ jit_modrm(j, 0x89, reg, r);
+}
+
+/* JMP, or Jcc if `cc` is its second opcode byte, to the elaisa address
+   `target` */
+void jit_jump(struct Jit *j, byte cc, word target, byte exit) {
+ if (cc) {
+  jit_byte(j, 0x0F);
+  jit_byte(j, cc);
+ } else {
+  jit_byte(j, 0xE9);
+ }
+ jit_word(j, 0);
+ j->jit_fix_at[j->jit_fix_count] = j->jit_used - 4;
+ j->jit_fix_to[j->jit_fix_count] = target;
+ j->jit_fix_exit[j->jit_fix_count++] = exit;
+}
+
+/* EAX op= ECX, leaving by `at` if it would raise an exception */
+void jit_arith(struct Jit *j, byte op, word at) {
+ if (op == 0) {
+  jit_byte(j, 0x01); jit_byte(j, 0xC8); /* add eax, ecx */
+ } else if (op == 1) {
+  jit_byte(j, 0x29); jit_byte(j, 0xC8); /* sub eax, ecx */
+ } else if (op == 2) {
+  jit_byte(j, 0x0F); jit_byte(j, 0xAF); jit_byte(j, 0xC1); /* imul eax, ecx */
+ } else {
+  jit_byte(j, 0x85); jit_byte(j, 0xC9); /* test ecx, ecx */
+  jit_jump(j, 0x84, at, 1);
+  jit_byte(j, 0x31); jit_byte(j, 0xD2); /* xor edx, edx */
+  jit_byte(j, 0xF7); jit_byte(j, 0xF1); /* div ecx */
+ }
+}
+
+/* BRC conditions, as the Jcc for an unsigned comparison of EAX with ECX */
+const byte jit_cc[BRC_COND_COUNT] = { 0x84, 0x85, 0x82, 0x86, 0x87, 0x83 };
+
+int jit_source(struct Rmab r) {
+ if (r.rmab_tag == 0) return r.rmab_r_reg < GPR_COUNT;
+ if (r.rmab_tag == 1) return r.rmab_m_mem < 0x80000000; /* A signed displacement */
+ return r.rmab_tag == 3 || r.rmab_tag == 4;
+}
+
+int jit_destination(struct Rmab r) {
+ return r.rmab_tag != 3 && jit_source(r);
+}
+
+int jit_supported(Instr p) {
+ byte i = p.param_instr;
+ if (i == 1) return jit_destination(p.param_dst) && jit_source(p.param_src);
+ if (i == 2 || i == 10) return p.param_op <= 3 && jit_destination(p.param_dst) && jit_source(p.param_src);
+ if (i == 9) return p.param_op <= 3 && jit_destination(p.param_dst) && jit_source(p.param_src) && jit_source(p.param_aux);
+ if (i == 7) return p.param_op < BRC_COND_COUNT && jit_source(p.param_dst) && jit_source(p.param_src);
+ return i == 6;
+}
+
+word jit_frame(struct Rmab r, word frame) {
+ word need = 4 * (word)r.rmab_s_slot + 4;
+ return r.rmab_tag == 4 && need > frame ? need : frame;
+}
+
+/* Translates the loop, leaving it JIT_COMPILED or JIT_FAILED */
+void jit_compile(struct Jit *j, Vm *v, struct JitLoop *l) {
+ Instr ins[JIT_MAX_INSTRS];
+ word adr[JIT_MAX_INSTRS + 1], native[JIT_MAX_INSTRS];
+ word n = 0, at = l->jl_start, i, k, start, stubs;
+ int len;
+
+ l->jl_state = JIT_FAILED;
+ l->jl_frame = 0;
+ while (at < l->jl_end) {
+  Instr p = { 0 };
+  if (n == JIT_MAX_INSTRS) return;
+  len = read_instr(&v->vm_mem[at], &p);
+  if (len == INVALID || !jit_supported(p)) return;
+  l->jl_frame = jit_frame(p.param_dst, jit_frame(p.param_src, jit_frame(p.param_aux, l->jl_frame)));
+  adr[n] = at;
+  ins[n++] = p;
+  at += len;
+ }
+ adr[n] = at;
+ if (at != l->jl_end || j->jit_used + (n + 1) * JIT_INSTR_BYTES > JIT_ARENA_SIZE) return;
+
+ mprotect(j->jit_arena, JIT_ARENA_SIZE, PROT_READ | PROT_WRITE);
+ start = j->jit_used;
+ j->jit_fix_count = 0;
+ jit_byte(j, 0x49); jit_byte(j, 0x89); jit_byte(j, 0xD0); /* mov r8, rdx */
+ for (i = 0; i < n; ++i) {
+  Instr p = ins[i];
+  native[i] = j->jit_used;
+  if (p.param_instr == 1) {
+   if (p.param_dst.rmab_tag == 1 && p.param_src.rmab_tag == 3) {
+    /* ASSGN MEM <- BYT stores just the byte */
+    jit_modrm(j, 0xC6, 0, p.param_dst);
+    jit_byte(j, p.param_src.rmab_b_byte);
+   } else {
+    jit_load(j, 1, p.param_src);
+    jit_store(j, 1, p.param_dst);
+   }
+  } else if (p.param_instr == 2 || p.param_instr == 10) {
+   jit_load(j, 1, p.param_src);
+   jit_load(j, 0, p.param_dst);
+   jit_arith(j, p.param_op, adr[i]);
+   jit_store(j, 0, p.param_dst);
+   if (p.param_instr == 10) jit_jump(j, 0, p.param_target, 0);
+  } else if (p.param_instr == 9) {
+   jit_load(j, 1, p.param_aux);
+   jit_load(j, 0, p.param_src);
+   jit_arith(j, p.param_op, adr[i]);
+   jit_store(j, 0, p.param_dst);
+  } else if (p.param_instr == 7) {
+   jit_load(j, 0, p.param_dst);
+   jit_load(j, 1, p.param_src);
+   jit_byte(j, 0x39); jit_byte(j, 0xC8); /* cmp eax, ecx */
+   jit_jump(j, jit_cc[p.param_op], p.param_target, 0);
+  } else {
+   jit_jump(j, 0, p.param_target, 0);
+  }
+ }
+ jit_jump(j, 0, l->jl_end, 1);
+
+ /* Branches within the loop go to the native code for their target, and
+    the rest to a stub that returns the target, one per address */
+ stubs = j->jit_used;
+ for (k = 0; k < j->jit_fix_count; ++k) {
+  word to = j->jit_fix_to[k], dst = INVALID, s;
+  for (i = 0; i < n && !j->jit_fix_exit[k]; ++i) {
+   if (adr[i] == to) dst = native[i];
+  }
+  for (s = stubs; s < j->jit_used && dst == (word)INVALID; s += 6) {
+   word stub_to;
+   read_word(&j->jit_arena[s + 1], &stub_to);
+   if (stub_to == to) dst = s;
+  }
+  if (dst == (word)INVALID) {
+   dst = j->jit_used;
+   jit_byte(j, 0xB8); /* mov eax, to */
+   jit_word(j, to);
+   jit_byte(j, 0xC3); /* ret */
+  }
+  write_word(&j->jit_arena[j->jit_fix_at[k]], dst - (j->jit_fix_at[k] + 4));
+ }
+ mprotect(j->jit_arena, JIT_ARENA_SIZE, PROT_READ | PROT_EXEC);
+
+ l->jl_code = start;
+ l->jl_state = JIT_COMPILED;
+}
+
+/* Returns 0, leaving the Vm to interpret everything, if the arena could not
+   be mapped */
+int jit_init(struct Jit *j, word threshold) {
+ word i;
+ j->jit_threshold = threshold;
+ j->jit_used = 0;
+ j->jit_compiled = j->jit_failed = j->jit_entries = j->jit_deopts = 0;
+ for (i = 0; i < JIT_LOOPS; ++i) j->jit_loops[i].jl_state = JIT_EMPTY;
+ j->jit_arena = mmap(0, JIT_ARENA_SIZE, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+ if (j->jit_arena == MAP_FAILED) {
+  j->jit_arena = 0;
+  return 0;
+ }
+ return 1;
+}
+
+void jit_free(struct Jit *j) {
+ if (j->jit_arena) munmap(j->jit_arena, JIT_ARENA_SIZE);
+ j->jit_arena = 0;
+}
+
+/* Forgets every loop and its native code */
+void jit_flush(struct Jit *j) {
+ word i;
+ j->jit_used = 0;
+ for (i = 0; i < JIT_LOOPS; ++i) j->jit_loops[i].jl_state = JIT_EMPTY;
+}
+
+/* Called by vm_run() once the instruction at `from` has branched back to
+   RIP. Counts the back edge, compiles the loop once it is hot, and runs it
+   if it has been compiled. The loop is not entered if `stop` is inside it. */
+void jit_backedge(Vm *v, word from, word stop) {
+ struct Jit *j = v->vm_jit;
+ word start = v->vm_rip, h = (start * 2654435761u) >> (32 - JIT_LOOP_BITS), probe;
+ struct JitLoop *l = 0;
+ byte op = v->vm_mem[from];
+
+ if (op != 6 && op != 7 && op != 10) return;
+ for (probe = 0; probe < JIT_LOOPS; ++probe) {
+  l = &j->jit_loops[(h + probe) & (JIT_LOOPS - 1)];
+  if (l->jl_state == JIT_EMPTY || l->jl_start == start) break;
+ }
+ if (probe == JIT_LOOPS) return;
+
+ if (l->jl_state == JIT_EMPTY) {
+  Instr p = { 0 };
+  int len = read_instr(&v->vm_mem[from], &p);
+  if (len == INVALID) return;
+  l->jl_state = JIT_COUNTING;
+  l->jl_start = start;
+  l->jl_end = from + len;
+  l->jl_count = 0;
+ }
+ if (l->jl_state == JIT_COUNTING && ++l->jl_count >= j->jit_threshold) {
+  jit_compile(j, v, l);
+  if (l->jl_state == JIT_COMPILED) j->jit_compiled += 1;
+  else j->jit_failed += 1;
+ }
+ if (l->jl_state != JIT_COMPILED || (stop >= l->jl_start && stop < l->jl_end)) return;
+ if (l->jl_frame && (v->vm_fp + l->jl_frame > v->vm_stack_limit || v->vm_fp + l->jl_frame < v->vm_fp)) return;
+
+ {
+  JitCode code;
+  byte *p = &j->jit_arena[l->jl_code];
+  memcpy(&code, &p, sizeof code);
+  v->vm_rip = code(v->vm_gpr, v->vm_mem, &v->vm_mem[v->vm_fp]);
+  j->jit_entries += 1;
+  if (v->vm_rip >= l->jl_start && v->vm_rip < l->jl_end) j->jit_deopts += 1;
+ }
+}
+
+#else
+
+int jit_init(struct Jit *j, word threshold) {
+ (void)j;
+ (void)threshold;
+ return 0;
+}
+
+void jit_free(struct Jit *j) { (void)j; }
+void jit_flush(struct Jit *j) { (void)j; }
+
+void jit_backedge(Vm *v, word from, word stop) {
+ (void)v;
+ (void)from;
+ (void)stop;
+}
+
+#endif
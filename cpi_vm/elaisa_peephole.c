@@ -0,0 +1,164 @@
+/* Code before it is encoded, a peephole pass over it, and the opcode pair
+   profile that picked the superinstructions the pass fuses.
+
+   Branches in a Code refer to labels rather than addresses, so the pass can
+   drop and merge instructions freely; code_encode() lays the result out and
+   resolves the labels. */
+
+#define CODE_MAX 512
+#define CODE_MAX_LABELS 64
+#define CODE_NO_LABEL 0xFFFFFFFF
+
+typedef struct Code Code;
+struct Code {
+ Instr co_instr[CODE_MAX];
+ word co_label[CODE_MAX]; /* Label a branch goes to, or CODE_NO_LABEL */
+ word co_len;
+ word co_label_at[CODE_MAX_LABELS]; /* Index of the instruction after each label */
+ word co_overflow; /* Set if an instruction or label did not fit */
+
+ word co_removed, co_fused; /* Peephole statistics */
+};
+
+Instr make_instr(byte instr, struct Rmab dst, byte op, struct Rmab src, word target) {
+ Instr p = { 0 };
+ p.param_instr = instr;
+ p.param_dst = dst;
+ p.param_op = op;
+ p.param_src = src;
+ p.param_target = target;
+ return p;
+}
+
+void code_push(Code *c, Instr p, word label) {
+ if (c->co_len == CODE_MAX) {
+  c->co_overflow = 1;
+  return;
+ }
+ c->co_instr[c->co_len] = p;
+ c->co_label[c->co_len++] = label;
+}
+
+void code_label(Code *c, word label) {
+ if (label >= CODE_MAX_LABELS) c->co_overflow = 1;
+ else c->co_label_at[label] = c->co_len;
+}
+
+/* Writes the code at `at` and returns the address just past it */
+word code_encode(const Code *c, byte *mem, word at) {
+ word adr[CODE_MAX + 1], i;
+ for (i = 0; i < c->co_len; ++i) {
+  adr[i] = at;
+  at += write_instr(&mem[at], c->co_instr[i]);
+ }
+ adr[c->co_len] = at;
+ for (i = 0; i < c->co_len; ++i) {
+  if (c->co_label[i] != CODE_NO_LABEL) write_word(&mem[adr[i + 1] - 4], adr[c->co_label_at[c->co_label[i]]]);
+ }
+ return at;
+}
+
+int rmab_same(struct Rmab a, struct Rmab b) {
+ if (a.rmab_tag != b.rmab_tag) return 0;
+ if (a.rmab_tag == 0) return a.rmab_r_reg == b.rmab_r_reg;
+ if (a.rmab_tag == 1) return a.rmab_m_mem == b.rmab_m_mem;
+ if (a.rmab_tag == 2) return a.rmab_a_ptr == b.rmab_a_ptr && a.rmab_a_len == b.rmab_a_len;
+ if (a.rmab_tag == 3) return a.rmab_b_byte == b.rmab_b_byte;
+ return a.rmab_s_slot == b.rmab_s_slot;
+}
+
+/* One pass over the code. Returns whether it changed anything.
+
+   Removes
+     ASSGN x <- x
+     ASSGN a <- b; ASSGN b <- a      (the second)
+     JMP to the next instruction
+   and fuses the pairs that dominated the opcode pair profile of loop code:
+     ASSGN d <- a; ARITH d op= b     into ARITH3 d <- a op b, unless b is d
+                                     or may be: b a SLT or REF, which can
+                                     point anywhere in vm_mem. Nor when d is
+                                     MEM and a a byte, as that ASSGN writes
+                                     one byte where ARITH3 writes a word
+     ARITH d op= s; JMP l            into ARITHJ
+   An instruction that is a branch target is never fused into the one
+   before it. */
+int peephole_pass(Code *c) {
+ byte target[CODE_MAX + 1] = { 0 };
+ word new_index[CODE_MAX + 1];
+ word i, w = 0, l;
+ int changed = 0;
+
+ for (l = 0; l < CODE_MAX_LABELS; ++l) {
+  if (c->co_label_at[l] <= c->co_len) target[c->co_label_at[l]] = 1;
+ }
+
+ for (i = 0; i < c->co_len; ++i) {
+  Instr p = c->co_instr[i];
+  word label = c->co_label[i];
+  int has_next = i + 1 < c->co_len && !target[i + 1];
+  Instr q = has_next ? c->co_instr[i + 1] : p;
+
+  new_index[i] = w;
+  if (p.param_instr == 1 && rmab_same(p.param_dst, p.param_src)) {
+   c->co_removed += 1;
+   changed = 1;
+   continue;
+  }
+  if (p.param_instr == 6 && c->co_label_at[label] == i + 1) {
+   c->co_removed += 1;
+   changed = 1;
+   continue;
+  }
+  if (has_next && p.param_instr == 1 && q.param_instr == 1
+   && rmab_same(p.param_dst, q.param_src) && rmab_same(p.param_src, q.param_dst)) {
+   new_index[++i] = w;
+   c->co_removed += 1;
+   changed = 1;
+  } else if (has_next && p.param_instr == 1 && q.param_instr == 2
+   && rmab_same(p.param_dst, q.param_dst) && !rmab_same(q.param_dst, q.param_src)
+   && q.param_src.rmab_tag != 4 && q.param_src.rmab_tag != 5
+   && p.param_src.rmab_tag != 2 && (p.param_dst.rmab_tag == 0 || (p.param_dst.rmab_tag == 1 && p.param_src.rmab_tag != 3))) {
+   p.param_instr = 9;
+   p.param_op = q.param_op;
+   p.param_aux = q.param_src;
+   new_index[++i] = w;
+   c->co_fused += 1;
+   changed = 1;
+  } else if (has_next && p.param_instr == 2 && q.param_instr == 6) {
+   p.param_instr = 10;
+   p.param_target = q.param_target;
+   label = c->co_label[i + 1];
+   new_index[++i] = w;
+   c->co_fused += 1;
+   changed = 1;
+  }
+  c->co_instr[w] = p;
+  c->co_label[w++] = label;
+ }
+ new_index[c->co_len] = w;
+
+ for (l = 0; l < CODE_MAX_LABELS; ++l) {
+  if (c->co_label_at[l] <= c->co_len) c->co_label_at[l] = new_index[c->co_label_at[l]];
+ }
+ c->co_len = w;
+ return changed;
+}
+
+void peephole(Code *c) {
+ while (peephole_pass(c));
+}
+
+/* Counts how often each opcode follows each other one while running to
+   `stop`. Quickened forms count as the instruction they quicken. */
+#define OPCODE_COUNT 11
+
+void vm_profile_pairs(Vm *v, word stop, word pairs[OPCODE_COUNT][OPCODE_COUNT]) {
+ byte prev = 0xFF;
+ while (v->vm_rip != stop) {
+  byte op = v->vm_mem[v->vm_rip];
+  if (op == ARITH_GPR_GPR || op == ARITH_GPR_BYTE) op = 2;
+  if (op < OPCODE_COUNT && prev < OPCODE_COUNT) pairs[prev][op] += 1;
+  prev = op;
+  if (!vm_step(v)) break;
+ }
+}
@@ -10,8 +10,57 @@ void exit(int);
  void *memcpy(void *dst, const void *src, unsigned long long sz);
 #endif
 
+/* A C library FILE, only ever used through a pointer */
+typedef struct HostFile HostFile;
+HostFile *fopen(const char *name, const char *mode);
+int fclose(HostFile *f);
+int fgetc(HostFile *f);
+int ungetc(int c, HostFile *f);
+int fputc(int c, HostFile *f);
+unsigned long fwrite(const void *p, unsigned long size, unsigned long n, HostFile *f);
+int remove(const char *name);
+
+/* Native code for hot loops is generated for x86-64 Linux only. Define
+   CPI_NO_JIT to leave it out there as well. */
+#if defined __x86_64__ && !defined PLATFORM_APPLE && !defined PLATFORM_WINDOWS && !defined CPI_NO_JIT
+ #define ELAISA_JIT 1
+#endif
+
+/* Guard pages around vm_mem need POSIX signals, and are only set up on
+   Linux. Define CPI_NO_GUARD to leave them out there as well. */
+#if !defined PLATFORM_APPLE && !defined PLATFORM_WINDOWS && !defined CPI_NO_GUARD
+ #define ELAISA_GUARD 1
+ #define _POSIX_C_SOURCE 200809L
+ #include <signal.h>
+ #include <setjmp.h>
+#endif
+
+#if defined ELAISA_JIT || defined ELAISA_GUARD
+ void *mmap(void *adr, unsigned long len, int prot, int flags, int fd, long off);
+ int munmap(void *adr, unsigned long len);
+ int mprotect(void *adr, unsigned long len, int prot);
+ #define PROT_READ 1
+ #define PROT_WRITE 2
+ #define PROT_EXEC 4
+ #define MAP_PRIVATE 2
+ #define MAP_ANONYMOUS 0x20
+ #define PROT_NONE 0
+ #define MAP_NORESERVE 0x4000
+ #define MAP_FAILED ((void *)-1)
+#endif
+
+#if defined CPI_RUN_BENCH
+ long clock(void);
+ #if defined PLATFORM_WINDOWS
+  #define CLOCKS_PER_SEC 1000
+ #else
+  #define CLOCKS_PER_SEC 1000000
+ #endif
+#endif
+
 typedef unsigned int word;
 typedef unsigned char byte;
+typedef unsigned long long qword;
 #define assert_platform_sizes \
 	do { if (sizeof(word) != 4*sizeof(byte)) { \
 		printf("\nCritical: Program is only defined for sizeof word == 4 * sizeof byte.\n"); \
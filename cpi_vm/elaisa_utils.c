@@ -4,10 +4,10 @@ int write_byte(byte *adr, byte what) {
 }
 
 int write_word(byte *adr, word what) {
- adr[0] = (what >> (0 * 4)) & 0xFF;
- adr[1] = (what >> (1 * 4)) & 0xFF;
- adr[2] = (what >> (2 * 4)) & 0xFF;
- adr[3] = (what >> (3 * 4)) & 0xFF;
+ adr[0] = (what >> (0 * 8)) & 0xFF;
+ adr[1] = (what >> (1 * 8)) & 0xFF;
+ adr[2] = (what >> (2 * 8)) & 0xFF;
+ adr[3] = (what >> (3 * 8)) & 0xFF;
  return 4;
 }
 
@@ -18,10 +18,10 @@ int read_byte(byte *adr, byte *out) {
 
 int read_word(byte *adr, word *out) {
  *out = 0;
- *out |= ((word)adr[0]) << (word)(0 * 4);
- *out |= ((word)adr[1]) << (word)(1 * 4);
- *out |= ((word)adr[2]) << (word)(2 * 4);
- *out |= ((word)adr[3]) << (word)(3 * 4);
+ *out |= ((word)adr[0]) << (word)(0 * 8);
+ *out |= ((word)adr[1]) << (word)(1 * 8);
+ *out |= ((word)adr[2]) << (word)(2 * 8);
+ *out |= ((word)adr[3]) << (word)(3 * 8);
  return 4;
 }
 